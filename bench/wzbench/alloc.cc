@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "bench/harness.hh"
+
+// The global allocation functions are replaced here, rather than in lib, so
+// that only the benchmarks pay for counting allocations. The array, sized and
+// nothrow forms all default to these.
+
+void* operator new(std::size_t size) {
+    bench::Allocations::Global().record(size);
+
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+// Over-aligned allocations are aligned by hand, since std::aligned_alloc is
+// not available everywhere: the block is over-allocated, and the pointer to
+// free is kept just before the aligned pointer.
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    bench::Allocations::Global().record(size);
+
+    const std::size_t a = std::max(static_cast<std::size_t>(alignment), sizeof(void*));
+    void* block = std::malloc(size + a + sizeof(void*));
+    if (!block)
+        throw std::bad_alloc();
+
+    const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(block) + sizeof(void*);
+    void** p = reinterpret_cast<void**>((start + a - 1) & ~(static_cast<std::uintptr_t>(a) - 1));
+    p[-1] = block;
+
+    return p;
+}
+
+// operator_delete_aligned frees p, allocated by the aligned operator new.
+static void operator_delete_aligned(
+    void* p) {
+    if (p)
+        std::free(static_cast<void**>(p)[-1]);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    operator_delete_aligned(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    operator_delete_aligned(p);
+}
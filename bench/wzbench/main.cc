@@ -0,0 +1,469 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bench/harness.hh"
+#include "util/error.hh"
+#include "wz/path.hh"
+#include "wz/query.hh"
+#include "wz/synthetic.hh"
+#include "wz/vfs.hh"
+#include "wz/wz.hh"
+
+// Options are parsed from key=value arguments.
+struct Options {
+    // dataset is a directory containing Map.wz. If empty, a synthetic
+    // dataset is generated, and removed afterwards.
+    std::string dataset;
+
+    // json is a file to write results to, as JSON.
+    std::string json;
+
+    bench::Harness::Options harness;
+};
+
+static Error main_options(
+    Options* options,
+    const std::vector<std::string>& args) {
+    for (size_t i = 1; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        const size_t equals = arg.find('=');
+        if (equals == std::string::npos) {
+            return error_new(Error::INVALIDUSAGE)
+                << "unexpected argument " << arg.c_str();
+        }
+
+        const std::string key = arg.substr(0, equals);
+        const std::string value = arg.substr(equals + 1);
+        if (key == "dir") {
+            options->dataset = value;
+            continue;
+        } else if (key == "json") {
+            options->json = value;
+            continue;
+        } else if (key == "filter") {
+            options->harness.filter = value;
+            continue;
+        }
+
+        uint64_t number = 0;
+        try {
+            number = std::stoull(value);
+        } catch (const std::exception&) {
+            return error_new(Error::CONVERTFAILED)
+                << "value of " << key.c_str() << " is not a number";
+        }
+
+        if (key == "samples") {
+            options->harness.samples = static_cast<uint32_t>(number);
+        } else if (key == "warmup") {
+            options->harness.warmup = static_cast<uint32_t>(number);
+        } else if (key == "min_sample_ns") {
+            options->harness.min_sample_ns = number;
+        } else {
+            return error_new(Error::INVALIDUSAGE)
+                << "unknown option " << key.c_str();
+        }
+    }
+
+    return Error();
+}
+
+// main_first_file returns the first .img file under node, in name order, so
+// that the same file is benchmarked on every run. Its path is appended to
+// path.
+static wz::Vfs::File* main_first_file(
+    wz::Vfs::Node* node,
+    std::wstring* path) {
+    if (wz::Vfs::File* file = node->file())
+        return file;
+
+    wz::Vfs::Directory* directory = node->directory();
+    if (directory == nullptr)
+        return nullptr;
+
+    std::vector<std::wstring> names;
+    for (const auto& it : directory->children) {
+        names.push_back(it.first);
+    }
+    std::sort(names.begin(), names.end());
+
+    for (const std::wstring& name : names) {
+        const size_t length = path->size();
+        if (!path->empty())
+            *path += L'/';
+        *path += name;
+
+        if (wz::Vfs::File* file = main_first_file(&directory->children.find(name)->second, path))
+            return file;
+
+        path->resize(length);
+    }
+
+    return nullptr;
+}
+
+// main_strings collects every encrypted string in container, including the
+// names of properties, without decrypting them.
+static Error main_strings(
+    const wz::Wz* wz,
+    const wz::PropertyContainer& container,
+    std::vector<wz::String>* strings) {
+    auto it = container.iterator(wz);
+    while (it) {
+        wz::Property p;
+        CHECK(it.next(&p),
+            Error::BADREAD) << "failed to read property";
+
+        strings->push_back(p.name);
+        if (const wz::String* s = std::get_if<wz::String>(&p.property)) {
+            strings->push_back(*s);
+        } else if (const wz::Uol* uol = std::get_if<wz::Uol>(&p.property)) {
+            strings->push_back(uol->uol);
+        } else if (const wz::PropertyContainer* c = std::get_if<wz::PropertyContainer>(&p.property)) {
+            CHECK(main_strings(wz, *c, strings),
+                Error::BADREAD) << "failed to read container";
+        } else if (const wz::Canvas* canvas = std::get_if<wz::Canvas>(&p.property)) {
+            CHECK(main_strings(wz, canvas->children, strings),
+                Error::BADREAD) << "failed to read canvas";
+        }
+    }
+
+    return Error();
+}
+
+// main_deepest returns the path of a leaf node reached by descending
+// through the last child of each node, for benchmarking lookups of a
+// realistic depth.
+static std::wstring main_deepest(
+    const wz::OpenedFile::Node* node) {
+    std::wstring path;
+    while (node->children.count > 0) {
+        node = &node->children.start[node->children.count - 1];
+        if (!path.empty())
+            path += L'/';
+        path += node->name;
+    }
+
+    return path;
+}
+
+static Error main_bench_archive(
+    bench::Harness* harness,
+    const std::filesystem::path& wz_path) {
+    const std::string filename = wz_path.string();
+    const uint64_t file_size = std::filesystem::file_size(wz_path);
+
+    CHECK(harness->run("wz/open", file_size, [&]() -> Error {
+        wz::Wz wz;
+        return wz::Wz::open(&wz, filename.c_str());
+    }), Error::INVALIDUSAGE) << "wz/open failed";
+
+    wz::Wz wz;
+    CHECK(wz::Wz::open(&wz, filename.c_str()),
+        Error::OPENFAILED) << "failed to open " << filename.c_str();
+
+    CHECK(harness->run("vfs/open", 0, [&]() -> Error {
+        wz::Vfs vfs;
+        return wz::Vfs::open(&vfs, &wz);
+    }), Error::INVALIDUSAGE) << "vfs/open failed";
+
+    wz::Vfs vfs;
+    CHECK(wz::Vfs::open(&vfs, &wz),
+        Error::OPENFAILED) << "failed to build vfs for " << filename.c_str();
+
+    // A whole archive scan, which touches every property once.
+    wz::Query query;
+    CHECK(wz::Query::init(&query, L"**", L"**/x", L">0"),
+        Error::INVALIDUSAGE) << "failed to build query";
+    for (uint32_t threads : { 1u, 0u }) {
+        const std::string name = threads ? "query/scan/serial" : "query/scan/parallel";
+        CHECK(harness->run(name, file_size, [&]() -> Error {
+            return query.run(&vfs, [](const wz::Query::Match&) {}, { .threads = threads });
+        }), Error::INVALIDUSAGE) << name.c_str() << " failed";
+    }
+
+    // A map, which is mostly small properties, and a tileset, which is
+    // mostly canvases.
+    std::wstring map_path;
+    wz::Vfs::File* map = nullptr;
+    if (wz::Vfs::Node* maps = vfs.find(L"Map"))
+        map = main_first_file(maps, &(map_path = L"Map"));
+
+    std::wstring tileset_path;
+    wz::Vfs::File* tileset = nullptr;
+    if (wz::Vfs::Node* tilesets = vfs.find(L"Tile"))
+        tileset = main_first_file(tilesets, &(tileset_path = L"Tile"));
+
+    for (wz::Vfs::File* file : { map, tileset }) {
+        if (file == nullptr)
+            continue;
+
+        const std::string name = file == map ? "openedfile/open/map" : "openedfile/open/tileset";
+        CHECK(harness->run(name, 0, [&]() -> Error {
+            wz::OpenedFile of;
+            return wz::OpenedFile::open(&wz, &of, &file->file);
+        }), Error::INVALIDUSAGE) << name.c_str() << " failed";
+    }
+
+    if (tileset) {
+        wz::OpenedFile of;
+        CHECK(wz::OpenedFile::open(&wz, &of, &tileset->file),
+            Error::OPENFAILED) << "failed to open " << tileset_path;
+
+        std::vector<const wz::Image*> images;
+        uint64_t bytes = 0;
+        for (const wz::OpenedFile::Node& node : of.nodes) {
+            if (const wz::OpenedFile::Canvas* canvas = node.canvas()) {
+                images.push_back(&canvas->image);
+                bytes += canvas->image.rawsize();
+            }
+        }
+
+        std::vector<uint8_t> out;
+        for (const wz::Image* image : images) {
+            out.resize(std::max<size_t>(out.size(), image->rawsize()));
+        }
+
+        if (!images.empty()) {
+            CHECK(harness->run("image/pixels", bytes, [&]() -> Error {
+                for (const wz::Image* image : images) {
+                    if (Error e = image->pixels(out.data()))
+                        return e;
+                }
+
+                return Error();
+            }), Error::INVALIDUSAGE) << "image/pixels failed";
+
+            CHECK(harness->run("image/bands", bytes, [&]() -> Error {
+                for (const wz::Image* image : images) {
+                    if (Error e = image->bands(0, [](const wz::Image::Band&) { return Error(); }))
+                        return e;
+                }
+
+                return Error();
+            }), Error::INVALIDUSAGE) << "image/bands failed";
+        }
+    }
+
+    if (map == nullptr)
+        return Error();
+
+    std::vector<wz::String> strings;
+    CHECK(main_strings(&wz, map->file.root, &strings),
+        Error::BADREAD) << "failed to collect strings of " << map_path;
+
+    uint64_t string_bytes = 0;
+    uint32_t longest = 0;
+    for (const wz::String& s : strings) {
+        string_bytes += s.kind == wz::String::TWOBYTE ? s.len * 2 : s.len;
+        longest = std::max(longest, s.len);
+    }
+
+    std::vector<wchar_t> decrypted(longest + 1);
+    CHECK(harness->run("string/decrypt", string_bytes, [&]() -> Error {
+        for (const wz::String& s : strings) {
+            if (Error e = s.decrypt(decrypted.data()))
+                return e;
+        }
+
+        return Error();
+    }), Error::INVALIDUSAGE) << "string/decrypt failed";
+
+    wz::Vfs::File::Handle handle;
+    CHECK(map->open(&handle),
+        Error::OPENFAILED) << "failed to open " << map_path;
+
+    const std::wstring deepest = main_deepest(&handle->nodes[0]);
+    const wz::Path deepest_path(deepest);
+
+    CHECK(harness->run("node/find/string", 0, [&]() -> Error {
+        if (handle->find(deepest.c_str()) == nullptr)
+            return error_new(Error::INVALIDUSAGE) << "path not found";
+
+        return Error();
+    }), Error::INVALIDUSAGE) << "node/find/string failed";
+
+    CHECK(harness->run("node/find/path", 0, [&]() -> Error {
+        if (handle->nodes[0].find(deepest_path) == nullptr)
+            return error_new(Error::INVALIDUSAGE) << "path not found";
+
+        return Error();
+    }), Error::INVALIDUSAGE) << "node/find/path failed";
+
+    CHECK(harness->run("node/find/cached", 0, [&]() -> Error {
+        if (handle->find(deepest_path) == nullptr)
+            return error_new(Error::INVALIDUSAGE) << "path not found";
+
+        return Error();
+    }), Error::INVALIDUSAGE) << "node/find/cached failed";
+
+    // Tiles are deserialized the same way as when a map is loaded.
+    std::vector<const wz::OpenedFile::Node*> tiles;
+    for (int layer = 0; layer < 8; ++layer) {
+        const wz::OpenedFile::Node* node = handle->find((std::to_wstring(layer) + L"/tile").c_str());
+        if (node == nullptr)
+            continue;
+
+        auto it = node->iterator();
+        while (const wz::OpenedFile::Node* tile = it.next()) {
+            tiles.push_back(tile);
+        }
+    }
+
+    if (!tiles.empty()) {
+        CHECK(harness->run("node/deserialize", 0, [&]() -> Error {
+            int32_t x = 0, y = 0, no = 0;
+            const wchar_t* u = nullptr;
+            for (const wz::OpenedFile::Node* tile : tiles) {
+                if (Error e = tile->deserialize({
+                    {L"x", &x},
+                    {L"y", &y},
+                    {L"u", &u},
+                    {L"no", &no},
+                }))
+                    return e;
+            }
+
+            return Error();
+        }), Error::INVALIDUSAGE) << "node/deserialize failed";
+    }
+
+    return Error();
+}
+
+// main_bench_sounds benchmarks reading sounds, which are used in place from
+// the archive.
+static Error main_bench_sounds(
+    bench::Harness* harness,
+    const std::filesystem::path& wz_path) {
+    std::error_code ec;
+    if (!std::filesystem::exists(wz_path, ec))
+        return Error();
+
+    const std::string filename = wz_path.string();
+    wz::Wz wz;
+    CHECK(wz::Wz::open(&wz, filename.c_str()),
+        Error::OPENFAILED) << "failed to open " << filename.c_str();
+
+    wz::Vfs vfs;
+    CHECK(wz::Vfs::open(&vfs, &wz),
+        Error::OPENFAILED) << "failed to build vfs for " << filename.c_str();
+
+    std::wstring path;
+    wz::Vfs::File* file = main_first_file(&vfs.root, &path);
+    if (file == nullptr)
+        return Error();
+
+    CHECK(harness->run("openedfile/open/sounds", 0, [&]() -> Error {
+        wz::OpenedFile of;
+        return wz::OpenedFile::open(&wz, &of, &file->file);
+    }), Error::INVALIDUSAGE) << "openedfile/open/sounds failed";
+
+    wz::OpenedFile of;
+    CHECK(wz::OpenedFile::open(&wz, &of, &file->file),
+        Error::OPENFAILED) << "failed to open " << path;
+
+    std::vector<const wz::Sound*> sounds;
+    uint64_t bytes = 0;
+    for (const wz::OpenedFile::Node& node : of.nodes) {
+        if (const wz::Sound* sound = node.sound()) {
+            sounds.push_back(sound);
+            bytes += sound->length;
+        }
+    }
+
+    if (sounds.empty())
+        return Error();
+
+    CHECK(harness->run("sound/stream", bytes, [&]() -> Error {
+        for (const wz::Sound* sound : sounds) {
+            wz::NullSink sink;
+            if (Error e = sound->stream(&sink))
+                return e;
+        }
+
+        return Error();
+    }), Error::INVALIDUSAGE) << "sound/stream failed";
+
+    return Error();
+}
+
+static Error main_bench(
+    bench::Harness* harness,
+    const std::filesystem::path& dataset) {
+    CHECK(main_bench_archive(harness, dataset / "Map.wz"),
+        Error::INVALIDUSAGE) << "failed to benchmark Map.wz";
+    CHECK(main_bench_sounds(harness, dataset / "Sound.wz"),
+        Error::INVALIDUSAGE) << "failed to benchmark Sound.wz";
+
+    return Error();
+}
+
+// wzbench benchmarks the hot paths of reading WZ archives: opening archives
+// and files, decoding canvases, decrypting strings, looking up nodes,
+// scanning with queries, and streaming sounds. It runs on the Map.wz and Sound.wz of a dataset, or of a
+// generated synthetic dataset.
+Error main_(const std::vector<std::string>& args) {
+    Options options = {};
+    CHECK(main_options(&options, args),
+        Error::INVALIDUSAGE) << "usage: " << args[0].c_str()
+        << " [dir=<dataset>] [json=<file>] [filter=<name>] [samples=N] [warmup=N] [min_sample_ns=N]";
+
+    std::filesystem::path dataset = options.dataset;
+    const bool synthetic = dataset.empty();
+    if (synthetic) {
+        dataset = std::filesystem::temp_directory_path() / "wzbench";
+
+        wz::Synthetic::Stats stats = {};
+        CHECK(wz::Synthetic::generate({ .sounds = 8, .encrypt = true }, dataset, &stats),
+            Error::WZ_WRITE_FAILED) << "failed to generate dataset";
+
+        std::cout
+            << "generated " << stats.files << " files, " << stats.canvases << " canvases in "
+            << dataset.string() << "\n";
+    }
+
+    bench::Harness harness;
+    bench::Harness::init(&harness, options.harness);
+
+    Error e = main_bench(&harness, dataset);
+    if (synthetic) {
+        std::error_code ec;
+        std::filesystem::remove_all(dataset, ec);
+    }
+    if (e)
+        return e;
+
+    harness.print(std::cout);
+
+    if (!options.json.empty()) {
+        std::ofstream out(options.json);
+        harness.json(out);
+        if (!out) {
+            return error_new(Error::OPENFAILED)
+                << "failed to write " << options.json.c_str();
+        }
+    }
+
+    return Error();
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; ++i) {
+        args.push_back(std::string(argv[i]));
+    }
+
+    Error e = main_(args);
+    if (e) {
+        std::cerr << "error\n";
+        e.print(std::wcerr);
+        return 1;
+    }
+
+    return 0;
+}
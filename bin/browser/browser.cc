@@ -5,14 +5,56 @@
 #include <iostream>
 #include <sstream>
 
-#include "lodepng/lodepng.h"
-
 #include "util/error.hh"
+#include "util/png.hh"
 #include "wz/vfs.hh"
 #include "wz/wz.hh"
 
 #include "gl.hh"
 
+// Browser_save writes canvas to filename as a PNG. PNG needs 8-bit RGBA, so
+// the canvas is expanded from its native layout a band at a time, and
+// encoded as it goes; canvases that are streamed are decoded the same way.
+static Error Browser_save(
+    const std::string& filename,
+    const wz::OpenedFile::Canvas& canvas) {
+    const wz::Image& image = canvas.image;
+
+    std::basic_ofstream<char> outf(filename.c_str(), std::ios::binary);
+    if (!outf) {
+        return error_new(Error::OPENFAILED)
+            << "failed to open " << filename.c_str();
+    }
+
+    util::PngWriter png;
+    CHECK(util::PngWriter::open(&png, &outf, image.width, image.height),
+        Error::PNG_WRITE_FAILED) << "failed to start PNG";
+
+    std::vector<uint8_t> rgba;
+    auto write = [&](const wz::Image::Band& band) -> Error {
+        rgba.resize(static_cast<size_t>(image.width) * band.rows * 4);
+        CHECK(image.expand(band, rgba.data()),
+            Error::UNKNOWNIMAGEFORMAT) << "failed to expand image data";
+        return png.rows(rgba.data(), band.rows);
+    };
+
+    if (canvas.image_data) {
+        const uint32_t rows = image.bandrows(0);
+        for (uint32_t y = 0; y < image.height; y += rows) {
+            CHECK(write(wz::Image::Band{
+                .y = y,
+                .rows = std::min(rows, image.height - y),
+                .pixels = canvas.image_data + image.bandsize(y),
+            }), Error::PNG_WRITE_FAILED) << "failed to write rows from " << y;
+        }
+    } else {
+        CHECK(image.bands(0, write),
+            Error::PNG_WRITE_FAILED) << "failed to write image";
+    }
+
+    return png.close();
+}
+
 static void Browser_ui_fromfilenode(
     Browser* self,
     const wz::OpenedFile* of,
@@ -56,8 +98,11 @@ static void Browser_ui_fromfilenode(
         }
         break;
         case 7:
-            label << " = [snd]";
-            break;
+        {
+            const wz::Sound* sound = std::get_if<7>(&child->value);
+            label << " = [snd] " << sound->duration_ms << " ms, "
+                << sound->length << " bytes (" << sound->format.tag << ")";
+        } break;
         case 8:
             label << " = [uol] " << std::get_if<8>(&child->value)->uol;
             break;
@@ -86,19 +131,10 @@ static void Browser_ui_fromfilenode(
                 if (canvas != nullptr) {
                     nk_layout_row_dynamic(self->ui.context, 0, 2); {
                         if (nk_button_label(self->ui.context, "Save")) {
-                            std::vector<uint8_t> png_data;
-                            unsigned err = lodepng::encode(png_data, canvas->image_data, canvas->image.width, canvas->image.height);
-                            if (err) {
-                                std::cerr << "failed to encode image data to PNG: " << err << "\n";
-                            } else {
-                                std::wstring filename = this_stack + L".png";
-                                std::wcout << L"writing " << filename << L"\n";
-                                std::basic_ofstream<char> outf(
-                                    self->converter.to_bytes(filename).c_str(),
-                                    std::ios::binary);
-                                outf.write(
-                                    reinterpret_cast<char*>(png_data.data()),
-                                    png_data.size());
+                            std::wstring filename = this_stack + L".png";
+                            std::wcout << L"writing " << filename << L"\n";
+                            if (Error e = Browser_save(self->converter.to_bytes(filename), *canvas)) {
+                                std::wcerr << L"failed to save image: " << e << "\n";
                             }
                         }
 
@@ -223,7 +259,10 @@ Error Browser::init(
         ss << argv[i].c_str();
 
         std::cerr << "loading vfs\n";
-        CHECK(wz::Vfs::opennamed(&bf->vfs, &bf->wz, ss.str()),
+        // Large canvases are only decoded to be shown or saved.
+        CHECK(wz::Vfs::opennamed(&bf->vfs, &bf->wz, ss.str(), {
+            .stream_above = wz::OpenedFile::DEFAULT_STREAM_ABOVE,
+        }),
             Error::OPENFAILED) << "failed to build vfs";
         std::cerr << "vfs loaded \n";
     }
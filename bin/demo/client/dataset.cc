@@ -22,7 +22,8 @@ std::string convert(const wchar_t* s) {
 
 Error Dataset::opendirectory(
     Dataset* self,
-    const std::filesystem::path& path) {
+    const std::filesystem::path& path,
+    const Options& options) {
     struct ToOpen {
         Wz* into;
         const char* basename;
@@ -94,17 +95,106 @@ Error Dataset::opendirectory(
         },
     };
 
+    // The client follows Uol links when loading sprites, so resolve them all
+    // up front. Large canvases, such as backgrounds, are only decoded while
+    // they are uploaded, a band at a time.
+    wz::OpenedFile::Options file_options = {
+        .resolve_uols = true,
+        .image_store = &self->images,
+        .disk_cache = nullptr,
+        .shared_cache = nullptr,
+        .stream_above = wz::OpenedFile::DEFAULT_STREAM_ABOVE,
+    };
+
+    if (!options.canvas_cache.empty()) {
+        self->canvas_cache.reset(new wz::DiskCache());
+        CHECK(wz::DiskCache::open(
+            self->canvas_cache.get(),
+            options.canvas_cache,
+            options.canvas_cache_options),
+            Error::OPENFAILED) << "failed to open canvas cache " << options.canvas_cache;
+
+        file_options.disk_cache = self->canvas_cache.get();
+    }
+
+    if (options.shared_cache) {
+        self->shared_cache.reset(new wz::SharedCache());
+        CHECK(wz::SharedCache::open(self->shared_cache.get()),
+            Error::OPENFAILED) << "failed to open shared cache";
+
+        file_options.shared_cache = self->shared_cache.get();
+    }
+
     for (size_t i = 0, l = sizeof(to_open) / sizeof(*to_open); i < l; ++i) {
         std::filesystem::path wz_path = path / to_open[i].basename;
-        LOG(INFO)
-            << "loading " << wz_path;
 
-        std::string path_converted = convert(wz_path.c_str());
+        // Prefer a packed archive (as produced by wzpack), which needs no
+        // decoding when files are opened, as long as it was packed from the
+        // WZ archive alongside it.
+        std::filesystem::path packed_path = wz_path;
+        packed_path += "p";
+
+        wz::Packed* packed = &to_open[i].into->packed;
+        wz::Wz* wz = &to_open[i].into->wz;
+
+        std::error_code ec;
+        bool use_packed = std::filesystem::exists(packed_path, ec);
+        if (use_packed) {
+            std::string path_converted = convert(packed_path.c_str());
+
+            // Archives packed by an older wzpack are of an older version,
+            // which is no reason not to load the WZ archive instead.
+            if (Error e = wz::Packed::open(packed, path_converted.c_str())) {
+                if (!std::filesystem::exists(wz_path, ec))
+                    return error_push(e, Error::OPENFAILED) << "failed to open " << packed_path;
+
+                LOG(Logger::WARNING)
+                    << "failed to open " << packed_path
+                    << ", ignoring it; repack it with wzpack: " << e;
+                use_packed = false;
+            }
+        }
+
+        if (use_packed && std::filesystem::exists(wz_path, ec)) {
+            std::string path_converted = convert(wz_path.c_str());
+
+            CHECK(wz::Wz::open(wz, path_converted.c_str()),
+                Error::OPENFAILED) << "failed to open " << to_open[i].basename;
+
+            if (wz->identity() != packed->header->identity) {
+                LOG(Logger::WARNING)
+                    << packed_path << " was not packed from " << wz_path
+                    << ", ignoring it; repack it with wzpack";
+
+                CHECK(packed->close(),
+                    Error::CLOSEFAILED) << "failed to close " << packed_path;
+                use_packed = false;
+            } else {
+                CHECK(wz->close(),
+                    Error::CLOSEFAILED) << "failed to close " << to_open[i].basename;
+            }
+        }
 
-        CHECK(wz::Wz::open(&to_open[i].into->wz, path_converted.c_str()),
-            Error::OPENFAILED) << "failed to open " << to_open[i].basename;
-        CHECK(wz::Vfs::open(&to_open[i].into->vfs, &to_open[i].into->wz),
-            Error::OPENFAILED) << "failed to build vfs for " << to_open[i].basename;
+        if (use_packed) {
+            LOG(INFO)
+                << "loading " << packed_path;
+
+            CHECK(wz::Vfs::openpacked(&to_open[i].into->vfs, packed, file_options),
+                Error::OPENFAILED) << "failed to build vfs for " << packed_path;
+        } else {
+            LOG(INFO)
+                << "loading " << wz_path;
+
+            if (!wz->fd) {
+                std::string path_converted = convert(wz_path.c_str());
+
+                CHECK(wz::Wz::open(wz, path_converted.c_str()),
+                    Error::OPENFAILED) << "failed to open " << to_open[i].basename;
+            }
+
+            CHECK(wz::Vfs::open(&to_open[i].into->vfs, wz, file_options),
+                Error::OPENFAILED) << "failed to build vfs for " << to_open[i].basename;
+        }
 
         LOG(Logger::INFO)
             << "loaded " << to_open[i].basename;
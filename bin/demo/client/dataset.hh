@@ -1,6 +1,7 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -12,6 +13,10 @@ namespace client {
 
 struct Wz {
     wz::Wz wz;
+
+    // packed is used instead of wz when a packed archive exists alongside
+    // the WZ archive.
+    wz::Packed packed;
     wz::Vfs vfs;
 
     Wz() = default;
@@ -21,6 +26,30 @@ struct Wz {
 };
 
 struct Dataset {
+    struct Options {
+        // canvas_cache, if not empty, is the directory of a persistent cache
+        // of decoded canvases.
+        std::filesystem::path canvas_cache;
+
+        // canvas_cache_options are the options of the canvas cache.
+        wz::DiskCache::Options canvas_cache_options;
+
+        // shared_cache enables sharing opened files with other processes
+        // on the same host, through shared memory.
+        bool shared_cache;
+    };
+
+    // images is the store that canvases of every file in the dataset are
+    // decoded through, so that identical images are decoded once.
+    wz::ImageStore images;
+
+    // canvas_cache is the persistent cache of decoded canvases, if enabled.
+    std::unique_ptr<wz::DiskCache> canvas_cache;
+
+    // shared_cache is the cache of files shared with other processes, if
+    // enabled.
+    std::unique_ptr<wz::SharedCache> shared_cache;
+
     Wz base;
     Wz character;
     Wz effect;
@@ -40,7 +69,8 @@ struct Dataset {
 
     static Error opendirectory(
         Dataset* self,
-        const std::filesystem::path& path);
+        const std::filesystem::path& path,
+        const Options& options = {});
 
     std::vector<std::wstring> openfiles() const;
 
@@ -8,6 +8,8 @@
 #include <string>
 
 #include "logger.hh"
+#include "client/game/renderqueue.hh"
+#include "gfx/atlas.hh"
 #include "gfx/vertex.hh"
 #include "util/convert.hh"
 #include "wz/property.hh"
@@ -191,8 +193,7 @@ static Error TileSet_load(
             // Load the frame.
             CHECK(gfx::Sprite::Frame::load(
                 &tile.frame,
-                canvas->image,
-                canvas->image_data),
+                *canvas),
                 Error::TILESET_LOAD_FRAMELOADFAILED) << "failed to load tile frame";
 
             CHECK(number->childvector(
@@ -216,7 +217,6 @@ static Error TileSet_load(
 }
 
 static Error ObjectSet_load(
-    client::Universe* universe,
     wz::Vfs* map_vfs,
     Map::ObjectSet* objectset,
     const wchar_t* objectset_name_s,
@@ -255,12 +255,7 @@ static Error ObjectSet_load(
                     << l0->name << "/" << l1->name << "/" << l2->name;
 
                 Map::ObjectSet::Object object;
-
-                CHECK(client::Sprite::init(
-                    &object.sprite,
-                    std::move(sprite),
-                    &universe->time),
-                    Error::OBJECTSET_LOAD_SPRITELOADFAILED) << "failed to load object sprite";
+                object.sprite = std::move(sprite);
 
                 const Map::ObjectSet::Object::Name name = {
                     .l0 = l0->name,
@@ -276,17 +271,21 @@ static Error ObjectSet_load(
 }
 
 static Error Map_load_layer(
-    client::Universe* universe,
     Map* self,
     wz::Vfs* map_vfs,
     Map::Layer* layer,
     const wz::OpenedFile::Node* layer_node,
+    Map::Library* library,
     Map::LoadResults* results) {
     // Load TileSet and tiles.
+    static const wz::Path tileset_name_path(L"info/tS");
+    static const wz::Path tile_path(L"tile");
+    static const wz::Path objects_path(L"obj");
+
     const Map::TileSet* tileset = nullptr;
     do {
         const wz::OpenedFile::Node* tileset_name_node =
-            layer_node->find(L"info/tS");
+            layer_node->find(tileset_name_path);
         if (tileset_name_node == nullptr)
             break;
 
@@ -298,13 +297,25 @@ static Error Map_load_layer(
 
         // Load the named tileset, if we haven't already.
         const std::wstring tileset_name(tileset_name_s);
-        if (!self->tilesets.contains(tileset_name)) {
-            Map::TileSet new_tileset;
+        if (auto it = self->tilesets.find(tileset_name); it != self->tilesets.end()) {
+            tileset = it->second.get();
+            break;
+        }
+
+        std::shared_ptr<const Map::TileSet> shared;
+        if (library) {
+            auto it = library->tilesets.find(tileset_name);
+            if (it != library->tilesets.end())
+                shared = it->second;
+        }
+
+        if (!shared) {
+            std::shared_ptr<Map::TileSet> new_tileset(new Map::TileSet());
 
             // It's not necessarily a fatal error to fail to load a tileset.
             Error e = TileSet_load(
                 map_vfs,
-                &new_tileset,
+                new_tileset.get(),
                 tileset_name_s,
                 results);
             if (e) {
@@ -319,18 +330,20 @@ static Error Map_load_layer(
                 break;
             }
 
-            self->tilesets.emplace(tileset_name, std::move(new_tileset));
-            tileset = &self->tilesets.at(tileset_name);
-        } else {
-            tileset = &self->tilesets.at(tileset_name);
+            shared = std::move(new_tileset);
+            if (library)
+                library->tilesets.emplace(tileset_name, shared);
         }
+
+        tileset = shared.get();
+        self->tilesets.emplace(tileset_name, std::move(shared));
     } while (false);
 
     layer->tileset = tileset;
 
     if (tileset) {
         const wz::OpenedFile::Node* tile_node =
-            layer_node->find(L"tile");
+            layer_node->find(tile_path);
         if (tile_node != nullptr) {
             auto tile_it = tile_node->iterator();
 
@@ -339,11 +352,12 @@ static Error Map_load_layer(
                 // TODO: The errors here should probably not be errors, but just failed loads.
                 Map::Layer::Tile tile;
                 Map::TileSet::Tile::Name name;
-                CHECK(tile_node->deserialize(
-                    L"u", &name.u,
-                    L"no", &name.no,
-                    L"x", &tile.position.x,
-                    L"y", &tile.position.y),
+                CHECK(tile_node->deserialize({
+                    {L"u", &name.u},
+                    {L"no", &name.no},
+                    {L"x", &tile.position.x},
+                    {L"y", &tile.position.y},
+                }),
                     Error::LAYER_LOAD_MISSINGATTRIBUTES) << "missing or invalid tile property";
 
                 // Specifically ignore errors here.
@@ -362,18 +376,10 @@ static Error Map_load_layer(
                 layer->tiles.emplace_back(std::move(tile));
             }
         }
-
-        // Sort tiles.
-        std::sort(
-            layer->tiles.begin(),
-            layer->tiles.end(),
-            [](const Map::Layer::Tile& left, const Map::Layer::Tile& right) {
-                return left.z < right.z;
-            });
     }
 
     // Load objects.
-    const wz::OpenedFile::Node* objects_node = layer_node->find(L"obj");
+    const wz::OpenedFile::Node* objects_node = layer_node->find(objects_path);
     if (objects_node) {
         // Track the object sets that fail to load.
         // Since we attempt to load object sets on every object in the layer, we can repeatedly
@@ -390,15 +396,16 @@ static Error Map_load_layer(
             // First, look for this object's set.
             const wchar_t* objectset_name_s = nullptr;
             Map::ObjectSet::Object::Name name;
-            CHECK(object_node->deserialize(
-                L"oS", &objectset_name_s,
-                L"l0", &name.l0,
-                L"l1", &name.l1,
-                L"l2", &name.l2,
-                L"x", &object.position.x,
-                L"y", &object.position.y,
-                L"z", &object.z,
-                L"f", &object.f),
+            CHECK(object_node->deserialize({
+                {L"oS", &objectset_name_s},
+                {L"l0", &name.l0},
+                {L"l1", &name.l1},
+                {L"l2", &name.l2},
+                {L"x", &object.position.x},
+                {L"y", &object.position.y},
+                {L"z", &object.z},
+                {L"f", &object.f},
+            }),
                 Error::LAYER_LOAD_MISSINGATTRIBUTES)
                 << "missing or invalid object attributes";
 
@@ -407,34 +414,46 @@ static Error Map_load_layer(
                 continue;
 
             const Map::ObjectSet* objectset = nullptr;
-            if (!self->objectsets.contains(objectset_name)) {
-                Map::ObjectSet new_objectset;
+            if (auto it = self->objectsets.find(objectset_name); it != self->objectsets.end()) {
+                objectset = it->second.get();
+            } else {
+                std::shared_ptr<const Map::ObjectSet> shared;
+                if (library) {
+                    auto it = library->objectsets.find(objectset_name);
+                    if (it != library->objectsets.end())
+                        shared = it->second;
+                }
 
-                // It's not necessarily a fatal error to fail to load an objectset.
-                Error e = ObjectSet_load(
-                    universe,
-                    map_vfs,
-                    &new_objectset,
-                    objectset_name_s,
-                    results);
-                if (e) {
-                    objectsets_missing.insert(objectset_name);
+                if (!shared) {
+                    std::shared_ptr<Map::ObjectSet> new_objectset(new Map::ObjectSet());
 
-                    // Record the failed load and move on.
-                    if (results) {
-                        std::wstringstream ss;
-                        e.print(ss);
+                    // It's not necessarily a fatal error to fail to load an objectset.
+                    Error e = ObjectSet_load(
+                        map_vfs,
+                        new_objectset.get(),
+                        objectset_name_s,
+                        results);
+                    if (e) {
+                        objectsets_missing.insert(objectset_name);
+
+                        // Record the failed load and move on.
+                        if (results) {
+                            std::wstringstream ss;
+                            e.print(ss);
 
-                        results->objectsets_missing[objectset_name] = ss.str();
+                            results->objectsets_missing[objectset_name] = ss.str();
+                        }
+
+                        continue;
                     }
 
-                    continue;
+                    shared = std::move(new_objectset);
+                    if (library)
+                        library->objectsets.emplace(objectset_name, shared);
                 }
 
-                self->objectsets.emplace(objectset_name, std::move(new_objectset));
-                objectset = &self->objectsets.at(objectset_name);
-            } else {
-                objectset = &self->objectsets.at(objectset_name);
+                objectset = shared.get();
+                self->objectsets.emplace(objectset_name, std::move(shared));
             }
 
             auto objectset_it = objectset->objects.find(name);
@@ -452,14 +471,33 @@ static Error Map_load_layer(
 
             layer->objects.emplace_back(std::move(object));
         }
+    }
 
-        // Sort objects.
-        std::sort(
-            layer->objects.begin(),
-            layer->objects.end(),
-            [](const Map::Layer::Object& left, const Map::Layer::Object& right) {
-                return left.z < right.z;
-            });
+    // Tiles and objects never move, so bake their quads. The geometry puts
+    // them in draw order by their keys: all of the layer's objects by z, then
+    // all of its tiles by z.
+    const uint32_t draw_layer = game::RenderQueue::MAP_LAYER + layer->index;
+    for (const Map::Layer::Object& object : layer->objects) {
+        const uint64_t key = game::RenderQueue::key(
+            draw_layer,
+            game::RenderQueue::OBJECTS,
+            object.z);
+
+        const gfx::Sprite& sprite = object.object->sprite;
+        if (sprite.frames.size() > 1) {
+            layer->geometry.add_animated(&sprite, object.position, key);
+        } else if (sprite.frames.size() == 1) {
+            layer->geometry.add(&sprite.frames[0], object.position, key);
+        }
+    }
+
+    for (const Map::Layer::Tile& tile : layer->tiles) {
+        const uint64_t key = game::RenderQueue::key(
+            draw_layer,
+            game::RenderQueue::TILES,
+            tile.z);
+
+        layer->geometry.add(&tile.tile->frame, tile.position, key);
     }
 
     return Error();
@@ -473,18 +511,19 @@ static Error Map_load_background(
     int32_t kind_i = 0;
     const wchar_t* back_file_node_basename = nullptr;
     int32_t no = 0;
-    CHECK(back_node->deserialize(
-        L"x", &background->position.x,
-        L"y", &background->position.y,
-        L"cx", &background->c.x,
-        L"cy", &background->c.y,
-        L"rx", &background->r.x,
-        L"ry", &background->r.y,
-        L"ani", &background->ani,
-        L"type", &kind_i,
-        L"front", &background->front,
-        L"bS", &back_file_node_basename,
-        L"no", &no),
+    CHECK(back_node->deserialize({
+        {L"x", &background->position.x},
+        {L"y", &background->position.y},
+        {L"cx", &background->c.x},
+        {L"cy", &background->c.y},
+        {L"rx", &background->r.x},
+        {L"ry", &background->r.y},
+        {L"ani", &background->ani},
+        {L"type", &kind_i},
+        {L"front", &background->front},
+        {L"bS", &back_file_node_basename},
+        {L"no", &no},
+    }),
         Error::BACKGROUND_LOAD_MISSINGATTRIBUTES)
         << "missing or invalid background property";
 
@@ -541,11 +580,18 @@ static Error Map_load_background(
             << "missing or invalid frame";
     }
 
-    CHECK(gfx::Sprite::Frame::load(
-        &background->frame,
-        canvas->image,
-        canvas->image_data),
-        Error::BACKGROUND_LOAD_FRAMELOADFAILED) << "failed to load frame";
+    // Tiled backgrounds are drawn with a repeating texture of their own.
+    if (background->kind == Map::Background::SINGLE) {
+        CHECK(gfx::Sprite::Frame::load(
+            &background->frame,
+            *canvas),
+            Error::BACKGROUND_LOAD_FRAMELOADFAILED) << "failed to load frame";
+    } else {
+        CHECK(gfx::Sprite::Frame::loadrepeating(
+            &background->frame,
+            *canvas),
+            Error::BACKGROUND_LOAD_FRAMELOADFAILED) << "failed to load frame";
+    }
 
     CHECK(frame_node->childvector(
         L"origin",
@@ -568,15 +614,36 @@ Error Map::load(
     Map* self,
     wz::Vfs* map_vfs,
     wz::Vfs::File::Handle&& map_file,
+    Map::Library* library,
     Map::LoadResults* results) {
     self->map_file = std::move(map_file);
 
+    // Snapshot dedup statistics, to report those of this map only.
+    wz::ImageStore* image_store = map_vfs->options.image_store;
+    const wz::ImageStore::Stats images_before =
+        image_store ? image_store->stats() : wz::ImageStore::Stats{ 0 };
+    const gfx::TextureCache::Stats textures_before =
+        gfx::TextureCache::Global().stats;
+
+    // Release the pages of maps that have been unloaded since, before
+    // packing this one.
+    gfx::Atlas& atlas = gfx::Atlas::Global();
+    atlas.trim();
+    const gfx::Atlas::Stats atlas_before = atlas.stats();
+
+    static const wz::Path backs_path(L"back");
+    static const wz::Path info_path(L"info");
+    static const wz::Path layer_paths[] = {
+        wz::Path(L"0"), wz::Path(L"1"), wz::Path(L"2"), wz::Path(L"3"),
+        wz::Path(L"4"), wz::Path(L"5"), wz::Path(L"6"), wz::Path(L"7"),
+    };
+
     self->time = universe->time.add<systems::Time::Component::Milliseconds>();
 
     // Load backgrounds.
     {
         const wz::OpenedFile::Node* backs =
-            self->map_file->find(L"back");
+            self->map_file->find(backs_path);
         if (backs != nullptr) {
             wz::OpenedFile::Node::Iterator it = backs->iterator();
 
@@ -616,35 +683,23 @@ Error Map::load(
         }
     }
 
-    // Backgrounds should be sorted in render order.
-    std::sort(
-        self->backgrounds.begin(),
-        self->backgrounds.end(),
-        [](const Map::Background& b1, const Map::Background& b2) {
-            return b1.z < b2.z;
-        });
-
     // Load layers.
     {
         // For now, load specifically named layers [0, 7].
         for (size_t i = 0; i < 8; ++i) {
-            const wz::OpenedFile::Node* layer_node = nullptr;
-            {
-                std::wstringstream ss;
-                ss << i;
-                layer_node = self->map_file->find(ss.str().c_str());
-            }
+            const wz::OpenedFile::Node* layer_node =
+                self->map_file->find(layer_paths[i]);
             if (layer_node == nullptr)
                 continue;
 
             Map::Layer layer;
             layer.index = i;
             CHECK(Map_load_layer(
-                universe,
                 self,
                 map_vfs,
                 &layer,
                 layer_node,
+                library,
                 results),
                 Error::MAP_LOAD_LAYERLOADFAILED) << "failed to load layer " << i;
 
@@ -654,7 +709,7 @@ Error Map::load(
 
     // Load map info.
     const wz::OpenedFile::Node* info_node =
-        self->map_file->find(L"info");
+        self->map_file->find(info_path);
     if (info_node == nullptr) {
         return error_new(Error::OPENFAILED)
             << "map has no info node";
@@ -717,8 +772,8 @@ Error Map::load(
             for (size_t i = 0, l = layer.objects.size(); i < l; ++i) {
                 const Map::Layer::Object& object = layer.objects[i];
 
-                for (size_t i = 0, l = object.object->sprite.sprite.frames.size(); i < l; ++i) {
-                    const gfx::Sprite::Frame& frame = object.object->sprite.sprite.frames[i];
+                for (size_t i = 0, l = object.object->sprite.frames.size(); i < l; ++i) {
+                    const gfx::Sprite::Frame& frame = object.object->sprite.frames[i];
 
                     const gfx::Vector<int32_t> topleft = object.position - frame.origin;
                     const gfx::Vector<int32_t> bottomright = {
@@ -739,6 +794,44 @@ Error Map::load(
         }
     }
 
+    {
+        const wz::ImageStore::Stats images_after =
+            image_store ? image_store->stats() : wz::ImageStore::Stats{ 0 };
+        const gfx::TextureCache::Stats& textures_after =
+            gfx::TextureCache::Global().stats;
+
+        Map::LoadResults::Dedup dedup = {
+            .images = images_after.lookups - images_before.lookups,
+            .images_shared = images_after.hits - images_before.hits,
+            .textures = textures_after.lookups - textures_before.lookups,
+            .textures_shared = textures_after.hits - textures_before.hits,
+        };
+
+        LOG(Logger::INFO)
+            << "map dedup: " << dedup.images_shared << "/" << dedup.images << " images and "
+            << dedup.textures_shared << "/" << dedup.textures << " textures shared ("
+            << (dedup.ratio() * 100) << "%)";
+
+        if (results)
+            results->dedup = dedup;
+
+        const gfx::Atlas::Stats atlas_after = atlas.stats();
+        Map::LoadResults::Atlas packing = {
+            .pages = atlas_after.pages,
+            .pages_created = atlas_after.pages_created - atlas_before.pages_created,
+            .regions = atlas_after.regions - atlas_before.regions,
+            .efficiency = atlas_after.efficiency(),
+        };
+
+        LOG(Logger::INFO)
+            << "map atlas: " << packing.regions << " frames packed into "
+            << packing.pages_created << " new pages, " << packing.pages << " pages in use, "
+            << (packing.efficiency * 100) << "% packed";
+
+        if (results)
+            results->atlas = packing;
+    }
+
     return Error();
 }
 
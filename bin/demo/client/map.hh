@@ -1,6 +1,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -11,6 +12,7 @@
 #include "client/sprite.hh"
 #include "client/time.hh"
 #include "client/universe.hh"
+#include "client/game/renderer.hh"
 #include "ms/map.hh"
 #include "gfx/program.hh"
 #include "gfx/sprite.hh"
@@ -76,7 +78,7 @@ struct Map {
     };
 
     // tilesets is a map from tileset name (tileset file basename) to TileSet.
-    std::unordered_map<std::wstring, TileSet> tilesets;
+    std::unordered_map<std::wstring, std::shared_ptr<const TileSet>> tilesets;
 
     struct ObjectSet {
         struct Object {
@@ -101,7 +103,10 @@ struct Map {
                 }
             };
 
-            client::Sprite sprite;
+            // sprite is not a client::Sprite, since objects are only drawn
+            // through their layer's geometry, which animates them on the
+            // GPU: they need no time component ticking on the CPU.
+            gfx::Sprite sprite;
 
             Object() = default;
             Object(Object&&) = default;
@@ -120,7 +125,28 @@ struct Map {
     };
 
     // objectsets is a map from objectset name (objectset file basename) to ObjectSet.
-    std::unordered_map<std::wstring, ObjectSet> objectsets;
+    std::unordered_map<std::wstring, std::shared_ptr<const ObjectSet>> objectsets;
+
+    // Library holds the tilesets and objectsets loaded by any map, so that
+    // maps loaded with the same Library share them instead of each loading
+    // their own. trim drops the sets that no map uses anymore.
+    struct Library {
+        std::unordered_map<std::wstring, std::shared_ptr<const TileSet>> tilesets;
+        std::unordered_map<std::wstring, std::shared_ptr<const ObjectSet>> objectsets;
+
+        void trim() {
+            std::erase_if(tilesets, [](const auto& it) {
+                return it.second.use_count() == 1;
+            });
+            std::erase_if(objectsets, [](const auto& it) {
+                return it.second.use_count() == 1;
+            });
+        }
+
+        Library() = default;
+        Library(Library&&) = default;
+        Library(const Library&) = delete;
+    };
 
     struct Layer {
         N<uint32_t> index;
@@ -143,6 +169,10 @@ struct Map {
 
         std::vector<Object> objects;
 
+        // geometry holds the quads of objects and then tiles, in the order
+        // they are drawn, baked when the layer is loaded.
+        client::game::Renderer::Geometry geometry;
+
         Layer() = default;
         Layer(Layer&&) = default;
         Layer(const Layer&) = delete;
@@ -205,6 +235,32 @@ struct Map {
         std::map<std::wstring, std::wstring> objectsets_missing;
         std::map<std::wstring, std::wstring> objects_missing;
 
+        // Dedup counts the images and textures loaded for this map, and how
+        // many of them were shared with already loaded ones.
+        struct Dedup {
+            uint64_t images;
+            uint64_t images_shared;
+            uint64_t textures;
+            uint64_t textures_shared;
+
+            // ratio returns the fraction of textures that were shared.
+            double ratio() const {
+                if (textures == 0)
+                    return 0;
+
+                return static_cast<double>(textures_shared) / textures;
+            }
+        } dedup = { 0 };
+
+        // Atlas counts the atlas pages created for this map, and how well
+        // the pages in use are packed once it is loaded.
+        struct Atlas {
+            uint64_t pages;
+            uint64_t pages_created;
+            uint64_t regions;
+            double efficiency;
+        } atlas = { 0 };
+
         bool empty() const {
             return
                 backgrounds_missing.size() == 0 &&
@@ -218,12 +274,14 @@ struct Map {
     // load loads Map information from an opened WZ file. Non-catastrophic errors,
     // such as missing backgrounds or missing tiles are not returned as Errors (i.e.
     // the load will still continue). Instead, they are reported in the LoadResults,
-    // if a pointer to one has been provided.
+    // if a pointer to one has been provided. Tilesets and objectsets are shared
+    // through library, if one is provided.
     static Error load(
         client::Universe* universe,
         Map* self,
         wz::Vfs* map_vfs,
         wz::Vfs::File::Handle&& map_file,
+        Library* library,
         LoadResults* results);
 
     Map() = default;
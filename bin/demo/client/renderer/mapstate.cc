@@ -3,6 +3,7 @@
 #include <string>
 
 #include "logger.hh"
+#include "client/game/softrenderer.hh"
 
 namespace client {
 namespace renderer {
@@ -92,13 +93,11 @@ Error MapLoader::load(
         return Error();
     }
 
-    std::wstring map_filename = id.as_filename();
-
     // Extract the file.
-    wz::Vfs::Node* map_node = dataset->map.vfs.find(map_filename.c_str());
+    wz::Vfs::Node* map_node = dataset->map.vfs.find(id.path());
     if (map_node == nullptr || map_node->file() == nullptr) {
         return error_new(Error::UIERROR)
-            << "failed to find map file " << map_filename;
+            << "failed to find map file " << id.as_filename();
     }
 
     // Open the file.
@@ -116,6 +115,7 @@ Error MapLoader::load(
         &new_map,
         &dataset->map.vfs,
         std::move(map_file),
+        &library,
         &load_results),
         Error::OPENFAILED) << "failed to load map";
 
@@ -175,28 +175,55 @@ static bool background_movesvertically(
     }
 }
 
+template <typename Target>
 static Error background_stationary(
-    const MapState* that,
-    client::game::Renderer::Target* target,
+    MapState* that,
+    Target* target,
     const client::Map::Background* background,
-    const gfx::Vector<double> shift,
-    const gfx::Rect<int32_t> bounds) {
-    uint32_t row_count = 1;
-    uint32_t column_count = 1;
+    const gfx::Vector<double> shift) {
+    const uint64_t key = client::game::RenderQueue::key(
+        client::game::RenderQueue::BACKGROUND,
+        0,
+        background->z);
+
+    const bool horizontal = background_tileshorizontally(background);
+    const bool vertical = background_tilesvertically(background);
 
     gfx::Vector<int32_t> start = background->position + shift;
 
-    if (background_tileshorizontally(background)) {
+    // Tiles that are laid end to end are drawn as a single quad, whatever
+    // the size of the map.
+    const bool seamless =
+        (!horizontal || background->c.x == static_cast<int32_t>(background->frame.image.width)) &&
+        (!vertical || background->c.y == static_cast<int32_t>(background->frame.image.height));
+    if ((horizontal || vertical) && seamless && background->frame.texture->repeating) {
+        that->queue.tiled(
+            key,
+            &background->frame,
+            start,
+            horizontal,
+            vertical);
+        return Error();
+    }
+
+    // Otherwise, draw each tile in view.
+    const gfx::Rect<int32_t> bounds =
+        static_cast<gfx::Rect<int32_t>>(target->game_viewport);
+
+    uint32_t row_count = 1;
+    uint32_t column_count = 1;
+
+    if (horizontal) {
         column_count = 3 +
-            (bounds.width() / background->frame.image.width);
+            (bounds.width() / background->c.x);
 
         start.x = bounds.topleft.x -
             (background->c.x -
                 ((start.x - bounds.topleft.x) % background->c.x));
     }
-    if (background_tilesvertically(background)) {
+    if (vertical) {
         row_count = 3 +
-            (bounds.height() / background->frame.image.height);
+            (bounds.height() / background->c.y);
 
         start.y = bounds.topleft.y -
             (background->c.y -
@@ -206,7 +233,8 @@ static Error background_stationary(
     gfx::Vector<int32_t> at = start;
     for (uint32_t row = 0; row < row_count; ++row) {
         for (uint32_t column = 0; column < column_count; ++column) {
-            target->frame(
+            that->queue.frame(
+                key,
                 &background->frame,
                 at);
 
@@ -220,9 +248,10 @@ static Error background_stationary(
     return Error();
 }
 
+template <typename Target>
 static Error background(
-    const MapState* that,
-    client::game::Renderer::Target* target,
+    MapState* that,
+    Target* target,
     const client::Map::Background* background,
     const ms::game::MapState* state,
     const client::Map* resources,
@@ -265,8 +294,7 @@ static Error background(
             that,
             target,
             background,
-            shift,
-            resources->bounding_box);
+            shift);
     default:
         // TODO
         break;
@@ -275,31 +303,37 @@ static Error background(
     return Error();
 }
 
-static Error layer(
-    const MapState* that,
-    client::game::Renderer::Target* target,
-    const client::Map::Layer* layer) {
-    for (const client::Map::Layer::Object& object : layer->objects) {
-        target->frame(
-            object.object->sprite.frame(),
-            object.position);
-    }
+static void layer(
+    MapState* that,
+    client::Map::Layer* layer,
+    uint64_t time) {
+    // The layer's quads are already on the GPU, and the program animates
+    // them from the time.
+    that->queue.geometry(
+        &layer->geometry,
+        time);
+}
 
-    for (const client::Map::Layer::Tile& tile : layer->tiles) {
-        target->frame(
-            &tile.tile->frame,
-            tile.position);
-    }
+// clip limits the drawing of target to bounds, in game coordinates.
+static void clip(
+    client::game::Renderer::Target* target,
+    const gfx::Rect<double> bounds) {
+    target->that->program.viewport(bounds);
+}
 
-    return Error();
+static void clip(
+    client::game::SoftRenderer::Target* target,
+    const gfx::Rect<double> bounds) {
+    target->clip(bounds);
 }
 
+template <typename Target>
 Error MapState::render(
     const MapState::Options* options,
-    client::game::Renderer::Target* target,
+    Target* target,
     MapLoader* loader,
     const ms::game::MapState* state,
-    uint64_t now) const {
+    uint64_t now) {
     // First, we need to get the resources for this map, which has the graphical info.
     client::Map* resources;
     CHECK(loader->load(
@@ -308,11 +342,29 @@ Error MapState::render(
         Error::RESOURCELOADFAILED)
         << "failed to load map resources";
 
-    target->that->program.viewport(
+    return draw(
+        options,
+        target,
+        resources,
+        &loader->map_helper,
+        state,
+        now);
+}
+
+template <typename Target>
+Error MapState::draw(
+    const MapState::Options* options,
+    Target* target,
+    client::Map* resources,
+    const MapHelper* helper,
+    const ms::game::MapState* state,
+    uint64_t now) {
+    clip(
+        target,
         (gfx::Rect<double>) resources->bounding_box);
 
-    // Draw the backgrounds before anything else.
-    uint32_t i = 0;
+    queue.begin(target->game_viewport);
+
     for (const client::Map::Background& b : resources->backgrounds) {
         background(
             this,
@@ -321,28 +373,40 @@ Error MapState::render(
             state,
             resources,
             now);
-        ++i;
     }
 
-    for (const client::Map::Layer& l : resources->layers) {
+    for (client::Map::Layer& l : resources->layers) {
         layer(
             this,
-            target,
-            &l);
+            &l,
+            now);
     }
 
-    if (options->debug.portals) {
+    if (state && helper && options->debug.portals) {
+        const uint64_t key = client::game::RenderQueue::key(
+            client::game::RenderQueue::OVERLAY,
+            0,
+            0);
+
         for (const ms::Map::Portal& p : state->basemap.portals) {
-            auto it = loader->map_helper.portal_sprites.find(p.kind);
-            if (it == loader->map_helper.portal_sprites.end())
+            auto it = helper->portal_sprites.find(p.kind);
+            if (it == helper->portal_sprites.end())
                 continue;
 
-            target->frame(
+            queue.frame(
+                key,
                 it->second.frame(),
                 p.at);
         }
     }
 
+    CHECK(queue.flush(target),
+        Error::UIERROR) << "failed to draw map";
+
+    // The debug drawings are of the logical map, so they need its state.
+    if (!state)
+        return Error();
+
     if (options->debug.footholds) {
         for (const auto& [k, l] : state->basemap.layers) {
             for (const ms::Map::Foothold& f : l.footholds) {
@@ -459,5 +523,28 @@ Error MapState::render(
     return Error();
 }
 
+template Error MapState::render(
+    const MapState::Options* options,
+    client::game::Renderer::Target* target,
+    MapLoader* loader,
+    const ms::game::MapState* state,
+    uint64_t now);
+
+template Error MapState::draw(
+    const MapState::Options* options,
+    client::game::Renderer::Target* target,
+    client::Map* resources,
+    const MapHelper* helper,
+    const ms::game::MapState* state,
+    uint64_t now);
+
+template Error MapState::draw(
+    const MapState::Options* options,
+    client::game::SoftRenderer::Target* target,
+    client::Map* resources,
+    const MapHelper* helper,
+    const ms::game::MapState* state,
+    uint64_t now);
+
 }
 }
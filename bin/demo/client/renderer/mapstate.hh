@@ -8,6 +8,7 @@
 #include "client/sprite.hh"
 #include "client/universe.hh"
 #include "client/game/renderer.hh"
+#include "client/game/renderqueue.hh"
 #include "ms/game/mapstate.hh"
 #include "util/error.hh"
 #include "wz/vfs.hh"
@@ -33,6 +34,9 @@ struct MapLoader {
 
     MapHelper map_helper;
 
+    // library shares tilesets and objectsets between the loaded maps.
+    client::Map::Library library;
+
     std::unordered_map<ms::Map::ID, client::Map, ms::Map::ID::Hash> maps;
 
     static Error init(
@@ -66,12 +70,33 @@ struct MapState {
         bool tiles{ true };
     };
 
+    // queue orders the draws of the map, and is reused from frame to frame
+    // so that it only allocates as it grows.
+    client::game::RenderQueue queue;
+
+    // render draws the map of state, whose resources are loaded through
+    // loader. It is instantiated for Renderer::Target.
+    template <typename Target>
     Error render(
         const Options* options,
-        client::game::Renderer::Target* target,
+        Target* target,
         MapLoader* loader,
         const ms::game::MapState* state,
-        uint64_t now) const;
+        uint64_t now);
+
+    // draw draws a map from its resources. Backgrounds, layers and portals
+    // are submitted to queue, which orders them; the debug lines are drawn
+    // over them. The debug drawings are skipped if state is null, and
+    // portals if helper is. It is instantiated for both Renderer::Target
+    // and SoftRenderer::Target.
+    template <typename Target>
+    Error draw(
+        const Options* options,
+        Target* target,
+        client::Map* resources,
+        const MapHelper* helper,
+        const ms::game::MapState* state,
+        uint64_t now);
 };
 
 }
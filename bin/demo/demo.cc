@@ -6,9 +6,10 @@
 Error Demo::init(
     Demo* self,
     const std::filesystem::path& dataset_path,
+    const client::Dataset::Options& dataset_options,
     uint64_t now,
     gfx::Vector<int32_t> window_size) {
-    CHECK(client::Dataset::opendirectory(&self->dataset, dataset_path),
+    CHECK(client::Dataset::opendirectory(&self->dataset, dataset_path, dataset_options),
           Error::OPENFAILED) << "failed to load dataset";
 
     wz::Vfs::Node* map_node = self->dataset.string.vfs.find(L"Map.img");
@@ -64,7 +65,7 @@ Error Demo::loadmap(
         << "looking for " << map_filename;
 
     // Extract the file.
-    wz::Vfs::Node* map_node = dataset.map.vfs.find(map_filename.c_str());
+    wz::Vfs::Node* map_node = dataset.map.vfs.find(map_id.path());
     if (map_node == nullptr || map_node->file() == nullptr) {
         return error_new(Error::UIERROR)
         << "failed to find map file";
@@ -89,6 +89,7 @@ struct Demo {
     static Error init(
         Demo* self,
         const std::filesystem::path& dataset_path,
+        const client::Dataset::Options& dataset_options,
         uint64_t now,
         gfx::Vector<int32_t> window_size);
 };
@@ -9,6 +9,7 @@
 #include "client/universe.hh"
 #include "client/game/renderer.hh"
 #include "client/renderer/mapstate.hh"
+#include "gfx/uploader.hh"
 #include "gl/window.hh"
 #include "ms/map.hh"
 #include "ms/game/mapstate.hh"
@@ -21,6 +22,7 @@
 #include "gl.hh"
 
 #include "demo.hh"
+#include "thumbnails.hh"
 
 enum {
     MAPID_LENGTH = 9,
@@ -31,10 +33,55 @@ static void glfw_errorcallback(int code, const char* message) {
         "GLFW error " << code << ": " << message;
 }
 
+// thumbnails_ renders every map into an output directory, given as:
+//   <wz directory> thumbnails <output directory> [scale] [threads]
+static Error thumbnails_(const std::vector<std::string>& args) {
+    if (args.size() < 4) {
+        return error_new(Error::INVALIDUSAGE)
+            << "please provide a WZ directory, \"thumbnails\" and an output directory, "
+            << "and optionally a scale and a number of threads";
+    }
+
+    Thumbnails::Options options = {
+        .output = args[3],
+        .scale = 0,
+        .threads = 0,
+        .encoders = 0,
+    };
+    if (args.size() > 4) {
+        std::stringstream ss(args[4]);
+        ss >> options.scale;
+    }
+    if (args.size() > 5) {
+        std::stringstream ss(args[5]);
+        ss >> options.threads;
+    }
+
+    return Thumbnails::run(
+        args[1],
+        {},
+        options,
+        nullptr);
+}
+
 Error main_(const std::vector<std::string>& args) {
     if (args.size() < 3) {
         return error_new(Error::INVALIDUSAGE)
-            << "please provide a WZ directory and map ID";
+            << "please provide a WZ directory and map ID, and optionally a canvas cache directory, "
+            << "\"verify\" and \"shared\"; or a WZ directory, \"thumbnails\" and an output directory";
+    }
+
+    if (args[2] == "thumbnails")
+        return thumbnails_(args);
+
+    client::Dataset::Options dataset_options = {};
+    if (args.size() > 3 && args[3] != "shared")
+        dataset_options.canvas_cache = args[3];
+    for (size_t i = 3; i < args.size(); ++i) {
+        if (args[i] == "verify")
+            dataset_options.canvas_cache_options.verify = true;
+        else if (args[i] == "shared")
+            dataset_options.shared_cache = true;
     }
 
     glfwSetErrorCallback(glfw_errorcallback);
@@ -48,6 +95,12 @@ Error main_(const std::vector<std::string>& args) {
         "Map demo"),
         Error::UIERROR) << "failed to initialize window";
 
+    // Upload textures in the background, so that loading a map does not
+    // freeze the window.
+    gfx::Uploader& uploader = gfx::Uploader::Global();
+    CHECK(uploader.start(),
+        Error::UIERROR) << "failed to start texture uploader";
+
     // Convert the provided map ID to an integer so that we can
     // convert it to a properly sized string below.
     ms::Map::ID map_id;
@@ -69,6 +122,7 @@ Error main_(const std::vector<std::string>& args) {
     CHECK(Demo::init(
         &demo,
         args[1],
+        dataset_options,
         client::now().to_milliseconds(),
         framebuffer_size),
         Error::UIERROR)
@@ -134,6 +188,8 @@ Error main_(const std::vector<std::string>& args) {
             .bottomright = (gfx::Vector<uint32_t>) display_size,
         };
 
+        uploader.pump();
+
         {
             gl::Window::Frame frame;
             CHECK(window.frame(
@@ -171,11 +227,19 @@ Error main_(const std::vector<std::string>& args) {
                     if (std::chrono::system_clock::now() - last_metrics > 3s) {
                         last_metrics = std::chrono::system_clock::now();
 
+                        // Draw the last batch, so that it is counted.
+                        target.flush();
+
                         LOG(DEBUG)
                             << "[render stats] "
                             << "quads: " << target.metrics.quads << " "
+                            << "culled: " << target.metrics.culled << " "
+                            << "pending: " << target.metrics.pending << " "
                             << "textures: " << target.metrics.textures() << " "
-                            << "draw calls: " << target.metrics.draw_calls;
+                            << "draw calls: " << target.metrics.draw_calls << " "
+                            << "gl calls: " << target.metrics.gl_calls << " "
+                            << "(" << target.metrics.gl_calls_skipped << " skipped) "
+                            << "uploads pending: " << uploader.stats().pending;
 
                         auto open_files = demo.dataset.openfiles();
                         std::wcerr << "open files: \n";
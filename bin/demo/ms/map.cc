@@ -24,11 +24,27 @@ std::wstring Map::ID::padded() const {
 }
 
 std::wstring Map::ID::as_filename() const {
-    std::wstring padded_id = padded();
+    // Format directly into a template, rather than through wstringstreams:
+    // map files are named Map/Map<first digit>/<9 digit id>.img.
+    wchar_t filename[] = L"Map/Map0/000000000.img";
+    enum {
+        FIRST_DIGIT = 7,
+        ID_START = 9,
+        ID_END = 18,
+    };
+
+    uint32_t n = static_cast<uint32_t>(id);
+    for (size_t i = ID_END; i > ID_START; --i) {
+        filename[i - 1] = L'0' + (n % 10);
+        n /= 10;
+    }
+    filename[FIRST_DIGIT] = filename[ID_START];
 
-    std::wstringstream ss;
-    ss << "Map/Map" << padded_id[0] << "/" << padded_id.c_str() << ".img";
-    return ss.str();
+    return filename;
+}
+
+wz::Path Map::ID::path() const {
+    return wz::Path::uninterned(as_filename());
 }
 
 bool Map::ID::from(
@@ -41,6 +57,10 @@ Error Map::load(
     Map* self,
     ID id,
     wz::Vfs::File::Handle&& map_file) {
+    static const wz::Path footholds_path(L"foothold");
+    static const wz::Path ladders_path(L"ladderRope");
+    static const wz::Path portals_path(L"portal");
+
     self->id = id;
     self->map_file = std::move(map_file);
 
@@ -50,7 +70,7 @@ Error Map::load(
     self->bounding_box.bottomright.y = INT32_MIN;
 
     const wz::OpenedFile::Node* footholds =
-        self->map_file->find(L"foothold");
+        self->map_file->find(footholds_path);
     if (footholds != nullptr) {
         auto layer_it = footholds->iterator();
 
@@ -83,13 +103,14 @@ Error Map::load(
                         Error::MAP_LOAD_LAYERLOADFAILED)
                         << "foothold node name is not an int32_t";
 
-                    CHECK(foothold_node->deserialize(
-                        L"x1", &foothold.start.x,
-                        L"y1", &foothold.start.y,
-                        L"x2", &foothold.end.x,
-                        L"y2", &foothold.end.y,
-                        L"prev", &foothold.prev_id,
-                        L"next", &foothold.next_id),
+                    CHECK(foothold_node->deserialize({
+                        {L"x1", &foothold.start.x},
+                        {L"y1", &foothold.start.y},
+                        {L"x2", &foothold.end.x},
+                        {L"y2", &foothold.end.y},
+                        {L"prev", &foothold.prev_id},
+                        {L"next", &foothold.next_id},
+                    }),
                         Error::MAP_LOAD_FOOTHOLDLOADFAILED)
                         << "foothold property missing or invalid";
 
@@ -118,7 +139,7 @@ Error Map::load(
     }
 
     const wz::OpenedFile::Node* ladders =
-        self->map_file->find(L"ladderRope");
+        self->map_file->find(ladders_path);
     if (ladders != nullptr) {
         auto ladder_it = ladders->iterator();
 
@@ -140,11 +161,12 @@ Error Map::load(
 
             int32_t x = 0;
             int32_t uf = 0;
-            CHECK(ladder_node->deserialize(
-                L"uf", &uf,
-                L"x", &x,
-                L"y1", &ladder.start.y,
-                L"y2", &ladder.end.y),
+            CHECK(ladder_node->deserialize({
+                {L"uf", &uf},
+                {L"x", &x},
+                {L"y1", &ladder.start.y},
+                {L"y2", &ladder.end.y},
+            }),
                 Error::MAP_LOAD_LADDERLOADFAILED)
                 << "ladder property missing or invalid";
 
@@ -157,7 +179,7 @@ Error Map::load(
     }
 
     const wz::OpenedFile::Node* portals =
-        self->map_file->find(L"portal");
+        self->map_file->find(portals_path);
     if (portals != nullptr) {
         auto portal_it = portals->iterator();
 
@@ -166,13 +188,14 @@ Error Map::load(
             Map::Portal portal;
 
             int32_t kind = 0;
-            CHECK(portal_node->deserialize(
-                L"pn", &portal.name,
-                L"pt", &kind,
-                L"x", &portal.at.x,
-                L"y", &portal.at.y,
-                L"tm", &portal.target_map.id,
-                L"tn", &portal.target_portal),
+            CHECK(portal_node->deserialize({
+                {L"pn", &portal.name},
+                {L"pt", &kind},
+                {L"x", &portal.at.x},
+                {L"y", &portal.at.y},
+                {L"tm", &portal.target_map.id},
+                {L"tn", &portal.target_portal},
+            }),
                 Error::MAP_LOAD_PORTALLOADFAILED)
                 << "portal property missing or invalid";
             if (kind < 0 || kind > Map::Portal::COLLISIONCHANGEABLE) {
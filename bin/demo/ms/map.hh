@@ -19,6 +19,10 @@ struct Map {
         std::wstring padded() const;
         std::wstring as_filename() const;
 
+        // path is as_filename as an uninterned wz::Path, for lookups in the
+        // Map Vfs.
+        wz::Path path() const;
+
         bool operator==(const ID& rhs) const {
             return id == rhs.id;
         }
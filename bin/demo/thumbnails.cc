@@ -0,0 +1,352 @@
+#include "thumbnails.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.hh"
+#include "client/map.hh"
+#include "client/time.hh"
+#include "client/universe.hh"
+#include "client/game/softrenderer.hh"
+#include "client/renderer/mapstate.hh"
+#include "gfx/texture.hh"
+#include "ms/mapindex.hh"
+
+// Thumbnail is a rendered map, waiting to be encoded.
+struct Thumbnail {
+    ms::Map::ID id;
+    client::game::SoftRenderer renderer;
+};
+
+// ThumbnailQueue hands rendered maps from the workers to the encoders. It
+// holds at most capacity maps, so that workers wait for the encoders rather
+// than pile up images.
+struct ThumbnailQueue {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::unique_ptr<Thumbnail>> thumbnails;
+    size_t capacity;
+    bool closed = false;
+
+    void push(
+        std::unique_ptr<Thumbnail> thumbnail) {
+        std::unique_lock<std::mutex> l(lock);
+        changed.wait(l, [this]() {
+            return thumbnails.size() < capacity;
+        });
+
+        thumbnails.push_back(std::move(thumbnail));
+        changed.notify_all();
+    }
+
+    // pop returns the next thumbnail, or nullptr once the queue is closed and
+    // empty.
+    std::unique_ptr<Thumbnail> pop() {
+        std::unique_lock<std::mutex> l(lock);
+        changed.wait(l, [this]() {
+            return closed || !thumbnails.empty();
+        });
+
+        if (thumbnails.empty())
+            return nullptr;
+
+        std::unique_ptr<Thumbnail> thumbnail = std::move(thumbnails.front());
+        thumbnails.pop_front();
+        changed.notify_all();
+
+        return thumbnail;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> l(lock);
+        closed = true;
+        changed.notify_all();
+    }
+};
+
+// Thumbnails_load loads the map whose file is map_node.
+static Error Thumbnails_load(
+    client::Dataset* dataset,
+    client::Universe* universe,
+    client::Map::Library* library,
+    wz::Vfs::Node* map_node,
+    client::Map* map) {
+    wz::Vfs::File::Handle map_file;
+    CHECK(map_node->file()->open(&map_file),
+        Error::OPENFAILED) << "failed to open map file";
+
+    CHECK(client::Map::load(
+        universe,
+        map,
+        &dataset->map.vfs,
+        std::move(map_file),
+        library,
+        nullptr),
+        Error::OPENFAILED) << "failed to load map";
+
+    return Error();
+}
+
+// Thumbnails_render renders map into the renderer of thumbnail.
+static Error Thumbnails_render(
+    client::Map* map,
+    double scale,
+    Thumbnail* thumbnail) {
+    const gfx::Rect<int32_t> bounds = map->bounding_box;
+    if (bounds.width() <= 0 || bounds.height() <= 0) {
+        return error_new(Error::INVALIDUSAGE)
+            << "map has no bounds";
+    }
+
+    const double longest = std::max(bounds.width(), bounds.height()) * scale;
+    if (longest > Thumbnails::MAX_EXTENT)
+        scale *= Thumbnails::MAX_EXTENT / longest;
+
+    // Maps are already rendered in parallel, one per worker, so each is
+    // rasterized by a single thread.
+    CHECK(client::game::SoftRenderer::init(
+        &thumbnail->renderer,
+        std::max(1u, static_cast<uint32_t>(std::lround(bounds.width() * scale))),
+        std::max(1u, static_cast<uint32_t>(std::lround(bounds.height() * scale))),
+        { .threads = 1 }),
+        Error::UIERROR) << "failed to init renderer";
+
+    client::game::SoftRenderer::Target target =
+        thumbnail->renderer.begin((gfx::Rect<double>) bounds);
+
+    client::renderer::MapState map_state_renderer;
+    client::renderer::MapState::Options draw_options;
+    CHECK(map_state_renderer.draw(
+        &draw_options,
+        &target,
+        map,
+        nullptr,
+        nullptr,
+        0),
+        Error::UIERROR) << "failed to draw map";
+
+    target.flush();
+    return Error();
+}
+
+Error Thumbnails::run(
+    const std::filesystem::path& dataset_path,
+    const client::Dataset::Options& dataset_options,
+    const Options& options,
+    Stats* stats) {
+    const auto start = std::chrono::steady_clock::now();
+
+    // Frames keep their pixels in memory, since there is no GL context to
+    // upload them to.
+    gfx::Texture::Headless() = true;
+
+    client::Dataset dataset;
+    CHECK(client::Dataset::opendirectory(&dataset, dataset_path, dataset_options),
+        Error::OPENFAILED) << "failed to load dataset";
+
+    wz::Vfs::Node* index_node = dataset.string.vfs.find(L"Map.img");
+    if (index_node == nullptr || index_node->file() == nullptr) {
+        return error_new(Error::NOTFOUND)
+            << "failed to find Map.img";
+    }
+
+    wz::Vfs::File::Handle index_file;
+    CHECK(index_node->file()->open(&index_file),
+        Error::OPENFAILED) << "failed to open Map.img";
+
+    ms::MapIndex map_index;
+    CHECK(ms::MapIndex::load(
+        &map_index,
+        std::move(index_file)),
+        Error::UIERROR) << "failed to load map index";
+
+    client::Universe universe;
+    systems::Time::init(
+        &universe.time,
+        client::now().to_milliseconds());
+
+    std::error_code ec;
+    std::filesystem::create_directories(options.output, ec);
+    if (ec) {
+        return error_new(Error::FILEOPENFAILED)
+            << "failed to create " << options.output.c_str() << ": " << ec.message().c_str();
+    }
+
+    std::vector<ms::Map::ID> ids;
+    for (const auto& [id, name] : map_index.id_to_name)
+        ids.push_back(id);
+    std::sort(ids.begin(), ids.end(), [](ms::Map::ID a, ms::Map::ID b) {
+        return a.id < b.id;
+    });
+
+    const double scale = options.scale > 0 ? options.scale : DEFAULT_SCALE;
+
+    uint32_t threads = options.threads;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<uint32_t>(std::min<size_t>(threads, std::max<size_t>(ids.size(), 1)));
+
+    uint32_t encoders = options.encoders;
+    if (encoders == 0)
+        encoders = std::max(1u, threads / 2);
+
+    LOG(Logger::INFO)
+        << "rendering " << ids.size() << " maps at scale " << scale << " with "
+        << threads << " workers and " << encoders << " encoders";
+
+    ThumbnailQueue queue;
+    queue.capacity = threads;
+
+    // load_lock guards loading and unloading maps, and library.
+    std::mutex load_lock;
+    client::Map::Library library;
+    uint64_t loaded = 0;
+
+    std::atomic<size_t> next = 0;
+    std::atomic<uint64_t> skipped = 0;
+    std::atomic<uint64_t> failed = 0;
+    std::atomic<uint64_t> written = 0;
+    std::atomic<uint64_t> pixels = 0;
+
+    auto worker = [&]() {
+        for (;;) {
+            const size_t i = next++;
+            if (i >= ids.size())
+                break;
+
+            const ms::Map::ID id = ids[i];
+            std::unique_ptr<client::Map> map(new client::Map());
+            std::unique_ptr<Thumbnail> thumbnail(new Thumbnail());
+            thumbnail->id = id;
+
+            bool missing = false;
+            Error e = [&]() -> Error {
+                {
+                    std::lock_guard<std::mutex> l(load_lock);
+
+                    // Map names are kept for maps that have been removed.
+                    wz::Vfs::Node* map_node = dataset.map.vfs.find(id.path());
+                    if (map_node == nullptr || map_node->file() == nullptr) {
+                        missing = true;
+                        return Error();
+                    }
+
+                    if (++loaded % TRIM_INTERVAL == 0)
+                        library.trim();
+
+                    CHECK(Thumbnails_load(
+                        &dataset,
+                        &universe,
+                        &library,
+                        map_node,
+                        map.get()),
+                        Error::OPENFAILED) << "failed to load map";
+                }
+
+                CHECK(Thumbnails_render(
+                    map.get(),
+                    scale,
+                    thumbnail.get()),
+                    Error::UIERROR) << "failed to render map";
+
+                return Error();
+            }();
+
+            {
+                // Unloading closes files and removes time components, which
+                // is no more synchronized than loading.
+                std::lock_guard<std::mutex> l(load_lock);
+                map.reset();
+            }
+
+            if (missing) {
+                ++skipped;
+                continue;
+            }
+
+            if (e) {
+                LOG(Logger::WARNING)
+                    << "failed to render map " << id << ": " << e;
+                ++failed;
+                continue;
+            }
+
+            queue.push(std::move(thumbnail));
+        }
+    };
+
+    auto encoder = [&]() {
+        while (std::unique_ptr<Thumbnail> thumbnail = queue.pop()) {
+            const std::filesystem::path path =
+                options.output / (std::to_string(thumbnail->id.id) + ".png");
+
+            std::ofstream out(path, std::ios::binary);
+            Error e = out ?
+                thumbnail->renderer.write(&out) :
+                error_new(Error::FILEOPENFAILED) << "failed to open " << path.c_str();
+            if (e) {
+                LOG(Logger::WARNING)
+                    << "failed to write map " << thumbnail->id << ": " << e;
+                ++failed;
+                continue;
+            }
+
+            pixels += static_cast<uint64_t>(thumbnail->renderer.width) * thumbnail->renderer.height;
+            const uint64_t count = ++written;
+            if (count % PROGRESS_INTERVAL == 0) {
+                const std::chrono::duration<double> elapsed =
+                    std::chrono::steady_clock::now() - start;
+
+                LOG(Logger::INFO)
+                    << count << "/" << ids.size() << " maps written, "
+                    << (count / elapsed.count()) << " maps/sec";
+            }
+        }
+    };
+
+    std::vector<std::thread> encoding;
+    for (uint32_t i = 0; i < encoders; ++i)
+        encoding.emplace_back(encoder);
+
+    std::vector<std::thread> pool;
+    for (uint32_t i = 1; i < threads; ++i)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread& thread : pool)
+        thread.join();
+
+    queue.close();
+    for (std::thread& thread : encoding)
+        thread.join();
+
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    Stats totals = {
+        .maps = written,
+        .skipped = skipped,
+        .failed = failed,
+        .pixels = pixels,
+        .seconds = elapsed.count(),
+    };
+
+    LOG(Logger::INFO)
+        << "wrote " << totals.maps << " maps (" << totals.skipped << " skipped, "
+        << totals.failed << " failed) in " << totals.seconds << "s, "
+        << totals.rate() << " maps/sec";
+
+    if (stats)
+        *stats = totals;
+
+    return Error();
+}
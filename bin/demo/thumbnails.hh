@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+#include "client/dataset.hh"
+#include "util/error.hh"
+
+// Thumbnails renders every map of a dataset into a PNG image, on the CPU and
+// without a window, at a chosen scale: small scales make thumbnails, and a
+// scale of 1 full overviews.
+//
+// Maps are loaded one at a time, since the dataset's files, the texture cache
+// and the universe are not synchronized, but they share the tilesets and
+// objectsets that they have in common through a client::Map::Library, so
+// that each is only decoded once. Loaded maps are rendered by a pool of
+// workers, and their images are encoded by other threads while the workers
+// go on to the next maps.
+struct Thumbnails {
+    struct Options {
+        // output is the directory that images are written into, named after
+        // the IDs of their maps.
+        std::filesystem::path output;
+
+        // scale is the number of pixels per game unit. If 0, DEFAULT_SCALE
+        // is used.
+        double scale;
+
+        // threads is the number of workers rendering maps. If 0, the number
+        // of hardware threads is used.
+        uint32_t threads;
+
+        // encoders is the number of threads encoding images. If 0, half the
+        // number of workers is used.
+        uint32_t encoders;
+    };
+
+    static constexpr double DEFAULT_SCALE = 0.25;
+
+    // MAX_EXTENT is the largest width or height of an image. Maps that would
+    // be larger at the chosen scale are scaled down to fit.
+    static constexpr uint32_t MAX_EXTENT = 8192;
+
+    // TRIM_INTERVAL is the number of maps loaded between trims of the
+    // library, which drop the sets that the maps in flight do not use.
+    static constexpr uint64_t TRIM_INTERVAL = 64;
+
+    // PROGRESS_INTERVAL is the number of images written between progress
+    // reports.
+    static constexpr uint64_t PROGRESS_INTERVAL = 100;
+
+    struct Stats {
+        // maps is the number of images written, skipped the number of map IDs
+        // without a map file, and failed the number of maps that failed to
+        // load, render or be written.
+        uint64_t maps;
+        uint64_t skipped;
+        uint64_t failed;
+
+        // pixels is the number of pixels written.
+        uint64_t pixels;
+
+        double seconds;
+
+        double rate() const {
+            if (seconds <= 0)
+                return 0;
+
+            return maps / seconds;
+        }
+    };
+
+    // run renders the maps of the dataset at dataset_path. Maps that fail are
+    // logged and counted, and do not stop the run.
+    static Error run(
+        const std::filesystem::path& dataset_path,
+        const client::Dataset::Options& dataset_options,
+        const Options& options,
+        Stats* stats);
+};
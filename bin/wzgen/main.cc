@@ -0,0 +1,146 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "util/error.hh"
+#include "wz/synthetic.hh"
+#include "wz/vfs.hh"
+#include "wz/wz.hh"
+
+// Options are parsed from key=value arguments, following the output
+// directory.
+static Error main_options(
+    wz::Synthetic::Options* options,
+    bool* verify,
+    const std::vector<std::string>& args) {
+    for (size_t i = 2; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg == "verify") {
+            *verify = true;
+            continue;
+        }
+
+        const size_t equals = arg.find('=');
+        if (equals == std::string::npos) {
+            return error_new(Error::INVALIDUSAGE)
+                << "unexpected argument " << arg.c_str();
+        }
+
+        const std::string key = arg.substr(0, equals);
+        uint32_t value = 0;
+        try {
+            value = static_cast<uint32_t>(std::stoul(arg.substr(equals + 1)));
+        } catch (const std::exception&) {
+            return error_new(Error::CONVERTFAILED)
+                << "value of " << key.c_str() << " is not a number";
+        }
+
+        if (key == "maps") {
+            options->maps = value;
+        } else if (key == "tiles") {
+            options->tiles = value;
+        } else if (key == "objects") {
+            options->objects = value;
+        } else if (key == "tilesets") {
+            options->tilesets = value;
+        } else if (key == "variants") {
+            options->variants = value;
+        } else if (key == "sounds") {
+            options->sounds = value;
+        } else if (key == "encrypt") {
+            options->encrypt = value != 0;
+        } else if (key == "seed") {
+            options->seed = value;
+        } else {
+            return error_new(Error::INVALIDUSAGE)
+                << "unknown option " << key.c_str();
+        }
+    }
+
+    return Error();
+}
+
+// main_verify_directory opens every file under directory, to check that
+// the generated archives read back.
+static Error main_verify_directory(
+    wz::Vfs::Directory* directory,
+    uint64_t* nodes) {
+    for (auto& it : directory->children) {
+        if (wz::Vfs::File* file = it.second.file()) {
+            wz::Vfs::File::Handle handle;
+            CHECK(file->open(&handle),
+                Error::OPENFAILED) << "failed to open " << it.first;
+
+            *nodes += handle->nodes.size();
+        } else if (wz::Vfs::Directory* child = it.second.directory()) {
+            CHECK(main_verify_directory(child, nodes),
+                Error::OPENFAILED) << "failed to verify " << it.first;
+        }
+    }
+
+    return Error();
+}
+
+// wzgen generates a synthetic dataset, for benchmarks and tests that cannot
+// use the game's data.
+Error main_(const std::vector<std::string>& args) {
+    if (args.size() < 2) {
+        return error_new(Error::INVALIDUSAGE)
+            << "usage: " << args[0].c_str()
+            << " <directory> [maps=N] [tiles=N] [objects=N] [tilesets=N] [variants=N]"
+            << " [sounds=N] [encrypt=0|1] [seed=N] [verify]";
+    }
+
+    wz::Synthetic::Options options = {};
+    bool verify = false;
+    CHECK(main_options(&options, &verify, args),
+        Error::INVALIDUSAGE) << "invalid arguments";
+
+    wz::Synthetic::Stats stats = {};
+    CHECK(wz::Synthetic::generate(options, args[1], &stats),
+        Error::WZ_WRITE_FAILED) << "failed to generate dataset";
+
+    std::cout
+        << "generated " << stats.files << " files, " << stats.canvases << " canvases, "
+        << stats.sounds << " sounds, "
+        << stats.bytes << " bytes\n";
+
+    if (verify) {
+        uint64_t nodes = 0;
+        for (const auto& entry : std::filesystem::directory_iterator(args[1])) {
+            if (entry.path().extension() != ".wz")
+                continue;
+
+            wz::Wz wz;
+            CHECK(wz::Wz::open(&wz, entry.path().string().c_str()),
+                Error::OPENFAILED) << "failed to open " << entry.path();
+
+            wz::Vfs vfs;
+            CHECK(wz::Vfs::open(&vfs, &wz, { .resolve_uols = true }),
+                Error::OPENFAILED) << "failed to build vfs for " << entry.path();
+
+            CHECK(main_verify_directory(vfs.root.directory(), &nodes),
+                Error::OPENFAILED) << "failed to verify " << entry.path();
+        }
+
+        std::cout << "verified " << nodes << " nodes\n";
+    }
+
+    return Error();
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; ++i) {
+        args.push_back(std::string(argv[i]));
+    }
+
+    Error e = main_(args);
+    if (e) {
+        std::cerr << "error\n";
+        e.print(std::wcerr);
+        return 1;
+    }
+
+    return 0;
+}
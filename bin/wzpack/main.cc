@@ -0,0 +1,51 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "util/error.hh"
+#include "wz/packed.hh"
+#include "wz/vfs.hh"
+#include "wz/wz.hh"
+
+// wzpack converts a WZ archive into a packed archive, which the client can
+// open without parsing, decrypting or inflating anything.
+Error main_(const std::vector<std::string>& args) {
+    if (args.size() < 3) {
+        return error_new(Error::INVALIDUSAGE)
+            << "usage: " << args[0].c_str() << " <in.wz> <out.wzp>";
+    }
+
+    wz::Wz wz;
+    CHECK(wz::Wz::open(&wz, args[1].c_str()),
+        Error::OPENFAILED) << "failed to open " << args[1].c_str();
+
+    wz::Vfs vfs;
+    CHECK(wz::Vfs::open(&vfs, &wz),
+        Error::OPENFAILED) << "failed to build vfs for " << args[1].c_str();
+
+    CHECK(wz::Packed::pack(&vfs, args[2].c_str()),
+        Error::OPENFAILED) << "failed to pack " << args[1].c_str();
+
+    // Make sure that the result can be opened.
+    wz::Packed packed;
+    CHECK(wz::Packed::open(&packed, args[2].c_str()),
+        Error::OPENFAILED) << "failed to reopen " << args[2].c_str();
+
+    return Error();
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; ++i) {
+        args.push_back(std::string(argv[i]));
+    }
+
+    Error e = main_(args);
+    if (e) {
+        std::cerr << "error\n";
+        e.print(std::wcerr);
+        return 1;
+    }
+
+    return 0;
+}
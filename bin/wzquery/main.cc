@@ -0,0 +1,107 @@
+#include <clocale>
+#include <codecvt>
+#include <iostream>
+#include <locale>
+#include <string>
+#include <vector>
+
+#include "util/error.hh"
+#include "wz/query.hh"
+#include "wz/vfs.hh"
+#include "wz/wz.hh"
+
+// main_print writes a match as a single line: the file, the property path,
+// and a summary of the value.
+static void main_print(
+    const wz::Query::Match& match) {
+    std::wcout << match.file << L":" << match.path;
+
+    const wz::Property& p = *match.property;
+    if (!match.string.empty() || std::holds_alternative<wz::String>(p.property)) {
+        std::wcout << L" = " << match.string;
+    } else if (match.numeric) {
+        std::wcout << L" = " << match.number;
+    } else if (const wz::Canvas* canvas = std::get_if<wz::Canvas>(&p.property)) {
+        std::wcout << L" = [img] " << canvas->image.width << L" x " << canvas->image.height;
+    } else if (const wz::Vector* v = std::get_if<wz::Vector>(&p.property)) {
+        std::wcout << L" = [vec] " << v->x << L", " << v->y;
+    } else if (const wz::Sound* sound = std::get_if<wz::Sound>(&p.property)) {
+        std::wcout << L" = [snd] " << sound->duration_ms << L" ms";
+    }
+
+    std::wcout << L"\n";
+}
+
+// wzquery prints every property of an archive that matches a query. For
+// example, every map that plays a given song:
+//
+// ```
+// wzquery Map.wz 'Map/Map*/*.img' info/bgm '=Bgm00/FloralLife'
+// ```
+Error main_(const std::vector<std::string>& args) {
+    if (args.size() < 4) {
+        return error_new(Error::INVALIDUSAGE)
+            << "usage: " << args[0].c_str()
+            << " <archive.wz> <file glob> <property glob> [predicate] [threads=N]";
+    }
+
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+
+    std::wstring predicate;
+    wz::Query::Options options = {};
+    for (size_t i = 4; i < args.size(); ++i) {
+        if (args[i].starts_with("threads=")) {
+            try {
+                options.threads = static_cast<uint32_t>(std::stoul(args[i].substr(8)));
+            } catch (const std::exception&) {
+                return error_new(Error::CONVERTFAILED)
+                    << "threads is not a number";
+            }
+        } else {
+            predicate = converter.from_bytes(args[i]);
+        }
+    }
+
+    wz::Query query;
+    CHECK(wz::Query::init(
+        &query,
+        converter.from_bytes(args[2]),
+        converter.from_bytes(args[3]),
+        predicate),
+        Error::INVALIDUSAGE) << "invalid query";
+
+    wz::Wz wz;
+    CHECK(wz::Wz::open(&wz, args[1].c_str()),
+        Error::OPENFAILED) << "failed to open " << args[1].c_str();
+
+    wz::Vfs vfs;
+    CHECK(wz::Vfs::open(&vfs, &wz),
+        Error::OPENFAILED) << "failed to build vfs for " << args[1].c_str();
+
+    wz::Query::Stats stats = {};
+    CHECK(query.run(&vfs, main_print, options, &stats),
+        Error::VISITFAILED) << "failed to run query";
+
+    std::wcerr
+        << stats.matches << L" matches in " << stats.files << L" files ("
+        << stats.properties << L" properties)\n";
+    return Error();
+}
+
+int main(int argc, char* argv[]) {
+    std::setlocale(LC_ALL, "");
+
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; ++i) {
+        args.push_back(std::string(argv[i]));
+    }
+
+    Error e = main_(args);
+    if (e) {
+        std::wcerr << L"error\n";
+        e.print(std::wcerr);
+        return 1;
+    }
+
+    return 0;
+}
@@ -57,6 +57,14 @@ func configure(p *Platform, b *Builder) {
         "bin",
         []string{"lib", "third-party"},
     )
+
+    // Benchmarks are built alongside binaries, so that they keep compiling.
+    // Their names must not collide with those of binaries.
+    p.mustBinaries(
+        b,
+        "bench",
+        []string{"lib", "third-party"},
+    )
 }
 
 func main() {
@@ -177,9 +185,11 @@ func ldflags(additionalLibraries []string) []string {
             "-L/opt/homebrew/opt/llvm/lib",
         }, pkgConfig("--libs", "glew", "glfw3")...), flags...)
     case "linux":
+        // librt provides shm_open on older glibcs.
         return append(append([]string{
             "-lz",
             "-lGL",
+            "-lrt",
         }, pkgConfig("--libs", "glew", "glfw3")...), additionalLibraries...)
     default:
         log.Fatal("unsupported platform")
@@ -768,7 +778,7 @@ func (p *Platform) binaries(b *Builder, location string, deps []string) error {
         if entry.IsDir() {
             var err error
 
-            s := filepath.Join("bin", entry.Name())
+            s := filepath.Join(location, entry.Name())
 
             name = entry.Name()
             dir = &s
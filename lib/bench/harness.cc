@@ -0,0 +1,191 @@
+#include "bench/harness.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace bench {
+
+static uint64_t Harness_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Harness_percentile returns the pth percentile of sorted, by nearest rank.
+static double Harness_percentile(
+    const std::vector<double>& sorted,
+    double p) {
+    size_t rank = static_cast<size_t>(p * sorted.size() + 0.5);
+    if (rank > 0)
+        --rank;
+    if (rank >= sorted.size())
+        rank = sorted.size() - 1;
+
+    return sorted[rank];
+}
+
+// Harness_sample runs op count times, and returns the elapsed time.
+static Error Harness_sample(
+    const Harness::Op& op,
+    uint64_t count,
+    uint64_t* elapsed_ns) {
+    const uint64_t start = Harness_now_ns();
+    for (uint64_t i = 0; i < count; ++i) {
+        if (Error e = op())
+            return e;
+    }
+    *elapsed_ns = Harness_now_ns() - start;
+
+    return Error();
+}
+
+void Harness::init(
+    Harness* self,
+    const Options& options) {
+    self->options = options;
+    if (self->options.warmup == 0)
+        self->options.warmup = DEFAULT_WARMUP;
+    if (self->options.samples == 0)
+        self->options.samples = DEFAULT_SAMPLES;
+    if (self->options.min_sample_ns == 0)
+        self->options.min_sample_ns = DEFAULT_MIN_SAMPLE_NS;
+}
+
+Error Harness::run(
+    const std::string& name,
+    uint64_t bytes,
+    const Op& op) {
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos)
+        return Error();
+
+    // Calibrate the batch size from a single run, which also serves as the
+    // first warmup.
+    uint64_t elapsed_ns = 0;
+    CHECK(Harness_sample(op, 1, &elapsed_ns),
+        Error::INVALIDUSAGE) << "benchmark " << name.c_str() << " failed";
+
+    uint64_t batch = 1;
+    if (elapsed_ns < options.min_sample_ns)
+        batch = options.min_sample_ns / (elapsed_ns ? elapsed_ns : 1);
+
+    for (uint32_t i = 1; i < options.warmup; ++i) {
+        CHECK(Harness_sample(op, batch, &elapsed_ns),
+            Error::INVALIDUSAGE) << "benchmark " << name.c_str() << " failed";
+    }
+
+    Allocations& allocations = Allocations::Global();
+    const uint64_t allocs_before = allocations.count.load(std::memory_order_relaxed);
+    const uint64_t alloc_bytes_before = allocations.bytes.load(std::memory_order_relaxed);
+
+    std::vector<double> times;
+    times.reserve(options.samples);
+    double total_ns = 0;
+    for (uint32_t i = 0; i < options.samples; ++i) {
+        CHECK(Harness_sample(op, batch, &elapsed_ns),
+            Error::INVALIDUSAGE) << "benchmark " << name.c_str() << " failed";
+
+        times.push_back(static_cast<double>(elapsed_ns) / batch);
+        total_ns += elapsed_ns;
+    }
+
+    const double ops = static_cast<double>(options.samples) * batch;
+    const uint64_t allocs = allocations.count.load(std::memory_order_relaxed) - allocs_before;
+    const uint64_t alloc_bytes = allocations.bytes.load(std::memory_order_relaxed) - alloc_bytes_before;
+
+    std::sort(times.begin(), times.end());
+
+    Result result = {
+        .name = name,
+        .samples = options.samples,
+        .batch = batch,
+        .ns_min = times.front(),
+        .ns_p50 = Harness_percentile(times, 0.50),
+        .ns_p90 = Harness_percentile(times, 0.90),
+        .ns_p99 = Harness_percentile(times, 0.99),
+        .ns_max = times.back(),
+        .ns_mean = total_ns / ops,
+        .bytes = bytes,
+        .mb_per_s = 0,
+        .allocs = allocs / ops,
+        .alloc_bytes = alloc_bytes / ops,
+    };
+    if (bytes > 0 && result.ns_p50 > 0)
+        result.mb_per_s = (bytes / (1024.0 * 1024.0)) / (result.ns_p50 / 1e9);
+
+    results.push_back(std::move(result));
+    return Error();
+}
+
+void Harness::print(
+    std::ostream& out) const {
+    char line[256];
+    std::snprintf(
+        line, sizeof(line),
+        "%-40s %12s %12s %12s %10s %10s %12s\n",
+        "benchmark", "p50 ns/op", "p90 ns/op", "p99 ns/op", "MB/s", "allocs/op", "B alloc/op");
+    out << line;
+
+    for (const Result& result : results) {
+        std::snprintf(
+            line, sizeof(line),
+            "%-40s %12.1f %12.1f %12.1f %10.1f %10.2f %12.1f\n",
+            result.name.c_str(),
+            result.ns_p50,
+            result.ns_p90,
+            result.ns_p99,
+            result.mb_per_s,
+            result.allocs,
+            result.alloc_bytes);
+        out << line;
+    }
+}
+
+// Harness_json_string writes s as a JSON string. Benchmark names are plain
+// ASCII, so only quotes, backslashes and control characters are escaped.
+static void Harness_json_string(
+    std::ostream& out,
+    const std::string& s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void Harness::json(
+    std::ostream& out) const {
+    out << "{\n  \"benchmarks\": [";
+    for (size_t i = 0, l = results.size(); i < l; ++i) {
+        const Result& result = results[i];
+
+        out << (i ? ",\n" : "\n") << "    {\"name\": ";
+        Harness_json_string(out, result.name);
+        out
+            << ", \"samples\": " << result.samples
+            << ", \"batch\": " << result.batch
+            << ", \"ns_per_op\": {"
+            << "\"min\": " << result.ns_min
+            << ", \"p50\": " << result.ns_p50
+            << ", \"p90\": " << result.ns_p90
+            << ", \"p99\": " << result.ns_p99
+            << ", \"max\": " << result.ns_max
+            << ", \"mean\": " << result.ns_mean
+            << "}"
+            << ", \"bytes_per_op\": " << result.bytes
+            << ", \"mb_per_s\": " << result.mb_per_s
+            << ", \"allocs_per_op\": " << result.allocs
+            << ", \"alloc_bytes_per_op\": " << result.alloc_bytes
+            << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "util/error.hh"
+
+namespace bench {
+
+// Allocations counts heap allocations. Counting is only done in binaries
+// that replace the global operator new to call record; elsewhere, the
+// counters stay at 0.
+struct Allocations {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> bytes;
+
+    void record(size_t size) {
+        count.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    static Allocations& Global() {
+        // Atomics are constant-initialized, so this is safe to use from
+        // operator new during static initialization.
+        static Allocations allocations;
+        return allocations;
+    }
+};
+
+// Result is the measurements of a single benchmark. Times are per operation.
+struct Result {
+    std::string name;
+
+    // samples is the number of timed samples, each of batch operations.
+    uint64_t samples;
+    uint64_t batch;
+
+    double ns_min;
+    double ns_p50;
+    double ns_p90;
+    double ns_p99;
+    double ns_max;
+    double ns_mean;
+
+    // bytes is the number of bytes processed by each operation, if
+    // meaningful, and mb_per_s the resulting throughput at the median time.
+    uint64_t bytes;
+    double mb_per_s;
+
+    double allocs;
+    double alloc_bytes;
+};
+
+// Harness runs benchmarks, and collects their results. Each benchmark is
+// warmed up, then timed in samples: each sample runs the operation enough
+// times to take at least min_sample_ns, so that fast operations are not
+// dominated by the cost of reading the clock.
+struct Harness {
+    struct Options {
+        // warmup is the number of untimed samples. If 0, DEFAULT_WARMUP is
+        // used.
+        uint32_t warmup;
+
+        // samples is the number of timed samples. If 0, DEFAULT_SAMPLES is
+        // used.
+        uint32_t samples;
+
+        // min_sample_ns is the minimum duration of a sample. If 0,
+        // DEFAULT_MIN_SAMPLE_NS is used.
+        uint64_t min_sample_ns;
+
+        // filter, if not empty, skips benchmarks whose names do not contain
+        // it.
+        std::string filter;
+    };
+
+    // Op is a single operation of a benchmark. Returning an Error aborts the
+    // benchmark.
+    typedef std::function<Error()> Op;
+
+    static constexpr uint32_t DEFAULT_WARMUP = 3;
+    static constexpr uint32_t DEFAULT_SAMPLES = 30;
+    static constexpr uint64_t DEFAULT_MIN_SAMPLE_NS = 1000000;
+
+    Options options;
+    std::vector<Result> results;
+
+    static void init(
+        Harness* self,
+        const Options& options = {});
+
+    // run benchmarks op, which processes bytes bytes each time it runs.
+    Error run(
+        const std::string& name,
+        uint64_t bytes,
+        const Op& op);
+
+    // print writes a table of results.
+    void print(
+        std::ostream& out) const;
+
+    // json writes results as a JSON document, for tracking regressions.
+    void json(
+        std::ostream& out) const;
+
+    Harness() = default;
+    Harness(Harness&&) = default;
+    Harness(const Harness&) = delete;
+};
+
+}
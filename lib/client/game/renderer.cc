@@ -1,42 +1,63 @@
 #include "client/game/renderer.hh"
 
+#include <algorithm>
+#include <cmath>
+
 #include "logger.hh"
 
 namespace client {
 namespace game {
 
-Error Renderer::Target::frame(
-    const gfx::Sprite::Frame* frame,
-    const gfx::Vector<int32_t> at) {
-    ++metrics.quads;
-    metrics.seen_textures.insert(frame->texture);
+// Target_viewport returns the game viewport of self, widened to whole game
+// coordinates.
+static gfx::Rect<int32_t> Target_viewport(
+    const Renderer::Target* self) {
+    return gfx::Rect<int32_t>{
+        .topleft = {
+            .x = static_cast<int32_t>(std::floor(self->game_viewport.topleft.x)),
+            .y = static_cast<int32_t>(std::floor(self->game_viewport.topleft.y)),
+        },
+        .bottomright = {
+            .x = static_cast<int32_t>(std::ceil(self->game_viewport.bottomright.x)),
+            .y = static_cast<int32_t>(std::ceil(self->game_viewport.bottomright.y)),
+        },
+    };
+}
 
-    // TODO: Instead of drawing each frame separately with its own call,
-    // submit to a draw chain.
-    that->program.projection(projection);
+// Target_quad batches a quad covering bounds, textured with the uv rectangle
+// of texture, unless it is out of view or texture is not ready.
+static void Target_quad(
+    Renderer::Target* self,
+    const gfx::Texture* texture,
+    const gfx::Rect<int32_t> bounds,
+    const gfx::Rect<float> uv) {
+    if (!bounds.intersects(Target_viewport(self))) {
+        ++self->metrics.culled;
+        return;
+    }
 
-    const uint8_t ebo[6] = { 0, 1, 3, 1, 2, 3 };
-    that->drawable.ebo_load(
-        ebo,
-        sizeof(ebo) / sizeof(*ebo));
+    if (!texture->ready) {
+        ++self->metrics.pending;
+        return;
+    }
 
-    gfx::Vertex quad[4] = { {0} };
+    ++self->metrics.quads;
+    self->metrics.seen_textures.insert(texture->name);
 
-    gfx::Vector<int32_t> topleft =
-        at - frame->origin;
-    gfx::Vector<int32_t> bottomright = {
-        .x = topleft.x + static_cast<int32_t>(frame->image.width),
-        .y = topleft.y + static_cast<int32_t>(frame->image.height),
-    };
+    // Quads are drawn in order, so a batch can only grow while its texture
+    // stays the same.
+    if (self->batch.texture != texture->name ||
+        self->batch.vertices.size() == Renderer::BATCH_QUADS * 4) {
+        self->flush();
+        self->batch.texture = texture->name;
+    }
 
-    gfx::Vector<float> topleft_uv = {
-        .x = 0,
-        .y = 0,
-    };
-    gfx::Vector<float> bottomright_uv = {
-        .x = 1,
-        .y = 1,
-    };
+    gfx::Vertex quad[4] = { {0} };
+
+    const gfx::Vector<int32_t> topleft = bounds.topleft;
+    const gfx::Vector<int32_t> bottomright = bounds.bottomright;
+    const gfx::Vector<float> topleft_uv = uv.topleft;
+    const gfx::Vector<float> bottomright_uv = uv.bottomright;
 
     quad[0].position[0] =
         static_cast<float>(topleft.x);
@@ -66,28 +87,686 @@ Error Renderer::Target::frame(
     quad[3].uv[0] = topleft_uv.x;
     quad[3].uv[1] = bottomright_uv.y;
 
-    that->drawable.vbo_load(
+    self->batch.vertices.insert(
+        self->batch.vertices.end(),
         quad,
-        sizeof(quad) / sizeof(*quad));
+        quad + 4);
+}
+
+Error Renderer::Target::frame(
+    const gfx::Sprite::Frame* frame,
+    const gfx::Vector<int32_t> at) {
+    gfx::Vector<int32_t> topleft =
+        at - frame->origin;
+    gfx::Vector<int32_t> bottomright = {
+        .x = topleft.x + static_cast<int32_t>(frame->image.width),
+        .y = topleft.y + static_cast<int32_t>(frame->image.height),
+    };
+
+    Target_quad(
+        this,
+        frame->texture.get(),
+        gfx::Rect<int32_t>{
+            .topleft = topleft,
+            .bottomright = bottomright,
+        },
+        frame->uv);
+
+    return Error();
+}
+
+Error Renderer::Target::tiled(
+    const gfx::Sprite::Frame* frame,
+    const gfx::Vector<int32_t> at,
+    bool horizontal,
+    bool vertical) {
+    if (!frame->texture->repeating) {
+        return error_new(Error::INVALIDUSAGE)
+            << "frame texture is not repeating";
+    }
+
+    const gfx::Rect<int32_t> viewport = Target_viewport(this);
+    const gfx::Vector<int32_t> topleft =
+        at - frame->origin;
+    const gfx::Vector<int32_t> size = {
+        .x = static_cast<int32_t>(frame->image.width),
+        .y = static_cast<int32_t>(frame->image.height),
+    };
+    if (size.x == 0 || size.y == 0)
+        return Error();
+
+    gfx::Rect<int32_t> bounds = {
+        .topleft = topleft,
+        .bottomright = topleft + size,
+    };
+
+    // Along a tiled axis, the quad covers the viewport, and its texture
+    // coordinates count the tiles from the frame's own position, so that
+    // the texture wraps around at every tile's edge.
+    if (horizontal) {
+        bounds.topleft.x = viewport.topleft.x;
+        bounds.bottomright.x = viewport.bottomright.x;
+    }
+    if (vertical) {
+        bounds.topleft.y = viewport.topleft.y;
+        bounds.bottomright.y = viewport.bottomright.y;
+    }
+
+    // Whole tiles are dropped from the offsets, which keeps the texture
+    // coordinates small, and so precise, however far the frame is.
+    auto wrap = [](int32_t offset, int32_t size) {
+        return ((offset % size) + size) % size;
+    };
+    const gfx::Vector<int32_t> offset = {
+        .x = wrap(bounds.topleft.x - topleft.x, size.x),
+        .y = wrap(bounds.topleft.y - topleft.y, size.y),
+    };
+
+    const gfx::Rect<float> uv = {
+        .topleft = {
+            .x = static_cast<float>(offset.x) / size.x,
+            .y = static_cast<float>(offset.y) / size.y,
+        },
+        .bottomright = {
+            .x = static_cast<float>(offset.x + bounds.width()) / size.x,
+            .y = static_cast<float>(offset.y + bounds.height()) / size.y,
+        },
+    };
+
+    Target_quad(
+        this,
+        frame->texture.get(),
+        bounds,
+        uv);
+
+    return Error();
+}
+
+// Target_drawbatch draws the batch of self, which is not empty.
+static void Target_drawbatch(
+    Renderer::Target* self) {
+    Renderer* that = self->that;
+    const size_t quads = self->batch.vertices.size() / 4;
+    const size_t quad_size = 4 * sizeof(gfx::Vertex);
+
+    gl::State& state = gl::State::Global();
+    state.use(that->program.program);
+    state.bind_vertex_array(that->drawable.vao);
+    state.bind_buffer(GL_ARRAY_BUFFER, that->drawable.vbo);
+
+    // When the ring wraps around, orphan the buffer rather than overwrite
+    // quads that the GPU may still be drawing.
+    if (that->batch_cursor + quads > Renderer::BATCH_QUADS) {
+        glBufferData(
+            GL_ARRAY_BUFFER,
+            Renderer::BATCH_QUADS * quad_size,
+            nullptr,
+            GL_STREAM_DRAW);
+        that->batch_cursor = 0;
+    }
+
+    // The region being written is never in use, so the write does not need
+    // to synchronize with the GPU.
+    void* to = glMapBufferRange(
+        GL_ARRAY_BUFFER,
+        that->batch_cursor * quad_size,
+        quads * quad_size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (to) {
+        memcpy(to, self->batch.vertices.data(), quads * quad_size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+
+        state.bind_texture(self->batch.texture);
+        glDrawElementsBaseVertex(
+            that->drawable.vbo_mode,
+            quads * 6,
+            that->drawable.ebo_type,
+            nullptr,
+            that->batch_cursor * 4);
+
+        that->batch_cursor += quads;
+        ++self->metrics.draw_calls;
+    }
+
+    self->batch.vertices.clear();
+}
+
+void Renderer::Target::flush() {
+    if (!batch.vertices.empty())
+        Target_drawbatch(this);
+
+    const gl::State::Stats& stats = gl::State::Global().stats;
+    metrics.gl_calls = stats.calls - state_start.calls;
+    metrics.gl_calls_skipped = stats.skipped - state_start.skipped;
+}
+
+Error Renderer::Target::geometry(
+    Renderer::Geometry* geometry,
+    uint64_t time) {
+    if (!geometry->uploaded) {
+        CHECK(geometry->upload(that),
+            Error::GLERROR) << "failed to upload geometry";
+    }
+
+    if (geometry->items.empty())
+        return Error();
+
+    geometry->find(Target_viewport(this));
+    metrics.culled += geometry->items.size() - geometry->visible.size();
+
+    return geometry_items(
+        geometry,
+        time,
+        geometry->visible.data(),
+        geometry->visible.size());
+}
+
+Error Renderer::Target::geometry_items(
+    Renderer::Geometry* geometry,
+    uint64_t time,
+    const uint32_t* items,
+    size_t count) {
+    if (!geometry->uploaded) {
+        CHECK(geometry->upload(that),
+            Error::GLERROR) << "failed to upload geometry";
+    }
+
+    if (count == 0)
+        return Error();
+
+    // Batched quads were submitted before these items, so they are drawn
+    // first.
+    flush();
+
+    gl::State& state = gl::State::Global();
+    state.use(that->program.program);
+    state.bind_vertex_array(geometry->drawable.vao);
+
+    // The program selects the frames of animated quads.
+    if (geometry->timing.texture) {
+        that->program.time(time);
+        state.bind_texture(
+            geometry->timing.texture,
+            gfx::Program::FRAMES_UNIT,
+            GL_TEXTURE_BUFFER);
+    }
+
+    // run is the run of quads, following each other in the buffer with the
+    // same texture, that has not been drawn yet.
+    const gfx::Texture* texture = nullptr;
+    uint32_t first = 0;
+    uint32_t run = 0;
+
+    auto draw = [&]() {
+        if (!texture->ready) {
+            metrics.pending += run;
+            return;
+        }
+
+        state.bind_texture(texture->name);
+
+        glDrawElementsBaseVertex(
+            geometry->drawable.vbo_mode,
+            run * 6,
+            geometry->drawable.ebo_type,
+            nullptr,
+            first * 4);
+
+        metrics.quads += run;
+        metrics.seen_textures.insert(texture->name);
+        ++metrics.draw_calls;
+    };
+
+    for (size_t i = 0; i < count; ++i) {
+        const Renderer::Geometry::Item& item = geometry->items[items[i]];
+
+        for (uint32_t quad = item.quad; quad < item.quad + item.quads; ++quad) {
+            const gfx::Texture* quad_texture = geometry->textures[quad];
+            if (run > 0 &&
+                (quad_texture != texture ||
+                    quad != first + run ||
+                    run == Renderer::Geometry::RUN_QUADS)) {
+                draw();
+                run = 0;
+            }
+
+            if (run == 0) {
+                texture = quad_texture;
+                first = quad;
+            }
+
+            ++run;
+        }
+    }
+
+    if (run > 0)
+        draw();
+
+    return Error();
+}
+
+// Geometry_bounds returns the bounds of the quad whose vertices start at
+// quad.
+static gfx::Rect<int32_t> Geometry_bounds(
+    const gfx::Vertex* quad) {
+    return gfx::Rect<int32_t>{
+        .topleft = {
+            .x = static_cast<int32_t>(std::floor(quad[0].position[0])),
+            .y = static_cast<int32_t>(std::floor(quad[0].position[1])),
+        },
+        .bottomright = {
+            .x = static_cast<int32_t>(std::ceil(quad[2].position[0])),
+            .y = static_cast<int32_t>(std::ceil(quad[2].position[1])),
+        },
+    };
+}
+
+// Geometry_union returns the smallest rectangle containing a and b.
+static gfx::Rect<int32_t> Geometry_union(
+    const gfx::Rect<int32_t> a,
+    const gfx::Rect<int32_t> b) {
+    return gfx::Rect<int32_t>{
+        .topleft = {
+            .x = std::min(a.topleft.x, b.topleft.x),
+            .y = std::min(a.topleft.y, b.topleft.y),
+        },
+        .bottomright = {
+            .x = std::max(a.bottomright.x, b.bottomright.x),
+            .y = std::max(a.bottomright.y, b.bottomright.y),
+        },
+    };
+}
+
+void Renderer::Geometry::add(
+    const gfx::Sprite::Frame* frame,
+    const gfx::Vector<int32_t> at,
+    uint64_t key) {
+    const uint32_t quad = static_cast<uint32_t>(textures.size());
+
+    vertices.resize(vertices.size() + 4);
+    frame->quad(at, &vertices[quad * 4]);
+    textures.push_back(frame->texture.get());
+
+    items.push_back(Item{
+        .bounds = Geometry_bounds(&vertices[quad * 4]),
+        .key = key,
+        .quad = quad,
+        .quads = 1,
+        .animation = NONE,
+    });
+}
+
+uint32_t Renderer::Geometry::add_animated(
+    const gfx::Sprite* sprite,
+    const gfx::Vector<int32_t> at,
+    uint64_t key) {
+    const uint32_t quad = static_cast<uint32_t>(textures.size());
+    Animation animation;
+
+    // The item is visible if any of its frames would be.
+    gfx::Rect<int32_t> bounds = { 0 };
+    for (const gfx::Sprite::Frame& frame : sprite->frames) {
+        vertices.resize(vertices.size() + 4);
+        frame.quad(at, &vertices[vertices.size() - 4]);
+        textures.push_back(frame.texture.get());
+        animation.delays.push_back(static_cast<uint64_t>(std::max(frame.delay, 0)));
+
+        const gfx::Rect<int32_t> b = Geometry_bounds(&vertices[vertices.size() - 4]);
+        bounds = animation.delays.size() == 1 ? b : Geometry_union(bounds, b);
+    }
+
+    const uint32_t index = static_cast<uint32_t>(animations.size());
+    animations.push_back(std::move(animation));
+    items.push_back(Item{
+        .bounds = bounds,
+        .key = key,
+        .quad = quad,
+        .quads = static_cast<uint32_t>(sprite->frames.size()),
+        .animation = index,
+    });
+
+    return index;
+}
+
+// Animation_period returns the period of self, in milliseconds. Animations
+// whose delays are all 0 have a period of 1, during which their first frame
+// is shown.
+static uint64_t Animation_period(
+    const Renderer::Geometry::Animation* self) {
+    uint64_t period = 0;
+    for (const uint64_t delay : self->delays)
+        period += delay;
+
+    return std::max<uint64_t>(period, 1);
+}
 
-    glUseProgram(that->program.program);
-    glBindVertexArray(that->drawable.vao);
-    glBindBuffer(GL_ARRAY_BUFFER, that->drawable.vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, that->drawable.ebo);
+uint32_t Renderer::Geometry::Animation::frame(
+    uint64_t time) const {
+    const uint64_t period = Animation_period(this);
+
+    // The program only has the low 32 bits of the time.
+    const uint64_t t = static_cast<uint32_t>(time) % period;
+
+    uint64_t end = 0;
+    for (size_t i = 0; i < delays.size(); ++i) {
+        end += delays[i];
+        if (t < end)
+            return static_cast<uint32_t>(i);
+    }
 
-    glBindTexture(GL_TEXTURE_2D, frame->texture);
+    return 0;
+}
+
+// Geometry_order sorts the items of self by key, and by texture within a
+// key, and lays their quads out in that order, so that quads drawn one after
+// the other are next to each other in the buffer. Animated items are sorted
+// by the texture of their first frame.
+static void Geometry_order(
+    Renderer::Geometry* self) {
+    std::stable_sort(
+        self->items.begin(),
+        self->items.end(),
+        [self](const Renderer::Geometry::Item& a, const Renderer::Geometry::Item& b) {
+            if (a.key != b.key)
+                return a.key < b.key;
+
+            return self->textures[a.quad]->id < self->textures[b.quad]->id;
+        });
+
+    std::vector<gfx::Vertex> vertices;
+    std::vector<const gfx::Texture*> textures;
+    vertices.reserve(self->vertices.size());
+    textures.reserve(self->textures.size());
+    for (Renderer::Geometry::Item& item : self->items) {
+        const auto from = self->vertices.begin() + item.quad * 4;
+        vertices.insert(vertices.end(), from, from + item.quads * 4);
+
+        const auto from_textures = self->textures.begin() + item.quad;
+        item.quad = static_cast<uint32_t>(textures.size());
+        textures.insert(textures.end(), from_textures, from_textures + item.quads);
+    }
+
+    self->vertices = std::move(vertices);
+    self->textures = std::move(textures);
+}
+
+// Geometry_cells returns the range of cells of grid that bounds overlaps,
+// clamped to the grid. The range is empty if bounds is outside the grid.
+static gfx::Rect<int32_t> Geometry_cells(
+    const Renderer::Geometry::Grid& grid,
+    const gfx::Rect<int32_t> bounds) {
+    const int32_t cell = Renderer::Geometry::CELL_SIZE;
+    const gfx::Vector<int32_t> topleft = bounds.topleft - grid.origin;
+    const gfx::Vector<int32_t> bottomright = bounds.bottomright - grid.origin;
+
+    // Cells are half open: a rectangle ending on a cell's edge does not
+    // reach into it.
+    auto below = [cell](int32_t v) {
+        return v >= 0 ? v / cell : -((cell - 1 - v) / cell);
+    };
+
+    return gfx::Rect<int32_t>{
+        .topleft = {
+            .x = std::max(below(topleft.x), 0),
+            .y = std::max(below(topleft.y), 0),
+        },
+        .bottomright = {
+            .x = std::min(below(bottomright.x - 1) + 1, grid.columns),
+            .y = std::min(below(bottomright.y - 1) + 1, grid.rows),
+        },
+    };
+}
+
+// Geometry_build buckets the items of self into its grid, which covers all
+// of them.
+static void Geometry_build(
+    Renderer::Geometry* self) {
+    Renderer::Geometry::Grid& grid = self->grid;
+    const int32_t cell = Renderer::Geometry::CELL_SIZE;
+
+    gfx::Rect<int32_t> extent = self->items[0].bounds;
+    for (const Renderer::Geometry::Item& item : self->items)
+        extent = Geometry_union(extent, item.bounds);
+
+    grid.origin = extent.topleft;
+    grid.columns = std::max((extent.width() + cell - 1) / cell, 1);
+    grid.rows = std::max((extent.height() + cell - 1) / cell, 1);
+
+    // Count the items of each cell, then lay the cells out one after the
+    // other, and fill them in.
+    const size_t cells = static_cast<size_t>(grid.columns) * grid.rows;
+    grid.starts.assign(cells + 1, 0);
+    for (const Renderer::Geometry::Item& item : self->items) {
+        const gfx::Rect<int32_t> r = Geometry_cells(grid, item.bounds);
+        for (int32_t y = r.topleft.y; y < r.bottomright.y; ++y)
+            for (int32_t x = r.topleft.x; x < r.bottomright.x; ++x)
+                ++grid.starts[y * grid.columns + x + 1];
+    }
+
+    for (size_t i = 0; i < cells; ++i)
+        grid.starts[i + 1] += grid.starts[i];
+
+    std::vector<uint32_t> cursors(grid.starts.begin(), grid.starts.end() - 1);
+    grid.items.resize(grid.starts.back());
+    for (uint32_t i = 0; i < self->items.size(); ++i) {
+        const gfx::Rect<int32_t> r = Geometry_cells(grid, self->items[i].bounds);
+        for (int32_t y = r.topleft.y; y < r.bottomright.y; ++y)
+            for (int32_t x = r.topleft.x; x < r.bottomright.x; ++x)
+                grid.items[cursors[y * grid.columns + x]++] = i;
+    }
+
+    self->marks.assign(self->items.size(), 0);
+    self->query = 0;
+}
+
+Renderer::Geometry::Timing::~Timing() {
+    gl::State& state = gl::State::Global();
+    if (texture) {
+        state.forget_texture(texture);
+        glDeleteTextures(1, &texture);
+    }
+
+    if (buffer) {
+        state.forget_buffer(buffer);
+        glDeleteBuffers(1, &buffer);
+    }
+
+    if (vbo) {
+        state.forget_buffer(vbo);
+        glDeleteBuffers(1, &vbo);
+    }
+}
 
-    glDrawElements(
-        that->drawable.vbo_mode,
-        6,
-        that->drawable.ebo_type,
+// Geometry_uploadtiming uploads the timing of the animated quads of self,
+// which is indexed, and adds it to its vertex array.
+static Error Geometry_uploadtiming(
+    Renderer::Geometry* self,
+    Renderer* renderer) {
+    GLuint attribute = 0;
+    CHECK(renderer->program.program.attribute(
+        "frame",
+        &attribute),
+        Error::GLERROR) << "failed to configure geometry timing";
+
+    // Each frame's timing is the start and end of the frame within its
+    // animation, and the animation's period, in milliseconds, which the
+    // program compares the time to.
+    std::vector<GLfloat> frames(self->vertices.size(), 0);
+    std::vector<GLuint> timings;
+    for (const Renderer::Geometry::Item& item : self->items) {
+        if (item.animation == Renderer::Geometry::NONE)
+            continue;
+
+        const Renderer::Geometry::Animation& animation =
+            self->animations[item.animation];
+        const uint64_t period = Animation_period(&animation);
+
+        // Animations whose delays are all 0 show their first frame.
+        const bool still = std::all_of(
+            animation.delays.begin(),
+            animation.delays.end(),
+            [](uint64_t delay) {
+                return delay == 0;
+            });
+
+        uint64_t start = 0;
+        for (uint32_t i = 0; i < item.quads; ++i) {
+            const uint64_t end = std::min(start + animation.delays[i], period);
+            const GLfloat frame = static_cast<GLfloat>(timings.size() / 4 + 1);
+            std::fill_n(&frames[(item.quad + i) * 4], 4, frame);
+
+            timings.push_back(static_cast<GLuint>(start));
+            timings.push_back(static_cast<GLuint>(still && i == 0 ? period : end));
+            timings.push_back(static_cast<GLuint>(period));
+            timings.push_back(0);
+
+            start = end;
+        }
+    }
+
+    gl::State& state = gl::State::Global();
+    Renderer::Geometry::Timing& timing = self->timing;
+
+    glGenBuffers(1, &timing.vbo);
+    state.bind_buffer(GL_ARRAY_BUFFER, timing.vbo);
+    glBufferData(
+        GL_ARRAY_BUFFER,
+        frames.size() * sizeof(GLfloat),
+        frames.data(),
+        GL_STATIC_DRAW);
+
+    state.bind_vertex_array(self->drawable.vao);
+    glEnableVertexAttribArray(attribute);
+    glVertexAttribPointer(
+        attribute,
+        1,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(GLfloat),
         nullptr);
 
-    ++metrics.draw_calls;
+    glGenBuffers(1, &timing.buffer);
+    state.bind_buffer(GL_TEXTURE_BUFFER, timing.buffer);
+    glBufferData(
+        GL_TEXTURE_BUFFER,
+        timings.size() * sizeof(GLuint),
+        timings.data(),
+        GL_STATIC_DRAW);
+
+    glGenTextures(1, &timing.texture);
+    state.bind_texture(
+        timing.texture,
+        gfx::Program::FRAMES_UNIT,
+        GL_TEXTURE_BUFFER);
+    glTexBuffer(
+        GL_TEXTURE_BUFFER,
+        GL_RGBA32UI,
+        timing.buffer);
+
+    return Error();
+}
+
+Error Renderer::Geometry::upload(
+    Renderer* renderer) {
+    uploaded = true;
+    if (items.empty())
+        return Error();
+
+    index();
+
+    gfx::Drawable::InitOptions init_options;
+    CHECK(gfx::Drawable::init(
+        &drawable,
+        &renderer->program.program,
+        &init_options),
+        Error::GLERROR) << "failed to init geometry drawable";
+
+    gl::State::Global().bind_buffer(GL_ARRAY_BUFFER, drawable.vbo);
+    glBufferData(
+        GL_ARRAY_BUFFER,
+        vertices.size() * sizeof(gfx::Vertex),
+        vertices.data(),
+        GL_STATIC_DRAW);
+
+    if (!animations.empty()) {
+        CHECK(Geometry_uploadtiming(
+            this,
+            renderer),
+            Error::GLERROR) << "failed to upload geometry timing";
+    }
+
+    // Every draw indexes the same quads, from its own base vertex, and draws
+    // at most a run of quads sharing a texture.
+    uint32_t longest = 1;
+    uint32_t run = 0;
+    for (size_t i = 0; i < textures.size(); ++i) {
+        const bool continues = i > 0 && textures[i - 1] == textures[i];
+
+        run = continues ? run + 1 : 1;
+        longest = std::max(longest, std::min(run, RUN_QUADS));
+    }
+
+    std::vector<uint16_t> ebo(longest * 6);
+    for (uint32_t i = 0; i < longest; ++i) {
+        const uint16_t v = static_cast<uint16_t>(i * 4);
+        const uint16_t indices[6] = { 0, 1, 3, 1, 2, 3 };
+        for (size_t j = 0; j < 6; ++j)
+            ebo[i * 6 + j] = v + indices[j];
+    }
+
+    drawable.ebo_load(
+        ebo.data(),
+        ebo.size());
+
+    // The quads now only live on the GPU.
+    vertices = std::vector<gfx::Vertex>();
 
     return Error();
 }
 
+void Renderer::Geometry::index() {
+    if (indexed || items.empty())
+        return;
+
+    indexed = true;
+    Geometry_order(this);
+    Geometry_build(this);
+}
+
+void Renderer::Geometry::find(
+    const gfx::Rect<int32_t> viewport) {
+    visible.clear();
+    if (items.empty())
+        return;
+
+    // An item overlapping several cells is only found once per query: marks
+    // remembers the last query that found each item.
+    ++query;
+    if (query == 0) {
+        std::fill(marks.begin(), marks.end(), 0);
+        query = 1;
+    }
+
+    const gfx::Rect<int32_t> r = Geometry_cells(grid, viewport);
+    for (int32_t y = r.topleft.y; y < r.bottomright.y; ++y) {
+        for (int32_t x = r.topleft.x; x < r.bottomright.x; ++x) {
+            const size_t cell = static_cast<size_t>(y) * grid.columns + x;
+            for (uint32_t j = grid.starts[cell]; j < grid.starts[cell + 1]; ++j) {
+                const uint32_t i = grid.items[j];
+                if (marks[i] == query)
+                    continue;
+
+                marks[i] = query;
+                if (items[i].bounds.intersects(viewport))
+                    visible.push_back(i);
+            }
+        }
+    }
+
+    // Items must still be drawn in draw order.
+    std::sort(visible.begin(), visible.end());
+}
+
 void Renderer::Target::line_withoptions(
     const gfx::Vector<int32_t> start_i,
     const gfx::Vector<int32_t> end_i,
@@ -97,12 +776,9 @@ void Renderer::Target::line_withoptions(
     //   2. Calculate a perpendicular vector.
     //   3. Scale the perpendicular vector so that it's length is line_width.
     //   4. Offset the line's endpoints by this vector, and it's reflection.
-    glUseProgram(that->line_program.program);
-    glUniformMatrix4fv(
-        that->line_program.uniforms.at("projection"),
-        1,
-        GL_FALSE,
-        &projection[0][0]);
+    gl::State::Global().set(
+        that->line_projection,
+        projection);
     const gfx::Vector<float> start = (gfx::Vector<float>) start_i;
     const gfx::Vector<float> end = (gfx::Vector<float>) end_i;
 
@@ -194,11 +870,28 @@ Error Renderer::init(
     LOG(Logger::INFO) << "loaded render program";
 
     gfx::Drawable::InitOptions drawable_init_options;
+    drawable_init_options.vbo_init_size = BATCH_QUADS * 4 * sizeof(gfx::Vertex);
     CHECK(gfx::Drawable::init(
         &that->drawable,
         &that->program.program,
         &drawable_init_options),
         Error::GLERROR) << "failed to init drawable";
+
+    // Every batch indexes the same quads, from its own base vertex.
+    std::vector<uint16_t> ebo(BATCH_QUADS * 6);
+    for (size_t i = 0; i < BATCH_QUADS; ++i) {
+        const uint16_t v = static_cast<uint16_t>(i * 4);
+        const uint16_t indices[6] = { 0, 1, 3, 1, 2, 3 };
+        for (size_t j = 0; j < 6; ++j)
+            ebo[i * 6 + j] = v + indices[j];
+    }
+
+    that->drawable.ebo_load(
+        ebo.data(),
+        ebo.size());
+
+    that->batch_cursor = 0;
+    that->batch_vertices.reserve(BATCH_QUADS * 4);
     LOG(Logger::INFO) << "loaded render drawable";
 
     gl::Program<gfx::LineVertex>::CompileOptions compile_options;
@@ -241,6 +934,12 @@ Error Renderer::init(
         Error::GLERROR) << "failed to init line drawable";
     LOG(Logger::INFO) << "loaded line drawable";
 
+    CHECK(gl::State::Global().uniform(
+        that->line_program,
+        "projection",
+        &that->line_projection),
+        Error::UIERROR) << "failed to resolve line program uniforms";
+
     return Error();
 }
 
@@ -290,6 +989,9 @@ Renderer::Target Renderer::begin(
     render_target.that = this;
     render_target.target = target;
     render_target.game_viewport = game_viewport;
+    render_target.batch.vertices = std::move(batch_vertices);
+    render_target.batch.texture = 0;
+    render_target.state_start = gl::State::Global().stats;
     
     if (glIsEnabled(GL_SCISSOR_TEST)) {
         GLint box[4] = {0};
@@ -386,6 +1088,9 @@ Renderer::Target Renderer::begin(
     render_target.inverse_projection[3][1] = -m4 / m2;
     render_target.inverse_projection[3][3] = 1;
 
+    // The projection is the same for every batch drawn to this Target.
+    program.projection(render_target.projection);
+
     return render_target;
 }
 
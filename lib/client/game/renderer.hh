@@ -3,6 +3,7 @@
 #include <optional>
 #include <unordered_set>
 #include <variant>
+#include <vector>
 
 #include "gl.hh"
 #include "p.hh"
@@ -23,12 +24,160 @@ namespace game {
 // All inputs to the Renderer are expected to be in game coordinates. The
 // Renderer will translate to screen coordinates.
 struct Renderer {
+    // Geometry is a list of quads that is baked into GPU buffers once, and
+    // then drawn every frame without being regenerated: scenery that never
+    // moves. Quads are drawn in the order of their keys (see RenderQueue),
+    // and of their textures within a key, with one draw call per run of
+    // visible quads sharing a texture. Quads with equal keys and textures are
+    // drawn in the order they were added.
+    //
+    // Animated quads are baked with every frame of their sprite, along with
+    // a table of when each frame is shown, so that the program selects the
+    // frame to show from the time it is drawn at: animating them costs
+    // nothing on the CPU.
+    //
+    // Quads are culled against the Target's viewport through a uniform grid,
+    // so that only the quads in view are drawn.
+    struct Geometry {
+        // RUN_QUADS is the longest run of quads drawn by a single call.
+        static constexpr uint32_t RUN_QUADS = 16384;
+
+        // CELL_SIZE is the width and height, in game coordinates, of the
+        // cells of the grid.
+        static constexpr int32_t CELL_SIZE = 256;
+
+        // NONE marks items that are not animated.
+        static constexpr uint32_t NONE = ~0u;
+
+        // Item is a quad, or an animated quad, in draw order.
+        struct Item {
+            gfx::Rect<int32_t> bounds;
+
+            // key is the RenderQueue key of the quad, without its texture.
+            uint64_t key;
+
+            // quad is the index of the quad, or of the first frame of an
+            // animated quad, and quads their number.
+            uint32_t quad;
+            uint32_t quads;
+
+            // animation is the index of an animated quad's animation, or
+            // NONE.
+            uint32_t animation;
+        };
+
+        // Animation is the timing of an animated quad: the delays of its
+        // frames, in milliseconds.
+        struct Animation {
+            std::vector<uint64_t> delays;
+
+            // frame returns the frame shown at time, like the program
+            // selects it.
+            uint32_t frame(
+                uint64_t time) const;
+        };
+
+        // Timing is the timing of animated quads on the GPU. vbo holds, for
+        // every vertex, 0 if its quad is static, and 1 + the index of its
+        // frame's timing otherwise. buffer holds the timings of all frames,
+        // read by the program through texture.
+        struct Timing {
+            N<GLuint> vbo;
+            N<GLuint> buffer;
+            N<GLuint> texture;
+
+            ~Timing();
+
+            Timing() = default;
+            Timing(Timing&&) = default;
+            Timing(const Timing&) = delete;
+        };
+
+        // Grid buckets items by the cells that their bounds overlap. The
+        // items of cell i are items[starts[i]] to items[starts[i + 1]].
+        struct Grid {
+            gfx::Vector<int32_t> origin;
+            int32_t columns;
+            int32_t rows;
+            std::vector<uint32_t> starts;
+            std::vector<uint32_t> items;
+        };
+
+        gfx::Drawable drawable;
+        Timing timing;
+        std::vector<Item> items;
+        std::vector<Animation> animations;
+        Grid grid;
+
+        // textures are the textures of the quads.
+        std::vector<const gfx::Texture*> textures;
+
+        // vertices are the vertices of the quads, until they are uploaded.
+        std::vector<gfx::Vertex> vertices;
+        bool uploaded = false;
+        bool indexed = false;
+
+        // visible and marks are scratch space for queries: the items found
+        // in view, and the query that each item was last found by.
+        std::vector<uint32_t> visible;
+        std::vector<uint32_t> marks;
+        uint32_t query = 0;
+
+        // add appends a static quad, placed like Target::frame places it,
+        // under key.
+        void add(
+            const gfx::Sprite::Frame* frame,
+            const gfx::Vector<int32_t> at,
+            uint64_t key = 0);
+
+        // add_animated appends a quad that shows one of the frames of
+        // sprite, under key, and returns the index of its animation.
+        uint32_t add_animated(
+            const gfx::Sprite* sprite,
+            const gfx::Vector<int32_t> at,
+            uint64_t key = 0);
+
+        // upload bakes the quads, and the timing of animated quads, into GPU
+        // buffers, and builds the grid. It is called by Target::geometry
+        // when the Geometry is first drawn, since it needs the Renderer's
+        // program.
+        Error upload(
+            Renderer* renderer);
+
+        // index puts the quads in draw order and builds the grid, if it has
+        // not been done. Quads added afterwards are never found.
+        void index();
+
+        // find sets visible to the items that may overlap viewport, in draw
+        // order. The Geometry must be indexed.
+        void find(
+            const gfx::Rect<int32_t> viewport);
+
+        Geometry() = default;
+        Geometry(Geometry&&) = default;
+        Geometry(const Geometry&) = delete;
+    };
+
     struct Target {
         P<Renderer> that;
 
         struct Metrics {
             size_t draw_calls{ 0 };
             size_t quads{ 0 };
+
+            // culled is the number of quads that were not drawn, because
+            // they were out of view.
+            size_t culled{ 0 };
+
+            // pending is the number of quads that were not drawn, because
+            // their textures are still being uploaded.
+            size_t pending{ 0 };
+
+            // gl_calls is the number of GL calls made through gl::State, and
+            // gl_calls_skipped the number it skipped as redundant. They are
+            // updated when the Target is flushed.
+            size_t gl_calls{ 0 };
+            size_t gl_calls_skipped{ 0 };
             std::unordered_set<GLuint> seen_textures;
 
             size_t textures() const {
@@ -38,6 +187,9 @@ struct Renderer {
 
         Metrics metrics;
 
+        // state_start is the statistics of gl::State when the Target began.
+        gl::State::Stats state_start = { 0 };
+
         // previous_scissor is the previous state of the scissor test.
         std::optional<gfx::Rect<GLint>> previous_scissor;
 
@@ -74,12 +226,54 @@ struct Renderer {
             std::vector<gfx::LineVertex> vbo;
         } lines;
 
+        // batch is the run of quads, all sharing a texture, that has not been
+        // drawn yet.
+        struct {
+            std::vector<gfx::Vertex> vertices;
+            GLuint texture;
+        } batch;
+
         // frame draws a textured quad, placed so that its origin is at the
-        // specified location (in game coordinates).
+        // specified location (in game coordinates). Quads out of view are
+        // skipped. Quads are batched: they are only drawn once a quad with a
+        // different texture is drawn, the batch is full, or the Target is
+        // flushed.
         Error frame(
             const gfx::Sprite::Frame* frame,
             const gfx::Vector<int32_t> at);
 
+        // tiled draws frame placed like frame does, and repeated end to end
+        // horizontally and/or vertically across the whole viewport, as a
+        // single quad. The texture of frame must be repeating. Tiled quads
+        // are batched like those of frame.
+        Error tiled(
+            const gfx::Sprite::Frame* frame,
+            const gfx::Vector<int32_t> at,
+            bool horizontal,
+            bool vertical);
+
+        // geometry draws geometry, uploading it first if it has not been.
+        // Animated quads show their frame at time, in milliseconds.
+        Error geometry(
+            Geometry* geometry,
+            uint64_t time);
+
+        // geometry_items draws the count items of geometry listed in items,
+        // in order, uploading it first if it has not been. Quads that follow
+        // each other in the geometry's buffer, with the same texture, are
+        // drawn by a single call, whether they are static or frames of
+        // animated quads.
+        Error geometry_items(
+            Geometry* geometry,
+            uint64_t time,
+            const uint32_t* items,
+            size_t count);
+
+        // flush draws the pending batch of quads, if there is one. Targets
+        // flush themselves when they are destroyed; flushing earlier is only
+        // needed to interleave other drawing, or to read complete metrics.
+        void flush();
+
         struct LineOptions {
             float width{ 2 };
             struct {
@@ -116,7 +310,15 @@ struct Renderer {
             const LineOptions options);
 
         ~Target() {
-            // TODO: If some kind of caching/queuing system is built, flush here.
+            if (that) {
+                flush();
+
+                // Hand the staging buffer back, to be reused by the next
+                // Target.
+                if (batch.vertices.capacity())
+                    that->batch_vertices = std::move(batch.vertices);
+            }
+
             if (lines.ebo.size() && lines.vbo.size()) {
                 that->line_drawable.ebo_load(
                     lines.ebo.data(),
@@ -125,10 +327,9 @@ struct Renderer {
                     lines.vbo.data(),
                     lines.vbo.size());
 
-                glUseProgram(that->line_program.program);
-                glBindVertexArray(that->line_drawable.vao);
-                glBindBuffer(GL_ARRAY_BUFFER, that->line_drawable.vbo);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, that->line_drawable.ebo);
+                gl::State& state = gl::State::Global();
+                state.use(that->line_program.program);
+                state.bind_vertex_array(that->line_drawable.vao);
 
                 glDrawElements(
                     that->line_drawable.vbo_mode,
@@ -154,14 +355,33 @@ struct Renderer {
         Target(Target&&) = default;
     };
 
+    // BATCH_QUADS is the number of quads that the streaming vertex buffer
+    // holds. Batches of more quads are split.
+    static constexpr size_t BATCH_QUADS = 4096;
+
+    // drawable draws batches of quads. Its vertex buffer is written as a ring
+    // of BATCH_QUADS quads, and is orphaned whenever it wraps around, so that
+    // writing a batch never waits on the GPU. Its index buffer holds the
+    // indices of BATCH_QUADS quads, and is written once.
     gfx::Drawable drawable;
 
+    // batch_cursor is the quad of drawable's vertex buffer at which the next
+    // batch is written.
+    size_t batch_cursor;
+
+    // batch_vertices is the staging buffer of batches, which is lent to each
+    // Target in turn so that it is only allocated once.
+    std::vector<gfx::Vertex> batch_vertices;
+
     gfx::Program program;
 
     gl::Drawable<gfx::LineVertex> line_drawable;
 
     gl::Program<gfx::LineVertex> line_program;
 
+    // line_projection is the projection uniform of line_program.
+    gl::State::Uniform line_projection;
+
     static Error init(
         Renderer* that);
 
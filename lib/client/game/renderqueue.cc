@@ -0,0 +1,209 @@
+#include "client/game/renderqueue.hh"
+
+#include <cmath>
+#include <utility>
+
+#include "client/game/softrenderer.hh"
+
+namespace client {
+namespace game {
+
+// RenderQueue_push submits entry under key, completed with texture.
+static void RenderQueue_push(
+    RenderQueue* self,
+    uint64_t key,
+    const gfx::Texture* texture,
+    const RenderQueue::Entry& entry) {
+    self->sorted.push_back(RenderQueue::Sortable{
+        .key = key | (texture->id & RenderQueue::TEXTURE_MASK),
+        .entry = static_cast<uint32_t>(self->entries.size()),
+    });
+    self->entries.push_back(entry);
+}
+
+void RenderQueue::begin(
+    const gfx::Rect<double> game_viewport) {
+    viewport = gfx::Rect<int32_t>{
+        .topleft = {
+            .x = static_cast<int32_t>(std::floor(game_viewport.topleft.x)),
+            .y = static_cast<int32_t>(std::floor(game_viewport.topleft.y)),
+        },
+        .bottomright = {
+            .x = static_cast<int32_t>(std::ceil(game_viewport.bottomright.x)),
+            .y = static_cast<int32_t>(std::ceil(game_viewport.bottomright.y)),
+        },
+    };
+
+    culled = 0;
+    entries.clear();
+    sorted.clear();
+}
+
+void RenderQueue::frame(
+    uint64_t key,
+    const gfx::Sprite::Frame* frame,
+    const gfx::Vector<int32_t> at) {
+    RenderQueue_push(
+        this,
+        key,
+        frame->texture.get(),
+        Entry{
+            .kind = Entry::FRAME,
+            .frame = frame,
+            .at = at,
+        });
+}
+
+void RenderQueue::tiled(
+    uint64_t key,
+    const gfx::Sprite::Frame* frame,
+    const gfx::Vector<int32_t> at,
+    bool horizontal,
+    bool vertical) {
+    RenderQueue_push(
+        this,
+        key,
+        frame->texture.get(),
+        Entry{
+            .kind = Entry::TILED,
+            .frame = frame,
+            .at = at,
+            .horizontal = horizontal,
+            .vertical = vertical,
+        });
+}
+
+void RenderQueue::geometry(
+    Renderer::Geometry* geometry,
+    uint64_t time) {
+    if (geometry->items.empty())
+        return;
+
+    geometry->index();
+    geometry->find(viewport);
+    culled += geometry->items.size() - geometry->visible.size();
+
+    for (const uint32_t i : geometry->visible) {
+        const Renderer::Geometry::Item& item = geometry->items[i];
+
+        // Animated items are keyed by the texture of their first frame,
+        // which they are ordered by in the geometry.
+        RenderQueue_push(
+            this,
+            item.key,
+            geometry->textures[item.quad],
+            Entry{
+                .kind = Entry::GEOMETRY,
+                .geometry = geometry,
+                .item = i,
+                .time = time,
+            });
+    }
+}
+
+void RenderQueue::sort() {
+    const size_t n = sorted.size();
+    if (n < 2)
+        return;
+
+    // Count the values of every byte of the keys in a single pass.
+    static constexpr int DIGITS = sizeof(uint64_t);
+    size_t counts[DIGITS][256] = { { 0 } };
+    for (const Sortable& s : sorted) {
+        for (int d = 0; d < DIGITS; ++d)
+            ++counts[d][(s.key >> (d * 8)) & 0xFF];
+    }
+
+    // Then sort by each byte, from the least significant. Each pass is
+    // stable, so that entries with equal keys keep their order.
+    scratch.resize(n);
+    for (int d = 0; d < DIGITS; ++d) {
+        const size_t* count = counts[d];
+
+        // Keys mostly differ in a few of their bytes, since the layers,
+        // passes and zs of a frame take few values.
+        if (count[(sorted[0].key >> (d * 8)) & 0xFF] == n)
+            continue;
+
+        size_t offsets[256];
+        size_t total = 0;
+        for (size_t i = 0; i < 256; ++i) {
+            offsets[i] = total;
+            total += count[i];
+        }
+
+        for (const Sortable& s : sorted)
+            scratch[offsets[(s.key >> (d * 8)) & 0xFF]++] = s;
+
+        std::swap(sorted, scratch);
+    }
+}
+
+template <typename Target>
+Error RenderQueue::flush(
+    Target* target) {
+    sort();
+
+    target->metrics.culled += culled;
+    culled = 0;
+
+    for (size_t i = 0; i < sorted.size();) {
+        const Entry& entry = entries[sorted[i].entry];
+        ++i;
+
+        switch (entry.kind) {
+        case Entry::FRAME:
+            CHECK(target->frame(
+                entry.frame,
+                entry.at),
+                Error::UIERROR) << "failed to draw frame";
+            break;
+        case Entry::TILED:
+            CHECK(target->tiled(
+                entry.frame,
+                entry.at,
+                entry.horizontal,
+                entry.vertical),
+                Error::UIERROR) << "failed to draw tiled frame";
+            break;
+        case Entry::GEOMETRY:
+            // Items of a geometry that are drawn one after the other are
+            // handed over together, so that runs of them are drawn by a
+            // single call.
+            items.clear();
+            items.push_back(entry.item);
+            while (i < sorted.size()) {
+                const Entry& next = entries[sorted[i].entry];
+                if (next.kind != Entry::GEOMETRY ||
+                    next.geometry != entry.geometry ||
+                    next.time != entry.time)
+                    break;
+
+                items.push_back(next.item);
+                ++i;
+            }
+
+            CHECK(target->geometry_items(
+                entry.geometry,
+                entry.time,
+                items.data(),
+                items.size()),
+                Error::UIERROR) << "failed to draw geometry";
+            break;
+        }
+    }
+
+    entries.clear();
+    sorted.clear();
+
+    return Error();
+}
+
+template Error RenderQueue::flush(
+    Renderer::Target* target);
+
+template Error RenderQueue::flush(
+    SoftRenderer::Target* target);
+
+}
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "client/game/renderer.hh"
+#include "gfx/rect.hh"
+#include "gfx/sprite.hh"
+#include "gfx/texture.hh"
+#include "util/error.hh"
+
+namespace client {
+namespace game {
+
+// RenderQueue collects the draws of a frame in any order, and draws them
+// sorted by key once they have all been submitted, so that scenery and
+// dynamic things, like mobs, characters and portals, are layered correctly
+// whatever order they are submitted in.
+//
+// Keys pack, from their most significant bits:
+//
+//   | layer (8) | pass (4) | z (24) | texture (28) |
+//
+// Within a layer, a pass is drawn entirely over the passes before it, which
+// is how tiles are drawn over all of the objects of their layer. Draws at
+// the same z are grouped by texture, or atlas page, so that they batch
+// together. Draws with equal keys are drawn in the order they were
+// submitted.
+//
+// Keys are sorted with a radix sort, which is linear in the number of
+// draws, and skips the bytes that all keys share.
+struct RenderQueue {
+    // Layer is the layer of a draw. Map layer i is MAP_LAYER + i.
+    enum Layer : uint8_t {
+        BACKGROUND = 0,
+        MAP_LAYER = 1,
+        OVERLAY = 0xFF,
+    };
+
+    // Pass is the pass of a draw, within its layer.
+    enum Pass : uint8_t {
+        OBJECTS = 0,
+        TILES = 1,
+        ENTITIES = 2,
+    };
+
+    static constexpr int LAYER_SHIFT = 56;
+    static constexpr int PASS_SHIFT = 52;
+    static constexpr int Z_SHIFT = 28;
+
+    static constexpr uint64_t PASS_MASK = 0xF;
+    static constexpr uint64_t TEXTURE_MASK = 0xFFFFFFF;
+
+    // Z_MIN and Z_MAX are the range of z that keys hold. Zs outside of it
+    // are clamped.
+    static constexpr int32_t Z_MIN = -(1 << 23);
+    static constexpr int32_t Z_MAX = (1 << 23) - 1;
+
+    // key returns the key of draws in layer, pass and z, without their
+    // texture, which the queue fills in.
+    static constexpr uint64_t key(
+        uint32_t layer,
+        uint32_t pass,
+        int32_t z) {
+        const int32_t clamped = z < Z_MIN ? Z_MIN : (z > Z_MAX ? Z_MAX : z);
+
+        return (static_cast<uint64_t>(layer & 0xFF) << LAYER_SHIFT) |
+            (static_cast<uint64_t>(pass & PASS_MASK) << PASS_SHIFT) |
+            (static_cast<uint64_t>(clamped - Z_MIN) << Z_SHIFT);
+    }
+
+    // Entry is a submitted draw.
+    struct Entry {
+        enum Kind {
+            FRAME,
+            TILED,
+            GEOMETRY,
+        };
+
+        Kind kind;
+
+        // frame, at, horizontal and vertical are the arguments of FRAME and
+        // TILED draws.
+        const gfx::Sprite::Frame* frame;
+        gfx::Vector<int32_t> at;
+        bool horizontal;
+        bool vertical;
+
+        // geometry, item and time are the item of a geometry to draw, and
+        // the time that its animations are shown at.
+        Renderer::Geometry* geometry;
+        uint32_t item;
+        uint64_t time;
+    };
+
+    // Sortable is the key of an entry, and its index.
+    struct Sortable {
+        uint64_t key;
+        uint32_t entry;
+    };
+
+    // viewport is the rectangle, in game coordinates, that geometry is
+    // culled against.
+    gfx::Rect<int32_t> viewport;
+
+    // culled is the number of geometry items that were not submitted,
+    // because they were out of view. It is added to the Target's metrics
+    // when the queue is flushed.
+    size_t culled = 0;
+
+    // entries are the submitted draws, and sorted their keys, which are
+    // sorted when the queue is flushed. scratch is the other buffer of the
+    // radix sort, and items the items of a geometry being drawn. They are
+    // all reused from frame to frame.
+    std::vector<Entry> entries;
+    std::vector<Sortable> sorted;
+    std::vector<Sortable> scratch;
+    std::vector<uint32_t> items;
+
+    // begin clears the queue, to collect the draws of a frame showing
+    // game_viewport.
+    void begin(
+        const gfx::Rect<double> game_viewport);
+
+    // frame submits a draw of frame, like Target::frame.
+    void frame(
+        uint64_t key,
+        const gfx::Sprite::Frame* frame,
+        const gfx::Vector<int32_t> at);
+
+    // tiled submits a draw of frame repeated across the viewport, like
+    // Target::tiled.
+    void tiled(
+        uint64_t key,
+        const gfx::Sprite::Frame* frame,
+        const gfx::Vector<int32_t> at,
+        bool horizontal,
+        bool vertical);
+
+    // geometry submits the items of geometry that are in view, each under
+    // the key it was added with. Animated items show their frame at time, in
+    // milliseconds.
+    void geometry(
+        Renderer::Geometry* geometry,
+        uint64_t time);
+
+    // sort sorts the submitted draws by key.
+    void sort();
+
+    // flush sorts the submitted draws, and draws them onto target. Runs of
+    // items of the same geometry are drawn together. It is instantiated for
+    // both Renderer::Target and SoftRenderer::Target.
+    template <typename Target>
+    Error flush(
+        Target* target);
+
+    RenderQueue() = default;
+    RenderQueue(RenderQueue&&) = default;
+    RenderQueue(const RenderQueue&) = delete;
+};
+
+}
+}
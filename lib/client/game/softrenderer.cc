@@ -0,0 +1,658 @@
+#include "client/game/softrenderer.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "util/png.hh"
+
+namespace client {
+namespace game {
+
+// Target_edge returns the first pixel, along an axis of size pixels, whose
+// center is past edge, in pixels. Like GL, quads cover the pixels whose
+// centers they contain.
+static int32_t Target_edge(
+    double edge,
+    uint32_t size) {
+    const double clamped = std::clamp(edge - 0.5, -1.0, static_cast<double>(size));
+    return std::clamp(static_cast<int32_t>(std::ceil(clamped)), 0, static_cast<int32_t>(size));
+}
+
+// Target_intersect returns the overlap of a and b, which is empty if they
+// do not overlap.
+static gfx::Rect<int32_t> Target_intersect(
+    const gfx::Rect<int32_t> a,
+    const gfx::Rect<int32_t> b) {
+    return gfx::Rect<int32_t>{
+        .topleft = {
+            .x = std::max(a.topleft.x, b.topleft.x),
+            .y = std::max(a.topleft.y, b.topleft.y),
+        },
+        .bottomright = {
+            .x = std::min(a.bottomright.x, b.bottomright.x),
+            .y = std::min(a.bottomright.y, b.bottomright.y),
+        },
+    };
+}
+
+// Target_pixels returns the pixels covered by bounds, in game coordinates,
+// clipped to the framebuffer.
+static gfx::Rect<int32_t> Target_pixels(
+    const SoftRenderer::Target* self,
+    const gfx::Rect<double> bounds) {
+    const SoftRenderer* that = self->that;
+    const gfx::Vector<double> scale = self->scale;
+    const gfx::Vector<double> origin = self->game_viewport.topleft;
+
+    return gfx::Rect<int32_t>{
+        .topleft = {
+            .x = Target_edge((bounds.topleft.x - origin.x) * scale.x, that->width),
+            .y = Target_edge((bounds.topleft.y - origin.y) * scale.y, that->height),
+        },
+        .bottomright = {
+            .x = Target_edge((bounds.bottomright.x - origin.x) * scale.x, that->width),
+            .y = Target_edge((bounds.bottomright.y - origin.y) * scale.y, that->height),
+        },
+    };
+}
+
+// Target_viewport returns the game viewport of self, widened to whole game
+// coordinates.
+static gfx::Rect<int32_t> Target_viewport(
+    const SoftRenderer::Target* self) {
+    return gfx::Rect<int32_t>{
+        .topleft = {
+            .x = static_cast<int32_t>(std::floor(self->game_viewport.topleft.x)),
+            .y = static_cast<int32_t>(std::floor(self->game_viewport.topleft.y)),
+        },
+        .bottomright = {
+            .x = static_cast<int32_t>(std::ceil(self->game_viewport.bottomright.x)),
+            .y = static_cast<int32_t>(std::ceil(self->game_viewport.bottomright.y)),
+        },
+    };
+}
+
+// Target_quad records a quad covering bounds, in game coordinates, textured
+// with the uv rectangle of texture, unless it is out of view or texture is
+// not ready.
+static Error Target_quad(
+    SoftRenderer::Target* self,
+    const gfx::Texture* texture,
+    const gfx::Rect<double> bounds,
+    const gfx::Rect<float> uv) {
+    const gfx::Vector<double> scale = self->scale;
+    const gfx::Vector<double> origin = self->game_viewport.topleft;
+
+    // Texels are stepped from pixel 0, so that clipping does not move them.
+    const gfx::Rect<int32_t> pixels = Target_intersect(
+        Target_pixels(self, bounds),
+        self->scissor);
+    if (pixels.width() <= 0 || pixels.height() <= 0) {
+        ++self->metrics.culled;
+        return Error();
+    }
+
+    if (texture->name) {
+        return error_new(Error::INVALIDUSAGE)
+            << "texture " << static_cast<GLuint>(texture->name) << " was not loaded headless";
+    }
+
+    if (!texture->ready) {
+        ++self->metrics.pending;
+        return Error();
+    }
+
+    // The texel under each pixel's center is a linear function of the
+    // pixel, so it is found by stepping from the texel under pixel 0.
+    const double du =
+        (uv.bottomright.x - uv.topleft.x) * texture->width /
+        ((bounds.bottomright.x - bounds.topleft.x) * scale.x);
+    const double dv =
+        (uv.bottomright.y - uv.topleft.y) * texture->height /
+        ((bounds.bottomright.y - bounds.topleft.y) * scale.y);
+    const double u =
+        uv.topleft.x * texture->width +
+        ((origin.x - bounds.topleft.x) * scale.x + 0.5) * du;
+    const double v =
+        uv.topleft.y * texture->height +
+        ((origin.y - bounds.topleft.y) * scale.y + 0.5) * dv;
+
+    SoftRenderer::Draw draw = { 0 };
+    draw.bounds = pixels;
+    draw.texture = texture;
+    draw.u = std::llround(u * 65536);
+    draw.v = std::llround(v * 65536);
+    draw.du = std::llround(du * 65536);
+    draw.dv = std::llround(dv * 65536);
+    self->draws.push_back(draw);
+
+    ++self->metrics.quads;
+    return Error();
+}
+
+Error SoftRenderer::Target::frame(
+    const gfx::Sprite::Frame* frame,
+    const gfx::Vector<int32_t> at) {
+    const gfx::Vector<int32_t> topleft =
+        at - frame->origin;
+    const gfx::Rect<double> bounds = {
+        .topleft = (gfx::Vector<double>) topleft,
+        .bottomright = {
+            .x = static_cast<double>(topleft.x + static_cast<int32_t>(frame->image.width)),
+            .y = static_cast<double>(topleft.y + static_cast<int32_t>(frame->image.height)),
+        },
+    };
+
+    return Target_quad(
+        this,
+        frame->texture.get(),
+        bounds,
+        frame->uv);
+}
+
+Error SoftRenderer::Target::tiled(
+    const gfx::Sprite::Frame* frame,
+    const gfx::Vector<int32_t> at,
+    bool horizontal,
+    bool vertical) {
+    if (!frame->texture->repeating) {
+        return error_new(Error::INVALIDUSAGE)
+            << "frame texture is not repeating";
+    }
+
+    const gfx::Rect<int32_t> viewport = Target_viewport(this);
+    const gfx::Vector<int32_t> topleft =
+        at - frame->origin;
+    const gfx::Vector<int32_t> size = {
+        .x = static_cast<int32_t>(frame->image.width),
+        .y = static_cast<int32_t>(frame->image.height),
+    };
+    if (size.x == 0 || size.y == 0)
+        return Error();
+
+    gfx::Rect<int32_t> bounds = {
+        .topleft = topleft,
+        .bottomright = topleft + size,
+    };
+
+    if (horizontal) {
+        bounds.topleft.x = viewport.topleft.x;
+        bounds.bottomright.x = viewport.bottomright.x;
+    }
+    if (vertical) {
+        bounds.topleft.y = viewport.topleft.y;
+        bounds.bottomright.y = viewport.bottomright.y;
+    }
+
+    // Texels wrap around when rasterized, so only the offset into the
+    // first tile matters.
+    auto wrap = [](int32_t offset, int32_t size) {
+        return ((offset % size) + size) % size;
+    };
+    const gfx::Vector<int32_t> offset = {
+        .x = wrap(bounds.topleft.x - topleft.x, size.x),
+        .y = wrap(bounds.topleft.y - topleft.y, size.y),
+    };
+
+    const gfx::Rect<float> uv = {
+        .topleft = {
+            .x = static_cast<float>(offset.x) / size.x,
+            .y = static_cast<float>(offset.y) / size.y,
+        },
+        .bottomright = {
+            .x = static_cast<float>(offset.x + bounds.width()) / size.x,
+            .y = static_cast<float>(offset.y + bounds.height()) / size.y,
+        },
+    };
+
+    return Target_quad(
+        this,
+        frame->texture.get(),
+        gfx::Rect<double>{
+            .topleft = (gfx::Vector<double>) bounds.topleft,
+            .bottomright = (gfx::Vector<double>) bounds.bottomright,
+        },
+        uv);
+}
+
+Error SoftRenderer::Target::geometry(
+    Renderer::Geometry* geometry,
+    uint64_t time) {
+    if (geometry->uploaded) {
+        return error_new(Error::INVALIDUSAGE)
+            << "geometry was uploaded, and its quads are not in memory anymore";
+    }
+
+    if (geometry->items.empty())
+        return Error();
+
+    geometry->index();
+    geometry->find(Target_viewport(this));
+    metrics.culled += geometry->items.size() - geometry->visible.size();
+
+    return geometry_items(
+        geometry,
+        time,
+        geometry->visible.data(),
+        geometry->visible.size());
+}
+
+Error SoftRenderer::Target::geometry_items(
+    Renderer::Geometry* geometry,
+    uint64_t time,
+    const uint32_t* items,
+    size_t count) {
+    if (geometry->uploaded) {
+        return error_new(Error::INVALIDUSAGE)
+            << "geometry was uploaded, and its quads are not in memory anymore";
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const Renderer::Geometry::Item& item = geometry->items[items[i]];
+
+        uint32_t quad = item.quad;
+        if (item.animation != Renderer::Geometry::NONE)
+            quad += geometry->animations[item.animation].frame(time);
+
+        const gfx::Texture* texture = geometry->textures[quad];
+
+        // Vertices are clockwise from the top left.
+        const gfx::Vertex* vertices = &geometry->vertices[quad * 4];
+        CHECK(Target_quad(
+            this,
+            texture,
+            gfx::Rect<double>{
+                .topleft = {
+                    .x = vertices[0].position[0],
+                    .y = vertices[0].position[1],
+                },
+                .bottomright = {
+                    .x = vertices[2].position[0],
+                    .y = vertices[2].position[1],
+                },
+            },
+            gfx::Rect<float>{
+                .topleft = { .x = vertices[0].uv[0], .y = vertices[0].uv[1] },
+                .bottomright = { .x = vertices[2].uv[0], .y = vertices[2].uv[1] },
+            }),
+            Error::INVALIDUSAGE) << "failed to draw geometry quad";
+    }
+
+    return Error();
+}
+
+void SoftRenderer::Target::line_withoptions(
+    const gfx::Vector<int32_t> start,
+    const gfx::Vector<int32_t> end,
+    const LineOptions options) {
+    // Like Renderer's, lines extend width to either side, and do not extend
+    // past their ends.
+    if (start.x == end.x && start.y == end.y)
+        return;
+
+    const gfx::Vector<double> origin = game_viewport.topleft;
+    const float radius = static_cast<float>(options.width * (scale.x + scale.y) / 2);
+
+    Draw draw = { 0 };
+    draw.start.x = static_cast<float>((start.x - origin.x) * scale.x);
+    draw.start.y = static_cast<float>((start.y - origin.y) * scale.y);
+    draw.end.x = static_cast<float>((end.x - origin.x) * scale.x);
+    draw.end.y = static_cast<float>((end.y - origin.y) * scale.y);
+    draw.radius = radius;
+    draw.color[0] = options.color.r;
+    draw.color[1] = options.color.g;
+    draw.color[2] = options.color.b;
+    draw.color[3] = options.color.a;
+
+    draw.bounds = Target_intersect(
+        gfx::Rect<int32_t>{
+            .topleft = {
+                .x = Target_edge(std::min(draw.start.x, draw.end.x) - radius, that->width),
+                .y = Target_edge(std::min(draw.start.y, draw.end.y) - radius, that->height),
+            },
+            .bottomright = {
+                .x = Target_edge(std::max(draw.start.x, draw.end.x) + radius + 1, that->width),
+                .y = Target_edge(std::max(draw.start.y, draw.end.y) + radius + 1, that->height),
+            },
+        },
+        scissor);
+    if (draw.bounds.width() <= 0 || draw.bounds.height() <= 0)
+        return;
+
+    draws.push_back(draw);
+    ++metrics.lines;
+}
+
+void SoftRenderer::Target::clip(
+    const gfx::Rect<double> bounds) {
+    scissor = Target_pixels(this, bounds);
+}
+
+void SoftRenderer::Target::rect_withoptions(
+    const gfx::Rect<int32_t> r,
+    const LineOptions options) {
+    const gfx::Vector<int32_t> topright = {
+        .x = r.bottomright.x,
+        .y = r.topleft.y,
+    };
+    const gfx::Vector<int32_t> bottomleft = {
+        .x = r.topleft.x,
+        .y = r.bottomright.y,
+    };
+
+    line_withoptions(
+        r.topleft,
+        topright,
+        options);
+    line_withoptions(
+        topright,
+        r.bottomright,
+        options);
+    line_withoptions(
+        r.bottomright,
+        bottomleft,
+        options);
+    line_withoptions(
+        bottomleft,
+        r.topleft,
+        options);
+}
+
+// SoftRenderer_blend blends count pixels of src over those of dst, like
+// Renderer blends with GL_SRC_ALPHA and GL_ONE_MINUS_SRC_ALPHA. Alpha itself
+// is blended as if it were an opaque color, so that an opaque framebuffer
+// stays opaque.
+static void SoftRenderer_blend(
+    uint8_t* dst,
+    const uint8_t* src,
+    int32_t count) {
+    int32_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphas = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    const __m128i full = _mm_set1_epi16(0xFF);
+    const __m128i half = _mm_set1_epi16(0x80);
+
+    // blend blends 2 pixels, widened to 16 bits per channel. Dividing by
+    // 255, rounded, is (x + 128 + ((x + 128) >> 8)) >> 8.
+    auto blend = [&](__m128i s, __m128i d) {
+        __m128i a = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+        s = _mm_or_si128(s, _mm_slli_epi64(full, 48));
+
+        __m128i x = _mm_add_epi16(
+            _mm_add_epi16(
+                _mm_mullo_epi16(s, a),
+                _mm_mullo_epi16(d, _mm_sub_epi16(full, a))),
+            half);
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    };
+
+    for (; i + 4 <= count; i += 4) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+
+        // Runs of fully transparent and fully opaque pixels, which most
+        // sprites are made of, need no blending.
+        const __m128i a = _mm_and_si128(s, alphas);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, zero)) == 0xFFFF)
+            continue;
+
+        __m128i* out = reinterpret_cast<__m128i*>(dst + i * 4);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, alphas)) == 0xFFFF) {
+            _mm_storeu_si128(out, s);
+            continue;
+        }
+
+        const __m128i d = _mm_loadu_si128(out);
+        const __m128i lo = blend(
+            _mm_unpacklo_epi8(s, zero),
+            _mm_unpacklo_epi8(d, zero));
+        const __m128i hi = blend(
+            _mm_unpackhi_epi8(s, zero),
+            _mm_unpackhi_epi8(d, zero));
+        _mm_storeu_si128(out, _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        const uint8_t* s = src + i * 4;
+        uint8_t* d = dst + i * 4;
+        const uint32_t a = s[3];
+
+        for (size_t c = 0; c < 4; ++c) {
+            const uint32_t color = c == 3 ? 0xFF : s[c];
+            const uint32_t x = color * a + d[c] * (0xFF - a) + 0x80;
+            d[c] = static_cast<uint8_t>((x + (x >> 8)) >> 8);
+        }
+    }
+}
+
+// SoftRenderer_texel returns the texel, along an axis of size texels, under
+// the 16.16 fixed point coordinate x.
+static inline uint32_t SoftRenderer_texel(
+    int64_t x,
+    uint32_t size,
+    bool repeating) {
+    int64_t texel = x >> 16;
+    if (repeating) {
+        texel %= size;
+        return static_cast<uint32_t>(texel < 0 ? texel + size : texel);
+    }
+
+    return static_cast<uint32_t>(std::clamp<int64_t>(texel, 0, size - 1));
+}
+
+// SoftRenderer_quad rasterizes the pixels of r covered by a quad. Each row
+// of texels is gathered into scratch, and then blended at once.
+static void SoftRenderer_quad(
+    SoftRenderer* self,
+    const SoftRenderer::Draw& draw,
+    const gfx::Rect<int32_t> r,
+    std::vector<uint8_t>* scratch) {
+    const gfx::Texture* texture = draw.texture;
+    const int32_t count = r.width();
+    scratch->resize(static_cast<size_t>(count) * 4);
+
+    for (int32_t y = r.topleft.y; y < r.bottomright.y; ++y) {
+        const uint32_t v = SoftRenderer_texel(
+            draw.v + y * draw.dv,
+            texture->height,
+            texture->repeating);
+        const uint8_t* row = texture->pixels.data() + static_cast<size_t>(v) * texture->width * 4;
+
+        uint8_t* gathered = scratch->data();
+        int64_t u = draw.u + r.topleft.x * draw.du;
+        for (int32_t x = 0; x < count; ++x, u += draw.du) {
+            const uint32_t texel = SoftRenderer_texel(
+                u,
+                texture->width,
+                texture->repeating);
+            memcpy(gathered + x * 4, row + texel * 4, 4);
+        }
+
+        SoftRenderer_blend(
+            self->pixels.data() + (static_cast<size_t>(y) * self->width + r.topleft.x) * 4,
+            gathered,
+            count);
+    }
+}
+
+// SoftRenderer_line rasterizes the pixels of r covered by a line: those
+// whose centers are within its radius, between its ends.
+static void SoftRenderer_line(
+    SoftRenderer* self,
+    const SoftRenderer::Draw& draw,
+    const gfx::Rect<int32_t> r) {
+    const float dx = draw.end.x - draw.start.x;
+    const float dy = draw.end.y - draw.start.y;
+    const float length2 = dx * dx + dy * dy;
+
+    for (int32_t y = r.topleft.y; y < r.bottomright.y; ++y) {
+        for (int32_t x = r.topleft.x; x < r.bottomright.x; ++x) {
+            const float px = x + 0.5f - draw.start.x;
+            const float py = y + 0.5f - draw.start.y;
+
+            const float along = (px * dx + py * dy) / length2;
+            if (along < 0 || along > 1)
+                continue;
+
+            const float across = px * dy - py * dx;
+            if (across * across > draw.radius * draw.radius * length2)
+                continue;
+
+            SoftRenderer_blend(
+                self->pixels.data() + (static_cast<size_t>(y) * self->width + x) * 4,
+                draw.color,
+                1);
+        }
+    }
+}
+
+void SoftRenderer::Target::flush() {
+    if (draws.empty())
+        return;
+
+    SoftRenderer* renderer = that;
+    const int32_t columns = (renderer->width + TILE_SIZE - 1) / TILE_SIZE;
+    const int32_t rows = (renderer->height + TILE_SIZE - 1) / TILE_SIZE;
+    const size_t tiles = static_cast<size_t>(columns) * rows;
+
+    // Bin the draws by the tiles they overlap, in order.
+    std::vector<std::vector<uint32_t>>& bins = renderer->bins;
+    bins.resize(tiles);
+    for (std::vector<uint32_t>& bin : bins)
+        bin.clear();
+
+    for (uint32_t i = 0; i < draws.size(); ++i) {
+        const gfx::Rect<int32_t> r = draws[i].bounds;
+        for (int32_t y = r.topleft.y / TILE_SIZE; y <= (r.bottomright.y - 1) / TILE_SIZE; ++y)
+            for (int32_t x = r.topleft.x / TILE_SIZE; x <= (r.bottomright.x - 1) / TILE_SIZE; ++x)
+                bins[y * columns + x].push_back(i);
+    }
+
+    uint32_t threads = renderer->options.threads;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<uint32_t>(std::min<size_t>(threads, tiles));
+
+    // Tiles do not overlap, so each is rasterized by a single thread, with
+    // no synchronization.
+    std::atomic<size_t> next = 0;
+    std::atomic<size_t> drawn = 0;
+    auto worker = [&]() {
+        std::vector<uint8_t> scratch;
+        for (;;) {
+            const size_t tile = next++;
+            if (tile >= tiles)
+                break;
+
+            const std::vector<uint32_t>& bin = bins[tile];
+            if (bin.empty())
+                continue;
+
+            const int32_t x = static_cast<int32_t>(tile % columns) * TILE_SIZE;
+            const int32_t y = static_cast<int32_t>(tile / columns) * TILE_SIZE;
+            const gfx::Rect<int32_t> clip = {
+                .topleft = { .x = x, .y = y },
+                .bottomright = {
+                    .x = std::min(x + TILE_SIZE, static_cast<int32_t>(renderer->width)),
+                    .y = std::min(y + TILE_SIZE, static_cast<int32_t>(renderer->height)),
+                },
+            };
+
+            for (const uint32_t i : bin) {
+                const Draw& draw = draws[i];
+                const gfx::Rect<int32_t> r = Target_intersect(draw.bounds, clip);
+
+                if (draw.texture)
+                    SoftRenderer_quad(renderer, draw, r, &scratch);
+                else
+                    SoftRenderer_line(renderer, draw, r);
+            }
+
+            ++drawn;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (uint32_t i = 1; i < threads; ++i)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread& thread : pool)
+        thread.join();
+
+    metrics.tiles += drawn;
+    draws.clear();
+}
+
+Error SoftRenderer::init(
+    SoftRenderer* self,
+    uint32_t width,
+    uint32_t height,
+    const Options& options) {
+    if (width == 0 || height == 0) {
+        return error_new(Error::INVALIDUSAGE)
+            << "framebuffer of " << width << " x " << height << " is empty";
+    }
+
+    self->options = options;
+    self->width = width;
+    self->height = height;
+    self->pixels.resize(static_cast<size_t>(width) * height * 4);
+    self->clear();
+
+    return Error();
+}
+
+void SoftRenderer::clear() {
+    for (size_t i = 0; i < pixels.size(); i += 4) {
+        pixels[i + 0] = 0;
+        pixels[i + 1] = 0;
+        pixels[i + 2] = 0;
+        pixels[i + 3] = 0xFF;
+    }
+}
+
+SoftRenderer::Target SoftRenderer::begin(
+    gfx::Rect<double> game_viewport) {
+    SoftRenderer::Target target;
+    target.that = this;
+    target.game_viewport = game_viewport;
+    target.scale = gfx::Vector<double>{
+        .x = width / game_viewport.width(),
+        .y = height / game_viewport.height(),
+    };
+    target.scissor = gfx::Rect<int32_t>{
+        .topleft = { .x = 0, .y = 0 },
+        .bottomright = {
+            .x = static_cast<int32_t>(width),
+            .y = static_cast<int32_t>(height),
+        },
+    };
+
+    return target;
+}
+
+Error SoftRenderer::write(
+    std::ostream* out) {
+    util::PngWriter png;
+    CHECK(util::PngWriter::open(&png, out, width, height),
+        Error::PNG_WRITE_FAILED) << "failed to start PNG";
+    CHECK(png.rows(pixels.data(), height),
+        Error::PNG_WRITE_FAILED) << "failed to write PNG rows";
+    CHECK(png.close(),
+        Error::PNG_WRITE_FAILED) << "failed to finish PNG";
+
+    return Error();
+}
+
+}
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "p.hh"
+#include "client/game/renderer.hh"
+#include "gfx/rect.hh"
+#include "gfx/sprite.hh"
+#include "gfx/texture.hh"
+#include "util/error.hh"
+
+namespace client {
+namespace game {
+
+// SoftRenderer renders game-related things into a framebuffer in memory, on
+// the CPU, through a Target with the same interface as Renderer's. It needs
+// no window and no GL context, so that maps can be rendered into images by
+// tools, tests and benchmarks.
+//
+// Frames drawn by a SoftRenderer must have been loaded in headless mode (see
+// gfx::Texture::Headless), so that their pixels are in memory.
+//
+// Draws are recorded as they are made, and rasterized when the Target is
+// flushed. The framebuffer is split into tiles of TILE_SIZE x TILE_SIZE
+// pixels, which are rasterized in parallel; within a tile, draws are blended
+// in the order they were made, like Renderer blends them.
+struct SoftRenderer {
+    // TILE_SIZE is the width and height, in pixels, of the tiles that are
+    // rasterized in parallel.
+    static constexpr int32_t TILE_SIZE = 64;
+
+    struct Options {
+        // threads is the number of threads that rasterize tiles. If 0, the
+        // number of hardware threads is used.
+        uint32_t threads;
+    };
+
+    // Draw is a recorded draw: a textured quad, or a line.
+    struct Draw {
+        // bounds are the pixels that the draw may cover, clipped to the
+        // framebuffer.
+        gfx::Rect<int32_t> bounds;
+
+        // texture is the texture of a quad, or nullptr for a line.
+        const gfx::Texture* texture;
+
+        // u and v are the texel coordinates of the center of pixel (0, 0),
+        // and du and dv their steps from one pixel to the next, all in 16.16
+        // fixed point.
+        int64_t u;
+        int64_t v;
+        int64_t du;
+        int64_t dv;
+
+        // start and end are the ends of a line, in pixels, radius its half
+        // width, and color its 8-bit RGBA color.
+        gfx::Vector<float> start;
+        gfx::Vector<float> end;
+        float radius;
+        uint8_t color[4];
+    };
+
+    struct Target {
+        P<SoftRenderer> that;
+
+        struct Metrics {
+            size_t quads{ 0 };
+            size_t lines{ 0 };
+
+            // culled is the number of quads that were not drawn, because
+            // they were out of view.
+            size_t culled{ 0 };
+
+            // pending is the number of quads that were not drawn, because
+            // their textures were not ready.
+            size_t pending{ 0 };
+
+            // tiles is the number of tiles rasterized, counting a tile once
+            // per flush that drew into it.
+            size_t tiles{ 0 };
+        };
+
+        Metrics metrics;
+
+        // game_viewport is the rectangle, in game coordinates, that is being
+        // drawn, and scale the number of pixels per game unit along each
+        // axis.
+        gfx::Rect<double> game_viewport;
+        gfx::Vector<double> scale;
+
+        // scissor is the rectangle of pixels that draws are limited to.
+        gfx::Rect<int32_t> scissor;
+
+        // draws are the draws made since the last flush.
+        std::vector<Draw> draws;
+
+        typedef Renderer::Target::LineOptions LineOptions;
+
+        // frame draws a textured quad, placed so that its origin is at the
+        // specified location (in game coordinates), like Renderer's.
+        Error frame(
+            const gfx::Sprite::Frame* frame,
+            const gfx::Vector<int32_t> at);
+
+        // tiled draws frame repeated end to end across the viewport, like
+        // Renderer's. The texture of frame must be repeating.
+        Error tiled(
+            const gfx::Sprite::Frame* frame,
+            const gfx::Vector<int32_t> at,
+            bool horizontal,
+            bool vertical);
+
+        // geometry draws the quads of geometry, which must not have been
+        // uploaded, since its quads then only live on the GPU. Animated
+        // quads show their frame at time, in milliseconds.
+        Error geometry(
+            Renderer::Geometry* geometry,
+            uint64_t time);
+
+        // geometry_items draws the count items of geometry listed in items,
+        // in order, like Renderer's.
+        Error geometry_items(
+            Renderer::Geometry* geometry,
+            uint64_t time,
+            const uint32_t* items,
+            size_t count);
+
+        // clip limits the draws that follow to bounds, in game coordinates,
+        // like Renderer's program viewport.
+        void clip(
+            const gfx::Rect<double> bounds);
+
+        // flush rasterizes the draws made so far into the framebuffer.
+        // Targets flush themselves when they are destroyed.
+        void flush();
+
+        inline void line(
+            const gfx::Vector<int32_t> start,
+            const gfx::Vector<int32_t> end) {
+            line_withoptions(
+                start,
+                end,
+                LineOptions());
+        }
+
+        void line_withoptions(
+            const gfx::Vector<int32_t> start,
+            const gfx::Vector<int32_t> end,
+            const LineOptions options);
+
+        inline void rect(
+            const gfx::Rect<int32_t> r) {
+            rect_withoptions(
+                r,
+                LineOptions());
+        }
+
+        void rect_withoptions(
+            const gfx::Rect<int32_t> r,
+            const LineOptions options);
+
+        ~Target() {
+            if (that)
+                flush();
+        }
+
+        Target() = default;
+        Target(const Target&) = delete;
+        Target(Target&&) = default;
+    };
+
+    Options options;
+
+    // pixels is the framebuffer: width x height pixels of 8-bit RGBA, row
+    // by row.
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> pixels;
+
+    // bins are the draws, by index, that overlap each tile, which are reused
+    // from flush to flush.
+    std::vector<std::vector<uint32_t>> bins;
+
+    static Error init(
+        SoftRenderer* self,
+        uint32_t width,
+        uint32_t height,
+        const Options& options = {});
+
+    // clear fills the framebuffer with opaque black.
+    void clear();
+
+    // begin starts a new render session, showing game_viewport, in game
+    // coordinates, across the whole framebuffer.
+    Target begin(
+        gfx::Rect<double> game_viewport);
+
+    // write encodes the framebuffer as a PNG into out.
+    Error write(
+        std::ostream* out);
+
+    SoftRenderer() = default;
+    SoftRenderer(SoftRenderer&&) = default;
+    SoftRenderer(const SoftRenderer&) = delete;
+};
+
+}
+}
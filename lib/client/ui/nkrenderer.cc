@@ -60,17 +60,16 @@ void NkRenderer::render(
 
                 gfx::Vector<int32_t> scale = { 1, 1 };
 
-                glBindTexture(GL_TEXTURE_2D, (GLuint)cmd->texture.id);
+                gl::State& state = gl::State::Global();
+                state.bind_texture((GLuint)cmd->texture.id);
                 glScissor(
                         (GLint)(cmd->clip_rect.x * scale.x),
                         (GLint)((window_size.y - (GLint)(cmd->clip_rect.y + cmd->clip_rect.h)) * scale.y),
                         (GLint)(cmd->clip_rect.w * scale.x),
                         (GLint)(cmd->clip_rect.h * scale.y));
 
-                glUseProgram(program.program);
-                glBindVertexArray(drawable.vao);
-                glBindBuffer(GL_ARRAY_BUFFER, drawable.vbo);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable.ebo);
+                state.use(program.program);
+                state.bind_vertex_array(drawable.vao);
 
                 glDrawElements(
                         drawable.vbo_mode,
@@ -0,0 +1,276 @@
+#include "gfx/atlas.hh"
+
+#include <algorithm>
+#include <limits>
+
+namespace gfx {
+
+void Skyline::init(
+    Skyline* self,
+    uint32_t width,
+    uint32_t height) {
+    self->width = width;
+    self->height = height;
+    self->segments.clear();
+    self->segments.push_back(Segment{
+        .x = 0,
+        .y = 0,
+        .width = width,
+    });
+}
+
+// Skyline_fit returns the height at which a w x h rectangle would sit if
+// placed at the start of segment i, or false if it does not fit there.
+static bool Skyline_fit(
+    const Skyline* self,
+    size_t i,
+    uint32_t w,
+    uint32_t h,
+    uint32_t* y) {
+    const uint32_t x = self->segments[i].x;
+    if (x + w > self->width)
+        return false;
+
+    *y = 0;
+    uint32_t remaining = w;
+    for (size_t j = i; remaining > 0; ++j) {
+        const Skyline::Segment& s = self->segments[j];
+        *y = std::max(*y, s.y);
+        if (*y + h > self->height)
+            return false;
+
+        remaining -= std::min(remaining, s.width);
+    }
+
+    return true;
+}
+
+bool Skyline::insert(
+    uint32_t w,
+    uint32_t h,
+    Vector<uint32_t>* at) {
+    size_t best = segments.size();
+    uint32_t best_top = std::numeric_limits<uint32_t>::max();
+    uint32_t best_width = std::numeric_limits<uint32_t>::max();
+    uint32_t best_y = 0;
+
+    // Prefer the lowest top edge, then the narrowest segment, which leaves
+    // wider ones for wider rectangles.
+    for (size_t i = 0; i < segments.size(); ++i) {
+        uint32_t y = 0;
+        if (!Skyline_fit(this, i, w, h, &y))
+            continue;
+
+        if (y + h < best_top || (y + h == best_top && segments[i].width < best_width)) {
+            best = i;
+            best_top = y + h;
+            best_width = segments[i].width;
+            best_y = y;
+        }
+    }
+
+    if (best == segments.size())
+        return false;
+
+    at->x = segments[best].x;
+    at->y = best_y;
+
+    // Raise the skyline over the rectangle, shrinking or removing the
+    // segments that it covers.
+    segments.insert(segments.begin() + best, Segment{
+        .x = at->x,
+        .y = best_y + h,
+        .width = w,
+    });
+
+    const uint32_t right = at->x + w;
+    size_t i = best + 1;
+    while (i < segments.size() && segments[i].x < right) {
+        Segment& s = segments[i];
+        const uint32_t end = s.x + s.width;
+        if (end <= right) {
+            segments.erase(segments.begin() + i);
+            continue;
+        }
+
+        s.width = end - right;
+        s.x = right;
+        break;
+    }
+
+    // Merge neighbours of equal height.
+    for (size_t i = 0; i + 1 < segments.size();) {
+        if (segments[i].y == segments[i + 1].y) {
+            segments[i].width += segments[i + 1].width;
+            segments.erase(segments.begin() + i + 1);
+        } else {
+            ++i;
+        }
+    }
+
+    return true;
+}
+
+// Atlas_newpage creates an empty page.
+static Atlas::Page Atlas_newpage() {
+    std::shared_ptr<Texture> texture(new Texture());
+    glGenTextures(1, &texture->name);
+
+    gl::State::Global().bind_texture(texture->name);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_RGBA8,
+        Atlas::PAGE_SIZE,
+        Atlas::PAGE_SIZE,
+        0,
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        nullptr);
+
+    Atlas::Page page;
+    page.texture = std::move(texture);
+    Skyline::init(&page.skyline, Atlas::PAGE_SIZE, Atlas::PAGE_SIZE);
+    page.used = 0;
+
+    return page;
+}
+
+// Atlas_upload uploads the pixels of image into the bound page, at at.
+static Error Atlas_upload(
+    const wz::Image& image,
+    const uint8_t* pixels,
+    Vector<uint32_t> at) {
+    GLenum format = 0;
+    GLenum type = 0;
+
+    switch (image.format + image.format2) {
+    case 1:
+        format = GL_BGRA;
+        type = GL_UNSIGNED_SHORT_4_4_4_4_REV;
+        break;
+    case 2:
+        format = GL_BGRA;
+        type = GL_UNSIGNED_BYTE;
+        break;
+    case 513:
+        format = GL_RGB;
+        type = GL_UNSIGNED_SHORT_5_6_5;
+        break;
+    case 517:
+        format = GL_RGB;
+        type = GL_UNSIGNED_SHORT_5_6_5_REV;
+        break;
+    }
+
+    // Pages are uncompressed, so compressed images are expanded first.
+    std::vector<uint8_t> rgba;
+    if (format == 0) {
+        rgba.resize(image.expandedsize());
+        CHECK(image.expand(pixels, rgba.data()),
+            Error::FRAMELOADFAILED) << "failed to expand image for atlas";
+
+        pixels = rgba.data();
+        format = GL_RGBA;
+        type = GL_UNSIGNED_BYTE;
+    }
+
+    // Rows of 16-bit images of odd widths are not 4-byte aligned.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(
+        GL_TEXTURE_2D,
+        0,
+        at.x,
+        at.y,
+        image.width,
+        image.height,
+        format,
+        type,
+        pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    return Error();
+}
+
+Error Atlas::insert(
+    const wz::Image& image,
+    const uint8_t* pixels,
+    Region* region) {
+    if (!fits(image) || !pixels) {
+        return error_new(Error::INVALIDUSAGE)
+            << "image of " << image.width << " x " << image.height << " cannot be packed";
+    }
+
+    const uint32_t w = image.width + PADDING;
+    const uint32_t h = image.height + PADDING;
+
+    // Pages that are nearly full are still tried first: most images are
+    // small, and fill the gaps left by larger ones.
+    Page* page = nullptr;
+    Vector<uint32_t> at = { 0 };
+    for (Page& p : pages) {
+        if (p.skyline.insert(w, h, &at)) {
+            page = &p;
+            break;
+        }
+    }
+
+    if (!page) {
+        pages.push_back(Atlas_newpage());
+        ++pages_created;
+
+        page = &pages.back();
+        if (!page->skyline.insert(w, h, &at)) {
+            return error_new(Error::FRAMELOADFAILED)
+                << "image of " << image.width << " x " << image.height << " does not fit in an empty page";
+        }
+    }
+
+    gl::State::Global().bind_texture(page->texture->name);
+    CHECK(Atlas_upload(image, pixels, at),
+        Error::FRAMELOADFAILED) << "failed to upload image into atlas";
+
+    page->used += static_cast<uint64_t>(image.width) * image.height;
+    ++regions;
+
+    const float size = static_cast<float>(PAGE_SIZE);
+    region->page = page->texture;
+    region->uv = Rect<float>{
+        .topleft = {
+            .x = at.x / size,
+            .y = at.y / size,
+        },
+        .bottomright = {
+            .x = (at.x + image.width) / size,
+            .y = (at.y + image.height) / size,
+        },
+    };
+
+    return Error();
+}
+
+void Atlas::trim() {
+    std::erase_if(pages, [](const Page& page) {
+        return page.texture.use_count() == 1;
+    });
+}
+
+Atlas::Stats Atlas::stats() const {
+    Stats stats = { 0 };
+    stats.pages = pages.size();
+    stats.pages_created = pages_created;
+    stats.regions = regions;
+
+    for (const Page& page : pages) {
+        stats.used += page.used;
+        stats.area += static_cast<uint64_t>(PAGE_SIZE) * PAGE_SIZE;
+    }
+
+    return stats;
+}
+
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "p.hh"
+#include "gl.hh"
+#include "gfx/rect.hh"
+#include "gfx/texture.hh"
+#include "util/error.hh"
+#include "wz/property.hh"
+
+namespace gfx {
+
+// Skyline packs rectangles into a fixed size area, bottom-left first. It
+// tracks the top edge of the packed rectangles (the skyline) as a list of
+// horizontal segments, and places each rectangle where its top would be
+// lowest.
+struct Skyline {
+    struct Segment {
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+    };
+
+    uint32_t width;
+    uint32_t height;
+    std::vector<Segment> segments;
+
+    static void init(
+        Skyline* self,
+        uint32_t width,
+        uint32_t height);
+
+    // insert finds room for a w x h rectangle, and returns false if there
+    // is none. at is set to its top left corner.
+    bool insert(
+        uint32_t w,
+        uint32_t h,
+        Vector<uint32_t>* at);
+};
+
+// Atlas packs small images into large textures, its pages, so that frames
+// drawn together mostly share a texture and can be drawn in a single batch.
+// Images are uploaded into a page as they are inserted; pages are never
+// repacked.
+//
+// The atlas holds a reference to each page so that it can keep packing into
+// it, and frames hold references to the pages of their regions. trim drops
+// the atlas' references to pages that no frame uses anymore, which frees
+// them.
+//
+// Atlas must only be used from the thread owning the GL context.
+struct Atlas {
+    // PAGE_SIZE is the width and height of pages.
+    static constexpr uint32_t PAGE_SIZE = 2048;
+
+    // MAX_EXTENT is the largest width or height of an image that is packed.
+    // Larger images, such as most backgrounds, get their own textures.
+    static constexpr uint32_t MAX_EXTENT = 512;
+
+    // PADDING is the gap left around each region, so that filtering never
+    // samples a neighbour.
+    static constexpr uint32_t PADDING = 1;
+
+    struct Page {
+        std::shared_ptr<const Texture> texture;
+        Skyline skyline;
+
+        // used is the area of the images packed into this page, excluding
+        // padding.
+        uint64_t used;
+    };
+
+    // Region is where an image was packed.
+    struct Region {
+        std::shared_ptr<const Texture> page;
+
+        // uv is the region's rectangle in the page, in texture coordinates.
+        Rect<float> uv;
+    };
+
+    struct Stats {
+        // pages is the number of pages held by the atlas, and pages_created
+        // the number ever created.
+        uint64_t pages;
+        uint64_t pages_created;
+
+        // regions is the number of images ever packed.
+        uint64_t regions;
+
+        // used is the area of the images packed into the held pages, and
+        // area the total area of those pages.
+        uint64_t used;
+        uint64_t area;
+
+        // efficiency returns the fraction of the held pages' area that is
+        // packed with images.
+        double efficiency() const {
+            if (area == 0)
+                return 0;
+
+            return static_cast<double>(used) / area;
+        }
+    };
+
+    std::vector<Page> pages;
+    N<uint64_t> pages_created;
+    N<uint64_t> regions;
+
+    // fits returns whether image is small enough to be packed.
+    static bool fits(
+        const wz::Image& image) {
+        return
+            image.width > 0 && image.height > 0 &&
+            image.width <= MAX_EXTENT && image.height <= MAX_EXTENT;
+    }
+
+    // insert packs image, whose decoded pixels are pixels, into a page, and
+    // uploads it there. image must fit.
+    Error insert(
+        const wz::Image& image,
+        const uint8_t* pixels,
+        Region* region);
+
+    // trim drops the pages that no frame uses anymore.
+    void trim();
+
+    Stats stats() const;
+
+    static Atlas& Global() {
+        static Atlas atlas;
+        return atlas;
+    }
+
+    Atlas() = default;
+    Atlas(Atlas&&) = delete;
+    Atlas(const Atlas&) = delete;
+};
+
+}
@@ -5,9 +5,10 @@ namespace gfx {
 Error LineVertex::configure(
     const gl::Program<LineVertex>* program,
     const gl::Drawable<LineVertex>* drawable) {
-    glBindVertexArray(drawable->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, drawable->vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable->ebo);
+    gl::State& state = gl::State::Global();
+    state.bind_vertex_array(drawable->vao);
+    state.bind_buffer(GL_ARRAY_BUFFER, drawable->vbo);
+    state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, drawable->ebo);
 
     GLuint position = 0;
     CHECK(program->attribute(
@@ -11,14 +11,28 @@ Error Program::init(
     compile_options.vertex_shader =
         "#version 330\n"
         "uniform mat4 projection;\n"
+        "uniform uint time;\n"
+        "uniform usamplerBuffer frames;\n"
         "in vec2 position;\n"
         "in vec2 uv;\n"
+        "in float frame;\n"
         "out vec2 game_position;\n"
         "out vec2 fragment_uv;\n"
         "void main() {\n"
         "  game_position = position.xy;\n"
         "  fragment_uv = uv;\n"
         "  gl_Position = projection * vec4(position.xy, 0, 1);\n"
+        // frame is 0 for quads that are always shown, which is also its
+        // value when it is not enabled. Otherwise, it is 1 + the index of
+        // the quad's timing: the start and end of its frame within its
+        // animation, and the animation's period. The quads of frames not
+        // being shown are collapsed to a point.
+        "  if (frame > 0) {\n"
+        "    uvec4 timing = texelFetch(frames, int(frame) - 1);\n"
+        "    uint t = time % timing.z;\n"
+        "    if (t < timing.x || t >= timing.y)\n"
+        "      gl_Position = vec4(2, 2, 2, 1);\n"
+        "  }\n"
         "}\n";
     compile_options.fragment_shader =
         "#version 330\n"
@@ -40,6 +54,26 @@ Error Program::init(
         &compile_options),
         Error::UIERROR) << "failed to compile render program";
 
+    gl::State& state = gl::State::Global();
+    const std::pair<const char*, gl::State::Uniform*> uniforms[] = {
+        { "viewport_topleft", &self->uniforms.viewport_topleft },
+        { "viewport_bottomright", &self->uniforms.viewport_bottomright },
+        { "projection", &self->uniforms.projection },
+        { "time", &self->uniforms.time },
+        { "frames", &self->uniforms.frames },
+    };
+    for (const auto& [name, uniform] : uniforms) {
+        CHECK(state.uniform(
+            self->program,
+            name,
+            uniform),
+            Error::UIERROR) << "failed to resolve render program uniforms";
+    }
+
+    state.set(
+        self->uniforms.frames,
+        static_cast<GLint>(FRAMES_UNIT));
+
     LOG(Logger::INFO) << "shaders compiled";
     return Error();
 }
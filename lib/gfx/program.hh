@@ -6,32 +6,50 @@
 namespace gfx {
 
 struct Program {
+        // FRAMES_UNIT is the texture unit that frame timings are read from.
+        static constexpr GLuint FRAMES_UNIT = 1;
+
         gl::Program<Vertex> program;
 
+        // The program's uniforms, resolved by init.
+        struct {
+                gl::State::Uniform viewport_topleft;
+                gl::State::Uniform viewport_bottomright;
+                gl::State::Uniform projection;
+                gl::State::Uniform time;
+                gl::State::Uniform frames;
+        } uniforms;
+
         static Error init(
                 Program* self);
 
         void viewport(
                 gfx::Rect<double> viewport) {
-                glUseProgram(program.program);
-                glUniform2f(
-                        program.uniforms.at("viewport_topleft"),
+                gl::State& state = gl::State::Global();
+                state.set(
+                        uniforms.viewport_topleft,
                         viewport.topleft.x,
                         viewport.topleft.y);
-                glUniform2f(
-                        program.uniforms.at("viewport_bottomright"),
+                state.set(
+                        uniforms.viewport_bottomright,
                         viewport.bottomright.x,
                         viewport.bottomright.y);
         }
 
         void projection(
                 GLfloat projection[4][4]) {
-                glUseProgram(program.program);
-                glUniformMatrix4fv(
-                        program.uniforms.at("projection"),
-                        1,
-                        GL_FALSE,
-                        &projection[0][0]);
+                gl::State::Global().set(
+                        uniforms.projection,
+                        projection);
+        }
+
+        // time sets the time, in milliseconds, that animated quads show
+        // their frame at. It wraps around every 2^32 milliseconds.
+        void time(
+                uint64_t time) {
+                gl::State::Global().set(
+                        uniforms.time,
+                        static_cast<GLuint>(time));
         }
 
         Program() = default;
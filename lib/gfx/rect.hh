@@ -26,6 +26,15 @@ struct Rect {
         return contains(r.topleft) && contains(r.bottomright);
     }
 
+    // intersects returns whether r overlaps this rectangle. Rectangles that
+    // only share an edge do not overlap.
+    template <typename U>
+    bool intersects(Rect<U> r) const {
+        return
+            r.topleft.x < bottomright.x && topleft.x < r.bottomright.x &&
+            r.topleft.y < bottomright.y && topleft.y < r.bottomright.y;
+    }
+
     Vector<T> center() const {
         Vector<T> center = {
             .x = (bottomright.x + topleft.x) / 2,
@@ -1,19 +1,166 @@
 #include "gfx/sprite.hh"
 
+#include <unordered_map>
+#include <vector>
+
+#include "gfx/atlas.hh"
+#include "gfx/uploader.hh"
+
 namespace gfx {
 
-Error Sprite::Frame::load(
+// Frame_stream uploads the pixels of image into the bound texture a band of
+// rows at a time, as they are decoded, so that they are never all in memory.
+static Error Frame_stream(
     Sprite::Frame* self,
-    wz::Image image,
+    const wz::Image& image) {
+    const bool gpu_compressed = self->compressed() && GLEW_EXT_texture_compression_s3tc;
+
+    // Allocate the texture's storage first, and fill it in with the bands.
+    if (gpu_compressed) {
+        glCompressedTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            self->compressed_format(),
+            image.width,
+            image.height,
+            0,
+            image.rawsize(),
+            nullptr);
+    } else {
+        glTexImage2D(
+            GL_TEXTURE_2D,
+            0,
+            GL_RGBA8,
+            image.width,
+            image.height,
+            0,
+            GL_RGBA,
+            GL_UNSIGNED_BYTE,
+            nullptr);
+    }
+
+    std::vector<uint8_t> rgba;
+    return image.bands(0, [&](const wz::Image::Band& band) -> Error {
+        if (gpu_compressed) {
+            glCompressedTexSubImage2D(
+                GL_TEXTURE_2D,
+                0,
+                0,
+                band.y,
+                image.width,
+                band.rows,
+                self->compressed_format(),
+                image.bandsize(band.rows),
+                band.pixels);
+        } else if (self->compressed()) {
+            // Without S3TC support, decode on the CPU instead.
+            rgba.resize(static_cast<size_t>(image.width) * band.rows * 4);
+            CHECK(image.expand(band, rgba.data()),
+                Error::FRAMELOADFAILED) << "failed to decode compressed band";
+
+            glTexSubImage2D(
+                GL_TEXTURE_2D,
+                0,
+                0,
+                band.y,
+                image.width,
+                band.rows,
+                GL_RGBA,
+                GL_UNSIGNED_BYTE,
+                rgba.data());
+        } else {
+            glTexSubImage2D(
+                GL_TEXTURE_2D,
+                0,
+                0,
+                band.y,
+                image.width,
+                band.rows,
+                self->format(),
+                self->type(),
+                band.pixels);
+        }
+
+        return Error();
+    });
+}
+
+// Frame_keep keeps the pixels of image in the headless texture of self,
+// expanded to 8-bit RGBA.
+static Error Frame_keep(
+    Sprite::Frame* self,
+    const wz::Image& image,
+    const uint8_t* image_data,
+    GLint wrap) {
+    std::shared_ptr<Texture> texture(new Texture());
+    texture->repeating = wrap == GL_REPEAT;
+    texture->width = image.width;
+    texture->height = image.height;
+    texture->pixels.resize(image.expandedsize());
+    self->texture = texture;
+
+    if (image_data) {
+        CHECK(image.expand(image_data, texture->pixels.data()),
+            Error::FRAMELOADFAILED) << "failed to expand image";
+
+        return Error();
+    }
+
+    const size_t stride = static_cast<size_t>(image.width) * 4;
+    return image.bands(0, [&](const wz::Image::Band& band) -> Error {
+        CHECK(image.expand(band, texture->pixels.data() + band.y * stride),
+            Error::FRAMELOADFAILED) << "failed to expand band";
+
+        return Error();
+    });
+}
+
+// Frame_upload uploads image, whose pixels are image_data, or are streamed
+// from its compressed data if image_data is null, into the bound texture.
+static Error Frame_upload(
+    Sprite::Frame* self,
+    const wz::Image& image,
     const uint8_t* image_data) {
-    self->image = image;
+    if (!image_data) {
+        CHECK(Frame_stream(self, image),
+            Error::FRAMELOADFAILED) << "failed to stream image";
+
+        return Error();
+    }
+
+    if (self->compressed()) {
+        if (GLEW_EXT_texture_compression_s3tc) {
+            // Upload the blocks as they are; the GPU decodes them.
+            glCompressedTexImage2D(
+                GL_TEXTURE_2D,
+                0,
+                self->compressed_format(),
+                image.width,
+                image.height,
+                0,
+                image.rawsize(),
+                image_data);
+        } else {
+            // Without S3TC support, decode on the CPU instead.
+            std::vector<uint8_t> rgba(image.expandedsize());
+            CHECK(image.expand(image_data, rgba.data()),
+                Error::FRAMELOADFAILED) << "failed to decode compressed image";
+
+            glTexImage2D(
+                GL_TEXTURE_2D,
+                0,
+                GL_RGBA8,
+                image.width,
+                image.height,
+                0,
+                GL_RGBA,
+                GL_UNSIGNED_BYTE,
+                rgba.data());
+        }
+
+        return Error();
+    }
 
-    glGenTextures(1, &self->texture);
-    glBindTexture(GL_TEXTURE_2D, self->texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexImage2D(
         GL_TEXTURE_2D,
         0,
@@ -28,6 +175,133 @@ Error Sprite::Frame::load(
     return Error();
 }
 
+// Frame_load loads image into a texture of its own, wrapping with wrap.
+static Error Frame_load(
+    Sprite::Frame* self,
+    wz::Image image,
+    const uint8_t* image_data,
+    GLint wrap) {
+    self->image = image;
+    self->uv = Rect<float>{
+        .topleft = { .x = 0, .y = 0 },
+        .bottomright = { .x = 1, .y = 1 },
+    };
+
+    if (!self->compressed() && self->format() == 0) {
+        return error_new(Error::UNKNOWNIMAGEFORMAT)
+            << "unsupported image format " << (image.format + image.format2);
+    }
+
+    if (Texture::Headless())
+        return Frame_keep(self, image, image_data, wrap);
+
+    std::shared_ptr<Texture> texture(new Texture());
+    glGenTextures(1, &texture->name);
+    texture->repeating = wrap == GL_REPEAT;
+    self->texture = texture;
+
+    gl::State::Global().bind_texture(texture->name);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+
+    // Rows of 16-bit images of odd widths are not 4-byte aligned.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    Error e = Frame_upload(self, image, image_data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    return e;
+}
+
+Error Sprite::Frame::load(
+    Sprite::Frame* self,
+    wz::Image image,
+    const uint8_t* image_data) {
+    return Frame_load(
+        self,
+        image,
+        image_data,
+        GL_CLAMP_TO_EDGE);
+}
+
+Error Sprite::Frame::load(
+    Sprite::Frame* self,
+    const wz::OpenedFile::Canvas& canvas) {
+    TextureCache& cache = TextureCache::Global();
+    const size_t size = canvas.image.rawsize();
+
+    if (std::shared_ptr<const Texture> texture = cache.find(canvas.key, size, &self->uv)) {
+        self->image = canvas.image;
+        self->texture = std::move(texture);
+        return Error();
+    }
+
+    // Streamed canvases are large, and so never packed, but are decoded and
+    // uploaded in the background like other large canvases. Headless
+    // textures are never packed or uploaded.
+    Atlas& atlas = Atlas::Global();
+    if (Texture::Headless()) {
+        CHECK(load(
+            self,
+            canvas.image,
+            canvas.image_data),
+            Error::FRAMELOADFAILED) << "failed to load headless frame from canvas";
+    } else if (Atlas::fits(canvas.image) && canvas.image_data) {
+        Atlas::Region region;
+        CHECK(atlas.insert(
+            canvas.image,
+            canvas.image_data,
+            &region),
+            Error::FRAMELOADFAILED) << "failed to pack frame into atlas";
+
+        self->image = canvas.image;
+        self->texture = std::move(region.page);
+        self->uv = region.uv;
+    } else if (Uploader& uploader = Uploader::Global(); uploader.accepts(canvas.image)) {
+        self->image = canvas.image;
+        CHECK(uploader.enqueue(
+            self,
+            canvas.image_data),
+            Error::FRAMELOADFAILED) << "failed to queue frame upload";
+    } else {
+        CHECK(load(
+            self,
+            canvas.image,
+            canvas.image_data),
+            Error::FRAMELOADFAILED) << "failed to load frame from canvas";
+    }
+
+    cache.insert(canvas.key, self->texture, self->uv, size);
+    return Error();
+}
+
+Error Sprite::Frame::loadrepeating(
+    Sprite::Frame* self,
+    const wz::OpenedFile::Canvas& canvas) {
+    // Repeating textures cannot be looked up in TextureCache, since the
+    // texture cached for the same contents may be an atlas page.
+    if (Uploader& uploader = Uploader::Global(); !Texture::Headless() && uploader.accepts(canvas.image)) {
+        self->image = canvas.image;
+        CHECK(uploader.enqueue(
+            self,
+            canvas.image_data,
+            GL_REPEAT),
+            Error::FRAMELOADFAILED) << "failed to queue repeating frame upload";
+
+        return Error();
+    }
+
+    CHECK(Frame_load(
+        self,
+        canvas.image,
+        canvas.image_data,
+        GL_REPEAT),
+        Error::FRAMELOADFAILED) << "failed to load repeating frame from canvas";
+
+    return Error();
+}
+
 Error Sprite::Frame::loadfromfile(
     Sprite::Frame* self,
     const wz::OpenedFile::Node* node) {
@@ -39,8 +313,7 @@ Error Sprite::Frame::loadfromfile(
 
     CHECK(load(
         self,
-        canvas->image,
-        canvas->image_data),
+        *canvas),
         Error::FRAMELOADFAILED)
         << "failed to load frame from image data";
 
@@ -61,6 +334,16 @@ Error Sprite::Frame::loadfromfile(
     return Error();
 }
 
+void Sprite::Frame::alias(
+    Sprite::Frame* self,
+    const Sprite::Frame& from) {
+    self->image = from.image;
+    self->texture = from.texture;
+    self->uv = from.uv;
+    self->origin = from.origin;
+    self->delay = from.delay;
+}
+
 void Sprite::Frame::quad(
     Vector<int32_t> at,
     gfx::Vertex vertices[4]) const {
@@ -68,29 +351,29 @@ void Sprite::Frame::quad(
         static_cast<float>(at.x - origin.x);
     vertices[0].position[1] =
         static_cast<float>(at.y - origin.y);
-    vertices[0].uv[0] = 0;
-    vertices[0].uv[1] = 0;
+    vertices[0].uv[0] = uv.topleft.x;
+    vertices[0].uv[1] = uv.topleft.y;
 
     vertices[1].position[0] =
         static_cast<float>(at.x + static_cast<int32_t>(image.width) - origin.x);
     vertices[1].position[1] =
         static_cast<float>(at.y - origin.y);
-    vertices[1].uv[0] = 1;
-    vertices[1].uv[1] = 0;
+    vertices[1].uv[0] = uv.bottomright.x;
+    vertices[1].uv[1] = uv.topleft.y;
 
     vertices[2].position[0] =
         static_cast<float>(at.x + static_cast<int32_t>(image.width) - origin.x);
     vertices[2].position[1] =
         static_cast<float>(at.y + static_cast<int32_t>(image.height) - origin.y);
-    vertices[2].uv[0] = 1;
-    vertices[2].uv[1] = 1;
+    vertices[2].uv[0] = uv.bottomright.x;
+    vertices[2].uv[1] = uv.bottomright.y;
 
     vertices[3].position[0] =
         static_cast<float>(at.x - origin.x);
     vertices[3].position[1] =
         static_cast<float>(at.y + static_cast<int32_t>(image.height) - origin.y);
-    vertices[3].uv[0] = 0;
-    vertices[3].uv[1] = 1;
+    vertices[3].uv[0] = uv.topleft.x;
+    vertices[3].uv[1] = uv.bottomright.y;
 }
 
 Error Sprite::loadfromfile(
@@ -98,6 +381,10 @@ Error Sprite::loadfromfile(
     const wz::OpenedFile::Node* node) {
     auto it = node->iterator();
 
+    // loaded maps canvas nodes to the index of the frame loaded from them, so
+    // that frames aliased by Uols share a texture.
+    std::unordered_map<const wz::OpenedFile::Node*, size_t> loaded;
+
     // TODO: are we guaranteed that sprite frames are in order?
     const wz::OpenedFile::Node* frame_node = nullptr;
     while ((frame_node = it.next())) {
@@ -112,15 +399,34 @@ Error Sprite::loadfromfile(
         }
 
         if (const auto* uol = std::get_if<wz::OpenedFile::Uol>(&frame_node->value)) {
-            frame_node = frame_node->parent->find(uol->uol);
+            // Follow the pre-resolved link if there is one; otherwise, fall
+            // back to resolving the Uol now.
+            const wchar_t* uol_path = uol->uol;
+            if (uol->target)
+                frame_node = uol->target;
+            else
+                frame_node = frame_node->parent->find(uol_path);
+
+            if (frame_node == nullptr) {
+                return error_new(Error::SPRITELOADFAILED)
+                    << "failed to resolve sprite frame uol " << uol_path;
+            }
         }
 
         Frame frame;
-        CHECK(Frame::loadfromfile(
-            &frame,
-            frame_node),
-            Error::SPRITELOADFAILED)
-            << "failed to load sprite frame";
+
+        auto loaded_it = loaded.find(frame_node);
+        if (loaded_it != loaded.end()) {
+            Frame::alias(&frame, self->frames[loaded_it->second]);
+        } else {
+            CHECK(Frame::loadfromfile(
+                &frame,
+                frame_node),
+                Error::SPRITELOADFAILED)
+                << "failed to load sprite frame";
+
+            loaded.emplace(frame_node, self->frames.size());
+        }
 
         self->frames.emplace_back(std::move(frame));
     }
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 
 #include "p.hh"
 #include "gl.hh"
+#include "gfx/rect.hh"
+#include "gfx/texture.hh"
 #include "gfx/vector.hh"
 #include "gfx/vertex.hh"
 #include "util/error.hh"
@@ -15,7 +18,12 @@ namespace gfx {
 struct Sprite {
     struct Frame {
         wz::Image image;
-        N<GLuint> texture;
+
+        // texture is the texture holding this frame's image: either its own,
+        // or an atlas page that it shares with other frames. uv is the
+        // rectangle of it that holds the image, in texture coordinates.
+        std::shared_ptr<const Texture> texture;
+        Rect<float> uv;
 
         Vector<int32_t> origin;
         int32_t delay;
@@ -25,10 +33,29 @@ struct Sprite {
             wz::Image image,
             const uint8_t* image_data);
 
+        // load loads a frame from canvas, sharing the texture of any other
+        // canvas with the same contents via TextureCache::Global. Small
+        // canvases are packed into Atlas::Global.
+        static Error load(
+            Frame* self,
+            const wz::OpenedFile::Canvas& canvas);
+
+        // loadrepeating loads a frame from canvas into a repeating texture
+        // of its own, which is never shared or packed, so that the frame can
+        // be tiled by a single quad.
+        static Error loadrepeating(
+            Frame* self,
+            const wz::OpenedFile::Canvas& canvas);
+
         static Error loadfromfile(
             Frame* self,
             const wz::OpenedFile::Node* node);
 
+        // alias initializes self as a copy of from, sharing its texture.
+        static void alias(
+            Frame* self,
+            const Frame& from);
+
         // quad computes the 4 vertices of the quad suitable for drawing this frame
         // at the specified point. The vertex positions are computed so as to place
         // the origin of this frame at the provided point; that is, for an origin
@@ -39,6 +66,31 @@ struct Sprite {
             Vector<int32_t> at,
             gfx::Vertex vertices[4]) const;
 
+        // compressed returns whether this frame's image is kept in a block
+        // compressed format, to be uploaded with glCompressedTexImage2D.
+        bool compressed() const {
+            switch (image.format + image.format2) {
+            case 1026:
+            case 2050:
+                return true;
+            }
+
+            return false;
+        }
+
+        // compressed_format returns the GL internal format of a compressed
+        // frame.
+        GLenum compressed_format() const {
+            switch (image.format + image.format2) {
+            case 1026:
+                return GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+            case 2050:
+                return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            }
+
+            return 0;
+        }
+
         GLenum format() const {
             switch (image.format + image.format2) {
             case 1:
@@ -56,6 +108,8 @@ struct Sprite {
         GLenum type() const {
             switch (image.format + image.format2) {
             case 1:
+                // Uploaded natively, without expanding to 8 bits per channel.
+                return GL_UNSIGNED_SHORT_4_4_4_4_REV;
             case 2:
                 return GL_UNSIGNED_BYTE;
             case 513:
@@ -68,11 +122,6 @@ struct Sprite {
             return 0;
         }
 
-        ~Frame() {
-            if (texture)
-                glDeleteTextures(1, &texture);
-        }
-
         Frame() = default;
         Frame(Frame&& rhs) = default;
         Frame& operator=(Frame&& rhs) = default;
@@ -0,0 +1,64 @@
+#include "gfx/texture.hh"
+
+#include "gfx/uploader.hh"
+
+namespace gfx {
+
+Texture::~Texture() {
+    if (!name)
+        return;
+
+    if (!ready)
+        Uploader::Global().forget(this);
+
+    gl::State::Global().forget_texture(name);
+    glDeleteTextures(1, &name);
+}
+
+std::shared_ptr<const Texture> TextureCache::find(
+    const wz::ImageKey& key,
+    size_t size,
+    Rect<float>* uv) {
+    ++stats.lookups;
+
+    auto it = textures.find(key);
+    if (it == textures.end())
+        return nullptr;
+
+    // Textures still being uploaded are not shared: the upload reads the
+    // pixels of the frame that queued it, which may go away first.
+    std::shared_ptr<const Texture> texture = it->second.texture.lock();
+    if (texture && !texture->ready)
+        return nullptr;
+
+    if (texture) {
+        ++stats.hits;
+        stats.shared_bytes += size;
+        *uv = it->second.uv;
+    }
+
+    return texture;
+}
+
+void TextureCache::insert(
+    const wz::ImageKey& key,
+    std::shared_ptr<const Texture> texture,
+    Rect<float> uv,
+    size_t size) {
+    stats.uploaded_bytes += size;
+    textures[key] = Entry{
+        .texture = texture,
+        .uv = uv,
+    };
+
+    // Entries whose textures have been deleted are only removed
+    // periodically, so that pruning is amortized over insertions.
+    if (textures.size() >= prune_at) {
+        std::erase_if(textures, [](const auto& it) {
+            return it.second.texture.expired();
+        });
+        prune_at = textures.size() * 2 + 1024;
+    }
+}
+
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "p.hh"
+#include "gl.hh"
+#include "gfx/rect.hh"
+#include "wz/imagestore.hh"
+
+namespace gfx {
+
+// Texture owns an OpenGL texture name. Textures are shared between the
+// Frames that display them.
+//
+// In headless mode, textures have no name: their images are kept in memory
+// instead, expanded to 8-bit RGBA, for renderers that draw on the CPU.
+struct Texture {
+    N<GLuint> name;
+
+    // id identifies the texture among all textures ever created, unlike
+    // name, which is reused. Draws are grouped by it.
+    const uint32_t id = NextId();
+
+    // pixels holds the image of a headless texture, of width x height
+    // pixels.
+    std::vector<uint8_t> pixels;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    // repeating is set for textures that wrap around, rather than clamp to
+    // their edges, so that they can be tiled by a single quad.
+    bool repeating = false;
+
+    // ready is cleared while the texture's image is being uploaded in the
+    // background, by Uploader. Textures that are not ready must not be
+    // drawn.
+    bool ready = true;
+
+    static uint32_t NextId() {
+        static std::atomic<uint32_t> next = 1;
+        return next++;
+    }
+
+    // Headless returns whether textures are created in headless mode. It
+    // must be set before any frame is loaded, by programs that never create
+    // a GL context.
+    static bool& Headless() {
+        static bool headless = false;
+        return headless;
+    }
+
+    ~Texture();
+
+    Texture() = default;
+    Texture(Texture&&) = delete;
+    Texture(const Texture&) = delete;
+};
+
+// TextureCache maps image contents to uploaded textures, so that images with
+// equal contents are only uploaded once. Images packed into an atlas map to
+// their page, along with their region of it. The cache does not keep textures
+// alive: entries expire once every Frame using them is destroyed.
+// TextureCache must only be used from the thread owning the GL context.
+struct TextureCache {
+    struct Stats {
+        // lookups is the number of textures requested from the cache.
+        uint64_t lookups;
+
+        // hits is the number of lookups served by an uploaded texture.
+        uint64_t hits;
+
+        // uploaded_bytes is the number of bytes of pixels uploaded.
+        uint64_t uploaded_bytes;
+
+        // shared_bytes is the number of bytes of pixels that did not need to
+        // be uploaded, because they were shared.
+        uint64_t shared_bytes;
+    };
+
+    // Entry is an uploaded image: a texture, and the rectangle of it that
+    // holds the image, in texture coordinates.
+    struct Entry {
+        std::weak_ptr<const Texture> texture;
+        Rect<float> uv;
+    };
+
+    std::unordered_map<wz::ImageKey, Entry, wz::ImageKey::Hash> textures;
+    Stats stats = { 0 };
+
+    // prune_at is the size of textures at which expired entries are next
+    // pruned.
+    size_t prune_at = 1024;
+
+    // find returns the texture uploaded for key, if there is one, and sets
+    // uv to the image's rectangle of it. size is the size of the image's
+    // pixels, for statistics.
+    std::shared_ptr<const Texture> find(
+        const wz::ImageKey& key,
+        size_t size,
+        Rect<float>* uv);
+
+    // insert records that texture was uploaded for key, in its uv rectangle.
+    void insert(
+        const wz::ImageKey& key,
+        std::shared_ptr<const Texture> texture,
+        Rect<float> uv,
+        size_t size);
+
+    static TextureCache& Global() {
+        static TextureCache cache;
+        return cache;
+    }
+
+    TextureCache() = default;
+    TextureCache(TextureCache&&) = delete;
+    TextureCache(const TextureCache&) = delete;
+};
+
+}
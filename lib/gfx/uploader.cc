@@ -0,0 +1,443 @@
+#include "gfx/uploader.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#include "logger.hh"
+
+namespace gfx {
+
+// Uploader_reserve reserves size bytes of the staging buffer after the last
+// reserved region, wrapping around to its start if need be. It returns false
+// if there is no room until older regions are released.
+static bool Uploader_reserve(
+    Uploader* self,
+    size_t size,
+    size_t* offset) {
+    const size_t capacity = self->options.staging_size;
+    if (self->regions.empty())
+        self->head = 0;
+
+    const size_t tail = self->regions.empty() ? 0 : self->regions.front().offset;
+
+    size_t at = 0;
+    if (self->regions.empty() || self->head > tail) {
+        if (self->head + size <= capacity)
+            at = self->head;
+        else if (size <= tail)
+            at = 0;
+        else
+            return false;
+    } else if (self->head < tail && self->head + size <= tail) {
+        at = self->head;
+    } else {
+        return false;
+    }
+
+    self->head = at + size;
+    self->regions.push_back(Uploader::Region{
+        .offset = at,
+        .size = size,
+        .done = false,
+        .fence = nullptr,
+    });
+
+    *offset = at;
+    return true;
+}
+
+// Uploader_release marks the region of job as done. If the GPU may still be
+// reading it, fence signals once it is not.
+static void Uploader_release(
+    Uploader* self,
+    const Uploader::Job* job,
+    GLsync fence) {
+    for (Uploader::Region& region : self->regions) {
+        if (region.offset == job->offset && !region.done) {
+            region.done = true;
+            region.fence = fence;
+            return;
+        }
+    }
+
+    if (fence)
+        glDeleteSync(fence);
+}
+
+// Uploader_work stages queued jobs, in order, for as long as the uploader
+// runs.
+static void Uploader_work(
+    Uploader* self) {
+    std::unique_lock<std::mutex> lock(self->lock);
+
+    while (!self->quit) {
+        auto it = std::find_if(self->jobs.begin(), self->jobs.end(), [](const auto& job) {
+            return job->state == Uploader::Job::QUEUED;
+        });
+
+        // Jobs are staged in the order they were queued, so a job that does
+        // not fit yet waits for older ones to be released.
+        size_t offset = 0;
+        if (it == self->jobs.end() || !Uploader_reserve(self, (*it)->size, &offset)) {
+            self->changed.wait(lock);
+            continue;
+        }
+
+        Uploader::Job* job = it->get();
+        job->state = Uploader::Job::STAGING;
+        job->offset = offset;
+
+        lock.unlock();
+
+        uint8_t* to = self->staging + offset;
+        if (!job->pixels) {
+            const wz::Image& image = job->image;
+            const size_t stride = static_cast<size_t>(image.width) * 4;
+            Error e = image.bands(0, [&](const wz::Image::Band& band) -> Error {
+                if (job->expand)
+                    return image.expand(band, to + stride * band.y);
+
+                memcpy(to + image.bandsize(band.y), band.pixels, image.bandsize(band.rows));
+                return Error();
+            });
+            job->failed = static_cast<bool>(e);
+        } else if (job->expand) {
+            Error e = job->image.expand(job->pixels, to);
+            job->failed = static_cast<bool>(e);
+        } else {
+            memcpy(to, job->pixels, job->size);
+        }
+
+        lock.lock();
+        job->state = Uploader::Job::STAGED;
+        self->changed.notify_all();
+    }
+}
+
+Error Uploader::start(
+    const Options& options) {
+    if (started) {
+        return error_new(Error::INVALIDUSAGE)
+            << "uploader already started";
+    }
+
+    this->options = options;
+    if (this->options.threads == 0)
+        this->options.threads = DEFAULT_THREADS;
+    if (this->options.staging_size == 0)
+        this->options.staging_size = DEFAULT_STAGING_SIZE;
+    if (this->options.budget.count() == 0)
+        this->options.budget = DEFAULT_BUDGET;
+
+    const GLsizeiptr size = static_cast<GLsizeiptr>(this->options.staging_size);
+    if (GLEW_ARB_buffer_storage) {
+        // The buffer stays mapped for as long as it lives, and writes to it
+        // are visible to the GPU without flushing.
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glGenBuffers(1, &buffer);
+        gl::State::Global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+        staging = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+        gl::State::Global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (!staging) {
+            glDeleteBuffers(1, &buffer);
+            buffer = 0;
+        }
+    }
+
+    if (!staging) {
+        LOG(Logger::WARNING)
+            << "persistently mapped buffers are not supported; staging uploads in memory";
+
+        fallback.resize(this->options.staging_size);
+        staging = fallback.data();
+    }
+
+    quit = false;
+    for (uint32_t i = 0; i < this->options.threads; ++i)
+        threads.emplace_back(Uploader_work, this);
+
+    started = true;
+    return Error();
+}
+
+bool Uploader::accepts(
+    const wz::Image& image) {
+    if (!started)
+        return false;
+
+    Sprite::Frame frame;
+    frame.image = image;
+
+    const bool expand = frame.compressed() && !GLEW_EXT_texture_compression_s3tc;
+    const size_t size = expand ? image.expandedsize() : image.rawsize();
+    return size > 0 && size <= options.staging_size;
+}
+
+Error Uploader::enqueue(
+    Sprite::Frame* frame,
+    const uint8_t* pixels,
+    GLint wrap) {
+    if (!frame->compressed() && frame->format() == 0) {
+        return error_new(Error::UNKNOWNIMAGEFORMAT)
+            << "unsupported image format " << (frame->image.format + frame->image.format2);
+    }
+
+    std::shared_ptr<Texture> texture(new Texture());
+    glGenTextures(1, &texture->name);
+    texture->ready = false;
+    texture->repeating = wrap == GL_REPEAT;
+
+    gl::State::Global().bind_texture(texture->name);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+
+    std::unique_ptr<Job> job(new Job());
+    job->texture = texture.get();
+    job->image = frame->image;
+    job->pixels = pixels;
+    job->expand = frame->compressed() && !GLEW_EXT_texture_compression_s3tc;
+    job->compressed_format = job->expand ? 0 : frame->compressed_format();
+    job->format = frame->format();
+    job->type = frame->type();
+    job->state = Job::QUEUED;
+    job->failed = false;
+    job->offset = 0;
+    job->size = job->expand ? frame->image.expandedsize() : frame->image.rawsize();
+    job->rows = 0;
+
+    frame->texture = std::move(texture);
+    frame->uv = Rect<float>{
+        .topleft = { .x = 0, .y = 0 },
+        .bottomright = { .x = 1, .y = 1 },
+    };
+
+    std::lock_guard<std::mutex> lock(this->lock);
+    jobs.push_back(std::move(job));
+    ++totals.queued;
+    changed.notify_all();
+
+    return Error();
+}
+
+// Uploader_band uploads the next band of rows of job, from source.
+static void Uploader_band(
+    Uploader* self,
+    Uploader::Job* job,
+    const uint8_t* source) {
+    const wz::Image& image = job->image;
+    const uint32_t band = std::min(
+        image.bandrows(wz::Image::DEFAULT_BAND_ROWS),
+        image.height - job->rows);
+
+    if (job->rows == 0) {
+        // Allocate the texture's storage, from no buffer at all.
+        gl::State::Global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (job->compressed_format) {
+            glCompressedTexImage2D(
+                GL_TEXTURE_2D,
+                0,
+                job->compressed_format,
+                image.width,
+                image.height,
+                0,
+                image.rawsize(),
+                nullptr);
+        } else {
+            glTexImage2D(
+                GL_TEXTURE_2D,
+                0,
+                GL_RGBA8,
+                image.width,
+                image.height,
+                0,
+                GL_RGBA,
+                GL_UNSIGNED_BYTE,
+                nullptr);
+        }
+    }
+
+    gl::State::Global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, self->buffer);
+
+    if (job->expand) {
+        glTexSubImage2D(
+            GL_TEXTURE_2D,
+            0,
+            0,
+            job->rows,
+            image.width,
+            band,
+            GL_RGBA,
+            GL_UNSIGNED_BYTE,
+            source + static_cast<size_t>(image.width) * 4 * job->rows);
+    } else if (job->compressed_format) {
+        glCompressedTexSubImage2D(
+            GL_TEXTURE_2D,
+            0,
+            0,
+            job->rows,
+            image.width,
+            band,
+            job->compressed_format,
+            image.bandsize(band),
+            source + image.bandsize(job->rows));
+    } else {
+        glTexSubImage2D(
+            GL_TEXTURE_2D,
+            0,
+            0,
+            job->rows,
+            image.width,
+            band,
+            job->format,
+            job->type,
+            source + image.bandsize(job->rows));
+    }
+
+    job->rows += band;
+}
+
+void Uploader::pump() {
+    if (!started)
+        return;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(this->lock);
+
+    // Release the regions that the GPU is done with, oldest first.
+    bool released = false;
+    while (!regions.empty() && regions.front().done) {
+        Region& region = regions.front();
+        if (region.fence) {
+            const GLenum status = glClientWaitSync(region.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+
+            glDeleteSync(region.fence);
+        }
+
+        regions.pop_front();
+        released = true;
+    }
+
+    if (released)
+        changed.notify_all();
+
+    // Rows of 16-bit images of odd widths are not 4-byte aligned.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    bool spent = false;
+    while (!spent) {
+        auto it = std::find_if(jobs.begin(), jobs.end(), [](const auto& job) {
+            return job->state == Job::STAGED;
+        });
+        if (it == jobs.end())
+            break;
+
+        Job* job = it->get();
+        if (job->failed) {
+            LOG(Logger::ERROR)
+                << "failed to stage image of " << job->image.width << " x " << job->image.height;
+
+            Uploader_release(this, job, nullptr);
+            jobs.erase(it);
+            continue;
+        }
+
+        // Only this thread removes jobs, so the job stays put while the
+        // lock is released for the upload.
+        lock.unlock();
+
+        // With a pixel buffer bound, sources are offsets into it.
+        const uint8_t* source = buffer ?
+            reinterpret_cast<const uint8_t*>(job->offset) :
+            staging + job->offset;
+
+        gl::State::Global().bind_texture(job->texture->name);
+        while (job->rows < job->image.height) {
+            Uploader_band(this, job, source);
+
+            // Always upload at least one band, so that uploads progress.
+            if (std::chrono::steady_clock::now() - start >= options.budget) {
+                spent = true;
+                break;
+            }
+        }
+
+        lock.lock();
+
+        if (job->rows == job->image.height) {
+            // Without a pixel buffer, pixels are copied out of the staging
+            // buffer as they are uploaded.
+            Uploader_release(this, job, buffer ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : nullptr);
+
+            job->texture->ready = true;
+            ++totals.uploaded;
+            totals.bytes += job->size;
+
+            jobs.erase(std::find_if(jobs.begin(), jobs.end(), [job](const auto& j) {
+                return j.get() == job;
+            }));
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    gl::State::Global().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void Uploader::forget(
+    const Texture* texture) {
+    std::unique_lock<std::mutex> lock(this->lock);
+    if (jobs.empty())
+        return;
+
+    auto find = [&]() {
+        return std::find_if(jobs.begin(), jobs.end(), [texture](const auto& job) {
+            return job->texture == texture;
+        });
+    };
+
+    auto it = find();
+    if (it == jobs.end())
+        return;
+
+    // A worker may be reading the job's pixels, which are about to go away.
+    while ((*it)->state == Job::STAGING) {
+        changed.wait(lock);
+        it = find();
+    }
+
+    if ((*it)->state == Job::STAGED) {
+        // The GPU may still be reading bands that were uploaded.
+        const bool uploading = (*it)->rows > 0 && buffer;
+        Uploader_release(this, it->get(), uploading ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : nullptr);
+    }
+
+    jobs.erase(it);
+    changed.notify_all();
+}
+
+Uploader::Stats Uploader::stats() {
+    std::lock_guard<std::mutex> lock(this->lock);
+
+    Stats stats = totals;
+    stats.pending = jobs.size();
+    return stats;
+}
+
+Uploader::~Uploader() {
+    {
+        std::lock_guard<std::mutex> lock(this->lock);
+        quit = true;
+        changed.notify_all();
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "p.hh"
+#include "gl.hh"
+#include "gfx/sprite.hh"
+#include "gfx/texture.hh"
+#include "util/error.hh"
+#include "wz/property.hh"
+
+namespace gfx {
+
+// Uploader uploads textures in the background, so that loading many large
+// images does not stall the thread owning the GL context.
+//
+// Worker threads copy the pixels of queued images, expanding them if the GPU
+// cannot decode them, into a staging buffer: a pixel buffer object that is
+// persistently mapped if the driver supports it, or plain memory otherwise.
+// Images queued without pixels, such as streamed canvases, are decoded from
+// their compressed data by the workers, a band at a time, straight into the
+// staging buffer.
+// pump then uploads staged images from the staging buffer, a band of rows at
+// a time, until its time budget is spent. A texture is marked ready once all
+// of its image has been uploaded; until then, it must not be drawn.
+//
+// The pixels, or compressed data, of queued images must stay valid until
+// their texture is ready or deleted. Deleting a texture cancels its upload.
+//
+// Uploader must be started, and pumped, from the thread owning the GL
+// context. Until it is started, textures are uploaded synchronously.
+struct Uploader {
+    struct Options {
+        // threads is the number of worker threads. If 0, DEFAULT_THREADS is
+        // used.
+        uint32_t threads;
+
+        // staging_size is the size of the staging buffer, and so the largest
+        // image that can be uploaded in the background. If 0,
+        // DEFAULT_STAGING_SIZE is used.
+        size_t staging_size;
+
+        // budget is the time that each pump may spend uploading. If 0,
+        // DEFAULT_BUDGET is used.
+        std::chrono::microseconds budget;
+    };
+
+    static constexpr uint32_t DEFAULT_THREADS = 2;
+    static constexpr size_t DEFAULT_STAGING_SIZE = 64 << 20;
+    static constexpr std::chrono::microseconds DEFAULT_BUDGET{ 4000 };
+
+    // Job is a queued image. Jobs are QUEUED until a worker reserves their
+    // region of the staging buffer, STAGING while the worker copies their
+    // pixels, and STAGED once they are ready to be uploaded.
+    struct Job {
+        enum State {
+            QUEUED,
+            STAGING,
+            STAGED,
+        };
+
+        Texture* texture;
+        wz::Image image;
+
+        // pixels are the decoded pixels of image, or null if they are to be
+        // decoded from image's data when the job is staged.
+        const uint8_t* pixels;
+
+        // expand is set for compressed images that the GPU cannot decode,
+        // which are expanded to RGBA when they are staged.
+        bool expand;
+        GLenum compressed_format;
+        GLenum format;
+        GLenum type;
+
+        State state;
+        bool failed;
+
+        // offset and size are the job's region of the staging buffer.
+        size_t offset;
+        size_t size;
+
+        // rows is the number of rows uploaded so far.
+        uint32_t rows;
+    };
+
+    // Region is a reserved part of the staging buffer. Regions are reserved,
+    // and released, in order. A region is released once its job is done and
+    // its fence has signaled, at which point the GPU has read it.
+    struct Region {
+        size_t offset;
+        size_t size;
+        bool done;
+        GLsync fence;
+    };
+
+    struct Stats {
+        // queued is the number of images ever queued, and uploaded the
+        // number whose textures are ready.
+        uint64_t queued;
+        uint64_t uploaded;
+
+        // bytes is the number of bytes uploaded.
+        uint64_t bytes;
+
+        // pending is the number of images that are not uploaded yet.
+        uint64_t pending;
+    };
+
+    Options options;
+    bool started = false;
+
+    // buffer is the pixel buffer object of the staging buffer, if it is
+    // persistently mapped at staging. Otherwise, staging is fallback.
+    N<GLuint> buffer;
+    uint8_t* staging = nullptr;
+    std::vector<uint8_t> fallback;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::unique_ptr<Job>> jobs;
+    std::deque<Region> regions;
+    size_t head = 0;
+    bool quit = false;
+    std::vector<std::thread> threads;
+    Stats totals = { 0 };
+
+    // start creates the staging buffer, and starts the worker threads.
+    Error start(
+        const Options& options = {});
+
+    // accepts returns whether image can be uploaded in the background.
+    bool accepts(
+        const wz::Image& image);
+
+    // enqueue creates the texture of frame, whose image is already set,
+    // wrapping with wrap, and queues pixels to be uploaded into it. If pixels
+    // is null, they are decoded from the image's data instead. The texture
+    // is not ready until they are uploaded.
+    Error enqueue(
+        Sprite::Frame* frame,
+        const uint8_t* pixels,
+        GLint wrap = GL_CLAMP_TO_EDGE);
+
+    // pump releases the parts of the staging buffer that the GPU is done
+    // with, and uploads staged images until the time budget is spent. It is
+    // meant to be called once per frame.
+    void pump();
+
+    // forget cancels the upload into texture, which is being deleted.
+    void forget(
+        const Texture* texture);
+
+    Stats stats();
+
+    static Uploader& Global() {
+        static Uploader uploader;
+        return uploader;
+    }
+
+    ~Uploader();
+
+    Uploader() = default;
+    Uploader(Uploader&&) = delete;
+    Uploader(const Uploader&) = delete;
+};
+
+}
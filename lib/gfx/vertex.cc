@@ -7,9 +7,10 @@ namespace gfx {
 Error Vertex::configure(
     const gl::Program<Vertex>* program,
     const gl::Drawable<Vertex>* drawable) {
-    glBindVertexArray(drawable->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, drawable->vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable->ebo);
+    gl::State& state = gl::State::Global();
+    state.bind_vertex_array(drawable->vao);
+    state.bind_buffer(GL_ARRAY_BUFFER, drawable->vbo);
+    state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, drawable->ebo);
 
     GLuint position = 0;
     CHECK(program->attribute(
@@ -1,5 +1,8 @@
 #include "gl.hh"
 
+#include <algorithm>
+#include <cstring>
+
 #include "logger.hh"
 
 namespace gl {
@@ -14,4 +17,127 @@ Error init() {
     return Error();
 }
 
+// State_cache records values as the value of slot, and returns whether they
+// differ from its cached value.
+static bool State_cache(
+    State::Slot* slot,
+    const GLfloat* values,
+    GLsizei size) {
+    if (slot->size == size &&
+        std::memcmp(slot->values, values, size * sizeof(GLfloat)) == 0)
+        return false;
+
+    slot->size = size;
+    std::memcpy(slot->values, values, size * sizeof(GLfloat));
+    return true;
+}
+
+void State::set(
+    Uniform uniform,
+    GLfloat x,
+    GLfloat y) {
+    if (uniform.slot == 0)
+        return;
+
+    Slot& slot = slots[uniform.slot];
+    const GLfloat values[2] = { x, y };
+    if (!State_cache(&slot, values, 2)) {
+        ++stats.skipped;
+        return;
+    }
+
+    use(slot.program);
+    glUniform2f(slot.location, x, y);
+    ++stats.calls;
+}
+
+void State::set(
+    Uniform uniform,
+    const GLfloat matrix[4][4]) {
+    if (uniform.slot == 0)
+        return;
+
+    Slot& slot = slots[uniform.slot];
+    if (!State_cache(&slot, &matrix[0][0], 16)) {
+        ++stats.skipped;
+        return;
+    }
+
+    use(slot.program);
+    glUniformMatrix4fv(slot.location, 1, GL_FALSE, &matrix[0][0]);
+    ++stats.calls;
+}
+
+// Integer uniforms are cached by their bits.
+void State::set(
+    Uniform uniform,
+    GLint x) {
+    if (uniform.slot == 0)
+        return;
+
+    Slot& slot = slots[uniform.slot];
+    GLfloat value;
+    std::memcpy(&value, &x, sizeof(value));
+    if (!State_cache(&slot, &value, 1)) {
+        ++stats.skipped;
+        return;
+    }
+
+    use(slot.program);
+    glUniform1i(slot.location, x);
+    ++stats.calls;
+}
+
+void State::set(
+    Uniform uniform,
+    GLuint x) {
+    if (uniform.slot == 0)
+        return;
+
+    Slot& slot = slots[uniform.slot];
+    GLfloat value;
+    std::memcpy(&value, &x, sizeof(value));
+    if (!State_cache(&slot, &value, 1)) {
+        ++stats.skipped;
+        return;
+    }
+
+    use(slot.program);
+    glUniform1ui(slot.location, x);
+    ++stats.calls;
+}
+
+void State::forget_program(
+    GLuint program) {
+    if (this->program == program)
+        this->program = 0;
+
+    // A new program may reuse the name, with uniforms of its own.
+    for (Slot& slot : slots) {
+        if (slot.program == program)
+            slot.size = 0;
+    }
+}
+
+void State::forget_vertex_array(
+    GLuint vertex_array) {
+    if (this->vertex_array == vertex_array)
+        this->vertex_array = 0;
+}
+
+void State::forget_buffer(
+    GLuint buffer) {
+    if (array_buffer == buffer)
+        array_buffer = 0;
+}
+
+void State::forget_texture(
+    GLuint texture) {
+    std::replace(
+        std::begin(textures),
+        std::end(textures),
+        texture,
+        static_cast<GLuint>(0));
+}
+
 }
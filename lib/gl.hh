@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -14,6 +16,192 @@ namespace gl {
 
 Error init();
 
+// State tracks the GL state that draws bind most often: the program, the
+// vertex array, the array buffer, the textures of each texture unit, and the
+// values of uniforms. Binding what is already bound, or setting a uniform to
+// the value it already has, is skipped.
+//
+// Uniforms are resolved by name once, into Uniform handles, so that setting
+// them does not look them up.
+//
+// The tracked state must only be changed through State, and objects must be
+// forgotten when they are deleted, since GL reuses their names. State must
+// only be used from the thread owning the GL context.
+struct State {
+    // TEXTURE_UNITS is the number of texture units tracked.
+    static constexpr size_t TEXTURE_UNITS = 16;
+
+    // Uniform is a handle to a uniform of a program. The zero handle refers
+    // to no uniform, and setting it does nothing.
+    struct Uniform {
+        uint32_t slot;
+    };
+
+    struct Stats {
+        // calls is the number of GL calls made through State.
+        uint64_t calls;
+
+        // skipped is the number of GL calls that were not made, because they
+        // would not have changed anything.
+        uint64_t skipped;
+    };
+
+    // Slot is the cached value of a uniform. size is the number of values
+    // cached, and is zero until the uniform is first set.
+    struct Slot {
+        GLuint program;
+        GLint location;
+        GLsizei size;
+        GLfloat values[16];
+    };
+
+    GLuint program = 0;
+    GLuint vertex_array = 0;
+    GLuint array_buffer = 0;
+    GLuint active_texture = 0;
+    GLuint textures[TEXTURE_UNITS] = { 0 };
+
+    std::vector<Slot> slots = std::vector<Slot>(1);
+    Stats stats = { 0 };
+
+    void use(
+        GLuint program) {
+        if (this->program == program) {
+            ++stats.skipped;
+            return;
+        }
+
+        glUseProgram(program);
+        this->program = program;
+        ++stats.calls;
+    }
+
+    void bind_vertex_array(
+        GLuint vertex_array) {
+        if (this->vertex_array == vertex_array) {
+            ++stats.skipped;
+            return;
+        }
+
+        glBindVertexArray(vertex_array);
+        this->vertex_array = vertex_array;
+        ++stats.calls;
+    }
+
+    // bind_buffer binds buffer to target. Only GL_ARRAY_BUFFER is tracked:
+    // the element array buffer is part of the bound vertex array's state.
+    void bind_buffer(
+        GLenum target,
+        GLuint buffer) {
+        if (target == GL_ARRAY_BUFFER) {
+            if (array_buffer == buffer) {
+                ++stats.skipped;
+                return;
+            }
+
+            array_buffer = buffer;
+        }
+
+        glBindBuffer(target, buffer);
+        ++stats.calls;
+    }
+
+    // activate_texture makes unit the active texture unit.
+    void activate_texture(
+        GLuint unit) {
+        if (active_texture == unit) {
+            ++stats.skipped;
+            return;
+        }
+
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active_texture = unit;
+        ++stats.calls;
+    }
+
+    // bind_texture binds texture to target of unit, and leaves unit active,
+    // even if texture was already bound, since texture calls that follow a
+    // bind act on the active unit. Units are tracked whatever their target,
+    // so each unit must only be used with one target.
+    void bind_texture(
+        GLuint texture,
+        GLuint unit = 0,
+        GLenum target = GL_TEXTURE_2D) {
+        activate_texture(unit);
+
+        if (textures[unit] == texture) {
+            ++stats.skipped;
+            return;
+        }
+
+        glBindTexture(target, texture);
+        textures[unit] = texture;
+        ++stats.calls;
+    }
+
+    // uniform resolves the uniform name of program into a handle.
+    template <typename P>
+    Error uniform(
+        const P& program,
+        const char* name,
+        Uniform* uniform) {
+        auto it = program.uniforms.find(name);
+        if (it == program.uniforms.end()) {
+            return error_new(Error::GLERROR)
+                << "no \"" << name << "\" uniform found in shaders";
+        }
+
+        uniform->slot = static_cast<uint32_t>(slots.size());
+        slots.push_back(Slot{
+            .program = program.program,
+            .location = static_cast<GLint>(it->second),
+            .size = 0,
+        });
+
+        return Error();
+    }
+
+    void set(
+        Uniform uniform,
+        GLfloat x,
+        GLfloat y);
+
+    void set(
+        Uniform uniform,
+        const GLfloat matrix[4][4]);
+
+    void set(
+        Uniform uniform,
+        GLint x);
+
+    void set(
+        Uniform uniform,
+        GLuint x);
+
+    // forget_* drop the objects of a name, which is about to be deleted,
+    // from the tracked state.
+    void forget_program(
+        GLuint program);
+
+    void forget_vertex_array(
+        GLuint vertex_array);
+
+    void forget_buffer(
+        GLuint buffer);
+
+    void forget_texture(
+        GLuint texture);
+
+    static State& Global() {
+        static State state;
+        return state;
+    }
+
+    State() = default;
+    State(State&&) = delete;
+    State(const State&) = delete;
+};
+
 template <typename V>
 struct Program {
     N<GLuint> program;
@@ -54,8 +242,10 @@ struct Program {
     }
 
     ~Program() {
-        if (program)
+        if (program) {
+            State::Global().forget_program(program);
             glDeleteProgram(program);
+        }
     }
 
     Program() = default;
@@ -89,7 +279,7 @@ struct Drawable {
     void vbo_load(
         const V* vertices,
         size_t count) {
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        State::Global().bind_buffer(GL_ARRAY_BUFFER, vbo);
         glBufferData(
             GL_ARRAY_BUFFER,
             count * sizeof(V),
@@ -97,11 +287,15 @@ struct Drawable {
             GL_STREAM_DRAW);
     }
 
+    // ebo_load_ binds the vertex array first, since the element array buffer
+    // binding is part of the bound vertex array's state.
     template <typename E>
     void ebo_load_(
         const E* indices,
         size_t count) {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        State& state = State::Global();
+        state.bind_vertex_array(vao);
+        state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
         glBufferData(
             GL_ELEMENT_ARRAY_BUFFER,
             count * sizeof(E),
@@ -131,14 +325,21 @@ struct Drawable {
     }
 
     ~Drawable() {
-        if (vao)
+        State& state = State::Global();
+        if (vao) {
+            state.forget_vertex_array(vao);
             glDeleteVertexArrays(1, &vao);
+        }
 
-        if (vbo)
+        if (vbo) {
+            state.forget_buffer(vbo);
             glDeleteBuffers(1, &vbo);
+        }
 
-        if (ebo)
+        if (ebo) {
+            state.forget_buffer(ebo);
             glDeleteBuffers(1, &ebo);
+        }
     }
 
     Drawable() = default;
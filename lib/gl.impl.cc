@@ -142,7 +142,7 @@ Error Drawable<V>::init(
         << "failed to configure VAO for vertex";
 
     if (options->vbo_init_size) {
-        glBindBuffer(GL_ARRAY_BUFFER, self->vbo);
+        State::Global().bind_buffer(GL_ARRAY_BUFFER, self->vbo);
         glBufferData(
             GL_ARRAY_BUFFER,
             options->vbo_init_size,
@@ -151,7 +151,7 @@ Error Drawable<V>::init(
     }
 
     if (options->ebo_init_size) {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, self->ebo);
+        State::Global().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, self->ebo);
         glBufferData(
             GL_ELEMENT_ARRAY_BUFFER,
             options->ebo_init_size,
@@ -58,7 +58,7 @@ Error Window::frame(
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glDisable(GL_CULL_FACE);
     glDisable(GL_DEPTH_TEST);
-    glActiveTexture(GL_TEXTURE0);
+    State::Global().activate_texture(0);
 
     glViewport(
         viewport.topleft.x,
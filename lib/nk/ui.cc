@@ -8,9 +8,10 @@ namespace nk {
 Error Vertex::configure(
     const gl::Program<Vertex>* program,
     const gl::Drawable<Vertex>* drawable) {
-    glBindVertexArray(drawable->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, drawable->vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, drawable->ebo);
+    gl::State& state = gl::State::Global();
+    state.bind_vertex_array(drawable->vao);
+    state.bind_buffer(GL_ARRAY_BUFFER, drawable->vbo);
+    state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, drawable->ebo);
 
     GLuint position = 0;
     CHECK(program->attribute(
@@ -101,6 +102,12 @@ Error Program::init(
         &compile_options),
         Error::UIERROR) << "failed to compile render program";
 
+    CHECK(gl::State::Global().uniform(
+        self->program,
+        "projection",
+        &self->projection_uniform),
+        Error::UIERROR) << "failed to resolve render program uniforms";
+
     LOG(Logger::INFO) << "shaders compiled";
     return Error();
 }
@@ -193,7 +200,7 @@ static Error Ui_init_fonts(
             &img_height,
             NK_FONT_ATLAS_RGBA32);
 
-        glBindTexture(GL_TEXTURE_2D, font_texture);
+        gl::State::Global().bind_texture(font_texture);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
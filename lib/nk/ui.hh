@@ -20,17 +20,16 @@ struct Vertex {
 struct Program {
         gl::Program<Vertex> program;
 
+        gl::State::Uniform projection_uniform;
+
         static Error init(
                 Program* self);
 
         void projection(
                 GLfloat projection[4][4]) {
-                glUseProgram(program.program);
-                glUniformMatrix4fv(
-                        program.uniforms.at("projection"),
-                        1,
-                        GL_FALSE,
-                        &projection[0][0]);
+                gl::State::Global().set(
+                        projection_uniform,
+                        projection);
         }
 
         Program() = default;
@@ -52,6 +52,8 @@ struct Error {
         MAP_LOAD_MISSINGATTRIBUTES,
         MAP_LOAD_PORTALLOADFAILED,
         WZ_DESERIALIZE_FAILED,
+        WZ_WRITE_FAILED,
+        PNG_WRITE_FAILED,
     };
 
     struct Frame {
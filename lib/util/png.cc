@@ -0,0 +1,166 @@
+#include "util/png.hh"
+
+#include <cstring>
+#define ZLIB_CONST
+#include <zlib.h>
+
+namespace util {
+
+// PngWriter_u32 appends x to out, in network byte order.
+static void PngWriter_u32(
+    std::vector<uint8_t>* out,
+    uint32_t x) {
+    out->push_back(static_cast<uint8_t>(x >> 24));
+    out->push_back(static_cast<uint8_t>(x >> 16));
+    out->push_back(static_cast<uint8_t>(x >> 8));
+    out->push_back(static_cast<uint8_t>(x));
+}
+
+// PngWriter_chunk writes a PNG chunk of the given type and data.
+static Error PngWriter_chunk(
+    std::ostream* out,
+    const char type[4],
+    const uint8_t* data,
+    size_t size) {
+    std::vector<uint8_t> header;
+    PngWriter_u32(&header, static_cast<uint32_t>(size));
+    header.insert(header.end(), type, type + 4);
+
+    uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+    if (size > 0)
+        crc = crc32(crc, data, static_cast<uInt>(size));
+
+    std::vector<uint8_t> trailer;
+    PngWriter_u32(&trailer, static_cast<uint32_t>(crc));
+
+    out->write(reinterpret_cast<const char*>(header.data()), header.size());
+    out->write(reinterpret_cast<const char*>(data), size);
+    out->write(reinterpret_cast<const char*>(trailer.data()), trailer.size());
+    if (!*out) {
+        return error_new(Error::PNG_WRITE_FAILED)
+            << "failed to write PNG chunk " << std::string(type, 4).c_str();
+    }
+
+    return Error();
+}
+
+// PngWriter_deflate compresses the input given to the stream, writing out an
+// IDAT chunk each time the chunk buffer fills. flush is a zlib flush mode.
+static Error PngWriter_deflate(
+    PngWriter* self,
+    int flush) {
+    z_stream* z = self->z.get();
+
+    int z_err = Z_OK;
+    do {
+        z->next_out = self->chunk.data() + (PngWriter::CHUNK_SIZE - z->avail_out);
+
+        z_err = deflate(z, flush);
+        if (z_err == Z_STREAM_ERROR) {
+            return error_new(Error::PNG_WRITE_FAILED)
+                << "zlib compression failed";
+        }
+
+        if (z->avail_out == 0 || (flush == Z_FINISH && z->avail_out < PngWriter::CHUNK_SIZE)) {
+            CHECK(PngWriter_chunk(self->out, "IDAT", self->chunk.data(), PngWriter::CHUNK_SIZE - z->avail_out),
+                Error::PNG_WRITE_FAILED) << "failed to write image data";
+            z->avail_out = PngWriter::CHUNK_SIZE;
+        }
+    } while (z->avail_in > 0 || (flush == Z_FINISH && z_err != Z_STREAM_END));
+
+    return Error();
+}
+
+Error PngWriter::open(
+    PngWriter* self,
+    std::ostream* out,
+    uint32_t width,
+    uint32_t height) {
+    if (width == 0 || height == 0) {
+        return error_new(Error::INVALIDUSAGE)
+            << "cannot write empty " << width << " x " << height << " PNG";
+    }
+
+    self->out = out;
+    self->width = width;
+    self->height = height;
+    self->written = 0;
+
+    std::unique_ptr<z_stream> z(new z_stream());
+    if (deflateInit(z.get(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+        return error_new(Error::INVALIDUSAGE)
+            << "failed to initialize zlib";
+    }
+    self->z.reset(z.release());
+
+    self->row.resize(1 + static_cast<size_t>(width) * 4);
+    self->chunk.resize(CHUNK_SIZE);
+    self->z->avail_out = CHUNK_SIZE;
+
+    static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    out->write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    // IHDR: 8-bit RGBA, deflate, adaptive filtering, no interlacing.
+    std::vector<uint8_t> ihdr;
+    PngWriter_u32(&ihdr, width);
+    PngWriter_u32(&ihdr, height);
+    ihdr.insert(ihdr.end(), { 8, 6, 0, 0, 0 });
+
+    return PngWriter_chunk(out, "IHDR", ihdr.data(), ihdr.size());
+}
+
+Error PngWriter::rows(
+    const uint8_t* rgba,
+    uint32_t count) {
+    if (written + count > height) {
+        return error_new(Error::INVALIDUSAGE)
+            << "too many rows: " << (written + count) << " > " << height;
+    }
+
+    const size_t stride = static_cast<size_t>(width) * 4;
+    for (uint32_t i = 0; i < count; ++i) {
+        // Every row uses the Sub filter, which is cheap, and compresses the
+        // flat runs of color common to game art well.
+        row[0] = 1;
+        memcpy(row.data() + 1, rgba, 4);
+        for (size_t x = 4; x < stride; ++x)
+            row[1 + x] = static_cast<uint8_t>(rgba[x] - rgba[x - 4]);
+
+        z->next_in = row.data();
+        z->avail_in = static_cast<uInt>(row.size());
+        CHECK(PngWriter_deflate(this, Z_NO_FLUSH),
+            Error::PNG_WRITE_FAILED) << "failed to write row " << written;
+
+        rgba += stride;
+        ++written;
+    }
+
+    return Error();
+}
+
+Error PngWriter::close() {
+    if (written != height) {
+        return error_new(Error::INVALIDUSAGE)
+            << "only " << written << " of " << height << " rows were written";
+    }
+
+    z->next_in = nullptr;
+    z->avail_in = 0;
+    CHECK(PngWriter_deflate(this, Z_FINISH),
+        Error::PNG_WRITE_FAILED) << "failed to finish image data";
+
+    z.reset();
+
+    CHECK(PngWriter_chunk(out, "IEND", nullptr, 0),
+        Error::PNG_WRITE_FAILED) << "failed to write PNG trailer";
+    out->flush();
+
+    return Error();
+}
+
+void PngWriter::Deflater::operator()(z_stream_s* z) const {
+    deflateEnd(z);
+    delete z;
+}
+
+}
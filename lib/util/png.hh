@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "util/error.hh"
+
+struct z_stream_s;
+
+namespace util {
+
+// PngWriter encodes an 8-bit RGBA PNG incrementally: rows are compressed and
+// written out as they are given, so that the whole image never needs to be
+// held in memory, neither raw nor encoded.
+//
+// ```
+// util::PngWriter png;
+// CHECK(util::PngWriter::open(&png, &out, width, height), ...);
+// for each band of rows:
+//     CHECK(png.rows(rgba, count), ...);
+// CHECK(png.close(), ...);
+// ```
+struct PngWriter {
+    // CHUNK_SIZE is the size of the compressed data buffered before it is
+    // written out as an IDAT chunk.
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    std::ostream* out;
+    uint32_t width;
+    uint32_t height;
+
+    // written is the number of rows written so far.
+    uint32_t written;
+
+    // Deflater ends and frees a zlib stream.
+    struct Deflater {
+        void operator()(z_stream_s* z) const;
+    };
+
+    std::unique_ptr<z_stream_s, Deflater> z;
+    std::vector<uint8_t> row;
+    std::vector<uint8_t> chunk;
+
+    // open writes the PNG header of a width x height image to out.
+    static Error open(
+        PngWriter* self,
+        std::ostream* out,
+        uint32_t width,
+        uint32_t height);
+
+    // rows writes count rows of 8-bit RGBA pixels, of width * 4 bytes each.
+    Error rows(
+        const uint8_t* rgba,
+        uint32_t count);
+
+    // close finishes the image, which must have had every row written.
+    Error close();
+
+    PngWriter() = default;
+    PngWriter(PngWriter&&) = default;
+    PngWriter(const PngWriter&) = delete;
+};
+
+}
@@ -0,0 +1,383 @@
+#include "wz/diskcache.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "logger.hh"
+#include "wz/hash.hh"
+
+// These are implemented alongside Wz, in the platform-specific sources.
+extern "C" {
+    int _wz_openfileforread(
+        int* handle_out,
+        size_t* size_out,
+        const char* filename);
+
+    int _wz_closefile(
+        int handle);
+
+    int _wz_mapfile(
+        const void** addr_out,
+        int handle,
+        size_t length);
+
+    int _wz_unmapfile(
+        const void* addr,
+        size_t length);
+}
+
+namespace wz {
+
+// CONTAINER_VERSION must be bumped whenever the container layout, or the
+// layout of decoded pixels, changes.
+static const uint32_t CONTAINER_VERSION = 1;
+static const char CONTAINER_MAGIC[8] = { 'W', 'Z', 'P', 'I', 'X', 'E', 'L', 'S' };
+static const char* CONTAINER_EXTENSION = ".px";
+
+// CONTAINER_ALIGNMENT is the alignment of pixels in a container.
+static const uint64_t CONTAINER_ALIGNMENT = 16;
+
+struct ContainerHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t identity;
+    uint64_t file_offset;
+};
+
+struct ContainerEntry {
+    uint64_t data_offset;
+    uint32_t data_length;
+    uint32_t size;
+    uint64_t pixels_offset;
+    uint64_t checksum;
+};
+
+static bool ContainerEntry_less(
+    const ContainerEntry& l,
+    const ContainerEntry& r) {
+    if (l.data_offset != r.data_offset)
+        return l.data_offset < r.data_offset;
+
+    return l.data_length < r.data_length;
+}
+
+static std::filesystem::path DiskCache_path(
+    const DiskCache* self,
+    const Wz* wz,
+    const File* f) {
+    std::stringstream ss;
+    ss << std::hex << wz->identity() << "-" << (f->base - wz->file.start) << CONTAINER_EXTENSION;
+    return self->directory / ss.str();
+}
+
+void DiskCache::Mapping::close() {
+    if (!extents.start)
+        return;
+
+    _wz_unmapfile(extents.start, extents.end - extents.start);
+    _wz_closefile(fd);
+
+    fd = 0;
+    extents = Extents{ 0 };
+}
+
+const uint8_t* DiskCache::Mapping::find(
+    uint64_t data_offset,
+    uint32_t data_length,
+    uint32_t size) const {
+    if (!extents.start)
+        return nullptr;
+
+    const ContainerHeader* header = reinterpret_cast<const ContainerHeader*>(extents.start);
+    const ContainerEntry* begin = reinterpret_cast<const ContainerEntry*>(header + 1);
+    const ContainerEntry* end = begin + header->count;
+
+    ContainerEntry key = { 0 };
+    key.data_offset = data_offset;
+    key.data_length = data_length;
+
+    const ContainerEntry* it = std::lower_bound(begin, end, key, ContainerEntry_less);
+    if (it == end ||
+        it->data_offset != data_offset ||
+        it->data_length != data_length ||
+        it->size != size)
+        return nullptr;
+
+    return extents.start + it->pixels_offset;
+}
+
+Error DiskCache::open(
+    DiskCache* self,
+    const std::filesystem::path& directory,
+    const Options& options) {
+    self->directory = directory;
+    self->options = options;
+    if (self->options.max_bytes == 0)
+        self->options.max_bytes = DEFAULT_MAX_BYTES;
+
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec) {
+        return error_new(Error::OPENFAILED)
+            << "failed to create cache directory " << directory << ": " << ec.message().c_str();
+    }
+
+    // Prune also computes the initial size of the directory.
+    CHECK(self->prune(),
+        Error::OPENFAILED) << "failed to scan cache directory";
+
+    return Error();
+}
+
+// DiskCache_validate checks that a mapped container is intact, and belongs to
+// f.
+static bool DiskCache_validate(
+    const DiskCache* self,
+    const Wz* wz,
+    const File* f,
+    const Extents& extents) {
+    const size_t size = extents.end - extents.start;
+    if (size < sizeof(ContainerHeader))
+        return false;
+
+    const ContainerHeader* header = reinterpret_cast<const ContainerHeader*>(extents.start);
+    if (::memcmp(header->magic, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)) != 0 ||
+        header->version != CONTAINER_VERSION ||
+        header->identity != wz->identity() ||
+        header->file_offset != static_cast<uint64_t>(f->base - wz->file.start))
+        return false;
+
+    if ((size - sizeof(ContainerHeader)) / sizeof(ContainerEntry) < header->count)
+        return false;
+
+    const ContainerEntry* entries = reinterpret_cast<const ContainerEntry*>(header + 1);
+    for (uint32_t i = 0; i < header->count; ++i) {
+        const ContainerEntry& entry = entries[i];
+        if (entry.pixels_offset > size || size - entry.pixels_offset < entry.size)
+            return false;
+
+        if (self->options.verify &&
+            wz::hash_bytes(extents.start + entry.pixels_offset, entry.size) != entry.checksum)
+            return false;
+    }
+
+    return true;
+}
+
+Error DiskCache::load(
+    const Wz* wz,
+    const File* f,
+    Mapping* mapping) {
+    mapping->close();
+
+    const std::filesystem::path path = DiskCache_path(this, wz, f);
+
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec))
+        return Error();
+
+    int fd = 0;
+    size_t size = 0;
+    if (_wz_openfileforread(&fd, &size, path.string().c_str()))
+        return Error();
+
+    const void* start = nullptr;
+    if (size == 0 || _wz_mapfile(&start, fd, size)) {
+        _wz_closefile(fd);
+        return Error();
+    }
+
+    Mapping loaded;
+    loaded.fd = fd;
+    loaded.extents.start = static_cast<const uint8_t*>(start);
+    loaded.extents.end = loaded.extents.start + size;
+
+    if (!DiskCache_validate(this, wz, f, loaded.extents)) {
+        LOG(Logger::WARNING)
+            << "discarding invalid canvas cache container " << path;
+
+        loaded.close();
+        std::filesystem::remove(path, ec);
+        return Error();
+    }
+
+    // Touch the container, so that it is the most recently used.
+    std::filesystem::last_write_time(
+        path,
+        std::filesystem::file_time_type::clock::now(),
+        ec);
+
+    *mapping = std::move(loaded);
+    return Error();
+}
+
+Error DiskCache::store(
+    const Wz* wz,
+    const File* f,
+    std::vector<Blob>* blobs) {
+    std::sort(
+        blobs->begin(),
+        blobs->end(),
+        [](const Blob& l, const Blob& r) {
+            if (l.data_offset != r.data_offset)
+                return l.data_offset < r.data_offset;
+
+            return l.data_length < r.data_length;
+        });
+
+    // The same compressed data may be referenced by multiple canvases.
+    blobs->erase(
+        std::unique(
+            blobs->begin(),
+            blobs->end(),
+            [](const Blob& l, const Blob& r) {
+                return l.data_offset == r.data_offset && l.data_length == r.data_length;
+            }),
+        blobs->end());
+
+    ContainerHeader header = { 0 };
+    ::memcpy(header.magic, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+    header.version = CONTAINER_VERSION;
+    header.count = static_cast<uint32_t>(blobs->size());
+    header.identity = wz->identity();
+    header.file_offset = static_cast<uint64_t>(f->base - wz->file.start);
+
+    std::vector<ContainerEntry> entries(blobs->size());
+    uint64_t offset = sizeof(ContainerHeader) + entries.size() * sizeof(ContainerEntry);
+    for (size_t i = 0, l = blobs->size(); i < l; ++i) {
+        const Blob& blob = (*blobs)[i];
+
+        offset = (offset + CONTAINER_ALIGNMENT - 1) & ~(CONTAINER_ALIGNMENT - 1);
+        entries[i] = ContainerEntry{
+            .data_offset = blob.data_offset,
+            .data_length = blob.data_length,
+            .size = blob.size,
+            .pixels_offset = offset,
+            .checksum = wz::hash_bytes(blob.pixels, blob.size),
+        };
+        offset += blob.size;
+    }
+
+    // Write to a temporary file first, and rename it into place, so that
+    // other processes never see a partially written container.
+    static std::atomic<uint32_t> counter;
+    const std::filesystem::path path = DiskCache_path(this, wz, f);
+    std::filesystem::path temporary = path;
+    {
+        std::stringstream ss;
+        ss << ".tmp." << std::hash<std::thread::id>{}(std::this_thread::get_id()) << "." << counter++;
+        temporary += ss.str();
+    }
+
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return error_new(Error::OPENFAILED)
+                << "failed to create " << temporary;
+        }
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ContainerEntry));
+
+        uint64_t written = sizeof(ContainerHeader) + entries.size() * sizeof(ContainerEntry);
+        for (size_t i = 0, l = blobs->size(); i < l; ++i) {
+            static const char padding[CONTAINER_ALIGNMENT] = { 0 };
+            out.write(padding, entries[i].pixels_offset - written);
+            out.write(reinterpret_cast<const char*>((*blobs)[i].pixels), (*blobs)[i].size);
+            written = entries[i].pixels_offset + (*blobs)[i].size;
+        }
+
+        if (!out) {
+            out.close();
+
+            std::error_code ec;
+            std::filesystem::remove(temporary, ec);
+            return error_new(Error::BADREAD)
+                << "failed to write " << temporary;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, path, ec);
+    if (ec) {
+        std::filesystem::remove(temporary, ec);
+        return error_new(Error::OPENFAILED)
+            << "failed to rename " << temporary << " to " << path;
+    }
+
+    bool over = false;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        total_bytes = total_bytes + offset;
+        over = total_bytes > options.max_bytes;
+    }
+
+    if (over) {
+        CHECK(prune(),
+            Error::OPENFAILED) << "failed to prune cache directory";
+    }
+
+    return Error();
+}
+
+Error DiskCache::prune() {
+    struct Container {
+        std::filesystem::path path;
+        std::filesystem::file_time_type last_used;
+        uint64_t size;
+    };
+
+    std::lock_guard<std::mutex> l(lock);
+
+    // Other processes may share the directory, so always rescan it rather
+    // than trusting total_bytes.
+    std::vector<Container> containers;
+    uint64_t total = 0;
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+        if (entry.path().extension() != CONTAINER_EXTENSION)
+            continue;
+
+        std::error_code entry_ec;
+        Container c = {
+            .path = entry.path(),
+            .last_used = entry.last_write_time(entry_ec),
+            .size = entry.file_size(entry_ec),
+        };
+        if (entry_ec)
+            continue;
+
+        total += c.size;
+        containers.push_back(std::move(c));
+    }
+    if (ec) {
+        return error_new(Error::BADREAD)
+            << "failed to list " << directory << ": " << ec.message().c_str();
+    }
+
+    if (total > options.max_bytes) {
+        std::sort(
+            containers.begin(),
+            containers.end(),
+            [](const Container& l, const Container& r) {
+                return l.last_used < r.last_used;
+            });
+
+        for (size_t i = 0; i < containers.size() && total > options.max_bytes; ++i) {
+            std::filesystem::remove(containers[i].path, ec);
+            if (!ec)
+                total -= containers[i].size;
+        }
+    }
+
+    total_bytes = total;
+    return Error();
+}
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+#include "p.hh"
+#include "util/error.hh"
+#include "wz/directory.hh"
+#include "wz/extents.hh"
+#include "wz/wz.hh"
+
+namespace wz {
+
+// DiskCache is a persistent cache of decoded canvas pixels, kept in a
+// directory. Each file in a WZ archive that has been opened has a container
+// in the directory, named by the archive's identity and the file's offset in
+// the archive. A container holds the decoded pixels of every canvas in the
+// file, keyed by the offset and length of the canvas' compressed data, laid
+// out so that the container can be mapped and its pixels used in place.
+//
+// The total size of the directory is capped: when a new container pushes it
+// over the cap, the least recently used containers are deleted.
+struct DiskCache {
+    // DEFAULT_MAX_BYTES is the default cap on the size of a cache directory.
+    static constexpr uint64_t DEFAULT_MAX_BYTES = 1ULL << 30;
+
+    struct Options {
+        // max_bytes caps the total size of containers in the directory. If
+        // 0, DEFAULT_MAX_BYTES is used.
+        uint64_t max_bytes;
+
+        // verify enables checking the checksum of every canvas' pixels when
+        // a container is loaded. Containers that fail verification are
+        // deleted.
+        bool verify;
+    };
+
+    // Blob is the decoded pixels of a single canvas.
+    struct Blob {
+        // data_offset is the offset of the canvas' compressed data in the
+        // archive.
+        uint64_t data_offset;
+
+        // data_length is the length of the canvas' compressed data.
+        uint32_t data_length;
+
+        // size is the size of pixels, in bytes.
+        uint32_t size;
+
+        const uint8_t* pixels;
+    };
+
+    // Mapping is a loaded container, mapped into memory.
+    struct Mapping {
+        N<int> fd;
+        Extents extents = { 0 };
+
+        // find returns the pixels of the canvas with the given compressed
+        // data, or nullptr if the container does not contain them.
+        const uint8_t* find(
+            uint64_t data_offset,
+            uint32_t data_length,
+            uint32_t size) const;
+
+        explicit operator bool() const {
+            return extents.start != nullptr;
+        }
+
+        void close();
+
+        ~Mapping() {
+            close();
+        }
+
+        Mapping& operator=(Mapping&& rhs) {
+            close();
+            fd = std::move(rhs.fd);
+            extents = std::exchange(rhs.extents, Extents{ 0 });
+            return *this;
+        }
+
+        Mapping() = default;
+        Mapping(Mapping&& rhs):
+            fd(std::move(rhs.fd)),
+            extents(std::exchange(rhs.extents, Extents{ 0 })) {}
+        Mapping(const Mapping&) = delete;
+    };
+
+    std::filesystem::path directory;
+    Options options;
+
+    // lock guards total_bytes, and pruning of the directory.
+    std::mutex lock;
+
+    // total_bytes is the total size of containers in the directory, as of
+    // the last scan plus any containers stored since.
+    N<uint64_t> total_bytes;
+
+    static Error open(
+        DiskCache* self,
+        const std::filesystem::path& directory,
+        const Options& options = {});
+
+    // load maps the container of f, if there is a valid one, into mapping.
+    // Misses are not errors: mapping is left empty.
+    Error load(
+        const Wz* wz,
+        const File* f,
+        Mapping* mapping);
+
+    // store writes the container of f, holding blobs.
+    Error store(
+        const Wz* wz,
+        const File* f,
+        std::vector<Blob>* blobs);
+
+    // prune deletes the least recently used containers until the directory
+    // is under its cap.
+    Error prune();
+
+    DiskCache() = default;
+    DiskCache(DiskCache&&) = delete;
+    DiskCache(const DiskCache&) = delete;
+};
+
+}
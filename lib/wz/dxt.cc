@@ -0,0 +1,192 @@
+#include "wz/dxt.hh"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace wz {
+
+// dxt_load16 reads a little endian uint16_t from p.
+static inline uint16_t dxt_load16(
+    const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+// dxt_palette computes the 4 colors of a DXT3 or DXT5 color block from its two
+// endpoints, as little endian RGBA with an alpha of 0. DXT3 and DXT5 blocks
+// always use 4 color mode: the other two colors are interpolated at 1/3 and
+// 2/3 between the endpoints.
+static inline void dxt_palette(
+    uint16_t c0,
+    uint16_t c1,
+    uint32_t palette[4]) {
+    const uint32_t r0 = (c0 >> 11) & 0x1F, g0 = (c0 >> 5) & 0x3F, b0 = c0 & 0x1F;
+    const uint32_t r1 = (c1 >> 11) & 0x1F, g1 = (c1 >> 5) & 0x3F, b1 = c1 & 0x1F;
+
+#if defined(__SSE2__)
+    // Expand both endpoints to 8 bits per channel, and interpolate all
+    // channels of both intermediate colors at once, in 16-bit lanes.
+    const __m128i e = _mm_setr_epi16(
+        (r0 << 3) | (r0 >> 2), (g0 << 2) | (g0 >> 4), (b0 << 3) | (b0 >> 2), 0,
+        (r1 << 3) | (r1 >> 2), (g1 << 2) | (g1 >> 4), (b1 << 3) | (b1 >> 2), 0);
+
+    // swapped holds the endpoints in the other order: lanes are c1, c0.
+    const __m128i swapped = _mm_shuffle_epi32(e, _MM_SHUFFLE(1, 0, 3, 2));
+
+    // (2 * e + swapped) / 3 gives (2c0 + c1) / 3 and (c0 + 2c1) / 3. Division
+    // by 3 is a multiply by 0xAAAB, keeping the high 17 bits.
+    __m128i sum = _mm_add_epi16(_mm_add_epi16(e, e), swapped);
+    __m128i interpolated = _mm_srli_epi16(
+        _mm_mulhi_epu16(sum, _mm_set1_epi16(static_cast<short>(0xAAAB))), 1);
+
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(palette),
+        _mm_packus_epi16(e, interpolated));
+#else
+    const uint32_t r[2] = { (r0 << 3) | (r0 >> 2), (r1 << 3) | (r1 >> 2) };
+    const uint32_t g[2] = { (g0 << 2) | (g0 >> 4), (g1 << 2) | (g1 >> 4) };
+    const uint32_t b[2] = { (b0 << 3) | (b0 >> 2), (b1 << 3) | (b1 >> 2) };
+
+    palette[0] = r[0] | (g[0] << 8) | (b[0] << 16);
+    palette[1] = r[1] | (g[1] << 8) | (b[1] << 16);
+    palette[2] =
+        ((2 * r[0] + r[1]) / 3) |
+        (((2 * g[0] + g[1]) / 3) << 8) |
+        (((2 * b[0] + b[1]) / 3) << 16);
+    palette[3] =
+        ((r[0] + 2 * r[1]) / 3) |
+        (((g[0] + 2 * g[1]) / 3) << 8) |
+        (((b[0] + 2 * b[1]) / 3) << 16);
+#endif
+}
+
+// dxt_store_row writes a row of 4 pixels of a block, clipping to the image.
+static inline void dxt_store_row(
+    uint32_t* out,
+    uint32_t visible,
+    uint32_t p0,
+    uint32_t p1,
+    uint32_t p2,
+    uint32_t p3) {
+#if defined(__SSE2__)
+    if (visible == 4) {
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(out),
+            _mm_setr_epi32(p0, p1, p2, p3));
+        return;
+    }
+#endif
+
+    const uint32_t row[4] = { p0, p1, p2, p3 };
+    ::memcpy(out, row, visible * sizeof(uint32_t));
+}
+
+// dxt_decode decodes each block of an image with decode_block, which receives
+// the block and fills in 16 RGBA pixels, in rows.
+template <typename F>
+static inline void dxt_decode(
+    const uint8_t* blocks,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* out,
+    F decode_block) {
+    uint32_t* pixels = reinterpret_cast<uint32_t*>(out);
+
+    for (uint32_t by = 0; by < height; by += 4) {
+        const uint32_t visible_rows = (height - by < 4) ? height - by : 4;
+
+        for (uint32_t bx = 0; bx < width; bx += 4) {
+            const uint32_t visible = (width - bx < 4) ? width - bx : 4;
+
+            uint32_t block[16];
+            decode_block(blocks, block);
+            blocks += DXT_BLOCK_SIZE;
+
+            for (uint32_t y = 0; y < visible_rows; ++y) {
+                dxt_store_row(
+                    &pixels[(by + y) * width + bx],
+                    visible,
+                    block[y * 4 + 0],
+                    block[y * 4 + 1],
+                    block[y * 4 + 2],
+                    block[y * 4 + 3]);
+            }
+        }
+    }
+}
+
+// dxt_decode_colors decodes the color half of a block, ORing each color into
+// pixels, which already hold alpha.
+static inline void dxt_decode_colors(
+    const uint8_t* color_block,
+    uint32_t pixels[16]) {
+    uint32_t palette[4];
+    dxt_palette(
+        dxt_load16(&color_block[0]),
+        dxt_load16(&color_block[2]),
+        palette);
+
+    uint32_t indices =
+        color_block[4] |
+        (color_block[5] << 8) |
+        (color_block[6] << 16) |
+        (static_cast<uint32_t>(color_block[7]) << 24);
+    for (uint32_t i = 0; i < 16; ++i) {
+        pixels[i] |= palette[indices & 0x3];
+        indices >>= 2;
+    }
+}
+
+void dxt3_decode(
+    const uint8_t* blocks,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* out) {
+    dxt_decode(blocks, width, height, out, [](const uint8_t* block, uint32_t pixels[16]) {
+        // DXT3 alpha is explicit: 4 bits per pixel, low nibble first.
+        for (uint32_t i = 0; i < 8; ++i) {
+            pixels[i * 2 + 0] = static_cast<uint32_t>((block[i] & 0x0F) * 0x11) << 24;
+            pixels[i * 2 + 1] = static_cast<uint32_t>((block[i] >> 4) * 0x11) << 24;
+        }
+
+        dxt_decode_colors(&block[8], pixels);
+    });
+}
+
+void dxt5_decode(
+    const uint8_t* blocks,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* out) {
+    dxt_decode(blocks, width, height, out, [](const uint8_t* block, uint32_t pixels[16]) {
+        // DXT5 alpha is interpolated between two endpoints, with 3-bit indices.
+        const uint32_t a0 = block[0];
+        const uint32_t a1 = block[1];
+
+        uint32_t alphas[8] = { a0, a1 };
+        if (a0 > a1) {
+            for (uint32_t i = 1; i < 7; ++i)
+                alphas[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+        } else {
+            for (uint32_t i = 1; i < 5; ++i)
+                alphas[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+            alphas[6] = 0;
+            alphas[7] = 0xFF;
+        }
+
+        uint64_t indices = 0;
+        for (uint32_t i = 0; i < 6; ++i)
+            indices |= static_cast<uint64_t>(block[2 + i]) << (8 * i);
+
+        for (uint32_t i = 0; i < 16; ++i) {
+            pixels[i] = alphas[indices & 0x7] << 24;
+            indices >>= 3;
+        }
+
+        dxt_decode_colors(&block[8], pixels);
+    });
+}
+
+}
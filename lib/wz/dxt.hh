@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+namespace wz {
+
+// DXT_BLOCK_SIZE is the size, in bytes, of a single 4x4 DXT3 or DXT5 block.
+constexpr uint32_t DXT_BLOCK_SIZE = 16;
+
+// dxt_size returns the size, in bytes, of a DXT3 or DXT5 image of the given
+// dimensions. Partial blocks at the right and bottom edges are padded out to
+// full blocks.
+constexpr uint32_t dxt_size(
+    uint32_t width,
+    uint32_t height) {
+    return ((width + 3) / 4) * ((height + 3) / 4) * DXT_BLOCK_SIZE;
+}
+
+// dxt3_decode decodes DXT3 blocks into 8-bit RGBA pixels in out, which must be
+// at least width * height * 4 bytes.
+void dxt3_decode(
+    const uint8_t* blocks,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* out);
+
+// dxt5_decode decodes DXT5 blocks into 8-bit RGBA pixels in out, which must be
+// at least width * height * 4 bytes.
+void dxt5_decode(
+    const uint8_t* blocks,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* out);
+
+}
@@ -0,0 +1,57 @@
+#include "wz/hash.hh"
+
+#include <cstring>
+
+namespace wz {
+
+enum : uint64_t {
+    PRIME1 = 0x9E3779B185EBCA87ULL,
+    PRIME2 = 0xC2B2AE3D27D4EB4FULL,
+    PRIME3 = 0x165667B19E3779F9ULL,
+};
+
+static inline uint64_t hash_rotl(
+    uint64_t x,
+    int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_round(
+    uint64_t h,
+    uint64_t word) {
+    word *= PRIME2;
+    word = hash_rotl(word, 31);
+    word *= PRIME1;
+    return hash_rotl(h ^ word, 27) * PRIME1 + PRIME3;
+}
+
+uint64_t hash_bytes(
+    const uint8_t* data,
+    size_t len,
+    uint64_t seed) {
+    uint64_t h = seed + PRIME3 + len;
+
+    const uint8_t* end = data + len;
+    for (; end - data >= 8; data += 8) {
+        uint64_t word;
+        ::memcpy(&word, data, sizeof(word));
+        h = hash_round(h, word);
+    }
+
+    // Fold the remaining bytes into a single word.
+    if (data < end) {
+        uint64_t word = 0;
+        ::memcpy(&word, data, end - data);
+        h = hash_round(h, word);
+    }
+
+    // Final avalanche, so that every input bit affects every output bit.
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+}
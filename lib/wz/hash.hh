@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wz {
+
+// HASH_SEED is the FNV-1a offset basis.
+constexpr uint32_t HASH_SEED = 0x811C9DC5;
+
+// hash computes the 32-bit FNV-1a hash of a wide string of len characters.
+// hash is constexpr so that names known at compile time can be hashed by the
+// compiler instead of at every lookup. Since FNV-1a is incremental, passing
+// the hash of a prefix as h continues hashing from the end of that prefix.
+constexpr uint32_t hash(
+    const wchar_t* s,
+    size_t len,
+    uint32_t h = HASH_SEED) {
+    for (size_t i = 0; i < len; ++i) {
+        h ^= static_cast<uint32_t>(s[i]);
+        h *= 0x01000193;
+    }
+
+    return h;
+}
+
+// hash_bytes computes a fast, non-cryptographic 64-bit hash of len bytes of
+// data, processing 8 bytes at a time. It is meant for hashing large spans,
+// such as compressed image data.
+uint64_t hash_bytes(
+    const uint8_t* data,
+    size_t len,
+    uint64_t seed = 0);
+
+// Key is a node name, along with its hash. Keys built from string literals
+// are hashed at compile time.
+struct Key {
+    // name is the null-terminated name of this key.
+    const wchar_t* name;
+
+    // len is the length of name, in characters, excluding the null terminator.
+    uint32_t len;
+
+    // hash is wz::hash(name, len).
+    uint32_t hash;
+
+    template <size_t L>
+    consteval Key(const wchar_t (&name)[L]):
+        name(name),
+        len(static_cast<uint32_t>(L - 1)),
+        hash(wz::hash(name, L - 1)) {}
+};
+
+}
@@ -0,0 +1,75 @@
+#include "wz/imagestore.hh"
+
+#include "wz/hash.hh"
+
+namespace wz {
+
+ImageKey ImageKey::of(
+    const Image& image) {
+    return ImageKey{
+        .hash = wz::hash_bytes(image.data, image.length),
+        .length = image.length,
+        .width = image.width,
+        .height = image.height,
+        .format = image.format + image.format2,
+    };
+}
+
+Error ImageStore::get(
+    const Image& image,
+    const ImageKey& key,
+    std::shared_ptr<const Pixels>* pixels) {
+    {
+        std::lock_guard<std::mutex> l(lock);
+        ++totals.lookups;
+
+        auto it = images.find(key);
+        if (it != images.end()) {
+            if ((*pixels = it->second.lock())) {
+                ++totals.hits;
+                totals.shared_bytes += (*pixels)->data.size();
+                return Error();
+            }
+        }
+    }
+
+    // Decode outside of the lock, so that distinct images can be decoded
+    // concurrently.
+    std::shared_ptr<Pixels> decoded(new Pixels());
+    decoded->data.resize(image.rawsize());
+    CHECK(image.pixels(decoded->data.data()),
+        Error::DECOMPRESSIONFAILED) << "failed to decode image pixels";
+
+    std::lock_guard<std::mutex> l(lock);
+
+    // Another thread may have decoded the same image in the meantime. If so,
+    // prefer its pixels, so that they are shared.
+    std::weak_ptr<const Pixels>& entry = images[key];
+    if ((*pixels = entry.lock())) {
+        ++totals.hits;
+        totals.shared_bytes += (*pixels)->data.size();
+        return Error();
+    }
+
+    totals.decoded_bytes += decoded->data.size();
+    entry = decoded;
+    *pixels = std::move(decoded);
+
+    // Entries whose pixels have been released are only removed periodically,
+    // so that pruning is amortized over insertions.
+    if (images.size() >= prune_at) {
+        std::erase_if(images, [](const auto& it) {
+            return it.second.expired();
+        });
+        prune_at = images.size() * 2 + 1024;
+    }
+
+    return Error();
+}
+
+ImageStore::Stats ImageStore::stats() {
+    std::lock_guard<std::mutex> l(lock);
+    return totals;
+}
+
+}
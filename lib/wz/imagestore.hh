@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "util/error.hh"
+#include "wz/property.hh"
+
+namespace wz {
+
+// ImageKey identifies the contents of an Image, by a hash of its compressed
+// data along with its dimensions and format. Images with equal keys decode to
+// the same pixels.
+struct ImageKey {
+    uint64_t hash;
+    uint32_t length;
+    uint32_t width;
+    uint32_t height;
+    int32_t format;
+
+    bool operator==(const ImageKey& rhs) const = default;
+
+    struct Hash {
+        size_t operator()(const ImageKey& key) const noexcept {
+            return static_cast<size_t>(key.hash);
+        }
+    };
+
+    static ImageKey of(
+        const Image& image);
+};
+
+// ImageStore is a content-addressed store of decoded image pixels. Images
+// with equal ImageKeys are decoded once, and their pixels are shared between
+// every OpenedFile that references them for as long as any of them is open.
+// ImageStore is safe for concurrent use.
+struct ImageStore {
+    // Pixels is a decoded image.
+    struct Pixels {
+        std::vector<uint8_t> data;
+    };
+
+    struct Stats {
+        // lookups is the number of images requested from the store.
+        uint64_t lookups;
+
+        // hits is the number of lookups served by already decoded pixels.
+        uint64_t hits;
+
+        // decoded_bytes is the number of bytes of pixels decoded.
+        uint64_t decoded_bytes;
+
+        // shared_bytes is the number of bytes of pixels that did not need to
+        // be decoded, because they were shared.
+        uint64_t shared_bytes;
+    };
+
+    std::mutex lock;
+    std::unordered_map<ImageKey, std::weak_ptr<const Pixels>, ImageKey::Hash> images;
+    Stats totals = { 0 };
+
+    // prune_at is the size of images at which expired entries are next pruned.
+    size_t prune_at = 1024;
+
+    // get returns the pixels of image, whose key is key, decoding them if they
+    // are not already in the store.
+    Error get(
+        const Image& image,
+        const ImageKey& key,
+        std::shared_ptr<const Pixels>* pixels);
+
+    // stats returns a snapshot of this store's statistics.
+    Stats stats();
+
+    ImageStore() = default;
+    ImageStore(ImageStore&&) = delete;
+    ImageStore(const ImageStore&) = delete;
+};
+
+}
@@ -0,0 +1,628 @@
+#include "wz/packed.hh"
+
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "logger.hh"
+#include "wz/vfs.hh"
+
+// These are implemented alongside Wz, in the platform-specific sources.
+extern "C" {
+    int _wz_openfileforread(
+        int* handle_out,
+        size_t* size_out,
+        const char* filename);
+
+    int _wz_closefile(
+        int handle);
+
+    int _wz_mapfile(
+        const void** addr_out,
+        int handle,
+        size_t length);
+
+    int _wz_unmapfile(
+        const void* addr,
+        size_t length);
+}
+
+namespace wz {
+
+static const uint32_t PACKED_VERSION = 2;
+static const char PACKED_MAGIC[8] = { 'W', 'Z', 'P', 'A', 'C', 'K', 'E', 'D' };
+
+// PACKED_NONE is the parent index of root nodes.
+static const uint32_t PACKED_NONE = UINT32_MAX;
+
+// Packed_table_valid checks that a table of count elements of size bytes at
+// offset lies within the archive.
+static bool Packed_table_valid(
+    const Packed* packed,
+    uint64_t offset,
+    uint64_t count,
+    uint64_t size) {
+    const uint64_t length = packed->file.end - packed->file.start;
+    return (offset % 8) == 0 &&
+        offset <= length &&
+        count <= (length - offset) / size;
+}
+
+static Error Packed_validate(
+    const Packed* packed) {
+    const uint64_t length = packed->file.end - packed->file.start;
+    if (length < sizeof(PackedHeader))
+        return error_new(Error::BADREAD)
+        << "packed archive is too small";
+
+    const PackedHeader* header = packed->header.get();
+    if (::memcmp(header->magic, PACKED_MAGIC, sizeof(PACKED_MAGIC)) != 0)
+        return error_new(Error::BADREAD)
+        << "not a packed archive";
+    if (header->version != PACKED_VERSION)
+        return error_new(Error::BADREAD)
+        << "unsupported packed archive version " << header->version;
+    if (header->wchar_size != sizeof(wchar_t))
+        return error_new(Error::BADREAD)
+        << "packed archive was packed with " << header->wchar_size << "-byte strings";
+
+    if (!Packed_table_valid(packed, header->strings, header->string_count, sizeof(wchar_t)) ||
+        !Packed_table_valid(packed, header->entries, header->entry_count, sizeof(PackedEntry)) ||
+        !Packed_table_valid(packed, header->node_parents, header->node_count, sizeof(uint32_t)) ||
+        !Packed_table_valid(packed, header->node_names, header->node_count, sizeof(uint32_t)) ||
+        !Packed_table_valid(packed, header->node_hashes, header->node_count, sizeof(uint32_t)) ||
+        !Packed_table_valid(packed, header->node_children_starts, header->node_count, sizeof(uint32_t)) ||
+        !Packed_table_valid(packed, header->node_children_counts, header->node_count, sizeof(uint32_t)) ||
+        !Packed_table_valid(packed, header->node_kinds, header->node_count, sizeof(uint8_t)) ||
+        !Packed_table_valid(packed, header->node_values, header->node_count, sizeof(uint64_t)) ||
+        !Packed_table_valid(packed, header->canvases, header->canvas_count, sizeof(PackedCanvas)) ||
+        !Packed_table_valid(packed, header->sounds, header->sound_count, sizeof(PackedSound)))
+        return error_new(Error::BADREAD)
+        << "packed archive table out of bounds";
+
+    // Every string offset must land on a null-terminated string.
+    if (header->string_count == 0 ||
+        packed->table<wchar_t>(header->strings)[header->string_count - 1] != L'\0')
+        return error_new(Error::BADREAD)
+        << "packed archive string table is not terminated";
+
+    if (header->entry_count == 0 || packed->entry(0)->kind != PackedEntry::DIRECTORY)
+        return error_new(Error::BADREAD)
+        << "packed archive has no root directory";
+
+    for (uint32_t i = 0; i < header->entry_count; ++i) {
+        const PackedEntry* entry = packed->entry(i);
+        if (entry->name >= header->string_count)
+            return error_new(Error::BADREAD)
+            << "packed entry " << i << " has an invalid name";
+
+        switch (entry->kind) {
+        case PackedEntry::DIRECTORY:
+            // Children always follow their directory, so that the tree has
+            // no cycles.
+            if (entry->count > 0 &&
+                (entry->start <= i || entry->start > header->entry_count ||
+                    header->entry_count - entry->start < entry->count))
+                return error_new(Error::BADREAD)
+                << "packed directory " << i << " has invalid children";
+            break;
+        case PackedEntry::FILE:
+            if (entry->start > header->node_count ||
+                header->node_count - entry->start < entry->count)
+                return error_new(Error::BADREAD)
+                << "packed file " << i << " has invalid nodes";
+            break;
+        default:
+            return error_new(Error::BADREAD)
+                << "packed entry " << i << " has unknown kind " << entry->kind;
+        }
+    }
+
+    // Pixels are used in place, and read as far as their image says, so
+    // every canvas must hold exactly the pixels of its image.
+    const PackedCanvas* canvases = packed->table<PackedCanvas>(header->canvases);
+    for (uint32_t i = 0; i < header->canvas_count; ++i) {
+        const PackedCanvas& c = canvases[i];
+        if (c.pixels > length || length - c.pixels < c.size)
+            return error_new(Error::BADREAD)
+            << "packed canvas " << i << " pixels out of bounds";
+
+        // rawsize is computed in 32 bits, so reject images that it could
+        // overflow for.
+        if (static_cast<uint64_t>(c.width) * c.height * 4 > UINT32_MAX)
+            return error_new(Error::BADREAD)
+            << "packed canvas " << i << " is too large: " << c.width << "x" << c.height;
+
+        const uint32_t rawsize = c.image().rawsize();
+        if (rawsize == 0 || c.format2 > UINT8_MAX)
+            return error_new(Error::BADREAD)
+            << "packed canvas " << i << " has unknown format "
+            << c.format << "+" << c.format2;
+        if (rawsize != c.size)
+            return error_new(Error::BADREAD)
+            << "packed canvas " << i << " holds " << c.size
+            << " bytes of pixels, but its image needs " << rawsize;
+    }
+
+    // Sounds are read in place too, so their headers and payloads must lie
+    // within the archive.
+    const PackedSound* sounds = packed->table<PackedSound>(header->sounds);
+    for (uint64_t i = 0; i < header->sound_count; ++i) {
+        const PackedSound& sound = sounds[i];
+        if (sound.header > length || length - sound.header < sound.header_length ||
+            sound.data > length || length - sound.data < sound.length ||
+            sound.length > UINT32_MAX)
+            return error_new(Error::BADREAD)
+            << "packed sound " << i << " out of bounds";
+    }
+
+    return Error();
+}
+
+Image PackedCanvas::image() const {
+    return Image{
+        .width = width,
+        .height = height,
+        .format = format,
+        .format2 = static_cast<uint8_t>(format2),
+        .unknown1 = 0,
+        .length = length,
+        .unknown2 = 0,
+        .data = nullptr,
+    };
+}
+
+Error Packed::open(
+    Packed* packed,
+    const char* filename) {
+    size_t size = 0;
+    int fd = 0;
+
+    int ret = _wz_openfileforread(&fd, &size, filename);
+    if (ret)
+        return error_new(Error::OPENFAILED)
+        << "failed to open packed archive for read: " << ret;
+
+    const void* start = nullptr;
+    ret = _wz_mapfile(&start, fd, size);
+    if (ret) {
+        _wz_closefile(fd);
+        return error_new(Error::OPENFAILED)
+            << "failed to mmap packed archive: " << ret;
+    }
+
+    packed->fd = fd;
+    packed->file.start = static_cast<const uint8_t*>(start);
+    packed->file.end = packed->file.start + size;
+    packed->header = reinterpret_cast<const PackedHeader*>(start);
+
+    if (Error e = Packed_validate(packed)) {
+        packed->close();
+        return error_push(e, Error::OPENFAILED) << "invalid packed archive " << filename;
+    }
+
+    return Error();
+}
+
+Error Packed::parse(
+    Packed* packed,
+    Extents file) {
+    packed->file = file;
+    packed->header = reinterpret_cast<const PackedHeader*>(file.start);
+
+    if (Error e = Packed_validate(packed)) {
+        packed->close();
+        return error_push(e, Error::OPENFAILED) << "invalid packed archive";
+    }
+
+    return Error();
+}
+
+Error Packed::close() {
+    if (!fd) {
+        file = Extents{ 0 };
+        header = nullptr;
+        return Error();
+    }
+
+    int ret = _wz_unmapfile(file.start, file.end - file.start);
+    if (ret)
+        return error_new(Error::CLOSEFAILED)
+        << "failed to unmap packed archive: " << ret;
+
+    ret = _wz_closefile(fd);
+    if (ret)
+        return error_new(Error::CLOSEFAILED)
+        << "failed to close packed archive: " << ret;
+
+    fd = 0;
+    file = Extents{ 0 };
+    header = nullptr;
+    return Error();
+}
+
+Packed::~Packed() {
+    close();
+}
+
+// Packer accumulates the tables of a packed archive, while pixels are
+// streamed to the output. Without an output, it only measures the archive.
+struct Packer {
+    std::ostream* out;
+    uint64_t offset;
+
+    std::vector<wchar_t> strings;
+    std::unordered_map<std::wstring, uint32_t> string_offsets;
+
+    std::vector<PackedEntry> entries;
+
+    std::vector<uint32_t> node_parents;
+    std::vector<uint32_t> node_names;
+    std::vector<uint32_t> node_hashes;
+    std::vector<uint32_t> node_children_starts;
+    std::vector<uint32_t> node_children_counts;
+    std::vector<uint8_t> node_kinds;
+    std::vector<uint64_t> node_values;
+
+    std::vector<PackedCanvas> canvases;
+    std::vector<PackedSound> sounds;
+};
+
+static uint32_t Packer_string(
+    Packer* self,
+    const wchar_t* s) {
+    auto it = self->string_offsets.find(s);
+    if (it != self->string_offsets.end())
+        return it->second;
+
+    const uint32_t offset = static_cast<uint32_t>(self->strings.size());
+    const size_t len = ::wcslen(s);
+    self->strings.insert(self->strings.end(), s, s + len + 1);
+    self->string_offsets.emplace(std::wstring(s, len), offset);
+    return offset;
+}
+
+static void Packer_write(
+    Packer* self,
+    const void* data,
+    size_t size) {
+    if (self->out)
+        self->out->write(static_cast<const char*>(data), size);
+    self->offset += size;
+}
+
+static void Packer_align(
+    Packer* self,
+    uint64_t alignment) {
+    static const char zeroes[Packed::PAGE_SIZE] = { 0 };
+
+    const uint64_t aligned = (self->offset + alignment - 1) & ~(alignment - 1);
+    Packer_write(self, zeroes, aligned - self->offset);
+}
+
+template <typename T>
+static uint64_t Packer_table(
+    Packer* self,
+    const std::vector<T>& table) {
+    Packer_align(self, 8);
+
+    const uint64_t offset = self->offset;
+    Packer_write(self, table.data(), table.size() * sizeof(T));
+    return offset;
+}
+
+static Error Packer_opened(
+    Packer* self,
+    const OpenedFile& of,
+    uint32_t entry_index) {
+    const OpenedFile::Node* base = of.nodes.data();
+
+    self->entries[entry_index].start = static_cast<uint32_t>(self->node_parents.size());
+    self->entries[entry_index].count = static_cast<uint32_t>(of.nodes.size());
+
+    uint64_t pixels = 0;
+    for (const OpenedFile::Node& node : of.nodes) {
+        if (const OpenedFile::Canvas* canvas = node.canvas())
+            pixels += canvas->image.rawsize();
+    }
+
+    if (pixels > Packed::PAGE_ALIGN_ABOVE)
+        Packer_align(self, Packed::PAGE_SIZE);
+
+    for (const OpenedFile::Node& node : of.nodes) {
+        self->node_parents.push_back(
+            node.parent ? static_cast<uint32_t>(node.parent - base) : PACKED_NONE);
+        // The root node is nameless.
+        self->node_names.push_back(Packer_string(self, node.name ? node.name : L""));
+        self->node_hashes.push_back(node.hash);
+        self->node_children_starts.push_back(
+            node.children.count ? static_cast<uint32_t>(node.children.start - base) : 0);
+        self->node_children_counts.push_back(node.children.count);
+
+        uint8_t kind = static_cast<uint8_t>(node.value.index());
+        uint64_t value = 0;
+        switch (kind) {
+        case 1:
+            value = *std::get_if<1>(&node.value);
+            break;
+        case 2:
+            value = static_cast<uint32_t>(*std::get_if<2>(&node.value));
+            break;
+        case 3:
+            value = std::bit_cast<uint32_t>(*std::get_if<3>(&node.value));
+            break;
+        case 4:
+            value = std::bit_cast<uint64_t>(*std::get_if<4>(&node.value));
+            break;
+        case 5:
+            value = Packer_string(self, std::get_if<5>(&node.value)->string);
+            break;
+        case 6:
+        {
+            const Vector* v = std::get_if<6>(&node.value);
+            value =
+                static_cast<uint64_t>(static_cast<uint32_t>(v->x)) |
+                (static_cast<uint64_t>(static_cast<uint32_t>(v->y)) << 32);
+        } break;
+        case 8:
+            value = Packer_string(self, std::get_if<8>(&node.value)->uol);
+            break;
+        case 9:
+        {
+            const OpenedFile::Canvas* canvas = std::get_if<9>(&node.value);
+            const uint32_t size = canvas->image.rawsize();
+            if ((!canvas->image_data && !canvas->image.data) || size == 0) {
+                return error_new(Error::UNKNOWNIMAGEFORMAT)
+                    << "cannot pack canvas " << node.name << " of format "
+                    << canvas->image.format << "+" << static_cast<uint32_t>(canvas->image.format2);
+            }
+
+            Packer_align(self, 16);
+            value = self->canvases.size();
+            self->canvases.push_back(PackedCanvas{
+                .width = canvas->image.width,
+                .height = canvas->image.height,
+                .format = canvas->image.format,
+                .format2 = canvas->image.format2,
+                .length = canvas->image.length,
+                .size = size,
+                .pixels = self->offset,
+                .hash = canvas->key.hash,
+            });
+            if (canvas->image_data || !self->out) {
+                Packer_write(self, canvas->image_data, size);
+            } else {
+                // Streamed canvases are decoded straight into the output.
+                CHECK(canvas->image.bands(0, [&](const Image::Band& band) {
+                    Packer_write(self, band.pixels, canvas->image.bandsize(band.rows));
+                    return Error();
+                }), Error::DECOMPRESSIONFAILED) << "failed to decode canvas " << node.name;
+            }
+        } break;
+        case 7:
+        {
+            // The header and payload are copied as they are, so that they
+            // can be read in place like the source archive's.
+            const Sound* sound = std::get_if<7>(&node.value);
+            value = self->sounds.size();
+
+            PackedSound packed = {
+                .format = sound->format,
+                .duration_ms = sound->duration_ms,
+                .header_length = sound->header_length,
+                .header = self->offset,
+                .data = 0,
+                .length = sound->length,
+            };
+            Packer_write(self, sound->header, sound->header_length);
+            packed.data = self->offset;
+            Packer_write(self, sound->data, sound->length);
+
+            self->sounds.push_back(packed);
+        } break;
+        default:
+            kind = 0;
+            break;
+        }
+
+        self->node_kinds.push_back(kind);
+        self->node_values.push_back(value);
+    }
+
+    if (self->out && !*self->out) {
+        return error_new(Error::BADREAD)
+            << "failed to write pixels";
+    }
+
+    return Error();
+}
+
+static Error Packer_file(
+    Packer* self,
+    Vfs::File* file,
+    uint32_t entry_index) {
+    Vfs::File::Handle handle;
+    CHECK(file->open(&handle),
+        Error::OPENFAILED) << "failed to open file";
+
+    return Packer_opened(self, *handle, entry_index);
+}
+
+static Error Packer_directory(
+    Packer* self,
+    Vfs::Directory* directory,
+    uint32_t entry_index) {
+    // Children of a directory are contiguous, so reserve all of their
+    // entries before descending into any of them.
+    const uint32_t start = static_cast<uint32_t>(self->entries.size());
+    self->entries[entry_index].start = start;
+    self->entries[entry_index].count = static_cast<uint32_t>(directory->children.size());
+
+    for (auto& it : directory->children) {
+        self->entries.push_back(PackedEntry{
+            .kind = it.second.file() ? PackedEntry::FILE : PackedEntry::DIRECTORY,
+            .name = Packer_string(self, it.first.c_str()),
+            .start = 0,
+            .count = 0,
+        });
+    }
+
+    uint32_t i = start;
+    for (auto& it : directory->children) {
+        if (Vfs::File* file = it.second.file()) {
+            CHECK(Packer_file(self, file, i),
+                Error::OPENFAILED) << "failed to pack file " << it.first;
+        } else if (Vfs::Directory* child = it.second.directory()) {
+            CHECK(Packer_directory(self, child, i),
+                Error::OPENFAILED) << "failed to pack directory " << it.first;
+        }
+
+        ++i;
+    }
+
+    return Error();
+}
+
+// Packer_begin starts an archive with a root directory named name. The
+// header is written last, once the offsets of the tables are known, so a
+// blank one is written in its place.
+static void Packer_begin(
+    Packer* self,
+    std::ostream* out,
+    const wchar_t* name) {
+    self->out = out;
+    self->offset = 0;
+
+    PackedHeader header = { 0 };
+    Packer_write(self, &header, sizeof(header));
+
+    self->entries.push_back(PackedEntry{
+        .kind = PackedEntry::DIRECTORY,
+        .name = Packer_string(self, name),
+        .start = 0,
+        .count = 0,
+    });
+}
+
+// Packer_finish writes the tables and the header of an archive.
+static Error Packer_finish(
+    Packer* self,
+    uint64_t identity,
+    PackedHeader* header) {
+    ::memcpy(header->magic, PACKED_MAGIC, sizeof(PACKED_MAGIC));
+    header->version = PACKED_VERSION;
+    header->wchar_size = sizeof(wchar_t);
+    header->identity = identity;
+    header->entry_count = static_cast<uint32_t>(self->entries.size());
+    header->node_count = static_cast<uint32_t>(self->node_parents.size());
+    header->canvas_count = static_cast<uint32_t>(self->canvases.size());
+    header->string_count = static_cast<uint32_t>(self->strings.size());
+
+    header->strings = Packer_table(self, self->strings);
+    header->entries = Packer_table(self, self->entries);
+    header->node_parents = Packer_table(self, self->node_parents);
+    header->node_names = Packer_table(self, self->node_names);
+    header->node_hashes = Packer_table(self, self->node_hashes);
+    header->node_children_starts = Packer_table(self, self->node_children_starts);
+    header->node_children_counts = Packer_table(self, self->node_children_counts);
+    header->node_kinds = Packer_table(self, self->node_kinds);
+    header->node_values = Packer_table(self, self->node_values);
+    header->canvases = Packer_table(self, self->canvases);
+    header->sound_count = self->sounds.size();
+    header->sounds = Packer_table(self, self->sounds);
+
+    if (!self->out)
+        return Error();
+
+    self->out->seekp(0);
+    self->out->write(reinterpret_cast<const char*>(header), sizeof(*header));
+    self->out->flush();
+    if (!*self->out) {
+        return error_new(Error::BADREAD)
+            << "failed to write packed archive";
+    }
+
+    return Error();
+}
+
+Error Packed::pack(
+    Vfs* vfs,
+    const char* filename) {
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return error_new(Error::OPENFAILED)
+            << "failed to create " << filename;
+    }
+
+    Packer packer;
+    Packer_begin(&packer, &out, vfs->root.name.c_str());
+    CHECK(Packer_directory(&packer, vfs->root.directory(), 0),
+        Error::OPENFAILED) << "failed to pack root directory";
+
+    PackedHeader header = { 0 };
+    CHECK(Packer_finish(&packer, vfs->wz ? vfs->wz->identity() : 0, &header),
+        Error::OPENFAILED) << "failed to write " << filename;
+
+    out.close();
+    if (!out) {
+        return error_new(Error::BADREAD)
+            << "failed to write " << filename;
+    }
+
+    LOG(Logger::INFO)
+        << "packed " << header.entry_count << " entries, " << header.node_count << " nodes and "
+        << header.canvas_count << " canvases and " << header.sound_count << " sounds into " << filename;
+
+    return Error();
+}
+
+// Packer_file_alone packs of as an archive of its own, to out, or only
+// measures it if out is null.
+static Error Packer_file_alone(
+    Packer* self,
+    const OpenedFile& of,
+    uint64_t identity,
+    std::ostream* out) {
+    Packer_begin(self, out, L"");
+
+    self->entries[0].start = 1;
+    self->entries[0].count = 1;
+    self->entries.push_back(PackedEntry{
+        .kind = PackedEntry::FILE,
+        .name = Packer_string(self, L""),
+        .start = 0,
+        .count = 0,
+    });
+    CHECK(Packer_opened(self, of, 1),
+        Error::OPENFAILED) << "failed to pack file";
+
+    PackedHeader header = { 0 };
+    CHECK(Packer_finish(self, identity, &header),
+        Error::OPENFAILED) << "failed to write packed file";
+
+    return Error();
+}
+
+Error Packed::pack_file(
+    const OpenedFile& of,
+    uint64_t identity,
+    std::ostream* out) {
+    Packer packer;
+    return Packer_file_alone(&packer, of, identity, out);
+}
+
+Error Packed::pack_file_size(
+    const OpenedFile& of,
+    uint64_t* size) {
+    Packer packer;
+    CHECK(Packer_file_alone(&packer, of, 0, nullptr),
+        Error::OPENFAILED) << "failed to measure packed file";
+
+    *size = packer.offset;
+    return Error();
+}
+
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+#include "p.hh"
+#include "util/error.hh"
+#include "wz/extents.hh"
+#include "wz/sound.hh"
+
+namespace wz {
+
+struct Image;
+struct OpenedFile;
+struct Vfs;
+
+// PackedHeader is the header at the start of a packed archive. Offsets are
+// from the start of the archive, and every table is 8-byte aligned.
+struct PackedHeader {
+    char magic[8];
+    uint32_t version;
+
+    // wchar_size is sizeof(wchar_t) of the platform that packed the archive.
+    // Strings are stored as wchar_t, so that they can be used in place.
+    uint32_t wchar_size;
+
+    // identity is the Wz::identity of the source archive.
+    uint64_t identity;
+
+    uint32_t entry_count;
+    uint32_t node_count;
+    uint32_t canvas_count;
+    uint32_t string_count;
+
+    // strings is a table of string_count wchar_ts: every null-terminated
+    // string in the archive, decrypted and deduplicated.
+    uint64_t strings;
+
+    // entries is a table of entry_count PackedEntries.
+    uint64_t entries;
+
+    // The node tables each hold node_count values, one per node of every
+    // file in the archive. Node indices in the tables are relative to the
+    // first node of the containing file.
+    uint64_t node_parents;
+    uint64_t node_names;
+    uint64_t node_hashes;
+    uint64_t node_children_starts;
+    uint64_t node_children_counts;
+    uint64_t node_kinds;
+    uint64_t node_values;
+
+    // canvases is a table of canvas_count PackedCanvases.
+    uint64_t canvases;
+
+    // sounds is a table of sound_count PackedSounds.
+    uint64_t sounds;
+    uint64_t sound_count;
+};
+
+// PackedEntry is a directory or file of a packed archive. Entry 0 is the root
+// directory, and the children of each directory are contiguous.
+struct PackedEntry {
+    enum Kind : uint32_t {
+        DIRECTORY,
+        FILE,
+    };
+
+    Kind kind;
+
+    // name is the offset of this entry's name in the string table.
+    uint32_t name;
+
+    // For directories, start and count are the span of child entries. For
+    // files, they are the span of the file's nodes in the node tables.
+    uint32_t start;
+    uint32_t count;
+};
+
+// PackedCanvas is a canvas of a packed archive, with its decoded pixels.
+struct PackedCanvas {
+    uint32_t width;
+    uint32_t height;
+    int32_t format;
+    uint32_t format2;
+
+    // length is the length of the canvas' compressed data in the source
+    // archive.
+    uint32_t length;
+
+    // size is the size of the decoded pixels, in bytes.
+    uint32_t size;
+
+    // pixels is the offset of the decoded pixels, in their native layout.
+    uint64_t pixels;
+
+    // hash is ImageKey::hash of the canvas in the source archive.
+    uint64_t hash;
+
+    // image returns the Image that the pixels are of. The compressed data is
+    // not kept in packed archives, so its data is null.
+    Image image() const;
+};
+
+// PackedSound is a sound of a packed archive, with its header and payload
+// copied from the source archive.
+struct PackedSound {
+    Sound::Format format;
+    uint32_t duration_ms;
+
+    // header_length is the length of the media type header, at offset
+    // header.
+    uint32_t header_length;
+    uint64_t header;
+
+    // data and length are the offset and length of the payload.
+    uint64_t data;
+    uint64_t length;
+};
+
+// Packed is a read-only archive derived from a WZ archive, in which strings
+// are decrypted, the property tree is flattened into tables, and canvases are
+// decoded. A packed archive is opened by mapping it into memory: Vfs and
+// OpenedFile use its strings and pixels in place, and do no parsing,
+// decrypting or inflating.
+struct Packed {
+    // PAGE_SIZE is the alignment of the pixels of each file with more than
+    // PAGE_ALIGN_ABOVE bytes of them, so that they are paged in apart from
+    // their neighbours'. The pixels of smaller files are packed tightly,
+    // since padding them would mostly waste space.
+    static constexpr uint64_t PAGE_SIZE = 4096;
+    static constexpr uint64_t PAGE_ALIGN_ABOVE = 16 * PAGE_SIZE;
+
+    // fd is the OS file descriptor of the opened archive, if owned by this
+    // Packed.
+    N<int> fd;
+
+    // file is the memory extents of the opened archive.
+    Extents file = { 0 };
+
+    P<const PackedHeader> header;
+
+    // table returns a pointer to the table at offset.
+    template <typename T>
+    const T* table(uint64_t offset) const {
+        return reinterpret_cast<const T*>(file.start + offset);
+    }
+
+    const wchar_t* string(uint32_t offset) const {
+        return table<wchar_t>(header->strings) + offset;
+    }
+
+    const PackedEntry* entry(uint32_t index) const {
+        return table<PackedEntry>(header->entries) + index;
+    }
+
+    // open maps a packed archive into memory, and validates its header.
+    static Error open(
+        Packed* packed,
+        const char* filename);
+
+    // parse validates a packed archive that is already in memory. The
+    // memory is not owned by the Packed, and must outlive it.
+    static Error parse(
+        Packed* packed,
+        Extents file);
+
+    // pack converts every file in vfs into a packed archive at filename.
+    static Error pack(
+        Vfs* vfs,
+        const char* filename);
+
+    // pack_file writes of as a packed archive of its own, to out. The file
+    // is entry 1 of the archive, in an unnamed root directory. identity is
+    // the identity of the archive that of was opened from.
+    static Error pack_file(
+        const OpenedFile& of,
+        uint64_t identity,
+        std::ostream* out);
+
+    // pack_file_size sets size to the size of the archive that pack_file
+    // would write for of, without decoding or writing anything.
+    static Error pack_file_size(
+        const OpenedFile& of,
+        uint64_t* size);
+
+    Error close();
+
+    ~Packed();
+
+    Packed() = default;
+    Packed(Packed&&) = delete;
+    Packed(const Packed&) = delete;
+};
+
+}
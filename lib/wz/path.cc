@@ -0,0 +1,92 @@
+#include "wz/path.hh"
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace wz {
+
+// Interner holds the process-wide storage for interned names and path ids.
+// Nodes of unordered containers are stable, so pointers into interned strings
+// remain valid for the life of the process.
+struct Interner {
+    std::mutex lock;
+    std::unordered_set<std::wstring> names;
+    std::unordered_map<std::wstring, uint32_t> ids;
+
+    static Interner& Global() {
+        static Interner interner;
+        return interner;
+    }
+};
+
+// Path_split calls f with each non-empty component of path.
+template <typename F>
+static void Path_split(
+    std::wstring_view path,
+    F f) {
+    while (path.size() > 0) {
+        std::wstring_view this_path = path;
+        path = std::wstring_view();
+
+        size_t next_slash = this_path.find(L'/');
+        if (next_slash != std::wstring_view::npos) {
+            path = this_path.substr(next_slash + 1);
+            this_path = this_path.substr(0, next_slash);
+        }
+
+        if (this_path.size() == 0)
+            continue;
+
+        f(this_path);
+    }
+}
+
+// Path_component returns the component named by the null-terminated name,
+// which must outlive it.
+static Path::Component Path_component(
+    const wchar_t* name,
+    size_t len) {
+    return Path::Component{
+        .name = name,
+        .len = static_cast<uint32_t>(len),
+        .hash = wz::hash(name, len),
+        .parent = std::wstring_view(name, len) == L"..",
+    };
+}
+
+Path::Path(std::wstring_view path) {
+    Interner& interner = Interner::Global();
+    std::lock_guard<std::mutex> lock(interner.lock);
+
+    // Ids start at 1, so that 0 is never a valid id.
+    auto id_it = interner.ids.try_emplace(
+        std::wstring(path),
+        static_cast<uint32_t>(interner.ids.size() + 1)).first;
+    id = id_it->second;
+
+    Path_split(path, [&](std::wstring_view component) {
+        const std::wstring& name = *interner.names.emplace(component).first;
+        components.push_back(Path_component(name.c_str(), name.size()));
+    });
+}
+
+Path Path::uninterned(std::wstring_view path) {
+    Path self;
+
+    // The names are zeroed, so the last is terminated by the extra element.
+    self.names = std::make_shared<wchar_t[]>(path.size() + 1);
+    std::copy(path.begin(), path.end(), self.names.get());
+
+    Path_split(path, [&](std::wstring_view component) {
+        wchar_t* name = self.names.get() + (component.data() - path.data());
+        name[component.size()] = L'\0';
+        self.components.push_back(Path_component(name, component.size()));
+    });
+
+    return self;
+}
+
+}
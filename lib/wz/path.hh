@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "wz/hash.hh"
+
+namespace wz {
+
+// Path is a '/' separated path of node names that has been split and hashed
+// ahead of time. Paths are meant to be built once, e.g. as static locals, and
+// then used for any number of lookups via Vfs::find and OpenedFile::find
+// without doing any string work.
+//
+// Component names are interned: every Path shares a single, process-wide copy
+// of each distinct name, and every distinct path string is given a unique id.
+// OpenedFile uses that id to cache resolution results. Interned names are
+// never freed, so paths built at runtime from data, such as map file names,
+// should be built with Path::uninterned instead.
+struct Path {
+    struct Component {
+        // name is the interned, null-terminated name of this component.
+        const wchar_t* name;
+
+        // len is the length of name, in characters.
+        uint32_t len;
+
+        // hash is wz::hash of name.
+        uint32_t hash;
+
+        // parent is true if this component is "..".
+        bool parent;
+
+        std::wstring_view view() const {
+            return std::wstring_view(name, len);
+        }
+    };
+
+    // id uniquely identifies the path string this Path was built from. Paths
+    // built from equal strings have equal ids. Uninterned paths have id 0,
+    // and their lookups are not cached.
+    uint32_t id;
+
+    std::vector<Component> components;
+
+    // names holds the component names of an uninterned path, each null
+    // terminated in place of the '/' that followed it.
+    std::shared_ptr<wchar_t[]> names;
+
+    // Path splits, hashes and interns path. Empty components (e.g. from a
+    // leading or doubled '/') are skipped.
+    explicit Path(std::wstring_view path);
+
+    // uninterned splits and hashes path like Path(path), but the Path owns
+    // its component names, which are freed along with it.
+    static Path uninterned(std::wstring_view path);
+
+    Path(): id(0) {}
+    Path(Path&&) = default;
+    Path(const Path&) = default;
+};
+
+}
@@ -2,8 +2,10 @@
 #include "wz/wz.hh"
 #include "wz/directory.hh"
 
+#include <algorithm>
 #include <cstring>
 #include <fstream>
+#include <vector>
 #define ZLIB_CONST
 #include <zlib.h>
 
@@ -128,161 +130,348 @@ Error String::decrypt(wchar_t* s) const {
     return Error();
 }
 
-Error Image::pixels(uint8_t* out) const {
+// Image_inflate decompresses the data of self, decrypting it first if
+// needed, and passes the decompressed bytes to sink as they are produced.
+// Decompressing more than limit bytes is an error.
+template <typename Sink>
+static Error Image_inflate(
+    const Image& self,
+    uint32_t limit,
+    Sink sink) {
     // Some image data requires decrypting.
-    bool is_encrypted = this->is_encrypted();
+    bool is_encrypted = self.is_encrypted();
     uint32_t encrypted_block_size = 0;
     uint32_t encrypted_block_cursor = 0;
 
-    const uint8_t* source = data;
-    const uint8_t* source_end = source + length - 1; // The last byte of image data seems to be, universally, unused.
-
-    uint32_t decompressed_len = rawsize();
-
-    if ((format + format2) == 1) {
-        // Type 1 images decompress into a smaller buffer, and then need to
-        // be expanded later.
-        decompressed_len /= 2;
-    } else if ((format + format2) == 517) {
-        // Type 517 images are weird: each final row is calculated from a single byte.
-        decompressed_len = width * height / 128;
-    }
+    const uint8_t* source = self.data;
+    const uint8_t* source_end = source + self.length - 1; // The last byte of image data seems to be, universally, unused.
 
     uint32_t decompressed = 0;
 
-    // Now decompress.
-    {
-        uint8_t* to = out + (rawsize() - decompressed_len);
-
-        // Operate in blocks of 4096 bytes.
-        enum { blocksize = 4096 };
+    // Operate in blocks of 4096 bytes.
+    enum { blocksize = 4096 };
 
-        uint8_t input_block[blocksize] = { 0 };
-        uint8_t output_block[blocksize] = { 0 };
-        z_stream z = { 0 };
-        int z_err = Z_OK;
+    uint8_t input_block[blocksize] = { 0 };
+    uint8_t output_block[blocksize] = { 0 };
+    z_stream z = { 0 };
+    int z_err = Z_OK;
 
-        inflateInit(&z);
+    inflateInit(&z);
 
-        do {
-            z.next_out = output_block;
-            z.avail_out = blocksize;
+    do {
+        z.next_out = output_block;
+        z.avail_out = blocksize;
 
-            // Do we need to feed more input data?
-            if (z.avail_in == 0) {
-                // Are we at the end?
-                if (source >= source_end)
-                    break;
+        // Do we need to feed more input data?
+        if (z.avail_in == 0) {
+            // Are we at the end?
+            if (source >= source_end)
+                break;
 
-                if (is_encrypted) {
-                    // For encrypted images, we need to decrypt the data and then copy it into
-                    // input_block.
+            if (is_encrypted) {
+                // For encrypted images, we need to decrypt the data and then copy it into
+                // input_block.
 
-                    // Are we in the middle of an input block?
-                    if (encrypted_block_cursor >= encrypted_block_size) {
-                        // If we aren't, we need to start a new block.
+                // Are we in the middle of an input block?
+                if (encrypted_block_cursor >= encrypted_block_size) {
+                    // If we aren't, we need to start a new block.
 
-                        // There may not be 4 bytes remaining to read a blocksize. If so, break early.
-                        if (source_end - source < 4) {
-                            break;
-                        }
+                    // There may not be 4 bytes remaining to read a blocksize. If so, break early.
+                    if (source_end - source < 4) {
+                        break;
+                    }
 
-                        encrypted_block_cursor = 0;
-                        encrypted_block_size = *reinterpret_cast<const uint32_t*>(source);
-                        source += 4;
+                    encrypted_block_cursor = 0;
+                    encrypted_block_size = *reinterpret_cast<const uint32_t*>(source);
+                    source += 4;
 
-                        // Quick check that this encrypted_block_size value is valid.
-                        if (source + encrypted_block_size > source_end) {
-                            return error_new(Error::BADREAD)
-                                << "encrypted image block size extends past image data: " << encrypted_block_size;
-                        }
-                    }
+                    // Quick check that this encrypted_block_size value is valid.
+                    if (source + encrypted_block_size > source_end) {
+                        inflateEnd(&z);
 
-                    size_t next_chunk_size = encrypted_block_size - encrypted_block_cursor;
-                    if (next_chunk_size > blocksize) {
-                        next_chunk_size = blocksize;
+                        return error_new(Error::BADREAD)
+                            << "encrypted image block size extends past image data: " << encrypted_block_size;
                     }
+                }
 
-                    for (size_t i = 0; i < next_chunk_size; ++i) {
-                        input_block[i] = *source ^ wz_key[encrypted_block_cursor];
+                size_t next_chunk_size = encrypted_block_size - encrypted_block_cursor;
+                if (next_chunk_size > blocksize) {
+                    next_chunk_size = blocksize;
+                }
 
-                        ++encrypted_block_cursor;
-                        ++source;
-                    }
+                for (size_t i = 0; i < next_chunk_size; ++i) {
+                    input_block[i] = *source ^ wz_key[encrypted_block_cursor];
 
-                    z.next_in = input_block;
-                    z.avail_in = next_chunk_size;
-                } else {
-                    // For images that are not encrypted, just feed zlib directly from source.
-                    size_t next_chunk_size = source_end - source;
-                    if (next_chunk_size > blocksize) {
-                        next_chunk_size = blocksize;
-                    }
+                    ++encrypted_block_cursor;
+                    ++source;
+                }
 
-                    z.next_in = source;
-                    z.avail_in = next_chunk_size;
-                    source += next_chunk_size;
+                z.next_in = input_block;
+                z.avail_in = next_chunk_size;
+            } else {
+                // For images that are not encrypted, just feed zlib directly from source.
+                size_t next_chunk_size = source_end - source;
+                if (next_chunk_size > blocksize) {
+                    next_chunk_size = blocksize;
                 }
+
+                z.next_in = source;
+                z.avail_in = next_chunk_size;
+                source += next_chunk_size;
             }
+        }
 
-            z_err = inflate(&z, Z_NO_FLUSH);
-            if (z_err < 0) {
-                inflateEnd(&z);
+        z_err = inflate(&z, Z_NO_FLUSH);
+        if (z_err < 0) {
+            inflateEnd(&z);
 
-                return error_new(Error::DECOMPRESSIONFAILED)
-                    << "zlib decompression failed: " << z_err << ": " << (z.msg ? z.msg : "");
-            }
+            return error_new(Error::DECOMPRESSIONFAILED)
+                << "zlib decompression failed: " << z_err << ": " << (z.msg ? z.msg : "");
+        }
 
-            decompressed += blocksize - z.avail_out;
-            if (decompressed > decompressed_len) {
-                return error_new(Error::DECOMPRESSIONFAILED)
-                    << "would decompress past buffer: " << decompressed << " > " << decompressed_len;
-            }
+        decompressed += blocksize - z.avail_out;
+        if (decompressed > limit) {
+            inflateEnd(&z);
+
+            return error_new(Error::DECOMPRESSIONFAILED)
+                << "would decompress past buffer: " << decompressed << " > " << limit;
+        }
 
-            memcpy(to, output_block, blocksize - z.avail_out);
-            to += blocksize - z.avail_out;
-        } while (z_err != Z_STREAM_END);
+        if (Error e = sink(output_block, blocksize - z.avail_out)) {
+            inflateEnd(&z);
+            return e;
+        }
+    } while (z_err != Z_STREAM_END);
 
-        inflateEnd(&z);
+    inflateEnd(&z);
+    return Error();
+}
+
+// Image_expand517 expands a single byte of type 517 image data into the 128
+// pixels it stands for, each bit being 16 pixels of either all zeroes or all
+// ones.
+static void Image_expand517(
+    uint8_t from,
+    uint8_t* to) {
+    for (uint32_t bit = 0; bit < 8; ++bit) {
+        uint32_t b = from & (1 << (7 - bit));
+        b >>= 7 - bit;
+        b *= 0xFF;
+
+        for (uint32_t k = 0; k < 16; ++k) {
+            to[0] = b;
+            to[1] = b;
+
+            to += 2;
+        }
+    }
+}
+
+Error Image::pixels(uint8_t* out) const {
+    uint32_t decompressed_len = rawsize();
+
+    if ((format + format2) == 517) {
+        // Type 517 images are weird: each final row is calculated from a single byte.
+        decompressed_len = width * height / 128;
+    }
+
+    // Now decompress.
+    {
+        uint8_t* to = out + (rawsize() - decompressed_len);
+
+        CHECK(Image_inflate(*this, decompressed_len, [&](const uint8_t* from, size_t size) {
+            memcpy(to, from, size);
+            to += size;
+            return Error();
+        }), Error::DECOMPRESSIONFAILED) << "failed to decompress image data";
     }
 
     // Perform special expansion.
-    if ((format + format2) == 1) {
-        uint8_t* from = out + (rawsize() - decompressed_len);
+    if ((format + format2) == 517) {
+        const uint8_t* from = out + (rawsize() - decompressed_len);
         uint8_t* to = out;
 
-        for (uint32_t i = 0, l = 2 * width * height; i < l; ++i) {
-            to[0] = (*from & 0x0F) * 0x11;
-            to[1] = ((*from & 0xF0) >> 4) * 0x11;
+        for (uint32_t i = 0; i < decompressed_len; ++i) {
+            Image_expand517(*from, to);
 
-            to += 2;
+            to += 256;
             ++from;
         }
-    } else if ((format + format2) == 517) {
-        uint8_t* from = out + (rawsize() - decompressed_len);
-        uint8_t* to = out;
+    }
 
-        for (uint32_t i = 0; i < decompressed_len; ++i) {
-            for (uint32_t bit = 0; bit < 8; ++bit) {
-                uint32_t b = *from & (1 << (7 - bit));
-                b >>= 7 - bit;
-                b *= 0xFF;
+    return Error();
+}
 
-                for (uint32_t k = 0; k < 16; ++k) {
-                    to[0] = b;
-                    to[1] = b;
+uint32_t Image::bandrows(uint32_t rows) const {
+    if (rows == 0)
+        rows = DEFAULT_BAND_ROWS;
 
-                    to += 2;
-                }
+    switch (format + format2) {
+    case 1026:
+    case 2050:
+        rows = (rows + 3) & ~3u;
+        break;
+    }
+
+    return rows;
+}
+
+Error Image::bands(
+    uint32_t rows,
+    const BandCallback& callback) const {
+    if (rawsize() == 0) {
+        return error_new(Error::UNKNOWNIMAGEFORMAT)
+            << "cannot decode image format " << (format + format2);
+    }
+
+    rows = std::min(bandrows(rows), height);
+
+    uint32_t decompressed_len = rawsize();
+    if ((format + format2) == 517)
+        decompressed_len = width * height / 128;
+
+    std::vector<uint8_t> band(bandsize(rows));
+    size_t filled = 0;
+    uint32_t y = 0;
+
+    // flush passes the filled band to callback, and starts the next.
+    auto flush = [&]() -> Error {
+        const uint32_t band_rows = std::min(rows, height - y);
+        CHECK(callback(Band{
+            .y = y,
+            .rows = band_rows,
+            .pixels = band.data(),
+        }), Error::VISITFAILED) << "failed to consume rows " << y << " to " << (y + band_rows);
+
+        y += band_rows;
+        filled = 0;
+        return Error();
+    };
+
+    // append copies pixels into the band, flushing it each time it fills.
+    auto append = [&](const uint8_t* from, size_t size) -> Error {
+        while (size > 0 && y < height) {
+            const size_t band_size = bandsize(std::min(rows, height - y));
+            const size_t n = std::min(size, band_size - filled);
+            memcpy(band.data() + filled, from, n);
+            filled += n;
+            from += n;
+            size -= n;
+
+            if (filled == band_size) {
+                if (Error e = flush())
+                    return e;
             }
+        }
 
-            ++from;
+        return Error();
+    };
+
+    CHECK(Image_inflate(*this, decompressed_len, [&](const uint8_t* from, size_t size) -> Error {
+        if ((format + format2) != 517)
+            return append(from, size);
+
+        uint8_t expanded[256];
+        for (size_t i = 0; i < size; ++i) {
+            Image_expand517(from[i], expanded);
+            if (Error e = append(expanded, sizeof(expanded)))
+                return e;
         }
+
+        return Error();
+    }), Error::DECOMPRESSIONFAILED) << "failed to decompress image data";
+
+    // Short image data leaves the remaining rows zeroed.
+    while (y < height) {
+        const size_t band_size = bandsize(std::min(rows, height - y));
+        memset(band.data() + filled, 0, band_size - filled);
+        CHECK(flush(),
+            Error::VISITFAILED) << "failed to consume trailing rows";
     }
 
     return Error();
 }
 
+// Image_expand converts rows rows of pixels of self into 8-bit RGBA.
+static Error Image_expand(
+    const Image& self,
+    const uint8_t* pixels,
+    uint32_t rows,
+    uint8_t* out) {
+    const uint32_t width = self.width;
+    const uint32_t count = width * rows;
+
+    switch (self.format + self.format2) {
+    case 1:
+        // BGRA 4_4_4_4_REV: the first byte holds blue and green, the second
+        // red and alpha, each in the low nibble first.
+        for (uint32_t i = 0; i < count; ++i) {
+            out[0] = (pixels[1] & 0x0F) * 0x11;
+            out[1] = ((pixels[0] & 0xF0) >> 4) * 0x11;
+            out[2] = (pixels[0] & 0x0F) * 0x11;
+            out[3] = ((pixels[1] & 0xF0) >> 4) * 0x11;
+
+            pixels += 2;
+            out += 4;
+        }
+        break;
+    case 2:
+        // BGRA8.
+        for (uint32_t i = 0; i < count; ++i) {
+            out[0] = pixels[2];
+            out[1] = pixels[1];
+            out[2] = pixels[0];
+            out[3] = pixels[3];
+
+            pixels += 4;
+            out += 4;
+        }
+        break;
+    case 513:
+    case 517:
+        // RGB 5_6_5, with red in the high bits. Format 517 pixels are either
+        // all zeroes or all ones, so the order of red and blue does not matter.
+        for (uint32_t i = 0; i < count; ++i) {
+            uint16_t p = static_cast<uint16_t>(pixels[0] | (pixels[1] << 8));
+            uint8_t r = (p >> 11) & 0x1F;
+            uint8_t g = (p >> 5) & 0x3F;
+            uint8_t b = p & 0x1F;
+
+            out[0] = (r << 3) | (r >> 2);
+            out[1] = (g << 2) | (g >> 4);
+            out[2] = (b << 3) | (b >> 2);
+            out[3] = 0xFF;
+
+            pixels += 2;
+            out += 4;
+        }
+        break;
+    case 1026:
+        dxt3_decode(pixels, width, rows, out);
+        break;
+    case 2050:
+        dxt5_decode(pixels, width, rows, out);
+        break;
+    default:
+        return error_new(Error::UNKNOWNIMAGEFORMAT)
+            << "cannot expand image format " << (self.format + self.format2);
+    }
+
+    return Error();
+}
+
+Error Image::expand(
+    const uint8_t* pixels,
+    uint8_t* out) const {
+    return Image_expand(*this, pixels, height, out);
+}
+
+Error Image::expand(
+    const Band& band,
+    uint8_t* out) const {
+    return Image_expand(*this, band.pixels, band.rows, out);
+}
+
 Error Image::parse(
     Image* x,
     Parser* p) {
@@ -485,7 +674,9 @@ Error Property::parse_named(
             Error::BADREAD) << "failed to read named property container";
         x->property = std::move(named_container);
     } else if (::wcscmp(kind_name, L"Sound_DX8") == 0) {
-        const uint8_t* sound = p->address;
+        Sound sound;
+        CHECK(Sound::parse(&sound, p),
+            Error::BADREAD) << "failed to read sound";
         x->property = sound;
     } else if (::wcscmp(kind_name, L"UOL") == 0) {
         // Skip unknown byte.
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <functional>
 #include <string>
 #include <variant>
 
 #include "util/error.hh"
+#include "wz/dxt.hh"
 #include "wz/parser.hh"
+#include "wz/sound.hh"
 
 namespace wz {
 
@@ -44,12 +47,14 @@ struct Image {
     const uint8_t* data;
 
     // rawsize returns the uncompressed, unencrypted size of this image's data.
-    // Buffers passed to pixels should be at least this big, in bytes.
+    // Buffers passed to pixels should be at least this big, in bytes. Pixels
+    // are kept in their native layout, so 16-bit formats take 2 bytes per
+    // pixel.
     uint32_t rawsize() const {
         switch (format + format2) {
         case 1:
-            // BGRA8.
-            return width * height * 4;
+            // BGRA 4_4_4_4_REV.
+            return width * height * 2;
         case 2:
             // BGRA8.
             return width * height * 4;
@@ -59,6 +64,10 @@ struct Image {
         case 517:
             // BGR 5_6_5_REV?
             return width * height * 2;
+        case 1026:
+        case 2050:
+            // DXT3 and DXT5 are kept in their compressed block form.
+            return dxt_size(width, height);
         }
 
         // TODO: handle errors here?
@@ -69,10 +78,69 @@ struct Image {
     // format of the image data depends on the value of format + format2.
     Error pixels(uint8_t* out) const;
 
+    // Band is a run of consecutive rows of this image's pixels, in their
+    // native layout, starting at row y.
+    struct Band {
+        uint32_t y;
+        uint32_t rows;
+        const uint8_t* pixels;
+    };
+
+    // BandCallback receives the bands of an image, in order. Its pixels are
+    // only valid for the duration of the call.
+    typedef std::function<Error(const Band&)> BandCallback;
+
+    // DEFAULT_BAND_ROWS is the number of rows in a band, if none is given.
+    static constexpr uint32_t DEFAULT_BAND_ROWS = 64;
+
+    // bandrows returns the number of rows that bands of (up to) rows rows
+    // actually hold. DXT images are banded by whole rows of blocks, so their
+    // bands are rounded up to a multiple of 4 rows. If rows is 0,
+    // DEFAULT_BAND_ROWS is used.
+    uint32_t bandrows(uint32_t rows) const;
+
+    // bandsize returns the size, in bytes, of rows rows of pixels. It is also
+    // the offset of row rows in the buffer filled by pixels.
+    uint32_t bandsize(uint32_t rows) const {
+        Image band = *this;
+        band.height = rows;
+        return band.rawsize();
+    }
+
+    // bands decodes this image's data like pixels, but a band of rows at a
+    // time, passing each band to callback as soon as it is complete. Only a
+    // single band's worth of pixels is held at once, so arbitrarily large
+    // images decode in bounded memory. Rows past the end of the image's data
+    // are zeroes, as they are with pixels.
+    Error bands(
+        uint32_t rows,
+        const BandCallback& callback) const;
+
+    // expandedsize returns the size of this image's pixels when expanded to
+    // 8-bit RGBA. Buffers passed to expand should be at least this big, in
+    // bytes.
+    uint32_t expandedsize() const {
+        return width * height * 4;
+    }
+
+    // expand converts pixels, as decoded by pixels, into 8-bit RGBA in out.
+    // This is only needed by consumers that cannot use the native layouts,
+    // such as PNG encoders.
+    Error expand(
+        const uint8_t* pixels,
+        uint8_t* out) const;
+
+    // expand converts a band, as decoded by bands, into 8-bit RGBA in out,
+    // which should be at least width * band.rows * 4 bytes.
+    Error expand(
+        const Band& band,
+        uint8_t* out) const;
+
     // is_encrypted returns whether this image's data is encrypted, based on
-    // a guess about valid zlib headers.
+    // a guess about valid zlib headers. Images opened from a packed archive
+    // have no data, and are never encrypted.
     bool is_encrypted() const {
-        return length > 2 && !(
+        return data && length > 2 && !(
             (data[0] == 0x78 && data[1] == 0x9C) ||
             (data[0] == 0x78 && data[1] == 0xDA) ||
             (data[0] == 0x78 && data[1] == 0x01) ||
@@ -178,7 +246,7 @@ struct Property {
         NamedPropertyContainer,
         Canvas,
         Vector,
-        const uint8_t*,
+        Sound,
         Uol> property;
 
     static Error parse(
@@ -0,0 +1,586 @@
+#include "wz/query.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cwchar>
+#include <mutex>
+#include <thread>
+
+namespace wz {
+
+// Query_glob returns whether name matches pattern, in which '*' matches any
+// run of characters and '?' any single character.
+static bool Query_glob(
+    std::wstring_view pattern,
+    std::wstring_view name) {
+    size_t p = 0;
+    size_t n = 0;
+
+    // star and star_n are where to resume after a mismatch: the pattern
+    // after the last '*', and the name one character further than it last
+    // matched from.
+    size_t star = std::wstring_view::npos;
+    size_t star_n = 0;
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == L'?' || pattern[p] == name[n])) {
+            ++p;
+            ++n;
+        } else if (p < pattern.size() && pattern[p] == L'*') {
+            star = ++p;
+            star_n = n;
+        } else if (star != std::wstring_view::npos) {
+            p = star;
+            n = ++star_n;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < pattern.size() && pattern[p] == L'*')
+        ++p;
+
+    return p == pattern.size();
+}
+
+static Error Query_components(
+    std::vector<Query::Component>* components,
+    std::wstring_view glob) {
+    while (!glob.empty()) {
+        const size_t slash = glob.find(L'/');
+        const std::wstring_view component = glob.substr(0, slash);
+        glob = (slash == std::wstring_view::npos) ? std::wstring_view() : glob.substr(slash + 1);
+
+        if (component.empty())
+            continue;
+
+        components->push_back(Query::Component{
+            .pattern = std::wstring(component),
+            .recursive = component == L"**",
+            });
+    }
+
+    if (components->empty()) {
+        return error_new(Error::INVALIDUSAGE)
+            << "glob is empty";
+    }
+
+    if (components->size() > Query::MAX_COMPONENTS) {
+        return error_new(Error::INVALIDUSAGE)
+            << "glob has more than " << Query::MAX_COMPONENTS << " components";
+    }
+
+    return Error();
+}
+
+Error Query::Predicate::parse(
+    Predicate* self,
+    std::wstring_view text) {
+    self->op = EXISTS;
+    self->field = VALUE;
+    self->operand.clear();
+    self->numeric = false;
+    self->number = 0;
+
+    if (text.empty())
+        return Error();
+
+    const size_t op_start = text.find_first_of(L"=!<>");
+    if (op_start == std::wstring_view::npos) {
+        return error_new(Error::INVALIDUSAGE)
+            << "predicate " << std::wstring(text) << " has no operator";
+    }
+
+    const std::wstring_view field = text.substr(0, op_start);
+    if (field.empty()) {
+        self->field = VALUE;
+    } else if (field == L"width") {
+        self->field = WIDTH;
+    } else if (field == L"height") {
+        self->field = HEIGHT;
+    } else if (field == L"area") {
+        self->field = AREA;
+    } else {
+        return error_new(Error::INVALIDUSAGE)
+            << "unknown predicate field " << std::wstring(field);
+    }
+
+    std::wstring_view rest = text.substr(op_start);
+    if (rest.starts_with(L"!=")) {
+        self->op = NE;
+        rest.remove_prefix(2);
+    } else if (rest.starts_with(L"==")) {
+        self->op = EQ;
+        rest.remove_prefix(2);
+    } else if (rest.starts_with(L"<=")) {
+        self->op = LE;
+        rest.remove_prefix(2);
+    } else if (rest.starts_with(L">=")) {
+        self->op = GE;
+        rest.remove_prefix(2);
+    } else if (rest.starts_with(L"=")) {
+        self->op = EQ;
+        rest.remove_prefix(1);
+    } else if (rest.starts_with(L"<")) {
+        self->op = LT;
+        rest.remove_prefix(1);
+    } else if (rest.starts_with(L">")) {
+        self->op = GT;
+        rest.remove_prefix(1);
+    } else {
+        return error_new(Error::INVALIDUSAGE)
+            << "unknown predicate operator in " << std::wstring(text);
+    }
+
+    self->operand = rest;
+    if (!self->operand.empty()) {
+        wchar_t* end = nullptr;
+        self->number = std::wcstod(self->operand.c_str(), &end);
+        self->numeric = end == self->operand.c_str() + self->operand.size();
+    }
+
+    if (self->field != VALUE && !self->numeric) {
+        return error_new(Error::INVALIDUSAGE)
+            << "canvas dimensions can only be compared to numbers";
+    }
+
+    return Error();
+}
+
+Error Query::init(
+    Query* self,
+    std::wstring_view files,
+    std::wstring_view path,
+    std::wstring_view predicate) {
+    self->files.clear();
+    self->path.clear();
+
+    CHECK(Query_components(&self->files, files),
+        Error::INVALIDUSAGE) << "invalid file glob";
+    CHECK(Query_components(&self->path, path),
+        Error::INVALIDUSAGE) << "invalid property path glob";
+    CHECK(Predicate::parse(&self->predicate, predicate),
+        Error::INVALIDUSAGE) << "invalid predicate";
+
+    return Error();
+}
+
+template <typename T>
+static bool Query_compare(
+    Query::Predicate::Op op,
+    T l,
+    T r) {
+    switch (op) {
+    case Query::Predicate::EXISTS:
+        return true;
+    case Query::Predicate::EQ:
+        return l == r;
+    case Query::Predicate::NE:
+        return l != r;
+    case Query::Predicate::LT:
+        return l < r;
+    case Query::Predicate::LE:
+        return l <= r;
+    case Query::Predicate::GT:
+        return l > r;
+    case Query::Predicate::GE:
+        return l >= r;
+    }
+
+    return false;
+}
+
+// Query_test returns whether match satisfies predicate. match.string, if
+// set, is null-terminated.
+static bool Query_test(
+    const Query::Predicate& predicate,
+    const Query::Match& match) {
+    if (predicate.op == Query::Predicate::EXISTS)
+        return true;
+
+    if (predicate.field != Query::Predicate::VALUE) {
+        const Canvas* canvas = std::get_if<Canvas>(&match.property->property);
+        if (canvas == nullptr)
+            return false;
+
+        double value = 0;
+        switch (predicate.field) {
+        case Query::Predicate::WIDTH:
+            value = canvas->image.width;
+            break;
+        case Query::Predicate::HEIGHT:
+            value = canvas->image.height;
+            break;
+        default:
+            value = static_cast<double>(canvas->image.width) * canvas->image.height;
+            break;
+        }
+
+        return Query_compare(predicate.op, value, predicate.number);
+    }
+
+    if (match.numeric) {
+        if (predicate.numeric)
+            return Query_compare(predicate.op, match.number, predicate.number);
+
+        return predicate.op == Query::Predicate::NE;
+    }
+
+    const bool is_string =
+        std::holds_alternative<String>(match.property->property) ||
+        std::holds_alternative<Uol>(match.property->property);
+    if (!is_string)
+        return false;
+
+    if (predicate.op == Query::Predicate::EQ || predicate.op == Query::Predicate::NE)
+        return Query_compare<std::wstring_view>(predicate.op, match.string, predicate.operand);
+
+    // Strings are ordered as numbers, if they are numbers.
+    if (!predicate.numeric || match.string.empty())
+        return false;
+
+    wchar_t* end = nullptr;
+    const double number = std::wcstod(match.string.data(), &end);
+    if (end != match.string.data() + match.string.size())
+        return false;
+
+    return Query_compare(predicate.op, number, predicate.number);
+}
+
+// QueryScan is the state of a thread scanning files. Its buffers are reused
+// from file to file, so that scanning does not allocate once they have
+// grown.
+struct QueryScan {
+    const Query* query;
+    const Query::Callback* callback;
+    std::mutex* lock;
+
+    const Wz* wz;
+    std::wstring_view file;
+
+    // path is the path of the property being visited. The name of each
+    // property is decrypted directly into it.
+    std::wstring path;
+
+    // value is the decrypted string value of a matched property.
+    std::vector<wchar_t> value;
+
+    Query::Stats stats;
+};
+
+// QueryStates is a set of components of the property path glob, a bit per
+// component: the components that the properties being visited may match.
+typedef uint64_t QueryStates;
+
+static Error QueryScan_visit(
+    QueryScan* self,
+    const Property& p,
+    size_t name_start,
+    QueryStates states);
+
+template <typename C>
+static Error QueryScan_descend(
+    QueryScan* self,
+    const C& container,
+    QueryStates states) {
+    const size_t length = self->path.size();
+
+    auto it = container.iterator(self->wz);
+    for (uint32_t index = 0; it; ++index) {
+        Property p;
+        CHECK(it.next(&p),
+            Error::BADREAD) << "failed to read property";
+        ++self->stats.properties;
+
+        if (length > 0)
+            self->path.push_back(L'/');
+        const size_t name_start = self->path.size();
+
+        if (p.name.len > 0) {
+            self->path.resize(name_start + p.name.len);
+            CHECK(p.name.decrypt(self->path.data() + name_start),
+                Error::BADREAD) << "failed to decrypt property name";
+        } else {
+            // The points of a convex are unnamed, so they are named by their
+            // index.
+            wchar_t index_name[16];
+            const int len = std::swprintf(index_name, 16, L"%u", index);
+            self->path.append(index_name, len);
+        }
+
+        CHECK(QueryScan_visit(self, p, name_start, states),
+            Error::BADREAD) << "failed to visit " << self->path;
+
+        self->path.resize(length);
+    }
+
+    return Error();
+}
+
+static Error QueryScan_children(
+    QueryScan* self,
+    const Property& p,
+    QueryStates states) {
+    if (const PropertyContainer* c = std::get_if<PropertyContainer>(&p.property)) {
+        return QueryScan_descend(self, *c, states);
+    } else if (const NamedPropertyContainer* c = std::get_if<NamedPropertyContainer>(&p.property)) {
+        return QueryScan_descend(self, *c, states);
+    } else if (const Canvas* canvas = std::get_if<Canvas>(&p.property)) {
+        return QueryScan_descend(self, canvas->children, states);
+    }
+
+    return Error();
+}
+
+static Error QueryScan_emit(
+    QueryScan* self,
+    const Property& p) {
+    Query::Match match = {
+        .file = self->file,
+        .path = self->path,
+        .property = &p,
+        .string = std::wstring_view(),
+        .numeric = true,
+        .number = 0,
+    };
+
+    const String* string = std::get_if<String>(&p.property);
+    if (const Uol* uol = std::get_if<Uol>(&p.property))
+        string = &uol->uol;
+
+    if (const uint16_t* x = std::get_if<uint16_t>(&p.property)) {
+        match.number = *x;
+    } else if (const int32_t* x = std::get_if<int32_t>(&p.property)) {
+        match.number = *x;
+    } else if (const float* x = std::get_if<float>(&p.property)) {
+        match.number = *x;
+    } else if (const double* x = std::get_if<double>(&p.property)) {
+        match.number = *x;
+    } else {
+        match.numeric = false;
+    }
+
+    if (string) {
+        if (self->value.size() < string->len + 1)
+            self->value.resize(string->len + 1);
+
+        CHECK(string->decrypt(self->value.data()),
+            Error::BADREAD) << "failed to decrypt property value";
+        self->value[string->len] = 0;
+        match.string = std::wstring_view(self->value.data(), string->len);
+    }
+
+    if (!Query_test(self->query->predicate, match))
+        return Error();
+
+    ++self->stats.matches;
+
+    std::lock_guard<std::mutex> l(*self->lock);
+    (*self->callback)(match);
+    return Error();
+}
+
+// QueryScan_visit matches p, whose name is in path from name_start, against
+// each component of the property path in states. Every way that the "**"s of
+// the path can match is followed at once, so p is visited, and emitted, only
+// once however many of them match it.
+static Error QueryScan_visit(
+    QueryScan* self,
+    const Property& p,
+    size_t name_start,
+    QueryStates states) {
+    const std::vector<Query::Component>& path = self->query->path;
+    const size_t n = path.size();
+
+    // "**" matches no components, so p may match the component after it too.
+    for (size_t c = 0; c + 1 < n; ++c) {
+        if ((states >> c & 1) && path[c].recursive)
+            states |= QueryStates(1) << (c + 1);
+    }
+
+    const std::wstring_view name = std::wstring_view(self->path).substr(name_start);
+    bool matched = false;
+    QueryStates children = 0;
+    for (size_t c = 0; c < n; ++c) {
+        if (!(states >> c & 1))
+            continue;
+
+        // "**" matches p, or any number of components, so p's children may
+        // match it too.
+        if (path[c].recursive)
+            children |= QueryStates(1) << c;
+        else if (!Query_glob(path[c].pattern, name))
+            continue;
+        else if (c + 1 < n)
+            children |= QueryStates(1) << (c + 1);
+
+        if (c + 1 == n)
+            matched = true;
+    }
+
+    if (matched) {
+        CHECK(QueryScan_emit(self, p),
+            Error::BADREAD) << "failed to emit match";
+    }
+
+    if (children == 0)
+        return Error();
+
+    return QueryScan_children(self, p, children);
+}
+
+struct QueryTarget {
+    std::wstring path;
+    const Vfs::File* file;
+};
+
+static void Query_collect(
+    const std::vector<Query::Component>& files,
+    const Vfs::Node* node,
+    std::wstring* path,
+    size_t component,
+    std::vector<QueryTarget>* targets);
+
+// Query_collect_child matches node, whose path is path, against the file
+// glob from component on.
+static void Query_collect_child(
+    const std::vector<Query::Component>& files,
+    const Vfs::Node* node,
+    std::wstring_view name,
+    std::wstring* path,
+    size_t component,
+    std::vector<QueryTarget>* targets) {
+    const Query::Component& c = files[component];
+    const bool last = component + 1 == files.size();
+
+    if (c.recursive) {
+        if (last) {
+            if (const Vfs::File* file = node->file())
+                targets->push_back(QueryTarget{ *path, file });
+        } else {
+            Query_collect_child(files, node, name, path, component + 1, targets);
+        }
+
+        Query_collect(files, node, path, component, targets);
+        return;
+    }
+
+    if (!Query_glob(c.pattern, name))
+        return;
+
+    if (last) {
+        if (const Vfs::File* file = node->file())
+            targets->push_back(QueryTarget{ *path, file });
+    } else {
+        Query_collect(files, node, path, component + 1, targets);
+    }
+}
+
+static void Query_collect(
+    const std::vector<Query::Component>& files,
+    const Vfs::Node* node,
+    std::wstring* path,
+    size_t component,
+    std::vector<QueryTarget>* targets) {
+    const Vfs::Directory* directory = node->directory();
+    if (directory == nullptr)
+        return;
+
+    const size_t length = path->size();
+    for (const auto& it : directory->children) {
+        if (length > 0)
+            path->push_back(L'/');
+        path->append(it.first);
+
+        Query_collect_child(files, &it.second, it.first, path, component, targets);
+        path->resize(length);
+    }
+}
+
+Error Query::run(
+    const Vfs* vfs,
+    const Callback& callback,
+    const Options& options,
+    Stats* stats) const {
+    if (vfs->packed) {
+        return error_new(Error::INVALIDUSAGE)
+            << "packed archives cannot be queried";
+    }
+
+    std::vector<QueryTarget> targets;
+    std::wstring path;
+    Query_collect(files, &vfs->root, &path, 0, &targets);
+
+    // "**" can match a file in more than one way. Scan files in path order,
+    // which is also roughly their order in the archive.
+    std::sort(targets.begin(), targets.end(), [](const QueryTarget& l, const QueryTarget& r) {
+        return l.path < r.path;
+        });
+    targets.erase(std::unique(targets.begin(), targets.end(), [](const QueryTarget& l, const QueryTarget& r) {
+        return l.file == r.file;
+        }), targets.end());
+
+    uint32_t threads = options.threads;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<uint32_t>(std::min<size_t>(threads, std::max<size_t>(targets.size(), 1)));
+
+    std::mutex lock;
+    std::atomic<size_t> next = 0;
+    std::atomic<bool> failed = false;
+    std::vector<Error> errors;
+    Stats totals = { 0 };
+
+    auto worker = [&]() {
+        QueryScan scan = {
+            .query = this,
+            .callback = &callback,
+            .lock = &lock,
+            .wz = nullptr,
+            .file = std::wstring_view(),
+            .path = std::wstring(),
+            .value = std::vector<wchar_t>(),
+            .stats = { 0 },
+        };
+
+        for (size_t i = next++; i < targets.size() && !failed; i = next++) {
+            const QueryTarget& target = targets[i];
+            scan.wz = target.file->wz.get();
+            scan.file = target.path;
+            scan.path.clear();
+            ++scan.stats.files;
+
+            if (Error e = QueryScan_descend(&scan, target.file->file.root, 1)) {
+                failed = true;
+
+                std::lock_guard<std::mutex> l(lock);
+                errors.push_back(std::move(
+                    error_push(e, Error::VISITFAILED) << "failed to scan " << target.path));
+                break;
+            }
+        }
+
+        std::lock_guard<std::mutex> l(lock);
+        totals.files += scan.stats.files;
+        totals.properties += scan.stats.properties;
+        totals.matches += scan.stats.matches;
+    };
+
+    std::vector<std::thread> pool;
+    for (uint32_t i = 1; i < threads; ++i)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread& thread : pool)
+        thread.join();
+
+    if (stats)
+        *stats = totals;
+
+    if (!errors.empty()) {
+        Error e = std::move(errors.front());
+        return error_push(e, Error::VISITFAILED) << "query failed";
+    }
+
+    return Error();
+}
+
+}
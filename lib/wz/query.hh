@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util/error.hh"
+#include "wz/property.hh"
+#include "wz/vfs.hh"
+
+namespace wz {
+
+// Query finds properties across every file of a Vfs. A query is made up of a
+// glob of files, a glob of property paths within them, and a predicate on the
+// value of the properties that the path matches. For example, every map that
+// plays a given song:
+//
+// ```
+// Query::init(&query, L"Map/Map*/*.img", L"info/bgm", L"=Bgm00/FloralLife");
+// ```
+//
+// Or every large canvas in any file:
+//
+// ```
+// Query::init(&query, L"**", L"**", L"area>1048576");
+// ```
+//
+// Globs are '/' separated. In each component, '*' matches any run of
+// characters and '?' any single character; a "**" component matches any
+// number of components.
+//
+// Files are scanned in parallel, with the raw parser: no OpenedFile is
+// built, and canvases are not decoded, so scanning costs little more than
+// decrypting property names. Subtrees are only descended into if the path
+// can still match below them.
+struct Query {
+    // Predicate tests the value of a matched property. Its text form is an
+    // optional field, an operator, and an operand: "=Bgm00/FloralLife",
+    // "width>1024", "!=0". An empty predicate matches every property.
+    struct Predicate {
+        enum Op {
+            EXISTS,
+            EQ,
+            NE,
+            LT,
+            LE,
+            GT,
+            GE,
+        };
+
+        // Field selects what is compared: the property's own value, or a
+        // dimension of a canvas.
+        enum Field {
+            VALUE,
+            WIDTH,
+            HEIGHT,
+            AREA,
+        };
+
+        Op op;
+        Field field;
+
+        // operand is the text of the operand. If it is a number, numeric is
+        // set and number is its value.
+        std::wstring operand;
+        bool numeric;
+        double number;
+
+        static Error parse(
+            Predicate* self,
+            std::wstring_view text);
+    };
+
+    // Options controls how a query is run.
+    struct Options {
+        // threads is the number of threads to scan files with. If 0, the
+        // number of hardware threads is used.
+        uint32_t threads;
+    };
+
+    // Match is a property that matched a query. Its views are only valid for
+    // the duration of the callback that is given the Match.
+    struct Match {
+        // file is the path of the file in the Vfs, and path the path of the
+        // property within the file.
+        std::wstring_view file;
+        std::wstring_view path;
+
+        // property is the raw property. Its strings are still encrypted.
+        const Property* property;
+
+        // string is the decrypted value of a string or Uol property. number
+        // is the value of a numeric property, and numeric is set if there is
+        // one.
+        std::wstring_view string;
+        bool numeric;
+        double number;
+    };
+
+    // Callback receives matches as they are found. Calls are serialized, so
+    // callbacks do not need to synchronize, but they are made from the
+    // scanning threads, in no particular order.
+    typedef std::function<void(const Match&)> Callback;
+
+    struct Stats {
+        uint64_t files;
+        uint64_t properties;
+        uint64_t matches;
+    };
+
+    // Component is a component of a glob.
+    struct Component {
+        std::wstring pattern;
+
+        // recursive is set if the component is "**".
+        bool recursive;
+    };
+
+    // MAX_COMPONENTS is the most components a glob may have.
+    static constexpr size_t MAX_COMPONENTS = 64;
+
+    std::vector<Component> files;
+    std::vector<Component> path;
+    Predicate predicate;
+
+    static Error init(
+        Query* self,
+        std::wstring_view files,
+        std::wstring_view path,
+        std::wstring_view predicate = L"");
+
+    // run scans every file of vfs that matches this query's file glob, and
+    // passes every matching property to callback. vfs must not be a packed
+    // archive, since the raw parser reads the archive itself.
+    Error run(
+        const Vfs* vfs,
+        const Callback& callback,
+        const Options& options = {},
+        Stats* stats = nullptr) const;
+
+    Query() = default;
+    Query(Query&&) = default;
+    Query(const Query&) = delete;
+};
+
+}
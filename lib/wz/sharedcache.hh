@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "p.hh"
+#include "util/error.hh"
+#include "wz/directory.hh"
+#include "wz/packed.hh"
+#include "wz/wz.hh"
+
+namespace wz {
+
+struct OpenedFile;
+
+// SharedCache shares opened files between processes on the same host, through
+// POSIX shared memory. The first process to open a file decodes it as usual,
+// and publishes it into a segment named by the archive's identity and the
+// file's offset in the archive. Every other process that opens the file maps
+// the segment read-only, and uses its strings and pixels in place, the same
+// way as a packed archive's. Only the nodes, which hold pointers, are private
+// to each process.
+//
+// Segments are reference counted by the processes that map them, and are
+// unlinked when the last one releases them, unless the cache persists them.
+// The segments of processes that crash are never released: they can be
+// deleted by their names, which all start with the cache's prefix. Segments
+// whose publisher crashed before they were ready are unlinked by the next
+// process to find them, once they are stale.
+struct SharedCache {
+    struct Options {
+        // prefix is the start of the names of segments. It must start with a
+        // '/'. If empty, DEFAULT_PREFIX is used.
+        std::string prefix;
+
+        // persist keeps segments after the last process releases them, so
+        // that processes that come and go can still share them.
+        bool persist;
+
+        // stale_after is how long a segment may go unready before its
+        // publisher is taken to have died. If 0, DEFAULT_STALE_AFTER is used.
+        std::chrono::seconds stale_after;
+    };
+
+    // SegmentHeader is the start of a segment, which is mapped writable by
+    // every process so that it can be reference counted. The packed file
+    // follows it, from data_offset.
+    struct SegmentHeader {
+        char magic[8];
+
+        // ready is set once the publisher has finished writing the segment.
+        std::atomic<uint32_t> ready;
+        std::atomic<uint32_t> refs;
+
+        uint64_t data_offset;
+        uint64_t data_size;
+    };
+
+    // Segment is a segment mapped by this process. Releasing it drops the
+    // process' reference.
+    struct Segment {
+        std::string name;
+        bool persist;
+
+        // device and inode identify the segment that was mapped, which name
+        // may since have been unlinked from and republished under.
+        uint64_t device;
+        uint64_t inode;
+
+        SegmentHeader* header;
+        size_t header_size;
+
+        // data is the read-only mapping of the packed file.
+        const uint8_t* data;
+        size_t data_size;
+
+        // packed is the packed file in the segment, which contains the file
+        // at entry 1.
+        Packed packed;
+
+        ~Segment();
+
+        Segment() = default;
+        Segment(Segment&&) = delete;
+        Segment(const Segment&) = delete;
+    };
+
+    struct Stats {
+        // hits is the number of files mapped from existing segments.
+        uint64_t hits;
+
+        // misses is the number of files that had no segment.
+        uint64_t misses;
+
+        // published is the number of segments published by this process.
+        uint64_t published;
+    };
+
+    static constexpr const char* DEFAULT_PREFIX = "/wz-";
+    static constexpr std::chrono::seconds DEFAULT_STALE_AFTER{ 30 };
+
+    Options options;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> published;
+
+    static Error open(
+        SharedCache* self,
+        const Options& options = {});
+
+    // acquire maps the segment of f, if one has been published, into
+    // segment. Misses, including segments that are still being published,
+    // are not errors: segment is left empty.
+    Error acquire(
+        const Wz* wz,
+        const File* f,
+        std::unique_ptr<Segment>* segment);
+
+    // publish creates the segment of f, holding of. If another process is
+    // publishing the same segment, nothing is done.
+    Error publish(
+        const Wz* wz,
+        const File* f,
+        const OpenedFile& of);
+
+    // stats returns a snapshot of this cache's statistics, in this process.
+    Stats stats() const;
+
+    SharedCache() = default;
+    SharedCache(SharedCache&&) = delete;
+    SharedCache(const SharedCache&) = delete;
+};
+
+}
@@ -0,0 +1,317 @@
+#include "wz/sharedcache.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <ostream>
+#include <sstream>
+
+#include "logger.hh"
+#include "wz/vfs.hh"
+
+namespace wz {
+
+static const char SEGMENT_MAGIC[8] = { 'W', 'Z', 'S', 'H', 'A', 'R', 'E', 'D' };
+
+static std::string SharedCache_name(
+    const SharedCache* self,
+    const Wz* wz,
+    const File* f) {
+    std::stringstream ss;
+    ss << self->options.prefix << std::hex << wz->identity() << "-" << (f->base - wz->file.start);
+    return ss.str();
+}
+
+// SharedCache_header_size is the size of the header of a segment: a page, so
+// that the packed file that follows it can be mapped separately.
+static size_t SharedCache_header_size() {
+    const long page = ::sysconf(_SC_PAGESIZE);
+    return page > 0 ? static_cast<size_t>(page) : 4096;
+}
+
+// SharedCache_names returns whether name still names the segment identified by
+// device and inode.
+static bool SharedCache_names(
+    const std::string& name,
+    uint64_t device,
+    uint64_t inode) {
+    const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        return false;
+
+    struct stat stat = { 0 };
+    const bool same = ::fstat(fd, &stat) == 0 &&
+        static_cast<uint64_t>(stat.st_dev) == device &&
+        static_cast<uint64_t>(stat.st_ino) == inode;
+    ::close(fd);
+    return same;
+}
+
+// SharedCache_reap unlinks the unready segment at name, described by stat,
+// if it has not been written to for options.stale_after, since its publisher
+// must have died before finishing it. Until it is unlinked, every process
+// would miss it, and none could publish it again.
+static void SharedCache_reap(
+    const SharedCache* self,
+    const std::string& name,
+    const struct stat& stat) {
+    if (::time(nullptr) - stat.st_mtime < self->options.stale_after.count())
+        return;
+
+    if (!SharedCache_names(name, stat.st_dev, stat.st_ino))
+        return;
+
+    LOG(Logger::WARNING)
+        << "unlinking shared segment " << name.c_str() << ", which was never finished";
+    ::shm_unlink(name.c_str());
+}
+
+// SegmentWriter is a streambuf over the mapped data of a segment, so that
+// files are packed straight into it.
+struct SegmentWriter : std::streambuf {
+    SegmentWriter(
+        uint8_t* start,
+        size_t size) {
+        char* s = reinterpret_cast<char*>(start);
+        setp(s, s + size);
+    }
+
+    pos_type seekoff(
+        off_type off,
+        std::ios_base::seekdir dir,
+        std::ios_base::openmode which) override {
+        if (dir == std::ios_base::cur)
+            off += pptr() - pbase();
+        else if (dir == std::ios_base::end)
+            off += epptr() - pbase();
+
+        return seekpos(pos_type(off), which);
+    }
+
+    pos_type seekpos(
+        pos_type pos,
+        std::ios_base::openmode which) override {
+        const off_type off = pos;
+        if (!(which & std::ios_base::out) || off < 0 || off > epptr() - pbase())
+            return pos_type(off_type(-1));
+
+        // pbump takes an int, so move in steps that fit one.
+        setp(pbase(), epptr());
+        for (off_type left = off; left > 0;) {
+            const int step = static_cast<int>(std::min<off_type>(left, INT_MAX));
+            pbump(step);
+            left -= step;
+        }
+
+        return pos;
+    }
+};
+
+SharedCache::Segment::~Segment() {
+    packed.close();
+
+    if (data)
+        ::munmap(const_cast<uint8_t*>(data), data_size);
+
+    if (header) {
+        // The last process to release a segment unlinks it. A process that
+        // opens the segment just before then keeps its mapping, which stays
+        // valid, and the segment is published again by the next miss. If
+        // that has already happened, name belongs to the new segment, which
+        // is left alone.
+        if (header->refs.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+            !persist &&
+            SharedCache_names(name, device, inode))
+            ::shm_unlink(name.c_str());
+
+        ::munmap(header, header_size);
+    }
+}
+
+Error SharedCache::open(
+    SharedCache* self,
+    const Options& options) {
+    self->options = options;
+    if (self->options.prefix.empty())
+        self->options.prefix = DEFAULT_PREFIX;
+    if (self->options.stale_after.count() == 0)
+        self->options.stale_after = DEFAULT_STALE_AFTER;
+
+    if (self->options.prefix[0] != '/' ||
+        self->options.prefix.find('/', 1) != std::string::npos) {
+        return error_new(Error::INVALIDUSAGE)
+            << "shared cache prefix must be a single '/' followed by a name";
+    }
+
+    self->hits = 0;
+    self->misses = 0;
+    self->published = 0;
+    return Error();
+}
+
+Error SharedCache::acquire(
+    const Wz* wz,
+    const File* f,
+    std::unique_ptr<Segment>* segment) {
+    segment->reset();
+
+    const std::string name = SharedCache_name(this, wz, f);
+    const int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    if (fd == -1) {
+        ++misses;
+        if (errno == ENOENT)
+            return Error();
+
+        return error_new(Error::OPENFAILED)
+            << "failed to open shared segment " << name.c_str() << ": " << errno;
+    }
+
+    std::unique_ptr<Segment> s(new Segment());
+    s->name = name;
+    s->persist = options.persist;
+    s->device = 0;
+    s->inode = 0;
+    s->header = nullptr;
+    s->data = nullptr;
+
+    // The publisher sizes the segment before writing anything, so a segment
+    // that is too small for a header is still being created.
+    const size_t header_size = SharedCache_header_size();
+    struct stat stat = { 0 };
+    if (::fstat(fd, &stat) == -1) {
+        ::close(fd);
+        ++misses;
+        return Error();
+    }
+
+    if (static_cast<size_t>(stat.st_size) < header_size) {
+        ::close(fd);
+        SharedCache_reap(this, name, stat);
+        ++misses;
+        return Error();
+    }
+
+    void* header = ::mmap(nullptr, header_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        ::close(fd);
+        return error_new(Error::OPENFAILED)
+            << "failed to map shared segment header " << name.c_str() << ": " << errno;
+    }
+    SegmentHeader* h = static_cast<SegmentHeader*>(header);
+
+    if (::memcmp(h->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0 ||
+        !h->ready.load(std::memory_order_acquire) ||
+        h->data_offset != header_size ||
+        h->data_offset + h->data_size > static_cast<uint64_t>(stat.st_size)) {
+        const bool ready = h->ready.load(std::memory_order_acquire);
+        ::munmap(header, header_size);
+        ::close(fd);
+        if (!ready)
+            SharedCache_reap(this, name, stat);
+        ++misses;
+        return Error();
+    }
+
+    h->refs.fetch_add(1, std::memory_order_acq_rel);
+    s->device = static_cast<uint64_t>(stat.st_dev);
+    s->inode = static_cast<uint64_t>(stat.st_ino);
+    s->header = h;
+    s->header_size = header_size;
+
+    void* data = ::mmap(nullptr, h->data_size, PROT_READ, MAP_SHARED, fd, h->data_offset);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return error_new(Error::OPENFAILED)
+            << "failed to map shared segment " << name.c_str() << ": " << errno;
+    }
+    s->data = static_cast<const uint8_t*>(data);
+    s->data_size = h->data_size;
+
+    CHECK(Packed::parse(&s->packed, Extents{ s->data, s->data + s->data_size }),
+        Error::OPENFAILED) << "invalid shared segment " << name.c_str();
+    if (s->packed.header->identity != wz->identity()) {
+        return error_new(Error::OPENFAILED)
+            << "shared segment " << name.c_str() << " is of another archive";
+    }
+
+    ++hits;
+    *segment = std::move(s);
+    return Error();
+}
+
+Error SharedCache::publish(
+    const Wz* wz,
+    const File* f,
+    const OpenedFile& of) {
+    // Measure the packed file first, so that it can be packed straight into
+    // the segment.
+    uint64_t data_size = 0;
+    CHECK(Packed::pack_file_size(of, &data_size),
+        Error::OPENFAILED) << "failed to measure file";
+
+    const std::string name = SharedCache_name(this, wz, f);
+    const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1) {
+        // Someone else got there first.
+        if (errno == EEXIST)
+            return Error();
+
+        return error_new(Error::OPENFAILED)
+            << "failed to create shared segment " << name.c_str() << ": " << errno;
+    }
+
+    const size_t header_size = SharedCache_header_size();
+    const size_t size = header_size + data_size;
+    void* segment = MAP_FAILED;
+    if (::ftruncate(fd, size) == 0)
+        segment = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (segment == MAP_FAILED) {
+        const int error = errno;
+        ::shm_unlink(name.c_str());
+        return error_new(Error::OPENFAILED)
+            << "failed to size shared segment " << name.c_str() << ": " << error;
+    }
+
+    uint8_t* start = static_cast<uint8_t*>(segment);
+    SegmentWriter writer(start + header_size, data_size);
+    std::ostream out(&writer);
+    if (Error e = Packed::pack_file(of, wz->identity(), &out)) {
+        ::munmap(segment, size);
+        ::shm_unlink(name.c_str());
+        return error_push(e, Error::OPENFAILED) << "failed to pack file";
+    }
+
+    // The segment is zeroed by ftruncate, so the header's atomics start out
+    // as 0: not ready, and unreferenced.
+    SegmentHeader* header = reinterpret_cast<SegmentHeader*>(start);
+    ::memcpy(header->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    header->data_offset = header_size;
+    header->data_size = data_size;
+    header->ready.store(1, std::memory_order_release);
+
+    ::munmap(segment, size);
+
+    ++published;
+    LOG(Logger::INFO)
+        << "published " << data_size << " bytes to shared segment " << name.c_str();
+    return Error();
+}
+
+SharedCache::Stats SharedCache::stats() const {
+    return Stats{
+        .hits = hits.load(),
+        .misses = misses.load(),
+        .published = published.load(),
+    };
+}
+
+}
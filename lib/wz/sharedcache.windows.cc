@@ -0,0 +1,36 @@
+#include "wz/sharedcache.hh"
+
+namespace wz {
+
+// Shared memory segments are only implemented with POSIX shared memory. On
+// Windows, opening a cache fails, so that files are decoded privately.
+
+SharedCache::Segment::~Segment() {}
+
+Error SharedCache::open(
+    SharedCache* self,
+    const Options& options) {
+    return error_new(Error::INVALIDUSAGE)
+        << "shared caches are not supported on this platform";
+}
+
+Error SharedCache::acquire(
+    const Wz* wz,
+    const File* f,
+    std::unique_ptr<Segment>* segment) {
+    segment->reset();
+    return Error();
+}
+
+Error SharedCache::publish(
+    const Wz* wz,
+    const File* f,
+    const OpenedFile& of) {
+    return Error();
+}
+
+SharedCache::Stats SharedCache::stats() const {
+    return Stats{ 0 };
+}
+
+}
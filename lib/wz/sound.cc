@@ -0,0 +1,104 @@
+#include "wz/sound.hh"
+
+#include <cstring>
+
+#include "wz/wz.hh"
+
+namespace wz {
+
+extern "C" {
+    extern const uint8_t wz_key[];
+}
+
+const uint8_t Sound::MEDIA_TYPE[Sound::MEDIA_TYPE_SIZE] = {
+    0x02,
+    // MEDIATYPE_Stream.
+    0x83, 0xEB, 0x36, 0xE4, 0x4F, 0x52, 0xCE, 0x11,
+    0x9F, 0x53, 0x00, 0x20, 0xAF, 0x0B, 0xA7, 0x70,
+    // MEDIASUBTYPE_WAVE.
+    0x8B, 0xEB, 0x36, 0xE4, 0x4F, 0x52, 0xCE, 0x11,
+    0x9F, 0x53, 0x00, 0x20, 0xAF, 0x0B, 0xA7, 0x70,
+    0x00,
+    0x01,
+    // FORMAT_WaveFormatEx.
+    0x81, 0x9F, 0x58, 0x05, 0x56, 0xC3, 0xCE, 0x11,
+    0xBF, 0x01, 0x00, 0xAA, 0x00, 0x55, 0x59, 0x5A,
+};
+
+// Sound_format reads a WAVEFORMATEX of len bytes. It is consistent if its
+// count of extra bytes accounts for the rest of len.
+static bool Sound_format(
+    Sound::Format* format,
+    const uint8_t* at,
+    uint32_t len) {
+    if (len < Sound::WAVEFORMATEX_SIZE)
+        return false;
+
+    uint16_t extra = 0;
+    std::memcpy(&format->tag, at + 0, 2);
+    std::memcpy(&format->channels, at + 2, 2);
+    std::memcpy(&format->samples_per_second, at + 4, 4);
+    std::memcpy(&format->bytes_per_second, at + 8, 4);
+    std::memcpy(&format->block_align, at + 12, 2);
+    std::memcpy(&format->bits_per_sample, at + 14, 2);
+    std::memcpy(&extra, at + 16, 2);
+
+    return Sound::WAVEFORMATEX_SIZE + extra == len;
+}
+
+Error Sound::parse(
+    Sound* x,
+    Parser* p) {
+    // Skip unknown byte.
+    ++p->address;
+
+    int32_t length = 0;
+    CHECK(p->i32_compressed(&length),
+        Error::BADREAD) << "failed to read sound length";
+    int32_t duration_ms = 0;
+    CHECK(p->i32_compressed(&duration_ms),
+        Error::BADREAD) << "failed to read sound duration";
+    if (length < 0 || duration_ms < 0) {
+        return error_new(Error::BADREAD)
+            << "read negative sound length " << length << " or duration " << duration_ms;
+    }
+
+    x->header = p->address;
+    p->address += MEDIA_TYPE_SIZE;
+
+    uint8_t format_length = 0;
+    CHECK(p->u8(&format_length),
+        Error::BADREAD) << "failed to read sound format length";
+
+    if (!p->wz->file.valid(p->address, format_length))
+        return error_new(Error::INVALIDOFFSET)
+        << "sound format is outside of file extents " << p->wz->file;
+
+    // Some archives encrypt the WAVEFORMATEX, which is detected by it being
+    // inconsistent. If it still is once decrypted, the format is unknown,
+    // but the payload can still be read.
+    if (!Sound_format(&x->format, p->address, format_length)) {
+        uint8_t decrypted[256];
+        for (uint32_t i = 0; i < format_length; ++i) {
+            decrypted[i] = p->address[i] ^ wz_key[i];
+        }
+
+        if (!Sound_format(&x->format, decrypted, format_length))
+            x->format = Format{ .tag = FORMAT_UNKNOWN };
+    }
+    p->address += format_length;
+
+    x->header_length = p->address - x->header;
+    x->duration_ms = duration_ms;
+    x->data = p->address;
+    x->length = length;
+
+    if (!p->wz->file.valid(x->data, x->length))
+        return error_new(Error::INVALIDOFFSET)
+        << "sound data of " << x->length << " bytes is outside of file extents " << p->wz->file;
+    p->address += x->length;
+
+    return Error();
+}
+
+}
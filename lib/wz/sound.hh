@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+
+#include "p.hh"
+#include "util/error.hh"
+#include "wz/parser.hh"
+
+namespace wz {
+
+// Sound is a Sound_DX8 property. It is made up of a DirectShow media type
+// header, which ends with a WAVEFORMATEX describing the payload, followed by
+// the payload itself: usually MP3 frames, sometimes PCM samples. The header
+// and payload are not copied out of the archive, and the payload is bounds
+// checked when the Sound is parsed, so it can be read directly.
+struct Sound {
+    // Format is the WAVEFORMATEX of a sound, without its extra bytes.
+    struct Format {
+        uint16_t tag;
+        uint16_t channels;
+        uint32_t samples_per_second;
+        uint32_t bytes_per_second;
+        uint16_t block_align;
+        uint16_t bits_per_sample;
+    };
+
+    // Reader hands out the payload of a Sound in chunks of at most
+    // chunk_size bytes, which point into the archive.
+    struct Reader {
+        const uint8_t* at;
+        const uint8_t* end;
+        uint32_t chunk_size;
+
+        // next returns the next chunk of the payload, or an empty span once
+        // all of it has been read.
+        std::span<const uint8_t> next() {
+            const size_t size = std::min<size_t>(end - at, chunk_size);
+            std::span<const uint8_t> chunk(at, size);
+            at += size;
+            return chunk;
+        }
+
+        explicit operator bool() const {
+            return at < end;
+        }
+    };
+
+    // FORMAT_* are the values of Format::tag used by the game's sounds. A tag
+    // of FORMAT_UNKNOWN means that the header could not be understood; the
+    // payload is still readable.
+    static constexpr uint16_t FORMAT_UNKNOWN = 0;
+    static constexpr uint16_t FORMAT_PCM = 1;
+    static constexpr uint16_t FORMAT_MPEGLAYER3 = 0x55;
+
+    // MEDIA_TYPE is the media type that precedes the WAVEFORMATEX in every
+    // header: stream major type, WAVE subtype and WaveFormatEx format type
+    // GUIDs, with their flags.
+    static constexpr uint32_t MEDIA_TYPE_SIZE = 51;
+    static const uint8_t MEDIA_TYPE[MEDIA_TYPE_SIZE];
+
+    // WAVEFORMATEX_SIZE is the size of a WAVEFORMATEX, up to and including
+    // its count of extra bytes.
+    static constexpr uint32_t WAVEFORMATEX_SIZE = 18;
+
+    static constexpr uint32_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+    Format format;
+
+    // duration_ms is the length of the sound, as recorded in the archive.
+    uint32_t duration_ms;
+
+    // header is the media type header, including the WAVEFORMATEX, as
+    // stored in the archive. Some archives encrypt the WAVEFORMATEX; format
+    // is always decrypted.
+    const uint8_t* header;
+    uint32_t header_length;
+
+    // data is the payload, of length bytes.
+    const uint8_t* data;
+    uint32_t length;
+
+    std::span<const uint8_t> payload() const {
+        return std::span<const uint8_t>(data, length);
+    }
+
+    // reader returns a Reader over the payload. If chunk_size is 0,
+    // DEFAULT_CHUNK_SIZE is used.
+    Reader reader(
+        uint32_t chunk_size = 0) const {
+        Reader r = {
+            .at = data,
+            .end = data + length,
+            .chunk_size = chunk_size ? chunk_size : DEFAULT_CHUNK_SIZE,
+        };
+
+        return r;
+    }
+
+    // stream writes the payload to sink in chunks, as a Reader would hand
+    // them out. Sink must provide:
+    //
+    // ```
+    // Error open(const Sound::Format& format, uint32_t duration_ms);
+    // Error write(std::span<const uint8_t> chunk);
+    // Error close();
+    // ```
+    template <typename Sink>
+    Error stream(
+        Sink* sink,
+        uint32_t chunk_size = 0) const {
+        CHECK(sink->open(format, duration_ms),
+            Error::OPENFAILED) << "failed to open sink";
+
+        Reader r = reader(chunk_size);
+        while (r) {
+            CHECK(sink->write(r.next()),
+                Error::BADREAD) << "failed to write to sink";
+        }
+
+        return sink->close();
+    }
+
+    // parse reads a Sound_DX8 property, which follows its kind name.
+    static Error parse(
+        Sound* x,
+        Parser* p);
+};
+
+// NullSink is a sound sink that discards everything written to it, for
+// exercising sound streaming without an audio device. It only keeps count of
+// what it was given.
+struct NullSink {
+    Sound::Format format;
+    N<uint32_t> duration_ms;
+    N<uint64_t> chunks;
+    N<uint64_t> bytes;
+
+    Error open(
+        const Sound::Format& format,
+        uint32_t duration_ms) {
+        this->format = format;
+        this->duration_ms = duration_ms;
+        return Error();
+    }
+
+    Error write(
+        std::span<const uint8_t> chunk) {
+        ++chunks;
+        bytes = bytes + chunk.size();
+        return Error();
+    }
+
+    Error close() {
+        return Error();
+    }
+};
+
+}
@@ -0,0 +1,496 @@
+#include "wz/synthetic.hh"
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "logger.hh"
+#include "wz/writer.hh"
+
+namespace wz {
+
+using SyntheticProperty = Writer::Property;
+
+// SYNTHETIC_ARCHIVES are the archives of a dataset, in the order they are
+// generated.
+static const char* SYNTHETIC_ARCHIVES[] = {
+    "Base.wz",
+    "Character.wz",
+    "Effect.wz",
+    "Etc.wz",
+    "Item.wz",
+    "Map.wz",
+    "Mob.wz",
+    "Morph.wz",
+    "Npc.wz",
+    "Quest.wz",
+    "Reactor.wz",
+    "Skill.wz",
+    "Sound.wz",
+    "String.wz",
+    "TamingMob.wz",
+    "UI.wz",
+};
+
+static const int32_t SYNTHETIC_TILE_WIDTH = 90;
+static const int32_t SYNTHETIC_TILE_HEIGHT = 60;
+static const uint32_t SYNTHETIC_LAYERS = 8;
+
+// Sounds are a second of 16-bit mono PCM.
+static const uint32_t SYNTHETIC_SOUND_RATE = 22050;
+static const uint32_t SYNTHETIC_SOUND_MS = 1000;
+
+// SyntheticContext is the state of a dataset being generated.
+struct SyntheticContext {
+    Synthetic::Options options;
+
+    // random is the state of a xorshift generator, so that datasets do not
+    // depend on the standard library's distributions.
+    uint64_t random;
+
+    Synthetic::Stats stats;
+};
+
+static uint32_t SyntheticContext_random(
+    SyntheticContext* self) {
+    self->random ^= self->random << 13;
+    self->random ^= self->random >> 7;
+    self->random ^= self->random << 17;
+    return static_cast<uint32_t>(self->random >> 32);
+}
+
+// SyntheticContext_canvas generates a canvas with pixels that are mostly
+// gradients, with some noise, so that they compress roughly like real
+// images.
+static SyntheticProperty SyntheticContext_canvas(
+    SyntheticContext* self,
+    std::wstring name,
+    uint32_t width,
+    uint32_t height,
+    int32_t format,
+    std::vector<SyntheticProperty>&& children) {
+    const uint32_t bytes_per_pixel = (format == 2) ? 4 : 2;
+    const uint32_t row = width * bytes_per_pixel;
+
+    SyntheticProperty::Canvas canvas = {
+        .width = width,
+        .height = height,
+        .format = format,
+        .format2 = 0,
+        .pixels = std::vector<uint8_t>(row * height),
+        .encrypted = self->options.encrypt,
+        .children = std::move(children),
+    };
+
+    const uint32_t dx = SyntheticContext_random(self) & 0x7;
+    const uint32_t dy = SyntheticContext_random(self) & 0x7;
+    const uint32_t base = SyntheticContext_random(self);
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < row; ++x) {
+            uint32_t value = base + x * dx + y * dy;
+            if ((SyntheticContext_random(self) & 0xF) == 0)
+                value ^= SyntheticContext_random(self);
+
+            canvas.pixels[y * row + x] = static_cast<uint8_t>(value);
+        }
+    }
+
+    ++self->stats.canvases;
+    return SyntheticProperty{ std::move(name), std::move(canvas) };
+}
+
+// SyntheticContext_sound generates a tone, with some noise.
+static SyntheticProperty SyntheticContext_sound(
+    SyntheticContext* self,
+    std::wstring name) {
+    const uint32_t samples = SYNTHETIC_SOUND_RATE * SYNTHETIC_SOUND_MS / 1000;
+    const double frequency = 220.0 + (SyntheticContext_random(self) % 440);
+
+    SyntheticProperty::Sound sound = {
+        .format = {
+            .tag = Sound::FORMAT_PCM,
+            .channels = 1,
+            .samples_per_second = SYNTHETIC_SOUND_RATE,
+            .bytes_per_second = SYNTHETIC_SOUND_RATE * 2,
+            .block_align = 2,
+            .bits_per_sample = 16,
+        },
+        .duration_ms = SYNTHETIC_SOUND_MS,
+        .data = std::vector<uint8_t>(samples * 2),
+    };
+
+    for (uint32_t i = 0; i < samples; ++i) {
+        const double t = static_cast<double>(i) / SYNTHETIC_SOUND_RATE;
+        const int16_t sample = static_cast<int16_t>(
+            8192 * std::sin(2 * M_PI * frequency * t) +
+            static_cast<int16_t>(SyntheticContext_random(self) & 0x1FF) - 0x100);
+
+        sound.data[i * 2] = static_cast<uint8_t>(sample);
+        sound.data[i * 2 + 1] = static_cast<uint8_t>(sample >> 8);
+    }
+
+    ++self->stats.sounds;
+    return SyntheticProperty{ std::move(name), std::move(sound) };
+}
+
+static std::wstring SyntheticContext_tileset_name(
+    uint32_t index) {
+    return L"synthetic" + std::to_wstring(index);
+}
+
+static const wchar_t* SyntheticContext_tile_group(
+    uint32_t variant) {
+    // Alternate between base tiles and edges.
+    return (variant % 2) ? L"enH0" : L"bsc";
+}
+
+static Writer::File SyntheticContext_tileset(
+    SyntheticContext* self,
+    uint32_t index) {
+    SyntheticProperty::Container groups[2];
+    for (uint32_t v = 0; v < self->options.variants; ++v) {
+        groups[v % 2].children.push_back(SyntheticContext_canvas(
+            self,
+            std::to_wstring(v / 2),
+            SYNTHETIC_TILE_WIDTH,
+            SYNTHETIC_TILE_HEIGHT,
+            2,
+            {
+                { L"origin", Vector{ 0, 0 } },
+                { L"z", static_cast<int32_t>(v % 2) },
+            }));
+    }
+
+    return Writer::File{
+        .name = SyntheticContext_tileset_name(index) + L".img",
+        .properties = {
+            { L"info", SyntheticProperty::Container{} },
+            { SyntheticContext_tile_group(0), std::move(groups[0]) },
+            { SyntheticContext_tile_group(1), std::move(groups[1]) },
+        },
+    };
+}
+
+static Writer::File SyntheticContext_objectset(
+    SyntheticContext* self) {
+    SyntheticProperty::Container objects;
+    for (uint32_t v = 0; v < self->options.variants; ++v) {
+        std::vector<SyntheticProperty> frames;
+        for (uint32_t f = 0; f < 2; ++f) {
+            frames.push_back(SyntheticContext_canvas(
+                self,
+                std::to_wstring(f),
+                48,
+                64,
+                1,
+                {
+                    { L"origin", Vector{ 24, 64 } },
+                    { L"delay", 150 },
+                }));
+        }
+
+        // The last frame repeats the first, through a link.
+        frames.push_back(SyntheticProperty{ L"2", SyntheticProperty::Uol{ L"0" } });
+
+        objects.children.push_back(SyntheticProperty{
+            std::to_wstring(v),
+            SyntheticProperty::Container{ std::move(frames) },
+            });
+    }
+
+    return Writer::File{
+        .name = L"synthetic.img",
+        .properties = {
+            { L"obj", SyntheticProperty::Container{ {
+                { L"0", std::move(objects) },
+            } } },
+        },
+    };
+}
+
+static Writer::File SyntheticContext_background(
+    SyntheticContext* self) {
+    return Writer::File{
+        .name = L"synthetic.img",
+        .properties = {
+            { L"back", SyntheticProperty::Container{ {
+                SyntheticContext_canvas(self, L"0", 256, 256, 513, {
+                    { L"origin", Vector{ 128, 128 } },
+                }),
+            } } },
+        },
+    };
+}
+
+static Writer::File SyntheticContext_maphelper(
+    SyntheticContext* self) {
+    SyntheticProperty::Container editor;
+    for (const wchar_t* kind : { L"sp", L"pi", L"pv", L"tp" }) {
+        editor.children.push_back(SyntheticContext_canvas(self, kind, 32, 32, 1, {
+            { L"origin", Vector{ 16, 32 } },
+        }));
+    }
+
+    SyntheticProperty::Container pv;
+    for (uint32_t f = 0; f < 4; ++f) {
+        pv.children.push_back(SyntheticContext_canvas(self, std::to_wstring(f), 64, 128, 1, {
+            { L"origin", Vector{ 32, 128 } },
+            { L"delay", 100 },
+        }));
+    }
+
+    return Writer::File{
+        .name = L"MapHelper.img",
+        .properties = {
+            { L"portal", SyntheticProperty::Container{ {
+                { L"editor", std::move(editor) },
+                { L"game", SyntheticProperty::Container{ {
+                    { L"pv", std::move(pv) },
+                } } },
+            } } },
+        },
+    };
+}
+
+static Writer::File SyntheticContext_map(
+    SyntheticContext* self,
+    uint32_t id) {
+    const Synthetic::Options& options = self->options;
+
+    // Tiles are laid out in a square grid, spread over the layers.
+    const uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(options.tiles))));
+    const uint32_t rows = (options.tiles + columns - 1) / columns;
+    const int32_t width = static_cast<int32_t>(columns) * SYNTHETIC_TILE_WIDTH;
+    const int32_t height = static_cast<int32_t>(rows) * SYNTHETIC_TILE_HEIGHT;
+
+    SyntheticProperty::Container layer_tiles[SYNTHETIC_LAYERS];
+    SyntheticProperty::Container layer_objects[SYNTHETIC_LAYERS];
+
+    for (uint32_t i = 0; i < options.tiles; ++i) {
+        const uint32_t layer = i % SYNTHETIC_LAYERS;
+        const uint32_t variant = SyntheticContext_random(self) % options.variants;
+
+        std::vector<SyntheticProperty>& tiles = layer_tiles[layer].children;
+        tiles.push_back(SyntheticProperty{
+            std::to_wstring(tiles.size()),
+            SyntheticProperty::Container{ {
+                { L"x", static_cast<int32_t>(i % columns) * SYNTHETIC_TILE_WIDTH },
+                { L"y", static_cast<int32_t>(i / columns) * SYNTHETIC_TILE_HEIGHT },
+                { L"u", std::wstring(SyntheticContext_tile_group(variant)) },
+                { L"no", static_cast<int32_t>(variant / 2) },
+                { L"zM", 0 },
+            } },
+            });
+    }
+
+    for (uint32_t i = 0; i < options.objects; ++i) {
+        const uint32_t layer = i % SYNTHETIC_LAYERS;
+
+        std::vector<SyntheticProperty>& objects = layer_objects[layer].children;
+        objects.push_back(SyntheticProperty{
+            std::to_wstring(objects.size()),
+            SyntheticProperty::Container{ {
+                { L"oS", std::wstring(L"synthetic") },
+                { L"l0", std::wstring(L"obj") },
+                { L"l1", std::wstring(L"0") },
+                { L"l2", std::to_wstring(SyntheticContext_random(self) % options.variants) },
+                { L"x", static_cast<int32_t>(SyntheticContext_random(self) % width) },
+                { L"y", static_cast<int32_t>(SyntheticContext_random(self) % height) },
+                { L"z", static_cast<int32_t>(i) },
+                { L"f", 0 },
+            } },
+            });
+    }
+
+    std::vector<SyntheticProperty> properties = {
+        { L"info", SyntheticProperty::Container{ {
+            { L"VRTop", 0 },
+            { L"VRLeft", 0 },
+            { L"VRBottom", height },
+            { L"VRRight", width },
+        } } },
+        { L"back", SyntheticProperty::Container{ {
+            { L"0", SyntheticProperty::Container{ {
+                { L"x", 0 },
+                { L"y", 0 },
+                { L"cx", 0 },
+                { L"cy", 0 },
+                { L"rx", 0 },
+                { L"ry", 0 },
+                { L"ani", 0 },
+                { L"type", 0 },
+                { L"front", 0 },
+                { L"bS", std::wstring(L"synthetic") },
+                { L"no", 0 },
+            } } },
+        } } },
+    };
+
+    for (uint32_t layer = 0; layer < SYNTHETIC_LAYERS; ++layer) {
+        properties.push_back(SyntheticProperty{
+            std::to_wstring(layer),
+            SyntheticProperty::Container{ {
+                { L"info", SyntheticProperty::Container{ {
+                    { L"tS", SyntheticContext_tileset_name(layer % options.tilesets) },
+                } } },
+                { L"tile", std::move(layer_tiles[layer]) },
+                { L"obj", std::move(layer_objects[layer]) },
+            } },
+            });
+    }
+
+    // A single floor, along the bottom of the map.
+    SyntheticProperty::Container footholds;
+    for (uint32_t i = 0; i < columns; ++i) {
+        const int32_t foothold_id = static_cast<int32_t>(i) + 1;
+        footholds.children.push_back(SyntheticProperty{
+            std::to_wstring(foothold_id),
+            SyntheticProperty::Container{ {
+                { L"x1", static_cast<int32_t>(i) * SYNTHETIC_TILE_WIDTH },
+                { L"y1", height },
+                { L"x2", static_cast<int32_t>(i + 1) * SYNTHETIC_TILE_WIDTH },
+                { L"y2", height },
+                { L"prev", foothold_id - 1 },
+                { L"next", (i + 1 < columns) ? foothold_id + 1 : 0 },
+            } },
+            });
+    }
+
+    properties.push_back(SyntheticProperty{ L"foothold", SyntheticProperty::Container{ {
+        { L"0", SyntheticProperty::Container{ {
+            { L"1", std::move(footholds) },
+        } } },
+    } } });
+
+    properties.push_back(SyntheticProperty{ L"portal", SyntheticProperty::Container{ {
+        { L"0", SyntheticProperty::Container{ {
+            { L"pn", std::wstring(L"sp") },
+            { L"pt", 0 },
+            { L"x", width / 2 },
+            { L"y", height },
+            { L"tm", 999999999 },
+            { L"tn", std::wstring() },
+        } } },
+    } } });
+
+    return Writer::File{
+        .name = std::to_wstring(id) + L".img",
+        .properties = std::move(properties),
+    };
+}
+
+static Error SyntheticContext_write(
+    SyntheticContext* self,
+    const Writer& writer,
+    const std::filesystem::path& path) {
+    CHECK(writer.write(path.string().c_str()),
+        Error::WZ_WRITE_FAILED) << "failed to write " << path;
+
+    std::error_code ec;
+    self->stats.bytes += std::filesystem::file_size(path, ec);
+    return Error();
+}
+
+Error Synthetic::generate(
+    const Options& options,
+    const std::filesystem::path& directory,
+    Stats* stats) {
+    SyntheticContext self = {
+        .options = options,
+        .random = 0x9E3779B97F4A7C15ULL ^ options.seed,
+        .stats = { 0 },
+    };
+    if (self.options.maps == 0)
+        self.options.maps = DEFAULT_MAPS;
+    if (self.options.tiles == 0)
+        self.options.tiles = DEFAULT_TILES;
+    if (self.options.tilesets == 0)
+        self.options.tilesets = DEFAULT_TILESETS;
+    if (self.options.variants == 0)
+        self.options.variants = DEFAULT_VARIANTS;
+
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec) {
+        return error_new(Error::OPENFAILED)
+            << "failed to create " << directory << ": " << ec.message().c_str();
+    }
+
+    for (const char* archive : SYNTHETIC_ARCHIVES) {
+        const std::string name(archive);
+
+        Writer writer;
+        CHECK(Writer::init(&writer),
+            Error::WZ_WRITE_FAILED) << "failed to initialize writer";
+
+        if (name == "Map.wz") {
+            Writer::Directory tiles = { .name = L"Tile" };
+            for (uint32_t i = 0; i < self.options.tilesets; ++i)
+                tiles.files.push_back(SyntheticContext_tileset(&self, i));
+
+            Writer::Directory objects = { .name = L"Obj" };
+            objects.files.push_back(SyntheticContext_objectset(&self));
+
+            Writer::Directory backs = { .name = L"Back" };
+            backs.files.push_back(SyntheticContext_background(&self));
+
+            // Every map ID has the same first digit, as long as there are
+            // fewer than 100000000 maps.
+            Writer::Directory maps = { .name = L"Map" };
+            Writer::Directory map_group = {
+                .name = L"Map" + std::to_wstring(FIRST_MAP_ID / 100000000),
+            };
+            for (uint32_t i = 0; i < self.options.maps; ++i)
+                map_group.files.push_back(SyntheticContext_map(&self, FIRST_MAP_ID + i));
+            maps.directories.push_back(std::move(map_group));
+
+            writer.root.directories.push_back(std::move(tiles));
+            writer.root.directories.push_back(std::move(objects));
+            writer.root.directories.push_back(std::move(backs));
+            writer.root.directories.push_back(std::move(maps));
+            writer.root.files.push_back(SyntheticContext_maphelper(&self));
+            self.stats.files += 4 + self.options.tilesets + self.options.maps;
+        } else if (name == "String.wz") {
+            SyntheticProperty::Container names;
+            for (uint32_t i = 0; i < self.options.maps; ++i) {
+                names.children.push_back(SyntheticProperty{
+                    std::to_wstring(FIRST_MAP_ID + i),
+                    SyntheticProperty::Container{ {
+                        { L"streetName", std::wstring(L"Synthetic") },
+                        { L"mapName", L"Synthetic Map " + std::to_wstring(i) },
+                    } },
+                    });
+            }
+
+            writer.root.files.push_back(Writer::File{
+                .name = L"Map.img",
+                .properties = {
+                    { L"synthetic", std::move(names) },
+                },
+                });
+            self.stats.files += 1;
+        } else if (name == "Sound.wz" && self.options.sounds > 0) {
+            Writer::File bgm = { .name = L"Bgm00.img" };
+            for (uint32_t i = 0; i < self.options.sounds; ++i) {
+                bgm.properties.push_back(
+                    SyntheticContext_sound(&self, L"synthetic" + std::to_wstring(i)));
+            }
+
+            writer.root.files.push_back(std::move(bgm));
+            self.stats.files += 1;
+        }
+
+        CHECK(SyntheticContext_write(&self, writer, directory / archive),
+            Error::WZ_WRITE_FAILED) << "failed to generate " << archive;
+    }
+
+    LOG(Logger::INFO)
+        << "generated " << self.stats.files << " files with " << self.stats.canvases
+        << " canvases and " << self.stats.sounds << " sounds (" << self.stats.bytes << " bytes) in " << directory;
+
+    if (stats)
+        *stats = self.stats;
+    return Error();
+}
+
+}
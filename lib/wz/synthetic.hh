@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+#include "util/error.hh"
+
+namespace wz {
+
+// Synthetic generates datasets of WZ archives with Writer, laid out like the
+// game's: a directory with an archive per category (Map.wz, String.wz, ...).
+// Only Map.wz, String.wz and Sound.wz have contents: maps with tiles,
+// objects, backgrounds, footholds and portals, the tilesets, object sets and
+// backgrounds that they use, and PCM sounds. Contents are derived from a seed, so that a
+// dataset can be regenerated exactly.
+struct Synthetic {
+    struct Options {
+        // maps is the number of maps. If 0, DEFAULT_MAPS is used.
+        uint32_t maps;
+
+        // tiles is the number of tiles in each map. If 0, DEFAULT_TILES is
+        // used.
+        uint32_t tiles;
+
+        // objects is the number of objects in each map.
+        uint32_t objects;
+
+        // tilesets is the number of tilesets. If 0, DEFAULT_TILESETS is used.
+        uint32_t tilesets;
+
+        // variants is the number of distinct tile images in each tileset. If
+        // 0, DEFAULT_VARIANTS is used.
+        uint32_t variants;
+
+        // sounds is the number of sounds in Sound.wz, all in Bgm00.img.
+        uint32_t sounds;
+
+        // encrypt enables encrypting canvas data.
+        bool encrypt;
+
+        uint32_t seed;
+    };
+
+    // Stats summarizes a generated dataset.
+    struct Stats {
+        uint64_t files;
+        uint64_t canvases;
+        uint64_t sounds;
+        uint64_t bytes;
+    };
+
+    static constexpr uint32_t DEFAULT_MAPS = 8;
+    static constexpr uint32_t DEFAULT_TILES = 256;
+    static constexpr uint32_t DEFAULT_TILESETS = 4;
+    static constexpr uint32_t DEFAULT_VARIANTS = 16;
+
+    // FIRST_MAP_ID is the ID of the first map. Maps are numbered from it.
+    static constexpr uint32_t FIRST_MAP_ID = 100000000;
+
+    // generate writes a dataset into directory, which is created if needed.
+    static Error generate(
+        const Options& options,
+        const std::filesystem::path& directory,
+        Stats* stats = nullptr);
+};
+
+}
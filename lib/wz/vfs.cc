@@ -1,5 +1,6 @@
 #include "wz/vfs.hh"
 
+#include <bit>
 #include <string_view>
 
 namespace wz {
@@ -51,6 +52,54 @@ const OpenedFile::Node* OpenedFile::Node::find(
         path);
 }
 
+const OpenedFile::Node* OpenedFile::Node::find(
+    const Path& path) const {
+    const Node* at = this;
+    for (const Path::Component& component : path.components) {
+        if (component.parent) {
+            // Only the root node has no parent.
+            at = at->parent;
+            if (!at)
+                return nullptr;
+
+            continue;
+        }
+
+        const Node* next = nullptr;
+        for (uint32_t i = 0, l = at->children.count; i < l; ++i) {
+            const Node* child = &at->children.start[i];
+
+            // Compare hashes first; the names only need to be compared to
+            // rule out a collision.
+            if (child->hash == component.hash &&
+                ::wcscmp(child->name, component.name) == 0) {
+                next = child;
+                break;
+            }
+        }
+
+        if (!next)
+            return nullptr;
+        at = next;
+    }
+
+    return at;
+}
+
+const OpenedFile::Node* OpenedFile::find(
+    const Path& path) const {
+    if (path.id == 0)
+        return nodes[0].find(path);
+
+    auto it = resolved.find(path.id);
+    if (it != resolved.end())
+        return it->second;
+
+    const Node* node = nodes[0].find(path);
+    resolved.emplace(path.id, node);
+    return node;
+}
+
 Error OpenedFile::Node::childint32(
     const wchar_t* n,
     int32_t* x) const {
@@ -110,6 +159,88 @@ Error OpenedFile::Node::childstring(
     return Error();
 }
 
+static Error OpenedFile_Node_deserialize_into(
+    const OpenedFile::Node* node,
+    const OpenedFile::Node::Field* field) {
+    switch (field->kind) {
+    case OpenedFile::Node::Field::INT32:
+    {
+        const int32_t* i = std::get_if<int32_t>(&node->value);
+        if (i == nullptr)
+            return error_new(Error::PROPERTYTYPEMISMATCH)
+            << "node " << field->key.name << " is not int32";
+
+        *static_cast<int32_t*>(field->destination) = *i;
+    } break;
+    case OpenedFile::Node::Field::STRING:
+    {
+        const OpenedFile::String* s = std::get_if<OpenedFile::String>(&node->value);
+        if (s == nullptr)
+            return error_new(Error::PROPERTYTYPEMISMATCH)
+            << "node " << field->key.name << " is not string";
+
+        *static_cast<const wchar_t**>(field->destination) = s->string;
+    } break;
+    }
+
+    return Error();
+}
+
+Error OpenedFile::Node::deserialize_partial(
+    const Field* fields,
+    size_t count,
+    uint64_t* found) const {
+    if (count > 64)
+        return error_new(Error::INVALIDUSAGE)
+        << "cannot deserialize more than 64 fields at once";
+
+    const uint64_t all = (count == 64) ? ~0ULL : ((1ULL << count) - 1);
+    *found = 0;
+
+    for (uint32_t i = 0, l = children.count; i < l && *found != all; ++i) {
+        const Node* child = &children.start[i];
+
+        for (size_t j = 0; j < count; ++j) {
+            // Compare hashes first; the names only need to be compared to
+            // rule out a collision.
+            if (fields[j].key.hash != child->hash ||
+                ::wcscmp(fields[j].key.name, child->name) != 0)
+                continue;
+
+            CHECK(OpenedFile_Node_deserialize_into(child, &fields[j]),
+                Error::WZ_DESERIALIZE_FAILED)
+                << "failed to deserialize node value: " << fields[j].key.name;
+
+            *found |= 1ULL << j;
+            break;
+        }
+    }
+
+    return Error();
+}
+
+Error OpenedFile::Node::deserialize(
+    std::initializer_list<Field> fields) const {
+    uint64_t found = 0;
+    CHECK(deserialize_partial(fields.begin(), fields.size(), &found),
+        Error::WZ_DESERIALIZE_FAILED) << "failed to deserialize node values";
+
+    const uint64_t all = (fields.size() == 64) ? ~0ULL : ((1ULL << fields.size()) - 1);
+    if (found != all) {
+        // Only build the list of missing names on failure.
+        std::wstringstream missing;
+        for (size_t i = 0, l = fields.size(); i < l; ++i) {
+            if (!(found & (1ULL << i)))
+                missing << " " << fields.begin()[i].key.name;
+        }
+
+        return error_new(Error::WZ_DESERIALIZE_FAILED)
+            << "missing node values:" << missing.str();
+    }
+
+    return Error();
+}
+
 struct Sizes {
     size_t strings;
     size_t images;
@@ -117,11 +248,20 @@ struct Sizes {
     size_t nodes;
 };
 
+// OpenedFile_streamed returns whether the pixels of image are left to be
+// streamed, rather than decoded when the file is opened.
+static bool OpenedFile_streamed(
+    const wz::Image& image,
+    const OpenedFile::Options& options) {
+    return options.stream_above && image.rawsize() > options.stream_above;
+}
+
 template <typename C>
 static Error container_computesizes(
     const wz::Wz* wz,
     Sizes* sizes,
-    const C& container) {
+    const C& container,
+    const OpenedFile::Options& options) {
     sizes->children += container.count;
     sizes->nodes += container.count;
 
@@ -141,21 +281,22 @@ static Error container_computesizes(
         } break;
         case 6:
         {
-            CHECK(container_computesizes(wz, sizes, *std::get_if<6>(&p.property)),
+            CHECK(container_computesizes(wz, sizes, *std::get_if<6>(&p.property), options),
                 Error::FILEOPENFAILED) << "failed to compute container sizes";
             ++sizes->nodes;
         } break;
         case 7:
         {
-            CHECK(container_computesizes(wz, sizes, *std::get_if<7>(&p.property)),
+            CHECK(container_computesizes(wz, sizes, *std::get_if<7>(&p.property), options),
                 Error::FILEOPENFAILED) << "failed to compute named container sizes";
             ++sizes->nodes;
         } break;
         case 8:
         {
             const Canvas* c = std::get_if<8>(&p.property);
-            sizes->images += c->image.rawsize();
-            CHECK(container_computesizes(wz, sizes, c->children),
+            if (!OpenedFile_streamed(c->image, options))
+                sizes->images += c->image.rawsize();
+            CHECK(container_computesizes(wz, sizes, c->children, options),
                 Error::FILEOPENFAILED) << "failed to compute canvas child sizes";
             ++sizes->nodes;
         } break;
@@ -173,6 +314,13 @@ struct Cursor {
     uint32_t node;
     wchar_t* string;
     uint8_t* image;
+
+    // canvas_cache, if set, is the mapped disk cache container to take
+    // canvas pixels from.
+    const DiskCache::Mapping* canvas_cache;
+
+    // canvas_cache_miss is set if canvas_cache did not contain a canvas.
+    bool canvas_cache_miss;
 };
 
 static Error OpenedFile_open_property(
@@ -180,12 +328,14 @@ static Error OpenedFile_open_property(
     const wz::Wz* wz,
     OpenedFile* of,
     const wz::Property* p,
-    const wz::File* f) {
+    const wz::File* f,
+    const OpenedFile::Options& options) {
     OpenedFile::Node& node = of->nodes[cursor->node];
 
     CHECK(p->name.decrypt(cursor->string),
         Error::FILEOPENFAILED) << "failed to decrypt property name";
     node.name = cursor->string;
+    node.hash = wz::hash(node.name, p->name.len);
     cursor->string += p->name.len + 1;
 
     switch (p->property.index()) {
@@ -221,15 +371,41 @@ static Error OpenedFile_open_property(
     case 8:
     {
         const wz::Canvas* canvas = std::get_if<8>(&p->property);
-        CHECK(canvas->image.pixels(cursor->image),
-            Error::FILEOPENFAILED) << "failed to retrieve image pixels of property ";
 
         wz::OpenedFile::Canvas node_canvas;
         node_canvas.image = canvas->image;
-        node_canvas.image_data = cursor->image;
-        node.value = node_canvas;
+        node_canvas.key = ImageKey::of(canvas->image);
+
+        if (OpenedFile_streamed(canvas->image, options)) {
+            node_canvas.image_data = nullptr;
+        } else if (cursor->canvas_cache) {
+            const uint8_t* pixels = cursor->canvas_cache->find(
+                canvas->image.data - wz->file.start,
+                canvas->image.length,
+                canvas->image.rawsize());
+            if (!pixels) {
+                cursor->canvas_cache_miss = true;
+                return error_new(Error::NOTFOUND)
+                    << "canvas is missing from the canvas cache";
+            }
+
+            node_canvas.image_data = pixels;
+        } else if (options.image_store) {
+            std::shared_ptr<const ImageStore::Pixels> pixels;
+            CHECK(options.image_store->get(canvas->image, node_canvas.key, &pixels),
+                Error::FILEOPENFAILED) << "failed to retrieve image pixels of property";
+
+            node_canvas.image_data = pixels->data.data();
+            of->shared_images.push_back(std::move(pixels));
+        } else {
+            CHECK(canvas->image.pixels(cursor->image),
+                Error::FILEOPENFAILED) << "failed to retrieve image pixels of property ";
+
+            node_canvas.image_data = cursor->image;
+            cursor->image += canvas->image.rawsize();
+        }
 
-        cursor->image += canvas->image.rawsize();
+        node.value = node_canvas;
     } break;
     case 11:
     {
@@ -237,13 +413,15 @@ static Error OpenedFile_open_property(
         CHECK(uol->uol.decrypt(cursor->string),
             Error::FILEOPENFAILED) << "failed to decrypt property string";
         node.value = wz::OpenedFile::Uol{
-            cursor->string,
+            .uol = cursor->string,
+            .target = nullptr,
         };
 
         cursor->string += uol->uol.len + 1;
     } break;
     case 10:
-        // TODO: Sound
+        // Sounds are left in the archive: only their header is kept.
+        node.value = *std::get_if<10>(&p->property);
         break;
     case 6:
     case 7:
@@ -263,7 +441,8 @@ static Error OpenedFile_open_container(
     OpenedFile::Node* self,
     const C& c,
     uint32_t this_index,
-    const wz::File* f) {
+    const wz::File* f,
+    const OpenedFile::Options& options) {
     uint32_t children_start = cursor->node;
     self->children.start = &of->nodes[cursor->node + 1];  // + 1 because cursor->node points to self
     self->children.count = c.count;
@@ -280,7 +459,7 @@ static Error OpenedFile_open_container(
         CHECK(it1.next(&p),
             Error::FILEOPENFAILED) << "failed to parse child";
         CHECK(OpenedFile_open_property(
-            cursor, wz, of, &p, f),
+            cursor, wz, of, &p, f, options),
             Error::FILEOPENFAILED) << "failed to open child";
         of->nodes[cursor->node].parent = self;
     }
@@ -296,15 +475,15 @@ static Error OpenedFile_open_container(
 
         if (const wz::Canvas* canvas = std::get_if<wz::Canvas>(&p.property)) {
             CHECK(OpenedFile_open_container(
-                cursor, wz, of, &of->nodes[children_start], canvas->children, children_start, f),
+                cursor, wz, of, &of->nodes[children_start], canvas->children, children_start, f, options),
                 Error::FILEOPENFAILED) << "failed to open canvas container";
         } else if (const wz::PropertyContainer* container = std::get_if<wz::PropertyContainer>(&p.property)) {
             CHECK(OpenedFile_open_container(
-                cursor, wz, of, &of->nodes[children_start], *container, children_start, f),
+                cursor, wz, of, &of->nodes[children_start], *container, children_start, f, options),
                 Error::FILEOPENFAILED) << "failed to open container";
         } else if (const wz::NamedPropertyContainer* container = std::get_if<wz::NamedPropertyContainer>(&p.property)) {
             CHECK(OpenedFile_open_container(
-                cursor, wz, of, &of->nodes[children_start], *container, children_start, f),
+                cursor, wz, of, &of->nodes[children_start], *container, children_start, f, options),
                 Error::FILEOPENFAILED) << "failed to open named container";
         }
     }
@@ -312,14 +491,101 @@ static Error OpenedFile_open_container(
     return Error();
 }
 
-Error OpenedFile::open(
+enum UolState : uint8_t {
+    UOL_UNVISITED,
+    UOL_RESOLVING,
+    UOL_RESOLVED,
+};
+
+// OpenedFile_resolve_uol resolves the Uol at node, and any Uols that it links
+// through, returning the non-Uol node at the end of the chain. nullptr is
+// returned for dangling and cyclic links.
+static const OpenedFile::Node* OpenedFile_resolve_uol(
+    OpenedFile* of,
+    OpenedFile::Node* node,
+    std::vector<UolState>* states) {
+    OpenedFile::Uol* uol = std::get_if<OpenedFile::Uol>(&node->value);
+    if (!uol)
+        return node;
+
+    UolState& state = (*states)[node - of->nodes.data()];
+    switch (state) {
+    case UOL_RESOLVED:
+        return uol->target;
+    case UOL_RESOLVING:
+        LOG(Logger::WARNING)
+            << "uol cycle through " << node->name << " -> " << uol->uol;
+        return nullptr;
+    case UOL_UNVISITED:
+        break;
+    }
+
+    state = UOL_RESOLVING;
+
+    const OpenedFile::Node* target = nullptr;
+    if (node->parent)
+        target = node->parent->find(uol->uol);
+    if (target) {
+        // Nodes are only ever reachable as const through find, but they live
+        // in of's arena.
+        target = OpenedFile_resolve_uol(
+            of,
+            const_cast<OpenedFile::Node*>(target),
+            states);
+    }
+
+    uol->target = target;
+    state = UOL_RESOLVED;
+    return target;
+}
+
+// OpenedFile_store_canvases writes the decoded canvases of of to the disk
+// cache.
+static Error OpenedFile_store_canvases(
+    const wz::Wz* wz,
+    const OpenedFile* of,
+    const wz::File* f,
+    DiskCache* disk_cache) {
+    std::vector<DiskCache::Blob> blobs;
+    for (const OpenedFile::Node& node : of->nodes) {
+        const OpenedFile::Canvas* canvas = node.canvas();
+        if (!canvas || !canvas->image_data)
+            continue;
+
+        blobs.push_back(DiskCache::Blob{
+            .data_offset = static_cast<uint64_t>(canvas->image.data - wz->file.start),
+            .data_length = canvas->image.length,
+            .size = canvas->image.rawsize(),
+            .pixels = canvas->image_data,
+        });
+    }
+
+    if (blobs.size() == 0)
+        return Error();
+
+    return disk_cache->store(wz, f, &blobs);
+}
+
+static Error OpenedFile_open(
     const wz::Wz* wz,
     OpenedFile* of,
-    const wz::File* f) {
+    const wz::File* f,
+    const OpenedFile::Options& options,
+    bool use_canvas_cache) {
+    if (options.disk_cache && use_canvas_cache) {
+        CHECK(options.disk_cache->load(wz, f, &of->canvas_cache),
+            Error::FILEOPENFAILED) << "failed to load canvas cache";
+    }
+
     Sizes sizes = { 0 };
-    CHECK(container_computesizes(wz, &sizes, f->root),
+    CHECK(container_computesizes(wz, &sizes, f->root, options),
         Error::FILEOPENFAILED) << "failed to precompute sizes";
 
+    // Pixels mapped from the disk cache, or decoded through an image store,
+    // are not kept in the arena.
+    if (of->canvas_cache || options.image_store)
+        sizes.images = 0;
+
     of->strings.resize(sizes.strings, L'\0');
     of->images.resize(sizes.images);
     of->nodes.resize(sizes.nodes + 1);
@@ -328,10 +594,236 @@ Error OpenedFile::open(
         .node = 0,
         .string = of->strings.data(),
         .image = of->images.data(),
+        .canvas_cache = of->canvas_cache ? &of->canvas_cache : nullptr,
+        .canvas_cache_miss = false,
     };
-    CHECK(OpenedFile_open_container(
-        &cursor, wz, of, &of->nodes[0], f->root, 0, f),
-        Error::FILEOPENFAILED) << "failed to open file";
+    Error e = OpenedFile_open_container(
+        &cursor, wz, of, &of->nodes[0], f->root, 0, f, options);
+    if (e && cursor.canvas_cache_miss) {
+        // The container is stale: decode everything, and replace it.
+        LOG(Logger::WARNING)
+            << "canvas cache is missing canvases, decoding instead";
+
+        of->canvas_cache.close();
+        of->strings.clear();
+        of->images.clear();
+        of->nodes.clear();
+        of->shared_images.clear();
+        return OpenedFile_open(wz, of, f, options, false);
+    }
+    if (e)
+        return error_push(e, Error::FILEOPENFAILED) << "failed to open file";
+
+    if (options.disk_cache && !of->canvas_cache) {
+        // Failing to populate the cache is not fatal.
+        if (Error e = OpenedFile_store_canvases(wz, of, f, options.disk_cache)) {
+            LOG(Logger::WARNING)
+                << "failed to store canvases in the canvas cache: " << e;
+        }
+    }
+
+    return Error();
+}
+
+// OpenedFile_open_shared opens f from the shared cache, publishing it first if
+// no process has yet. shared is left unset if the file was decoded privately
+// instead, because another process is still publishing it.
+static Error OpenedFile_open_shared(
+    const wz::Wz* wz,
+    OpenedFile* of,
+    const wz::File* f,
+    const OpenedFile::Options& options,
+    bool* shared) {
+    *shared = false;
+
+    std::unique_ptr<SharedCache::Segment> segment;
+    CHECK(options.shared_cache->acquire(wz, f, &segment),
+        Error::FILEOPENFAILED) << "failed to acquire shared segment";
+
+    if (!segment) {
+        CHECK(OpenedFile_open(wz, of, f, options, true),
+            Error::FILEOPENFAILED) << "failed to open file";
+
+        // Failing to publish is not fatal: the file is still usable.
+        if (Error e = options.shared_cache->publish(wz, f, *of)) {
+            LOG(Logger::WARNING)
+                << "failed to publish file to the shared cache: " << e;
+        }
+
+        CHECK(options.shared_cache->acquire(wz, f, &segment),
+            Error::FILEOPENFAILED) << "failed to acquire shared segment";
+        if (!segment)
+            return Error();
+
+        // Drop the private copy in favor of the shared one.
+        of->canvas_cache.close();
+        of->strings = std::vector<wchar_t>();
+        of->images = std::vector<uint8_t>();
+        of->nodes = std::vector<OpenedFile::Node>();
+        of->shared_images = std::vector<std::shared_ptr<const ImageStore::Pixels>>();
+    }
+
+    CHECK(OpenedFile::open_packed(&segment->packed, of, 1, options),
+        Error::FILEOPENFAILED) << "failed to open file from shared segment";
+    of->shared_segment = std::move(segment);
+    *shared = true;
+
+    return Error();
+}
+
+Error OpenedFile::open(
+    const wz::Wz* wz,
+    OpenedFile* of,
+    const wz::File* f,
+    const Options& options) {
+    if (options.shared_cache) {
+        bool shared = false;
+        CHECK(OpenedFile_open_shared(wz, of, f, options, &shared),
+            Error::FILEOPENFAILED) << "failed to open shared file";
+
+        // open_packed resolves Uols itself.
+        if (shared)
+            return Error();
+    } else {
+        CHECK(OpenedFile_open(wz, of, f, options, true),
+            Error::FILEOPENFAILED) << "failed to open file";
+    }
+
+    if (options.resolve_uols) {
+        std::vector<UolState> states(of->nodes.size(), UOL_UNVISITED);
+        for (OpenedFile::Node& node : of->nodes)
+            OpenedFile_resolve_uol(of, &node, &states);
+    }
+
+    return Error();
+}
+
+Error OpenedFile::open_packed(
+    const Packed* packed,
+    OpenedFile* of,
+    uint32_t entry_index,
+    const Options& options) {
+    if (entry_index >= packed->header->entry_count)
+        return error_new(Error::INVALIDUSAGE)
+        << "packed entry " << entry_index << " out of range";
+
+    const PackedEntry* entry = packed->entry(entry_index);
+    if (entry->kind != PackedEntry::FILE || entry->count == 0)
+        return error_new(Error::INVALIDUSAGE)
+        << "packed entry " << entry_index << " is not a file";
+
+    const PackedHeader* header = packed->header.get();
+    const uint32_t* parents = packed->table<uint32_t>(header->node_parents) + entry->start;
+    const uint32_t* names = packed->table<uint32_t>(header->node_names) + entry->start;
+    const uint32_t* hashes = packed->table<uint32_t>(header->node_hashes) + entry->start;
+    const uint32_t* children_starts = packed->table<uint32_t>(header->node_children_starts) + entry->start;
+    const uint32_t* children_counts = packed->table<uint32_t>(header->node_children_counts) + entry->start;
+    const uint8_t* kinds = packed->table<uint8_t>(header->node_kinds) + entry->start;
+    const uint64_t* values = packed->table<uint64_t>(header->node_values) + entry->start;
+    const PackedCanvas* canvases = packed->table<PackedCanvas>(header->canvases);
+    const PackedSound* sounds = packed->table<PackedSound>(header->sounds);
+
+    of->nodes.resize(entry->count);
+    for (uint32_t i = 0, l = entry->count; i < l; ++i) {
+        OpenedFile::Node& node = of->nodes[i];
+
+        // Check indices here, rather than when the archive is opened, so
+        // that opening an archive does not touch every node.
+        if (names[i] >= header->string_count ||
+            (children_counts[i] > 0 &&
+                (children_starts[i] >= l || l - children_starts[i] < children_counts[i])) ||
+            ((kinds[i] == 5 || kinds[i] == 8) && values[i] >= header->string_count)) {
+            return error_new(Error::FILEOPENFAILED)
+                << "packed node " << i << " of entry " << entry_index << " is invalid";
+        }
+
+        // Strings in the archive are never written through, despite Node
+        // having mutable pointers.
+        node.parent = (parents[i] < l) ? &of->nodes[parents[i]] : nullptr;
+        node.name = const_cast<wchar_t*>(packed->string(names[i]));
+        node.hash = hashes[i];
+        node.children.count = children_counts[i];
+        node.children.start = (children_starts[i] < l) ? &of->nodes[children_starts[i]] : nullptr;
+
+        const uint64_t value = values[i];
+        switch (kinds[i]) {
+        case 1:
+            node.value = static_cast<uint16_t>(value);
+            break;
+        case 2:
+            node.value = static_cast<int32_t>(value);
+            break;
+        case 3:
+            node.value = std::bit_cast<float>(static_cast<uint32_t>(value));
+            break;
+        case 4:
+            node.value = std::bit_cast<double>(value);
+            break;
+        case 5:
+            node.value = OpenedFile::String{
+                const_cast<wchar_t*>(packed->string(static_cast<uint32_t>(value))),
+            };
+            break;
+        case 6:
+            node.value = Vector{
+                static_cast<int32_t>(value),
+                static_cast<int32_t>(value >> 32),
+            };
+            break;
+        case 8:
+            node.value = OpenedFile::Uol{
+                .uol = const_cast<wchar_t*>(packed->string(static_cast<uint32_t>(value))),
+                .target = nullptr,
+            };
+            break;
+        case 9:
+        {
+            if (value >= header->canvas_count)
+                return error_new(Error::FILEOPENFAILED)
+                << "packed canvas " << value << " out of range";
+
+            const PackedCanvas& c = canvases[value];
+
+            OpenedFile::Canvas canvas;
+            canvas.image = c.image();
+            canvas.image_data = packed->file.start + c.pixels;
+            canvas.key = ImageKey{
+                .hash = c.hash,
+                .length = c.length,
+                .width = c.width,
+                .height = c.height,
+                .format = c.format + static_cast<int32_t>(c.format2),
+            };
+            node.value = canvas;
+        } break;
+        case 7:
+        {
+            if (value >= header->sound_count)
+                return error_new(Error::FILEOPENFAILED)
+                << "packed sound " << value << " out of range";
+
+            const PackedSound& s = sounds[value];
+
+            Sound sound;
+            sound.format = s.format;
+            sound.duration_ms = s.duration_ms;
+            sound.header = packed->file.start + s.header;
+            sound.header_length = s.header_length;
+            sound.data = packed->file.start + s.data;
+            sound.length = static_cast<uint32_t>(s.length);
+            node.value = sound;
+        } break;
+        default:
+            node.value = Void{};
+            break;
+        }
+    }
+
+    if (options.resolve_uols) {
+        std::vector<UolState> states(of->nodes.size(), UOL_UNVISITED);
+        for (OpenedFile::Node& node : of->nodes)
+            OpenedFile_resolve_uol(of, &node, &states);
+    }
 
     return Error();
 }
@@ -382,6 +874,7 @@ static Error Vfs_open_fromdirectory(
             Vfs::File file;
             file.wz = vfs->wz.get();
             file.file = entry_file->file;
+            file.options = vfs->options;
 
             Vfs::Node child;
             child.name = name;
@@ -412,9 +905,11 @@ static Error Vfs_open_fromdirectory(
 Error Vfs::opennamed(
     Vfs* vfs,
     const wz::Wz* wz,
-    std::wstring&& name) {
+    std::wstring&& name,
+    const OpenedFile::Options& options) {
     Vfs::Directory directory;
     vfs->wz = wz;
+    vfs->options = options;
     vfs->root.name = std::move(name);
     vfs->root.contents.emplace<0>(std::move(directory));
 
@@ -424,10 +919,69 @@ Error Vfs::opennamed(
     return Error();
 }
 
+static void Vfs_openpacked_directory(
+    Vfs* vfs,
+    Vfs::Directory* at,
+    const PackedEntry* directory) {
+    for (uint32_t i = directory->start, l = directory->start + directory->count; i < l; ++i) {
+        const PackedEntry* entry = vfs->packed->entry(i);
+        std::wstring name(vfs->packed->string(entry->name));
+
+        Vfs::Node child;
+        child.name = name;
+
+        if (entry->kind == PackedEntry::FILE) {
+            Vfs::File file;
+            file.options = vfs->options;
+            file.packed = vfs->packed.get();
+            file.packed_entry = i;
+            child.contents.emplace<1>(std::move(file));
+
+            at->children.emplace(name, std::move(child));
+        } else {
+            child.contents.emplace<0>(Vfs::Directory());
+
+            auto it = at->children.emplace(name, std::move(child)).first;
+            Vfs_openpacked_directory(vfs, it->second.directory(), entry);
+        }
+    }
+}
+
+Error Vfs::openpacked(
+    Vfs* vfs,
+    const Packed* packed,
+    const OpenedFile::Options& options) {
+    vfs->packed = packed;
+    vfs->options = options;
+    vfs->root.contents.emplace<0>(Vfs::Directory());
+
+    // Entries were validated when the archive was opened.
+    Vfs_openpacked_directory(vfs, vfs->root.directory(), packed->entry(0));
+
+    return Error();
+}
+
 Vfs::Node* Vfs::find(const wchar_t* path) {
     return Vfs_Node_find(&root, path);
 }
 
+Vfs::Node* Vfs::find(const Path& path) {
+    Vfs::Node* at = &root;
+    for (const Path::Component& component : path.components) {
+        Vfs::Directory* directory = at->directory();
+        if (directory == nullptr)
+            return nullptr;
+
+        auto it = directory->children.find(component);
+        if (it == directory->children.end())
+            return nullptr;
+
+        at = &it->second;
+    }
+
+    return at;
+}
+
 const Vfs::Node::Maybe Vfs::Node::child(
     const wchar_t* name) {
     Vfs::Directory* dir = directory();
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <initializer_list>
 #include <stdexcept>
 #include <type_traits>
 #include <unordered_map>
@@ -10,7 +11,13 @@
 #include "p.hh"
 #include "util/error.hh"
 #include "wz/directory.hh"
+#include "wz/diskcache.hh"
+#include "wz/hash.hh"
+#include "wz/imagestore.hh"
+#include "wz/packed.hh"
+#include "wz/path.hh"
 #include "wz/property.hh"
+#include "wz/sharedcache.hh"
 #include "wz/wz.hh"
 
 namespace wz {
@@ -20,17 +27,67 @@ struct Basename {
 };
 
 struct OpenedFile {
+    struct Node;
+
+    // Options controls the optional work done by open.
+    struct Options {
+        // resolve_uols enables a post-pass that resolves every Uol in the file
+        // to the node it (eventually) links to.
+        bool resolve_uols;
+
+        // image_store, if set, is used to decode canvases. Pixels are then
+        // shared with every other file that contains the same image, instead
+        // of being decoded into this file's images arena.
+        ImageStore* image_store;
+
+        // disk_cache, if set, is a persistent cache of decoded canvases.
+        // Canvases are mapped from it in place when it holds this file, and
+        // it is populated when it does not.
+        DiskCache* disk_cache;
+
+        // shared_cache, if set, shares this file with other processes. When
+        // another process has published the file, it is opened from shared
+        // memory instead of being decoded, and image_store and disk_cache
+        // are not used. Otherwise, the file is decoded and published. Like
+        // files of packed archives, shared files have no sounds.
+        SharedCache* shared_cache;
+
+        // stream_above, if not 0, is the size in bytes of pixels above which
+        // canvases are not decoded when the file is opened. Their image_data
+        // is null, and consumers decode them a band of rows at a time with
+        // Image::bands, so that large backgrounds and minimaps never need
+        // their whole pixels in memory. Such canvases bypass image_store and
+        // disk_cache. Published shared files decode them into the segment.
+        uint32_t stream_above;
+    };
+
+    // DEFAULT_STREAM_ABOVE is a suggested stream_above: a 1024 x 1024 BGRA8
+    // canvas.
+    static constexpr uint32_t DEFAULT_STREAM_ABOVE = 4 * 1024 * 1024;
+
     struct String {
         wchar_t* string;
     };
 
     struct Uol {
         wchar_t* uol;
+
+        // target is the non-Uol node that this Uol links to, following chains
+        // of Uols. target is only set if the file was opened with
+        // resolve_uols, and the link resolves without a cycle.
+        const Node* target;
     };
 
     struct Canvas {
         wz::Image image;
-        uint8_t* image_data;
+
+        // image_data is the decoded pixels of image, or null if they are to
+        // be streamed (see Options::stream_above).
+        const uint8_t* image_data;
+
+        // key identifies the contents of image. Canvases with equal keys
+        // have equal pixels.
+        ImageKey key;
     };
 
     struct Node {
@@ -72,6 +129,9 @@ struct OpenedFile {
         // to the containing OpenedFile's strings arena.
         wchar_t* name;
 
+        // hash is wz::hash of name, computed when the file is opened.
+        uint32_t hash;
+
         // children is a span of node indices in the containing OpenedFile's children
         // arena.
         struct {
@@ -87,7 +147,7 @@ struct OpenedFile {
             double,
             String,
             Vector,
-            uint8_t*,
+            Sound,
             Uol,
             Canvas> value;
 
@@ -99,6 +159,13 @@ struct OpenedFile {
             return std::get_if<Canvas>(&value);
         }
 
+        // sound returns this node's sound. Its payload points into the
+        // archive, WZ or packed, so it is only valid for as long as the
+        // archive is open.
+        const Sound* sound() const {
+            return std::get_if<Sound>(&value);
+        }
+
         Iterator iterator() const {
             Iterator it = {
                 .node = this,
@@ -111,6 +178,10 @@ struct OpenedFile {
         const Node* find(
             const wchar_t* path) const;
 
+        // find resolves a precompiled path relative to this node.
+        const Node* find(
+            const Path& path) const;
+
         const Maybe child(
             const wchar_t* name) const;
         const Maybe child(
@@ -129,98 +200,46 @@ struct OpenedFile {
             const wchar_t* n,
             const wchar_t** x) const;
 
-        template <typename S, typename T, typename... Args>
-        Error deserialize(
-            S name,
-            T destination,
-            Args... rest) const {
-            static_assert(std::is_same<S, const wchar_t*>::value, "name must be const wchar_t*");
-
-            constexpr size_t count = (sizeof...(rest) / 2) + 1;
-            bool found[count] = { false };
-
-            for (uint32_t i = 0, l = children.count; i < l; ++i) {
-                if (Error e = (deserialize_match<S, T, Args...>(
-                    found,
-                    &children.start[i],
-                    name,
-                    destination,
-                    rest...))) {
-                    return error_push(e, Error::WZ_DESERIALIZE_FAILED)
-                        << "failed to deserialize node value";
-                }
-            }
-
-            for (size_t i = 0; i < count; ++i) {
-                if (!found[i]) {
-                    return error_new(Error::WZ_DESERIALIZE_FAILED)
-                        << "not all node values were deserialized";
-                }
-            }
-
-            return Error();
-        }
-
-    private:
-
-        template <typename... Args>
-        static Error deserialize_match(
-            bool* found,
-            const wz::OpenedFile::Node* child) {
-            return Error();
-        }
-
-        template <typename S, typename T, typename... Args>
-        static Error deserialize_match(
-            bool* found,
-            const wz::OpenedFile::Node* child,
-            S name,
-            T destination,
-            Args... rest) {
-            static_assert(std::is_same<S, const wchar_t*>::value, "name must be const wchar_t*");
-
-            if (wcscmp(name, child->name) == 0) {
-                CHECK(deserialize_into(
-                    child,
-                    destination),
-                    Error::WZ_DESERIALIZE_FAILED)
-                    << "failed to deserialize node value: " << name;
-
-                *found = true;
-                return Error();
-            }
-
-            return deserialize_match<Args...>(
-                found + 1,
-                child,
-                rest...);
-        }
+        // Field describes a single child value to extract with deserialize.
+        // The name of a Field is hashed at compile time.
+        struct Field {
+            enum Kind {
+                INT32,
+                STRING,
+            };
 
-        static Error deserialize_into(
-            const wz::OpenedFile::Node* node,
-            const wchar_t** destination) {
-            if (const String* s = std::get_if<String>(&node->value)) {
-                *destination = s->string;
-            } else {
-                return error_new(Error::PROPERTYTYPEMISMATCH)
-                    << "node is not string";
-            }
+            Key key;
+            Kind kind;
+            void* destination;
 
-            return Error();
-        }
+            Field(Key key, int32_t* destination):
+                key(key), kind(INT32), destination(destination) {}
 
-        static Error deserialize_into(
-            const wz::OpenedFile::Node* node,
-            int32_t* destination) {
-            if (const int32_t* i = std::get_if<int32_t>(&node->value)) {
-                *destination = *i;
-            } else {
-                return error_new(Error::PROPERTYTYPEMISMATCH)
-                    << "node is not int32";
-            }
+            Field(Key key, const wchar_t** destination):
+                key(key), kind(STRING), destination(destination) {}
+        };
 
-            return Error();
-        }
+        // deserialize extracts the values of the named children of this node
+        // into their destinations, in a single pass over the children. All
+        // fields are required: an Error naming the missing fields is returned
+        // if any are not present. Usage:
+        //
+        // ```
+        // node->deserialize({
+        //     {L"x", &x},
+        //     {L"y", &y},
+        // });
+        // ```
+        Error deserialize(
+            std::initializer_list<Field> fields) const;
+
+        // deserialize_partial is like deserialize, except that missing fields
+        // are not an error. Instead, bit i of found is set if fields[i] was
+        // deserialized. At most 64 fields may be provided.
+        Error deserialize_partial(
+            const Field* fields,
+            size_t count,
+            uint64_t* found) const;
     };
 
     // strings is an arena containing null-terminated decrypted strings in this file.
@@ -230,13 +249,40 @@ struct OpenedFile {
     // an atlas; image data here is one after the other.
     std::vector<uint8_t> images;
 
+    // shared_images holds references to the pixels of canvases decoded
+    // through an ImageStore, for as long as this file is open.
+    std::vector<std::shared_ptr<const ImageStore::Pixels>> shared_images;
+
+    // canvas_cache is the disk cache container that canvas pixels are
+    // mapped from, if the file was opened with a disk cache that held it.
+    DiskCache::Mapping canvas_cache;
+
+    // shared_segment is the shared memory segment that strings and pixels
+    // are used from, if the file was opened from a shared cache.
+    std::unique_ptr<SharedCache::Segment> shared_segment;
+
     // nodes is an arena containing the Nodes in this file.
     std::vector<Node> nodes;
 
+    // resolved caches the results of find(const Path&), keyed by Path id.
+    // Misses are cached as nullptr. The cache is not synchronized: an
+    // OpenedFile must not be searched by Path from multiple threads at once.
+    mutable std::unordered_map<uint32_t, const Node*> resolved;
+
     static Error open(
         const wz::Wz* wz,
         OpenedFile* of,
-        const wz::File* f);
+        const wz::File* f,
+        const Options& options = {});
+
+    // open_packed opens the file at entry of a packed archive. Strings and
+    // pixels are used in place from the archive's mapping, so only the nodes
+    // are materialized. image_store and disk_cache are not used.
+    static Error open_packed(
+        const Packed* packed,
+        OpenedFile* of,
+        uint32_t entry,
+        const Options& options = {});
 
     Node::Iterator iterator() const {
         return nodes[0].iterator();
@@ -247,6 +293,12 @@ struct OpenedFile {
         return nodes[0].find(path);
     }
 
+    // find resolves a precompiled path from the root of this file. The result
+    // is cached, so repeated lookups of the same Path are a single hash
+    // lookup.
+    const Node* find(
+        const Path& path) const;
+
     OpenedFile() = default;
     OpenedFile(OpenedFile&&) = default;
     OpenedFile(const OpenedFile&) = delete;
@@ -260,6 +312,13 @@ struct Vfs {
     struct File {
         P<const wz::Wz> wz;
         wz::File file;
+        OpenedFile::Options options;
+
+        // packed is the packed archive this file is in, if it was opened
+        // from one instead of from wz. packed_entry is the file's entry in
+        // packed.
+        P<const Packed> packed;
+        N<uint32_t> packed_entry;
         N<uint32_t> rc;
 
         std::unique_ptr<OpenedFile> opened;
@@ -304,8 +363,13 @@ struct Vfs {
         Error open(Handle* h) {
             if (rc == (uint32_t)0) {
                 opened.reset(new OpenedFile());
-                CHECK(OpenedFile::open(wz.get(), opened.get(), &file),
-                    Error::OPENFAILED) << "failed to open file";
+                if (packed) {
+                    CHECK(OpenedFile::open_packed(packed.get(), opened.get(), packed_entry, options),
+                        Error::OPENFAILED) << "failed to open packed file";
+                } else {
+                    CHECK(OpenedFile::open(wz.get(), opened.get(), &file, options),
+                        Error::OPENFAILED) << "failed to open file";
+                }
             }
 
             if (h) {
@@ -340,32 +404,21 @@ struct Vfs {
     struct Directory {
         struct Hash
         {
-            using hash_type = std::hash<std::wstring_view>;
             using is_transparent = void;
 
             std::size_t operator()(const wchar_t* str) const { return operator()(std::wstring_view{ str }); }
             std::size_t operator()(std::wstring const& str) const { return operator()((std::wstring_view)str); }
             std::size_t operator()(std::wstring_view str) const {
-                if (str.ends_with(L".img")) {
-                    str.remove_suffix(4);
-                    return operator()(Basename{ str });
-                }
-
-                return hash_type{}(str);
+                return wz::hash(str.data(), str.size());
             }
             std::size_t operator()(const Basename& basename) const {
-                hash_type hasher;
-                const std::size_t kMul = 0x9ddfea08eb382d69ULL;
-
-                std::size_t seed = hasher(basename.name);
-
-                std::size_t a = (hasher(L".img") ^ seed) * kMul;
-                a ^= (a >> 47);
-
-                std::size_t b = (seed ^ a) * kMul;
-                b ^= (b >> 47);
-
-                return b * kMul;
+                // Since wz::hash is incremental, this is equal to the hash
+                // of the full name, including ".img".
+                return wz::hash(L".img", 4,
+                    wz::hash(basename.name.data(), basename.name.size()));
+            }
+            std::size_t operator()(const Path::Component& component) const {
+                return component.hash;
             }
         };
 
@@ -400,6 +453,13 @@ struct Vfs {
             bool operator()(const std::wstring& l, const wchar_t* r) const {
                 return ::wcscmp(l.c_str(), r) == 0;
             }
+
+            bool operator()(const Path::Component& l, const std::wstring& r) const {
+                return this->operator()(r, l);
+            }
+            bool operator()(const std::wstring& l, const Path::Component& r) const {
+                return l == r.view();
+            }
         };
 
         std::unordered_map<std::wstring, Node, Hash, Equal> children;
@@ -474,24 +534,40 @@ struct Vfs {
     };
 
     P<const wz::Wz> wz;
+    P<const Packed> packed;
     Node root;
 
+    // options are the options every File in this Vfs is opened with.
+    OpenedFile::Options options;
+
     static Error opennamed(
         Vfs* vfs,
         const wz::Wz* wz,
-        std::wstring&& name);
+        std::wstring&& name,
+        const OpenedFile::Options& options = {});
+
+    // openpacked builds a Vfs over a packed archive.
+    static Error openpacked(
+        Vfs* vfs,
+        const Packed* packed,
+        const OpenedFile::Options& options = {});
 
     static Error open(
         Vfs* vfs,
-        const wz::Wz* wz) {
+        const wz::Wz* wz,
+        const OpenedFile::Options& options = {}) {
         return opennamed(
             vfs,
             wz,
-            L"");
+            L"",
+            options);
     }
 
     Node* find(const wchar_t* path);
 
+    // find resolves a precompiled path from the root of this Vfs.
+    Node* find(const Path& path);
+
     const Node::Maybe child(
         const wchar_t* name) {
         return root.child(name);
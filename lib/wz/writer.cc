@@ -0,0 +1,575 @@
+#include "wz/writer.hh"
+
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#define ZLIB_CONST
+#include <zlib.h>
+
+#include "wz/wz.hh"
+
+namespace wz {
+
+extern "C" {
+    extern const uint8_t wz_key[];
+}
+
+// Output is a buffer that a file or directory is serialized into.
+struct Output {
+    std::vector<uint8_t> bytes;
+
+    // strings maps the strings written so far to their offsets in bytes, so
+    // that repeated strings in a file can be written as offsets.
+    std::unordered_map<std::wstring, uint32_t> strings;
+};
+
+// OUTPUT_MIN_SHARED_STRING is the length of the shortest string written as
+// an offset when repeated. Offsets take 5 bytes.
+static const size_t OUTPUT_MIN_SHARED_STRING = 4;
+
+// OUTPUT_ENCRYPTED_BLOCK_SIZE is the size of the blocks that encrypted image
+// data is split into.
+static const uint32_t OUTPUT_ENCRYPTED_BLOCK_SIZE = 4096;
+
+static void Output_bytes(
+    Output* out,
+    const void* data,
+    size_t size) {
+    const uint8_t* start = static_cast<const uint8_t*>(data);
+    out->bytes.insert(out->bytes.end(), start, start + size);
+}
+
+template <typename T>
+static void Output_primitive(
+    Output* out,
+    T x) {
+    Output_bytes(out, &x, sizeof(x));
+}
+
+static void Output_i32_compressed(
+    Output* out,
+    int32_t x) {
+    // -128 marks a full i32, so it cannot be written in the short form.
+    if (x > -128 && x <= 127) {
+        Output_primitive<int8_t>(out, static_cast<int8_t>(x));
+    } else {
+        Output_primitive<int8_t>(out, -128);
+        Output_primitive<int32_t>(out, x);
+    }
+}
+
+// Output_string writes an encrypted string, in the form read by
+// String::parse. Strings of only 8-bit characters are written with one byte
+// per character, and others with two; characters beyond 16 bits are
+// truncated.
+static void Output_string(
+    Output* out,
+    const std::wstring& s) {
+    const uint32_t len = static_cast<uint32_t>(s.size());
+    if (len == 0) {
+        Output_primitive<int8_t>(out, 0);
+        return;
+    }
+
+    bool onebyte = true;
+    for (wchar_t c : s) {
+        if (static_cast<uint32_t>(c) > 0xFF) {
+            onebyte = false;
+            break;
+        }
+    }
+
+    if (onebyte) {
+        if (len < 128) {
+            Output_primitive<int8_t>(out, -static_cast<int8_t>(len));
+        } else {
+            Output_primitive<int8_t>(out, -128);
+            Output_primitive<uint32_t>(out, len);
+        }
+
+        uint8_t mask = 0xAA;
+        for (uint32_t i = 0; i < len; ++i) {
+            Output_primitive<uint8_t>(out,
+                static_cast<uint8_t>(s[i]) ^ mask ^ wz_key[i & 0xFFFF]);
+            ++mask;
+        }
+    } else {
+        if (len < 127) {
+            Output_primitive<int8_t>(out, static_cast<int8_t>(len));
+        } else {
+            Output_primitive<int8_t>(out, 0x7F);
+            Output_primitive<uint32_t>(out, len);
+        }
+
+        uint16_t mask = 0xAAAA;
+        for (uint32_t i = 0; i < len; ++i) {
+            const uint16_t key = static_cast<uint16_t>(
+                (wz_key[((i * 2) + 1) & 0xFFFF] << 8) + wz_key[(i * 2) & 0xFFFF]);
+            Output_primitive<uint16_t>(out,
+                static_cast<uint16_t>(s[i]) ^ mask ^ key);
+            ++mask;
+        }
+    }
+}
+
+// Output_string_withoffset writes a string in the form read by
+// String::parse_withoffset: inline the first time it is written, and as an
+// offset to the first occurrence after that.
+static void Output_string_withoffset(
+    Output* out,
+    const std::wstring& s,
+    uint8_t inline_kind,
+    uint8_t offset_kind) {
+    if (s.size() >= OUTPUT_MIN_SHARED_STRING) {
+        auto it = out->strings.find(s);
+        if (it != out->strings.end()) {
+            Output_primitive<uint8_t>(out, offset_kind);
+            Output_primitive<int32_t>(out, static_cast<int32_t>(it->second));
+            return;
+        }
+
+        Output_primitive<uint8_t>(out, inline_kind);
+        out->strings.emplace(s, static_cast<uint32_t>(out->bytes.size()));
+    } else {
+        Output_primitive<uint8_t>(out, inline_kind);
+    }
+
+    Output_string(out, s);
+}
+
+static void Output_name(
+    Output* out,
+    const std::wstring& s) {
+    Output_string_withoffset(out, s, 0x00, 0x01);
+}
+
+static void Output_kind_name(
+    Output* out,
+    const std::wstring& s) {
+    Output_string_withoffset(out, s, 0x73, 0x1B);
+}
+
+static Error Output_image(
+    Output* out,
+    const Writer::Property::Canvas& canvas) {
+    Image image = { 0 };
+    image.width = canvas.width;
+    image.height = canvas.height;
+    image.format = canvas.format;
+    image.format2 = canvas.format2;
+
+    const uint32_t expected = ((canvas.format + canvas.format2) == 517) ?
+        canvas.width * canvas.height / 128 :
+        image.rawsize();
+    if (expected == 0 && canvas.width * canvas.height > 0) {
+        return error_new(Error::UNKNOWNIMAGEFORMAT)
+            << "cannot write image format " << (canvas.format + canvas.format2);
+    }
+    if (canvas.pixels.size() != expected) {
+        return error_new(Error::INVALIDUSAGE)
+            << "image has " << canvas.pixels.size() << " bytes of pixels, expected " << expected;
+    }
+
+    uLongf compressed_length = compressBound(canvas.pixels.size());
+    std::vector<uint8_t> compressed(compressed_length);
+    int ret = compress2(
+        compressed.data(),
+        &compressed_length,
+        canvas.pixels.data(),
+        canvas.pixels.size(),
+        Z_DEFAULT_COMPRESSION);
+    if (ret != Z_OK) {
+        return error_new(Error::WZ_WRITE_FAILED)
+            << "zlib compression failed: " << ret;
+    }
+    compressed.resize(compressed_length);
+
+    if (canvas.encrypted) {
+        std::vector<uint8_t> encrypted;
+        encrypted.reserve(compressed.size() + 4 * (compressed.size() / OUTPUT_ENCRYPTED_BLOCK_SIZE + 2));
+
+        for (size_t at = 0; at < compressed.size();) {
+            uint32_t block = static_cast<uint32_t>(compressed.size() - at);
+            if (block > OUTPUT_ENCRYPTED_BLOCK_SIZE)
+                block = OUTPUT_ENCRYPTED_BLOCK_SIZE;
+
+            // Encryption is detected by the absence of a zlib header, so the
+            // size of the first block must not look like one.
+            if (at == 0 && block == 0x0178)
+                --block;
+
+            const uint8_t* size = reinterpret_cast<const uint8_t*>(&block);
+            encrypted.insert(encrypted.end(), size, size + sizeof(block));
+            for (uint32_t i = 0; i < block; ++i)
+                encrypted.push_back(compressed[at + i] ^ wz_key[i]);
+
+            at += block;
+        }
+
+        compressed.swap(encrypted);
+    }
+
+    Output_i32_compressed(out, static_cast<int32_t>(canvas.width));
+    Output_i32_compressed(out, static_cast<int32_t>(canvas.height));
+    Output_i32_compressed(out, canvas.format);
+    Output_primitive<uint8_t>(out, canvas.format2);
+    Output_primitive<int32_t>(out, 0);
+
+    // The length includes a trailing byte, which is unused.
+    Output_primitive<uint32_t>(out, static_cast<uint32_t>(compressed.size() + 1));
+    Output_primitive<uint8_t>(out, 0);
+    Output_bytes(out, compressed.data(), compressed.size());
+    Output_primitive<uint8_t>(out, 0);
+
+    return Error();
+}
+
+static Error Output_property(
+    Output* out,
+    const Writer::Property& property);
+
+static Error Output_properties(
+    Output* out,
+    const std::vector<Writer::Property>& properties) {
+    Output_i32_compressed(out, static_cast<int32_t>(properties.size()));
+    for (const Writer::Property& property : properties) {
+        CHECK(Output_property(out, property),
+            Error::WZ_WRITE_FAILED) << "failed to write property " << property.name;
+    }
+
+    return Error();
+}
+
+// Output_named writes the value of a property in the form read by
+// Property::parse_named: prefixed by the name of its kind.
+static Error Output_named(
+    Output* out,
+    const Writer::Property& property) {
+    if (const auto* container = std::get_if<Writer::Property::Container>(&property.value)) {
+        Output_kind_name(out, L"Property");
+        Output_primitive<uint16_t>(out, 0);
+        CHECK(Output_properties(out, container->children),
+            Error::WZ_WRITE_FAILED) << "failed to write container";
+    } else if (const auto* canvas = std::get_if<Writer::Property::Canvas>(&property.value)) {
+        Output_kind_name(out, L"Canvas");
+        Output_primitive<uint8_t>(out, 0);
+
+        if (canvas->children.empty()) {
+            Output_primitive<uint8_t>(out, 0);
+        } else {
+            Output_primitive<uint8_t>(out, 1);
+            Output_primitive<uint16_t>(out, 0);
+            CHECK(Output_properties(out, canvas->children),
+                Error::WZ_WRITE_FAILED) << "failed to write canvas children";
+        }
+
+        CHECK(Output_image(out, *canvas),
+            Error::WZ_WRITE_FAILED) << "failed to write canvas image";
+    } else if (const auto* vector = std::get_if<Vector>(&property.value)) {
+        Output_kind_name(out, L"Shape2D#Vector2D");
+        Output_i32_compressed(out, vector->x);
+        Output_i32_compressed(out, vector->y);
+    } else if (const auto* convex = std::get_if<Writer::Property::Convex>(&property.value)) {
+        Output_kind_name(out, L"Shape2D#Convex2D");
+        Output_i32_compressed(out, static_cast<int32_t>(convex->points.size()));
+        for (const Writer::Property& point : convex->points) {
+            CHECK(Output_named(out, point),
+                Error::WZ_WRITE_FAILED) << "failed to write convex point";
+        }
+    } else if (const auto* sound = std::get_if<Writer::Property::Sound>(&property.value)) {
+        Output_kind_name(out, L"Sound_DX8");
+        Output_primitive<uint8_t>(out, 0);
+        Output_i32_compressed(out, static_cast<int32_t>(sound->data.size()));
+        Output_i32_compressed(out, static_cast<int32_t>(sound->duration_ms));
+
+        // The WAVEFORMATEX is written unencrypted, without extra bytes.
+        Output_bytes(out, wz::Sound::MEDIA_TYPE, wz::Sound::MEDIA_TYPE_SIZE);
+        Output_primitive<uint8_t>(out, wz::Sound::WAVEFORMATEX_SIZE);
+        Output_primitive<uint16_t>(out, sound->format.tag);
+        Output_primitive<uint16_t>(out, sound->format.channels);
+        Output_primitive<uint32_t>(out, sound->format.samples_per_second);
+        Output_primitive<uint32_t>(out, sound->format.bytes_per_second);
+        Output_primitive<uint16_t>(out, sound->format.block_align);
+        Output_primitive<uint16_t>(out, sound->format.bits_per_sample);
+        Output_primitive<uint16_t>(out, 0);
+
+        Output_bytes(out, sound->data.data(), sound->data.size());
+    } else if (const auto* uol = std::get_if<Writer::Property::Uol>(&property.value)) {
+        Output_kind_name(out, L"UOL");
+        Output_primitive<uint8_t>(out, 0);
+        Output_name(out, uol->uol);
+    } else {
+        return error_new(Error::INVALIDUSAGE)
+            << "property kind " << property.value.index() << " cannot be written as a named property";
+    }
+
+    return Error();
+}
+
+static Error Output_property(
+    Output* out,
+    const Writer::Property& property) {
+    Output_name(out, property.name);
+
+    if (std::get_if<Void>(&property.value)) {
+        Output_primitive<uint8_t>(out, 0x00);
+    } else if (const auto* u = std::get_if<uint16_t>(&property.value)) {
+        Output_primitive<uint8_t>(out, 0x02);
+        Output_primitive<uint16_t>(out, *u);
+    } else if (const auto* i = std::get_if<int32_t>(&property.value)) {
+        Output_primitive<uint8_t>(out, 0x03);
+        Output_i32_compressed(out, *i);
+    } else if (const auto* f = std::get_if<float>(&property.value)) {
+        Output_primitive<uint8_t>(out, 0x04);
+        if (*f == 0) {
+            Output_primitive<uint8_t>(out, 0x00);
+        } else {
+            Output_primitive<uint8_t>(out, 0x80);
+            Output_primitive<float>(out, *f);
+        }
+    } else if (const auto* d = std::get_if<double>(&property.value)) {
+        Output_primitive<uint8_t>(out, 0x05);
+        Output_primitive<double>(out, *d);
+    } else if (const auto* s = std::get_if<std::wstring>(&property.value)) {
+        Output_primitive<uint8_t>(out, 0x08);
+        Output_name(out, *s);
+    } else {
+        // Everything else is a named property, prefixed by its length.
+        Output_primitive<uint8_t>(out, 0x09);
+
+        const size_t length_at = out->bytes.size();
+        Output_primitive<uint32_t>(out, 0);
+
+        CHECK(Output_named(out, property),
+            Error::WZ_WRITE_FAILED) << "failed to write named property";
+
+        const uint32_t length = static_cast<uint32_t>(out->bytes.size() - (length_at + sizeof(uint32_t)));
+        ::memcpy(&out->bytes[length_at], &length, sizeof(length));
+    }
+
+    return Error();
+}
+
+static Error Output_file(
+    Output* out,
+    const Writer::File& file) {
+    Output_primitive<uint8_t>(out, 0x73);
+
+    // The kind name of the file may be referred to by later properties.
+    out->strings.emplace(L"Property", static_cast<uint32_t>(out->bytes.size()));
+    Output_string(out, L"Property");
+    Output_primitive<uint16_t>(out, 0);
+
+    CHECK(Output_properties(out, file.properties),
+        Error::WZ_WRITE_FAILED) << "failed to write properties";
+
+    return Error();
+}
+
+Error Writer::init(
+    Writer* writer,
+    uint16_t version) {
+    if (version == 0 || version >= 0x7F) {
+        return error_new(Error::INVALIDUSAGE)
+            << "version " << version << " is out of range";
+    }
+
+    // Readers take the highest version that matches the obfuscated version.
+    uint32_t version_hash = 0;
+    const uint16_t obfuscated = Header::hash_version(version, &version_hash);
+    for (uint16_t later = version + 1; later < 0x7F; ++later) {
+        if (Header::hash_version(later, &version_hash) == obfuscated) {
+            return error_new(Error::INVALIDUSAGE)
+                << "version " << version << " would be read as version " << later;
+        }
+    }
+
+    writer->version = version;
+    writer->copyright = L"Package file v1.0 Copyright 2002 Wizet, ZZ";
+    return Error();
+}
+
+// Writer_offset encrypts the offset target, to be stored at the offset at,
+// in the form read by Parser::offset.
+static uint32_t Writer_offset(
+    uint32_t file_start,
+    uint32_t version_hash,
+    uint32_t at,
+    uint32_t target) {
+    uint32_t value = (at - file_start) ^ 0xFFFFFFFF;
+    value *= version_hash;
+    value -= 0x581C3F6D;
+    value = std::rotl(value, static_cast<int>(value & 0x1F));
+
+    return value ^ (target - file_start * 2);
+}
+
+Error Writer::serialize(
+    std::vector<uint8_t>* out) const {
+    if (version == (uint16_t)0) {
+        return error_new(Error::INVALIDUSAGE)
+            << "writer is not initialized";
+    }
+
+    uint32_t version_hash = 0;
+    const uint16_t obfuscated_version = Header::hash_version(version, &version_hash);
+
+    // Patch is an offset in a directory, to be filled in once the position
+    // of every directory and file is known.
+    struct Patch {
+        size_t at;
+        bool file;
+        size_t index;
+    };
+
+    struct Block {
+        Output output;
+        std::vector<Patch> patches;
+    };
+
+    // Directories are laid out breadth first, followed by files.
+    std::vector<const Directory*> directories = { &root };
+    std::vector<Block> blocks;
+    std::vector<Output> files;
+
+    for (size_t i = 0; i < directories.size(); ++i) {
+        const Directory* directory = directories[i];
+
+        Block block;
+        Output_i32_compressed(
+            &block.output,
+            static_cast<int32_t>(directory->directories.size() + directory->files.size()));
+
+        for (const Directory& child : directory->directories) {
+            Output_primitive<uint8_t>(&block.output, 3);
+            Output_string(&block.output, child.name);
+            Output_i32_compressed(&block.output, 0);
+            Output_i32_compressed(&block.output, 0);
+
+            block.patches.push_back(Patch{
+                .at = block.output.bytes.size(),
+                .file = false,
+                .index = directories.size(),
+            });
+            Output_primitive<uint32_t>(&block.output, 0);
+
+            directories.push_back(&child);
+        }
+
+        for (const File& child : directory->files) {
+            Output file;
+            CHECK(Output_file(&file, child),
+                Error::WZ_WRITE_FAILED) << "failed to write file " << child.name;
+
+            int32_t checksum = 0;
+            for (uint8_t b : file.bytes)
+                checksum += b;
+
+            Output_primitive<uint8_t>(&block.output, 4);
+            Output_string(&block.output, child.name);
+            Output_i32_compressed(&block.output, static_cast<int32_t>(file.bytes.size()));
+            Output_i32_compressed(&block.output, checksum);
+
+            block.patches.push_back(Patch{
+                .at = block.output.bytes.size(),
+                .file = true,
+                .index = files.size(),
+            });
+            Output_primitive<uint32_t>(&block.output, 0);
+
+            files.push_back(std::move(file));
+        }
+
+        blocks.push_back(std::move(block));
+    }
+
+    Output header;
+    {
+        const char ident[4] = { 'P', 'K', 'G', '1' };
+        Output_bytes(&header, ident, sizeof(ident));
+        Output_primitive<uint64_t>(&header, 0);
+        Output_primitive<uint32_t>(&header, 0);
+        for (wchar_t c : copyright)
+            Output_primitive<uint8_t>(&header, static_cast<uint8_t>(c));
+        Output_primitive<uint8_t>(&header, 0);
+    }
+
+    const uint64_t file_start = header.bytes.size();
+
+    std::vector<uint64_t> block_positions;
+    std::vector<uint64_t> file_positions;
+    uint64_t position = file_start + sizeof(uint16_t);
+    for (const Block& block : blocks) {
+        block_positions.push_back(position);
+        position += block.output.bytes.size();
+    }
+    for (const Output& file : files) {
+        file_positions.push_back(position);
+        position += file.bytes.size();
+    }
+
+    if (position > UINT32_MAX) {
+        return error_new(Error::WZ_WRITE_FAILED)
+            << "archive of " << position << " bytes is too large";
+    }
+
+    const uint64_t file_size = position - file_start;
+    const uint32_t file_start_u32 = static_cast<uint32_t>(file_start);
+    ::memcpy(&header.bytes[4], &file_size, sizeof(file_size));
+    ::memcpy(&header.bytes[12], &file_start_u32, sizeof(file_start_u32));
+
+    out->clear();
+    out->reserve(position);
+    out->insert(out->end(), header.bytes.begin(), header.bytes.end());
+    out->insert(
+        out->end(),
+        reinterpret_cast<const uint8_t*>(&obfuscated_version),
+        reinterpret_cast<const uint8_t*>(&obfuscated_version) + sizeof(obfuscated_version));
+
+    for (size_t i = 0, l = blocks.size(); i < l; ++i) {
+        Block& block = blocks[i];
+        for (const Patch& patch : block.patches) {
+            const uint64_t target = patch.file ?
+                file_positions[patch.index] :
+                block_positions[patch.index];
+            const uint32_t value = Writer_offset(
+                file_start_u32,
+                version_hash,
+                static_cast<uint32_t>(block_positions[i] + patch.at),
+                static_cast<uint32_t>(target));
+            ::memcpy(&block.output.bytes[patch.at], &value, sizeof(value));
+        }
+
+        out->insert(out->end(), block.output.bytes.begin(), block.output.bytes.end());
+    }
+
+    for (const Output& file : files)
+        out->insert(out->end(), file.bytes.begin(), file.bytes.end());
+
+    return Error();
+}
+
+Error Writer::write(
+    const char* filename) const {
+    std::vector<uint8_t> bytes;
+    CHECK(serialize(&bytes),
+        Error::WZ_WRITE_FAILED) << "failed to serialize archive";
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return error_new(Error::OPENFAILED)
+            << "failed to create " << filename;
+    }
+
+    out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    out.close();
+    if (!out) {
+        return error_new(Error::WZ_WRITE_FAILED)
+            << "failed to write " << filename;
+    }
+
+    return Error();
+}
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "p.hh"
+#include "util/error.hh"
+#include "wz/property.hh"
+
+namespace wz {
+
+// Writer builds WZ archives. The contents of an archive are described as a
+// tree of Directories, Files and Properties, which write serializes in the
+// layout that Wz reads: an obfuscated version, encrypted directory offsets,
+// encrypted strings (deduplicated within each file by string offsets), and
+// zlib-compressed canvases, which may also be encrypted.
+struct Writer {
+    struct Property {
+        struct Container {
+            std::vector<Property> children;
+        };
+
+        struct Canvas {
+            uint32_t width;
+            uint32_t height;
+            int32_t format;
+            uint8_t format2;
+
+            // pixels is the uncompressed image data, as produced by
+            // Image::pixels: the native layout of the format, except for
+            // format 517, which has one byte per 128 pixels.
+            std::vector<uint8_t> pixels;
+
+            // encrypted enables encrypting the compressed image data.
+            bool encrypted;
+
+            std::vector<Property> children;
+        };
+
+        // Convex is a list of unnamed properties, each of which must be one
+        // of the kinds written as named properties: a Container, Canvas,
+        // Vector, Convex, Sound or Uol.
+        struct Convex {
+            std::vector<Property> points;
+        };
+
+        struct Sound {
+            wz::Sound::Format format;
+            uint32_t duration_ms;
+
+            // data is the payload, in format.
+            std::vector<uint8_t> data;
+        };
+
+        struct Uol {
+            std::wstring uol;
+        };
+
+        std::wstring name;
+
+        std::variant<
+            Void,
+            uint16_t,
+            int32_t,
+            float,
+            double,
+            std::wstring,
+            Container,
+            Canvas,
+            Vector,
+            Convex,
+            Sound,
+            Uol> value;
+    };
+
+    struct File {
+        std::wstring name;
+        std::vector<Property> properties;
+    };
+
+    struct Directory {
+        std::wstring name;
+        std::vector<Directory> directories;
+        std::vector<File> files;
+    };
+
+    // DEFAULT_VERSION is the version that archives are written with, unless
+    // otherwise specified.
+    static constexpr uint16_t DEFAULT_VERSION = 83;
+
+    N<uint16_t> version;
+    std::wstring copyright;
+    Directory root;
+
+    // init prepares a Writer for an archive of the given version. Versions
+    // whose obfuscated form is ambiguous, and so would be read back as a
+    // different version, are rejected.
+    static Error init(
+        Writer* writer,
+        uint16_t version = DEFAULT_VERSION);
+
+    // serialize writes the archive into out.
+    Error serialize(
+        std::vector<uint8_t>* out) const;
+
+    // write writes the archive to filename.
+    Error write(
+        const char* filename) const;
+
+    Writer() = default;
+    Writer(Writer&&) = default;
+    Writer(const Writer&) = delete;
+};
+
+}
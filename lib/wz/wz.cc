@@ -1,5 +1,9 @@
 #include "wz/wz.hh"
 
+#include <variant>
+
+#include "wz/hash.hh"
+
 // The following 4 functions provide platform-specific functionality for
 // mapping files into memory.
 extern "C" {
@@ -38,6 +42,61 @@ Error Header::parse(
         return Error();
 }
 
+uint16_t Header::hash_version(
+        uint16_t version,
+        uint32_t* version_hash) {
+        *version_hash = 0;
+
+        std::stringstream ss;
+        ss << version;
+        std::string str = ss.str();
+        for (size_t i = 0, l = str.size(); i < l; ++i)
+                *version_hash = (32 * *version_hash) + (int)str[i] + 1;
+        uint32_t a = (*version_hash >> 24) & 0xFF;
+        uint32_t b = (*version_hash >> 16) & 0xFF;
+        uint32_t c = (*version_hash >> 8) & 0xFF;
+        uint32_t d = (*version_hash >> 0) & 0xFF;
+        return static_cast<uint16_t>(0xFF ^ a ^ b ^ c ^ d);
+}
+
+// Wz_identity_directory hashes the size and checksum of every entry under d
+// into identity, along with the offset of every file. Writers store the byte
+// sum of each img as its checksum, so this catches rewritten imgs anywhere in
+// the file while only reading its directories. Entries that fail to parse end the walk of their
+// directory; the same failure will surface to anything that reads them.
+static void Wz_identity_directory(
+        const Wz* wz,
+        const Directory& d,
+        uint64_t* identity) {
+        EntryContainer::Iterator it = d.children.iterator(wz);
+        while (it) {
+                Entry entry;
+                if (Error e = it.next(&entry)) return;
+
+                if (const Entry::File* file = std::get_if<Entry::File>(&entry.entry)) {
+                        const uint64_t values[] = {
+                                file->size,
+                                file->checksum,
+                                static_cast<uint64_t>(file->file.base - wz->file.start),
+                        };
+                        *identity = hash_bytes(
+                                reinterpret_cast<const uint8_t*>(values),
+                                sizeof(values),
+                                *identity);
+                } else if (const Entry::Directory* directory = std::get_if<Entry::Directory>(&entry.entry)) {
+                        const uint64_t values[] = {
+                                directory->size,
+                                directory->checksum,
+                        };
+                        *identity = hash_bytes(
+                                reinterpret_cast<const uint8_t*>(values),
+                                sizeof(values),
+                                *identity);
+                        Wz_identity_directory(wz, directory->directory, identity);
+                }
+        }
+}
+
 Wz::~Wz() {
         close();
 }
@@ -86,17 +145,7 @@ Error Wz::parse(
         // Determine file version.
         for (uint16_t try_version = 1; try_version < 0x7F; ++try_version) {
                 uint32_t version_hash = 0;
-
-                std::stringstream ss;
-                ss << try_version;
-                std::string str = ss.str();
-                for (size_t i = 0, l = str.size(); i < l; ++i)
-                        version_hash = (32 * version_hash) + (int)str[i] + 1;
-                uint32_t a = (version_hash >> 24) & 0xFF;
-                uint32_t b = (version_hash >> 16) & 0xFF;
-                uint32_t c = (version_hash >> 8) & 0xFF;
-                uint32_t d = (version_hash >> 0) & 0xFF;
-                if ((0xFF ^ a ^ b ^ c ^ d) == wz->header.version) {
+                if (Header::hash_version(try_version, &version_hash) == wz->header.version) {
                         wz->header.version_hash = version_hash;
                         wz->version = try_version;
                 }
@@ -122,7 +171,29 @@ Error Wz::close() {
                 << "failed to close file: " << ret;
 
         fd = 0;
+        identity_cache.value = 0;
         return Error();
 }
 
+uint64_t Wz::identity() const {
+        enum {
+                IDENTITY_PREFIX = 64 * 1024,
+        };
+
+        uint64_t identity = identity_cache.value.load(std::memory_order_relaxed);
+        if (identity) return identity;
+
+        // The prefix covers the header and the root directory, including the
+        // names the directory walk skips over.
+        const size_t size = file.end - file.start;
+        const size_t prefix = size < IDENTITY_PREFIX ? size : IDENTITY_PREFIX;
+        identity = hash_bytes(file.start, prefix, size);
+        Wz_identity_directory(this, root, &identity);
+
+        // 0 marks identity as not computed yet.
+        if (identity == 0) identity = 1;
+        identity_cache.value.store(identity, std::memory_order_relaxed);
+        return identity;
+}
+
 }
@@ -1,6 +1,8 @@
 // wz contains a library for one-copy, zero-allocation reading and parsing of WZ files.
 #pragma once
 
+#include <atomic>
+
 #include "p.hh"
 #include "util/error.hh"
 #include "wz/directory.hh"
@@ -33,6 +35,13 @@ struct Header {
         static Error parse(
                 Header* h,
                 Parser* p);
+
+        // hash_version computes the hash of an un-obfuscated version number
+        // into version_hash, and returns the obfuscated version number, as
+        // stored in the header.
+        static uint16_t hash_version(
+                uint16_t version,
+                uint32_t* version_hash);
 };
 
 // Wz is a no-allocation lazy WZ file reader. WZ files are read from memory
@@ -53,6 +62,17 @@ struct Wz {
         // root is the root wz directory that contains all the data in the file.
         Directory root;
 
+        // identity_cache holds the result of identity once it has been computed,
+        // or 0.
+        struct IdentityCache {
+                mutable std::atomic<uint64_t> value{0};
+
+                IdentityCache() = default;
+                IdentityCache(IdentityCache&& rhs):
+                        value(rhs.value.exchange(0)) {}
+        };
+        IdentityCache identity_cache;
+
         // Wz has a non-trivial destructor that calls `close`.
         ~Wz();
 
@@ -70,6 +90,15 @@ struct Wz {
         // close unmaps a WZ file, if it was mapped by this Wz.
         Error close();
 
+        // identity returns a hash of the size and leading contents of the wz
+        // file, and of the size, checksum and offset of every entry in its
+        // directory tree. It is used to key caches of data derived from the
+        // file. It depends only on the file's contents, so it survives copying
+        // the file, and is computed on first use, since only the caches need
+        // it. Rewriting an img changes its checksum, but editing an img's
+        // bytes in place, without updating its directory entry, goes unnoticed.
+        uint64_t identity() const;
+
         Wz() = default;
         Wz(Wz&&) = default;
         Wz(const Wz&) = delete;